@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cstdlib>
+#include <strings.h>
+#include "admission.h"
+#include "ws_transport.h"
+
+bool AdmissionConfig::set(const char *name, const char *value)
+{
+    if (!strcasecmp(name, "admission-rate"))
+        rate = std::max(0.0, atof(value));
+    else if (!strcasecmp(name, "admission-burst"))
+        burst = std::max(0, atoi(value));
+    else if (!strcasecmp(name, "endpoint-max-streams"))
+        endpoint_max_streams = std::max(0, atoi(value));
+    else if (!strcasecmp(name, "node-max-streams"))
+        node_max_streams = std::max(0, atoi(value));
+    else if (!strcasecmp(name, "admission-policy"))
+    {
+        if (!strcasecmp(value, "queue"))
+            queue = true;
+        else if (!strcasecmp(value, "reject"))
+            queue = false;
+        else
+            return false;
+    }
+    else if (!strcasecmp(name, "admission-max-wait-ms"))
+        max_wait_ms = std::max(0, atoi(value));
+    else
+        return false;
+    return true;
+}
+
+AdmissionController::Ticket::Ticket(std::shared_ptr<AdmissionController> owner, Endpoint *endpoint)
+    : m_owner(std::move(owner)), m_endpoint(endpoint)
+{
+}
+
+AdmissionController::Ticket::~Ticket()
+{
+    m_owner->release(m_endpoint);
+}
+
+AdmissionController::AdmissionController(const AdmissionConfig &config)
+    : m_config(config), m_stopping(false), m_active(0), m_waiting(0), m_admitted(0), m_queued(0), m_rejected(0), m_max_wait_ms(0)
+{
+}
+
+AdmissionController::~AdmissionController()
+{
+    shutdown();
+}
+
+std::string AdmissionController::endpointKey(const std::string &url)
+{
+    if (WsTransport::isUnix(url))
+        return url.substr(0, url.find(':', 10)); // the socket
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    const size_t end = url.find_first_of("/?#", start);
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+AdmissionController::Endpoint &AdmissionController::endpoint(const std::string &url)
+{
+    const std::string key = endpointKey(url);
+    auto it = m_endpoints.find(key);
+    if (it != m_endpoints.end())
+        return it->second;
+    Endpoint &created = m_endpoints[key];
+    created.key = key;
+    return created;
+}
+
+void AdmissionController::refill(Endpoint &endpoint, clock::time_point now)
+{
+    const double burst = m_config.burst > 0 ? m_config.burst : std::max(1.0, m_config.rate);
+    if (endpoint.tokens < 0)
+        endpoint.tokens = burst;
+    else
+        endpoint.tokens = std::min(burst, endpoint.tokens + m_config.rate * std::chrono::duration<double>(now - endpoint.refilled).count());
+    endpoint.refilled = now;
+}
+
+void AdmissionController::prune()
+{
+    // entries without streams or waiters; a full bucket is recreated on demand
+    for (auto it = m_endpoints.begin(); it != m_endpoints.end();)
+    {
+        if (it->second.active == 0 && it->second.waiting == 0)
+            it = m_endpoints.erase(it);
+        else
+            ++it;
+    }
+}
+
+// Takes a token and a slot on the first endpoint of the route with both;
+// next_token is how long until the nearest one would have a token.
+std::unique_ptr<AdmissionController::Ticket> AdmissionController::take(const std::vector<Endpoint *> &endpoints, clock::time_point now,
+                                                                       size_t &chosen, clock::duration &next_token)
+{
+    if (m_config.node_max_streams > 0 && m_active >= (uint32_t)m_config.node_max_streams)
+        return nullptr;
+    for (size_t i = 0; i < endpoints.size(); i++)
+    {
+        Endpoint &endpoint = *endpoints[i];
+        if (m_config.endpoint_max_streams > 0 && endpoint.active >= (uint32_t)m_config.endpoint_max_streams)
+            continue;
+        if (m_config.rate > 0)
+        {
+            refill(endpoint, now);
+            if (endpoint.tokens < 1)
+            {
+                const auto until = std::chrono::duration_cast<clock::duration>(
+                    std::chrono::duration<double>((1 - endpoint.tokens) / m_config.rate));
+                next_token = std::min(next_token, until);
+                continue;
+            }
+            endpoint.tokens -= 1;
+        }
+        endpoint.active++;
+        endpoint.admitted++;
+        m_active++;
+        m_admitted++;
+        chosen = i;
+        return std::unique_ptr<Ticket>(new Ticket(shared_from_this(), &endpoint));
+    }
+    return nullptr;
+}
+
+std::unique_ptr<AdmissionController::Ticket> AdmissionController::admit(const std::vector<std::string> &route, size_t &chosen,
+                                                                        Callback done, bool &queued)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    queued = false;
+    if (m_endpoints.size() >= ADMISSION_MAX_ENDPOINTS)
+        prune();
+    std::vector<Endpoint *> endpoints;
+    for (const auto &url : route)
+        endpoints.push_back(&endpoint(url));
+
+    // starts already queued go first
+    const bool queue = m_config.queue && m_config.max_wait_ms > 0 && !m_stopping;
+    if (!queue || m_waiters.empty())
+    {
+        clock::duration next_token = clock::duration::max();
+        std::unique_ptr<Ticket> ticket = take(endpoints, clock::now(), chosen, next_token);
+        if (ticket)
+            return ticket;
+    }
+    if (!queue)
+    {
+        m_rejected++;
+        endpoints[0]->rejected++;
+        return nullptr;
+    }
+
+    m_waiting++;
+    for (Endpoint *endpoint : endpoints)
+        endpoint->waiting++;
+    m_waiters.push_back(Waiter{std::move(endpoints), clock::now(), std::move(done)});
+    queued = true;
+    if (!m_thread.joinable())
+        m_thread = std::thread(&AdmissionController::run, this);
+    m_cv.notify_all();
+    return nullptr;
+}
+
+// The admission thread. Each pass offers the free slots to the queued
+// starts in order and rejects those past max_wait_ms; their callbacks run
+// without the lock, so they may give a ticket straight back.
+void AdmissionController::run()
+{
+    struct Outcome
+    {
+        Callback done;
+        std::unique_ptr<Ticket> ticket;
+        size_t chosen;
+        uint32_t waited_ms;
+    };
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        const clock::time_point now = clock::now();
+        clock::time_point wake = clock::time_point::max();
+        std::vector<Outcome> outcomes;
+        for (auto it = m_waiters.begin(); it != m_waiters.end();)
+        {
+            clock::duration next_token = clock::duration::max();
+            size_t chosen = 0;
+            std::unique_ptr<Ticket> ticket = take(it->endpoints, now, chosen, next_token);
+            const clock::time_point deadline = it->start + std::chrono::milliseconds(m_config.max_wait_ms);
+            if (!ticket && now < deadline && m_config.queue && !m_stopping)
+            {
+                // woken early by a release or a limit change
+                wake = std::min(wake, deadline);
+                if (next_token != clock::duration::max())
+                    wake = std::min(wake, now + next_token);
+                ++it;
+                continue;
+            }
+            const uint32_t waited = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(now - it->start).count();
+            m_waiting--;
+            for (Endpoint *endpoint : it->endpoints)
+                endpoint->waiting--;
+            if (ticket)
+            {
+                m_queued++;
+                m_max_wait_ms = std::max(m_max_wait_ms, waited);
+            }
+            else
+            {
+                m_rejected++;
+                it->endpoints[0]->rejected++;
+            }
+            outcomes.push_back(Outcome{std::move(it->done), std::move(ticket), chosen, waited});
+            it = m_waiters.erase(it);
+        }
+
+        if (!outcomes.empty())
+        {
+            lock.unlock();
+            for (auto &outcome : outcomes)
+                outcome.done(std::move(outcome.ticket), outcome.chosen, outcome.waited_ms);
+            outcomes.clear(); // tickets nobody took are given back unlocked
+            lock.lock();
+            continue;
+        }
+        if (m_stopping)
+            return;
+        if (wake == clock::time_point::max())
+            m_cv.wait(lock);
+        else
+            m_cv.wait_until(lock, wake);
+    }
+}
+
+void AdmissionController::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void AdmissionController::release(Endpoint *endpoint)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        endpoint->active--;
+        m_active--;
+    }
+    m_cv.notify_all();
+}
+
+AdmissionConfig AdmissionController::config()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_config;
+}
+
+bool AdmissionController::set(const char *name, const char *value)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const clock::time_point now = clock::now();
+        // settle the buckets at the old rate before it changes
+        for (auto &entry : m_endpoints)
+        {
+            if (entry.second.tokens >= 0)
+                refill(entry.second, now);
+        }
+        if (!m_config.set(name, value))
+            return false;
+    }
+    m_cv.notify_all();
+    return true;
+}
+
+AdmissionController::Stats AdmissionController::stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats = {m_active, m_waiting, m_admitted, m_queued, m_rejected, m_max_wait_ms, {}};
+    for (const auto &entry : m_endpoints)
+    {
+        const Endpoint &endpoint = entry.second;
+        stats.endpoints.push_back(EndpointStats{endpoint.key, endpoint.active, endpoint.waiting, endpoint.admitted, endpoint.rejected});
+    }
+    return stats;
+}
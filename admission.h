@@ -0,0 +1,154 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define ADMISSION_MAX_ENDPOINTS 1024 /* idle endpoint entries are pruned beyond this */
+
+struct AdmissionConfig
+{
+    double rate = 0;              /* new connections per second per endpoint, 0 is unlimited */
+    int burst = 0;                /* token bucket size, 0 means max(1, rate) */
+    int endpoint_max_streams = 0; /* open streams per endpoint, 0 is unlimited */
+    int node_max_streams = 0;     /* open streams of this module, 0 is unlimited */
+    bool queue = true;            /* wait for a token or a free slot instead of rejecting at once */
+    int max_wait_ms = 2000;       /* longest a queued start waits before it is rejected */
+
+    /* one setting by its video_stream.conf / API name, false if unknown or invalid */
+    bool set(const char *name, const char *value);
+};
+
+/*
+ * Smooths the connects of call spikes. Every new stream needs a token from
+ * the bucket of its endpoint (host:port of the websocket url) and a free
+ * slot below the per endpoint and per node stream caps. The slot is held
+ * by a Ticket for the lifetime of the stream, until its websocket is
+ * closed. Over the limits a start is either queued for up to max_wait_ms
+ * or rejected right away. Nothing blocks the caller: queued starts are
+ * admitted in order of arrival by a thread of the controller, started
+ * with the first one. Reconnects of running streams are not admitted
+ * again; they have their own backoff.
+ *
+ * Limits can be changed at runtime; queued starts re-check them.
+ */
+class AdmissionController : public std::enable_shared_from_this<AdmissionController>
+{
+    struct Endpoint;
+
+public:
+    class Ticket
+    {
+    public:
+        Ticket(std::shared_ptr<AdmissionController> owner, Endpoint *endpoint);
+        ~Ticket();
+        Ticket(const Ticket &) = delete;
+        Ticket &operator=(const Ticket &) = delete;
+
+    private:
+        std::shared_ptr<AdmissionController> m_owner;
+        Endpoint *m_endpoint;
+    };
+
+    struct EndpointStats
+    {
+        std::string endpoint;
+        uint32_t active;
+        uint32_t waiting;
+        uint64_t admitted;
+        uint64_t rejected;
+    };
+
+    struct Stats
+    {
+        uint32_t active;
+        uint32_t waiting;
+        uint64_t admitted;
+        uint64_t queued;   /* admitted after waiting */
+        uint64_t rejected;
+        uint32_t max_wait_ms; /* longest wait of an admitted start */
+        std::vector<EndpointStats> endpoints;
+    };
+
+    /* the outcome of a queued start: a ticket, or null once max_wait_ms passed */
+    typedef std::function<void(std::unique_ptr<Ticket> ticket, size_t chosen, uint32_t waited_ms)> Callback;
+
+    explicit AdmissionController(const AdmissionConfig &config);
+    ~AdmissionController();
+
+    /*
+     * Admits a start to the first url of route that has room; chosen is the
+     * index in route. Returns null when there is none. If the policy queues,
+     * queued is then set and done is called later from the admission
+     * thread, otherwise the start is rejected.
+     */
+    std::unique_ptr<Ticket> admit(const std::vector<std::string> &route, size_t &chosen, Callback done, bool &queued);
+
+    /*
+     * Rejects the starts still queued and joins the admission thread. Called
+     * before the owner lets go of the controller, so that a ticket given back
+     * by a callback never deletes it on that thread.
+     */
+    void shutdown();
+
+    AdmissionConfig config();
+    bool set(const char *name, const char *value);
+    Stats stats();
+
+    /* host:port of a websocket url, the socket of a ws+unix:// one */
+    static std::string endpointKey(const std::string &url);
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Endpoint
+    {
+        std::string key;
+        double tokens = -1; /* negative until first used, then filled to burst */
+        clock::time_point refilled;
+        uint32_t active = 0;
+        uint32_t waiting = 0;
+        uint64_t admitted = 0;
+        uint64_t rejected = 0;
+    };
+
+    struct Waiter
+    {
+        std::vector<Endpoint *> endpoints; /* the route */
+        clock::time_point start;
+        Callback done;
+    };
+
+    Endpoint &endpoint(const std::string &url);
+    void refill(Endpoint &endpoint, clock::time_point now);
+    std::unique_ptr<Ticket> take(const std::vector<Endpoint *> &endpoints, clock::time_point now, size_t &chosen,
+                                 clock::duration &next_token);
+    void release(Endpoint *endpoint);
+    void prune();
+    void run();
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv; /* a start was queued, a slot was freed or the limits changed */
+    AdmissionConfig m_config;
+    std::deque<Waiter> m_waiters; /* queued starts, oldest first */
+    std::thread m_thread;         /* admits m_waiters, runs from the first one queued */
+    bool m_stopping;
+    std::unordered_map<std::string, Endpoint> m_endpoints;
+    uint32_t m_active;
+    uint32_t m_waiting;
+    uint64_t m_admitted;
+    uint64_t m_queued;
+    uint64_t m_rejected;
+    uint32_t m_max_wait_ms;
+};
+
+#endif // ADMISSION_H
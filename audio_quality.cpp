@@ -0,0 +1,122 @@
+#include "audio_quality.h"
+#include "audio_resampler.h"
+
+#define ULAW_BIAS 0x84
+#define ULAW_CLIP 32635
+
+uint8_t quality_linear_to_ulaw(int16_t sample)
+{
+    const int sign = sample < 0 ? 0x80 : 0;
+    int magnitude = sign ? -(int)sample : sample;
+    if (magnitude > ULAW_CLIP)
+        magnitude = ULAW_CLIP;
+    magnitude += ULAW_BIAS;
+    int exponent = 7;
+    for (int mask = 0x4000; !(magnitude & mask) && exponent > 0; mask >>= 1)
+        exponent--;
+    const int mantissa = (magnitude >> (exponent + 3)) & 0x0f;
+    return (uint8_t)~(sign | (exponent << 4) | mantissa);
+}
+
+QualityController::QualityController(const AdaptiveQualityConfig &config, int rate)
+    : m_config(config), m_index(0), m_switches(0)
+{
+    m_ladder.push_back(QUALITY_FULL);
+    if (rate > 8000)
+        m_ladder.push_back(QUALITY_L16_8K);
+    m_ladder.push_back(QUALITY_PCMU);
+}
+
+int QualityController::update(int delay_ms, clock::time_point now)
+{
+    if (delay_ms >= m_config.down_ms)
+    {
+        m_calm_since = clock::time_point();
+        if (m_index + 1 >= m_ladder.size() || now - m_changed < std::chrono::milliseconds(QUALITY_STEP_MS))
+            return -1;
+        m_index++;
+    }
+    else if (delay_ms * 4 > m_config.down_ms || m_index == 0)
+    {
+        m_calm_since = clock::time_point();
+        return -1;
+    }
+    else
+    {
+        if (m_calm_since == clock::time_point())
+            m_calm_since = now;
+        if (now - m_calm_since < std::chrono::milliseconds(m_config.recover_ms))
+            return -1;
+        // one format per recover_ms
+        m_calm_since = now;
+        m_index--;
+    }
+    m_changed = now;
+    m_switches++;
+    return m_ladder[m_index];
+}
+
+QualityEncoder::QualityEncoder(int rate, int channels)
+    : m_rate(rate), m_channels(channels), m_resampler(nullptr)
+{
+    if (rate != 8000)
+    {
+        int err = 0;
+        m_resampler = stream_resampler_create(channels, rate, 8000, SWITCH_RESAMPLE_QUALITY, &err);
+    }
+}
+
+QualityEncoder::~QualityEncoder()
+{
+    if (m_resampler)
+        stream_resampler_destroy(m_resampler);
+}
+
+void QualityEncoder::reset()
+{
+    if (m_resampler)
+        m_resampler->reset();
+}
+
+const char *QualityEncoder::encoding(AudioQuality quality)
+{
+    return quality == QUALITY_PCMU ? "PCMU" : "L16";
+}
+
+int QualityEncoder::rate(AudioQuality quality) const
+{
+    return quality == QUALITY_FULL ? m_rate : 8000;
+}
+
+size_t QualityEncoder::encode(AudioQuality quality, const uint8_t *data, size_t len, const uint8_t **out)
+{
+    if (quality == QUALITY_FULL)
+    {
+        *out = data;
+        return len;
+    }
+
+    const spx_int16_t *samples = reinterpret_cast<const spx_int16_t *>(data);
+    size_t count = len / sizeof(spx_int16_t);
+    if (m_resampler)
+    {
+        // room for the ratio plus what the filter holds back
+        spx_uint32_t in_len = count / m_channels;
+        spx_uint32_t out_len = in_len * 8000 / m_rate + 16;
+        m_resampled.resize((size_t)out_len * m_channels);
+        m_resampler->process(samples, &in_len, m_resampled.data(), &out_len);
+        samples = m_resampled.data();
+        count = (size_t)out_len * m_channels;
+    }
+    if (quality == QUALITY_L16_8K)
+    {
+        *out = reinterpret_cast<const uint8_t *>(samples);
+        return count * sizeof(spx_int16_t);
+    }
+
+    m_encoded.resize(count);
+    for (size_t i = 0; i < count; i++)
+        m_encoded[i] = quality_linear_to_ulaw(samples[i]);
+    *out = m_encoded.data();
+    return count;
+}
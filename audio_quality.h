@@ -0,0 +1,93 @@
+#ifndef AUDIO_QUALITY_H
+#define AUDIO_QUALITY_H
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "mod_video_stream.h"
+
+#define QUALITY_QUEUE_MS 2000 /* send queue cap when adaptive quality is on without one */
+#define QUALITY_STEP_MS 1000  /* least time between two steps down */
+
+struct AdaptiveQualityConfig
+{
+    bool enabled = false;
+    int down_ms = 200;     /* send delay that steps the format down */
+    int recover_ms = 5000; /* time under a quarter of down_ms before stepping back up */
+};
+
+/* Outbound formats, best first. */
+enum AudioQuality
+{
+    QUALITY_FULL,   /* L16 at the stream's websocket rate */
+    QUALITY_L16_8K, /* L16 at 8 kHz, skipped when the stream already is 8 kHz */
+    QUALITY_PCMU    /* G.711 mu-law at 8 kHz */
+};
+
+/*
+ * Picks the outbound format of a stream from how long its audio waits in
+ * the send queue, which covers both a server that reads slowly and a
+ * transport call that takes long. Steps down one format at a time, at
+ * most every QUALITY_STEP_MS while the delay stays at down_ms or above,
+ * and back up one format after recover_ms of low delay.
+ */
+class QualityController
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    QualityController(const AdaptiveQualityConfig &config, int rate);
+
+    /* the new format when it changes with this packet, -1 otherwise */
+    int update(int delay_ms, clock::time_point now);
+
+    AudioQuality quality() const
+    {
+        return m_ladder[m_index];
+    }
+
+    uint32_t switches() const
+    {
+        return m_switches;
+    }
+
+private:
+    const AdaptiveQualityConfig m_config;
+    std::vector<AudioQuality> m_ladder;
+    size_t m_index;
+    clock::time_point m_changed;
+    clock::time_point m_calm_since; /* epoch while the delay is not low */
+    uint32_t m_switches;
+};
+
+/* Converts L16 packets at the stream rate to a lower format. */
+class QualityEncoder
+{
+public:
+    QualityEncoder(int rate, int channels);
+    ~QualityEncoder();
+
+    QualityEncoder(const QualityEncoder &) = delete;
+    QualityEncoder &operator=(const QualityEncoder &) = delete;
+
+    /* the packet in quality; QUALITY_FULL returns it unchanged */
+    size_t encode(AudioQuality quality, const uint8_t *data, size_t len, const uint8_t **out);
+
+    /* a format change starts the resampler over */
+    void reset();
+
+    static const char *encoding(AudioQuality quality);
+    int rate(AudioQuality quality) const;
+
+private:
+    const int m_rate;
+    const int m_channels;
+    stream_resampler_t *m_resampler; /* to 8 kHz, null when the stream is 8 kHz */
+    std::vector<spx_int16_t> m_resampled;
+    std::vector<uint8_t> m_encoded;
+};
+
+/* G.711 mu-law of one sample */
+uint8_t quality_linear_to_ulaw(int16_t sample);
+
+#endif // AUDIO_QUALITY_H
@@ -0,0 +1,323 @@
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "audio_resampler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLER_HAVE_AVX2_DISPATCH 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define RESAMPLER_HAVE_NEON 1
+#endif
+
+namespace
+{
+    /* dot product over n floats, n is always a multiple of 8 */
+    typedef float (*dot_fn_t)(const float *a, const float *b, size_t n);
+
+    float dot_scalar(const float *a, const float *b, size_t n)
+    {
+        float acc0 = 0.f, acc1 = 0.f, acc2 = 0.f, acc3 = 0.f;
+        for (size_t i = 0; i < n; i += 4)
+        {
+            acc0 += a[i] * b[i];
+            acc1 += a[i + 1] * b[i + 1];
+            acc2 += a[i + 2] * b[i + 2];
+            acc3 += a[i + 3] * b[i + 3];
+        }
+        return (acc0 + acc1) + (acc2 + acc3);
+    }
+
+#if defined(RESAMPLER_HAVE_AVX2_DISPATCH)
+    __attribute__((target("avx2,fma"))) float dot_avx2(const float *a, const float *b, size_t n)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        for (size_t i = 0; i < n; i += 8)
+        {
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+        }
+        __m128 lo = _mm256_castps256_ps128(acc);
+        __m128 hi = _mm256_extractf128_ps(acc, 1);
+        lo = _mm_add_ps(lo, hi);
+        lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+        lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 0x55));
+        return _mm_cvtss_f32(lo);
+    }
+#endif
+
+#if defined(RESAMPLER_HAVE_NEON)
+    float dot_neon(const float *a, const float *b, size_t n)
+    {
+        float32x4_t acc0 = vdupq_n_f32(0.f);
+        float32x4_t acc1 = vdupq_n_f32(0.f);
+        for (size_t i = 0; i < n; i += 8)
+        {
+            acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+            acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        }
+        float32x4_t acc = vaddq_f32(acc0, acc1);
+        float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+        return vget_lane_f32(vpadd_f32(sum, sum), 0);
+    }
+#endif
+
+    dot_fn_t select_dot()
+    {
+#if defined(RESAMPLER_HAVE_AVX2_DISPATCH)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return dot_avx2;
+#elif defined(RESAMPLER_HAVE_NEON)
+        return dot_neon;
+#endif
+        return dot_scalar;
+    }
+
+    const dot_fn_t dot = select_dot();
+
+    double bessel_i0(double x)
+    {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 32; k++)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    /*
+     * Kaiser windowed-sinc prototype of L * TAPS coefficients, split into L
+     * phases of TAPS coefficients each. Every phase is stored reversed and
+     * normalized to unity DC gain so that an output sample is a single
+     * forward dot product over the most recent TAPS input samples.
+     *
+     * Q is the speex quality whose filter is reproduced: its length in
+     * input samples (scaled up by the ratio when downsampling), bandwidth
+     * and Kaiser window come from speex's quality table, so the kernels
+     * pass and reject what speex does at that quality.
+     */
+    template <unsigned L, unsigned M, int Q>
+    struct PolyphaseTable
+    {
+        static const unsigned LENGTH = Q >= 7 ? 128 : Q >= 4 ? 64 : 32;
+        static const unsigned TAPS = L >= M ? LENGTH : LENGTH * M / L;
+        float coeffs[L][TAPS];
+
+        PolyphaseTable()
+        {
+            const unsigned N = L * TAPS;
+            const double bandwidth = L >= M ? (Q >= 7 ? 0.950 : Q >= 4 ? 0.940 : 0.910)
+                                            : (Q >= 7 ? 0.950 : Q >= 4 ? 0.921 : 0.882);
+            const double fc = 0.5 * bandwidth / (L > M ? L : M); /* cutoff in cycles per upsampled sample */
+            const double beta = Q >= 7 ? 10.0 : Q >= 4 ? 8.0 : 6.0;
+            const double center = (N - 1) / 2.0;
+            const double norm = bessel_i0(beta);
+            std::vector<double> h(N);
+            for (unsigned j = 0; j < N; j++)
+            {
+                const double x = j - center;
+                const double sinc = x == 0.0 ? 2.0 * fc : std::sin(2.0 * M_PI * fc * x) / (M_PI * x);
+                const double r = 2.0 * j / (N - 1) - 1.0;
+                h[j] = sinc * bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / norm;
+            }
+            for (unsigned p = 0; p < L; p++)
+            {
+                double sum = 0.0;
+                for (unsigned q = 0; q < TAPS; q++)
+                    sum += h[p + q * L];
+                for (unsigned q = 0; q < TAPS; q++)
+                    coeffs[p][TAPS - 1 - q] = (float)(h[p + q * L] / sum);
+            }
+        }
+
+        static const PolyphaseTable &get()
+        {
+            static const PolyphaseTable table;
+            return table;
+        }
+    };
+
+    inline spx_int16_t to_int16(float v)
+    {
+        if (v >= 32767.f)
+            return 32767;
+        if (v <= -32768.f)
+            return -32768;
+        return (spx_int16_t)lrintf(v);
+    }
+
+    template <unsigned L, unsigned M, int Q>
+    class FixedRatioResampler : public stream_resampler
+    {
+    public:
+        static const unsigned TAPS = PolyphaseTable<L, M, Q>::TAPS;
+
+        explicit FixedRatioResampler(int channels) : m_table(PolyphaseTable<L, M, Q>::get()), m_channels(channels), m_t(0),
+                                                     m_work(channels)
+        {
+            reset();
+        }
+
+        int process(const spx_int16_t *in, spx_uint32_t *in_len, spx_int16_t *out, spx_uint32_t *out_len) override
+        {
+            const size_t n = *in_len;
+            const size_t cap = *out_len;
+            const int channels = m_channels;
+
+            /* working buffer per channel: TAPS - 1 samples of history followed by the new input */
+            for (int c = 0; c < channels; c++)
+            {
+                std::vector<float> &w = m_work[c];
+                if (w.size() < TAPS - 1 + n)
+                    w.resize(TAPS - 1 + n);
+                float *dst = w.data() + TAPS - 1;
+                for (size_t i = 0; i < n; i++)
+                    dst[i] = in[i * channels + c];
+            }
+
+            size_t t = m_t;
+            size_t produced = 0;
+            while (t / L < n && produced < cap)
+            {
+                const float *coeffs = m_table.coeffs[t % L];
+                const size_t i = t / L;
+                for (int c = 0; c < channels; c++)
+                    out[produced * channels + c] = to_int16(dot(coeffs, m_work[c].data() + i, TAPS));
+                produced++;
+                t += M;
+            }
+
+            const size_t consumed = std::min(n, t / L);
+            for (int c = 0; c < channels; c++)
+            {
+                float *w = m_work[c].data();
+                memmove(w, w + consumed, (TAPS - 1) * sizeof(float));
+            }
+            m_t = t - consumed * L;
+
+            *in_len = (spx_uint32_t)consumed;
+            *out_len = (spx_uint32_t)produced;
+            return 0;
+        }
+
+        void reset() override
+        {
+            m_t = 0;
+            for (auto &w : m_work)
+                w.assign(TAPS - 1, 0.f);
+        }
+
+        const char *name() const override
+        {
+            return "polyphase";
+        }
+
+    private:
+        const PolyphaseTable<L, M, Q> &m_table;
+        const int m_channels;
+        size_t m_t; /* output position in upsampled time, relative to the first unconsumed input */
+        std::vector<std::vector<float>> m_work;
+    };
+
+    class SpeexResampler : public stream_resampler
+    {
+    public:
+        explicit SpeexResampler(SpeexResamplerState *state, int channels) : m_state(state), m_channels(channels) {}
+
+        ~SpeexResampler() override
+        {
+            speex_resampler_destroy(m_state);
+        }
+
+        int process(const spx_int16_t *in, spx_uint32_t *in_len, spx_int16_t *out, spx_uint32_t *out_len) override
+        {
+            if (m_channels == 1)
+                return speex_resampler_process_int(m_state, 0, in, in_len, out, out_len);
+            return speex_resampler_process_interleaved_int(m_state, in, in_len, out, out_len);
+        }
+
+        void reset() override
+        {
+            speex_resampler_reset_mem(m_state);
+        }
+
+        const char *name() const override
+        {
+            return "speex";
+        }
+
+    private:
+        SpeexResamplerState *m_state;
+        const int m_channels;
+    };
+
+    int gcd(int a, int b)
+    {
+        while (b)
+        {
+            int r = a % b;
+            a = b;
+            b = r;
+        }
+        return a;
+    }
+
+    template <int Q>
+    stream_resampler *create_fixed_ratio(int channels, int l, int m)
+    {
+        if (l == 2 && m == 1)
+            return new FixedRatioResampler<2, 1, Q>(channels);
+        if (l == 1 && m == 2)
+            return new FixedRatioResampler<1, 2, Q>(channels);
+        if (l == 3 && m == 2)
+            return new FixedRatioResampler<3, 2, Q>(channels);
+        if (l == 2 && m == 3)
+            return new FixedRatioResampler<2, 3, Q>(channels);
+        if (l == 6 && m == 1)
+            return new FixedRatioResampler<6, 1, Q>(channels);
+        if (l == 1 && m == 6)
+            return new FixedRatioResampler<1, 6, Q>(channels);
+        return nullptr;
+    }
+
+    /* three filters cover the quality range: qualities up to 2 get the
+       speex quality 2 filter, 3 and 4 that of quality 4, above that quality 7 */
+    stream_resampler *create_fixed_ratio(int channels, int l, int m, int quality)
+    {
+        if (quality >= 5)
+            return create_fixed_ratio<7>(channels, l, m);
+        if (quality >= 3)
+            return create_fixed_ratio<4>(channels, l, m);
+        return create_fixed_ratio<2>(channels, l, m);
+    }
+}
+
+stream_resampler_t *stream_resampler_create(int channels, int in_rate, int out_rate, int quality, int *err)
+{
+    *err = 0;
+    if (in_rate > 0 && out_rate > 0)
+    {
+        const int g = gcd(in_rate, out_rate);
+        stream_resampler *fixed = create_fixed_ratio(channels, out_rate / g, in_rate / g, quality);
+        if (fixed)
+            return fixed;
+    }
+    return stream_resampler_create_speex(channels, in_rate, out_rate, quality, err);
+}
+
+stream_resampler_t *stream_resampler_create_speex(int channels, int in_rate, int out_rate, int quality, int *err)
+{
+    *err = 0;
+    SpeexResamplerState *state = speex_resampler_init(channels, in_rate, out_rate, quality, err);
+    if (!state || *err != 0)
+        return nullptr;
+    return new SpeexResampler(state, channels);
+}
+
+void stream_resampler_destroy(stream_resampler_t *resampler)
+{
+    delete resampler;
+}
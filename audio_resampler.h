@@ -0,0 +1,30 @@
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+
+#include "mod_video_stream.h"
+
+/*
+ * Resampler used for both stream directions. The common telephony ratios
+ * (8k<->16k, 16k<->24k, 8k<->48k and any rates reducing to them) are served
+ * by fixed-ratio polyphase kernels whose coefficient tables are built once
+ * and shared by every call; anything else falls back to speex. quality is
+ * the speex quality and also picks the length of the fixed-ratio filters.
+ *
+ * process() follows speex_resampler_process_interleaved_int semantics:
+ * in_len / out_len are frames (samples per channel) and are updated with
+ * the number of frames consumed / produced.
+ */
+struct stream_resampler
+{
+    virtual ~stream_resampler() {}
+    virtual int process(const spx_int16_t *in, spx_uint32_t *in_len, spx_int16_t *out, spx_uint32_t *out_len) = 0;
+    virtual void reset() = 0;
+    virtual const char *name() const = 0;
+};
+
+stream_resampler_t *stream_resampler_create(int channels, int in_rate, int out_rate, int quality, int *err);
+/* always speex, whatever the ratio; the reference the fixed-ratio kernels are measured against */
+stream_resampler_t *stream_resampler_create_speex(int channels, int in_rate, int out_rate, int quality, int *err);
+void stream_resampler_destroy(stream_resampler_t *resampler);
+
+#endif // AUDIO_RESAMPLER_H
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "audio_vad.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define VAD_HAVE_NEON 1
+#endif
+
+uint64_t vad_sum_squares(const int16_t *samples, size_t count)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    /* pairs of squares fit in an unsigned 32 bit lane, widen before accumulating */
+    __m128i acc = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(samples + i));
+        __m128i sq = _mm_madd_epi16(v, v);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc);
+    sum = lanes[0] + lanes[1];
+#elif defined(VAD_HAVE_NEON)
+    uint64x2_t acc = vdupq_n_u64(0);
+    for (; i + 4 <= count; i += 4)
+    {
+        int16x4_t v = vld1_s16(samples + i);
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(vmull_s16(v, v)));
+    }
+    sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+
+    for (; i < count; i++)
+    {
+        sum += (uint64_t)((int32_t)samples[i] * samples[i]);
+    }
+    return sum;
+}
+
+VoiceGate::VoiceGate(const VoiceGateConfig &config, size_t bytes_per_ms)
+    : m_config(config), m_bytes_per_ms(bytes_per_ms ? bytes_per_ms : 1),
+      m_preroll_cap(config.preroll_ms * (bytes_per_ms ? bytes_per_ms : 1)),
+      m_level(-96.0), m_active(false), m_hangover_left(0), m_silence_ms(0), m_last_packet_ms(0),
+      m_preroll(m_preroll_cap), m_preroll_start(0), m_preroll_size(0)
+{
+    m_threshold = 32768.0 * 32768.0 * std::pow(10.0, config.threshold_dbfs / 10.0);
+}
+
+VoiceGate::Transition VoiceGate::update(const uint8_t *data, size_t len)
+{
+    const size_t count = len / sizeof(int16_t);
+    const size_t packet_ms = len / m_bytes_per_ms;
+    m_last_packet_ms = packet_ms;
+    if (count == 0)
+        return NONE;
+
+    const double energy = (double)vad_sum_squares(reinterpret_cast<const int16_t *>(data), count) / count;
+    m_level = energy > 0.0 ? 10.0 * std::log10(energy / (32768.0 * 32768.0)) : -96.0;
+
+    if (energy >= m_threshold)
+    {
+        m_hangover_left = m_config.hangover_ms;
+        m_silence_ms = 0;
+        if (!m_active)
+        {
+            m_active = true;
+            return SPEECH_START;
+        }
+        return NONE;
+    }
+
+    if (m_active)
+    {
+        if (m_hangover_left > packet_ms)
+        {
+            m_hangover_left -= packet_ms;
+            return NONE;
+        }
+        m_hangover_left = 0;
+        m_active = false;
+        return SPEECH_STOP;
+    }
+    return NONE;
+}
+
+void VoiceGate::remember(const uint8_t *data, size_t len)
+{
+    if (m_preroll_cap == 0)
+        return;
+    if (len >= m_preroll_cap)
+    {
+        memcpy(m_preroll.data(), data + len - m_preroll_cap, m_preroll_cap);
+        m_preroll_start = 0;
+        m_preroll_size = m_preroll_cap;
+        return;
+    }
+    // once full, the packet overwrites the oldest bytes
+    const size_t end = (m_preroll_start + m_preroll_size) % m_preroll_cap;
+    const size_t first = std::min(len, m_preroll_cap - end);
+    memcpy(&m_preroll[end], data, first);
+    memcpy(&m_preroll[0], data + first, len - first);
+    if (m_preroll_size + len > m_preroll_cap)
+    {
+        m_preroll_start = (m_preroll_start + m_preroll_size + len - m_preroll_cap) % m_preroll_cap;
+        m_preroll_size = m_preroll_cap;
+    }
+    else
+    {
+        m_preroll_size += len;
+    }
+}
+
+const uint8_t *VoiceGate::preroll()
+{
+    // only on a speech start, so the rotation does not cost per packet
+    if (m_preroll_start > 0)
+    {
+        std::rotate(m_preroll.begin(), m_preroll.begin() + m_preroll_start, m_preroll.end());
+        m_preroll_start = 0;
+    }
+    return m_preroll.data();
+}
+
+bool VoiceGate::keepaliveDue()
+{
+    if (m_config.keepalive_ms <= 0)
+        return false;
+    m_silence_ms += m_last_packet_ms;
+    if (m_silence_ms >= (size_t)m_config.keepalive_ms)
+    {
+        m_silence_ms = 0;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,87 @@
+#ifndef AUDIO_VAD_H
+#define AUDIO_VAD_H
+
+#include <vector>
+#include "mod_video_stream.h"
+
+#define VAD_KEEPALIVE_MSG "{\"type\":\"silence\"}"
+
+struct VoiceGateConfig
+{
+    bool enabled = false;
+    int threshold_dbfs = -45; /* packets above this level count as speech */
+    int hangover_ms = 500;    /* keep sending this long after the last speech packet */
+    int preroll_ms = 200;     /* audio held back during silence and sent on speech start */
+    int keepalive_ms = 1000;  /* interval of VAD_KEEPALIVE_MSG during silence, 0 disables it */
+};
+
+/*
+ * Energy based voice activity gate for outbound audio. It is fed whole
+ * packets as they are about to be sent and decides whether they go out,
+ * keeping the most recent preroll_ms of suppressed audio in a ring so the
+ * start of an utterance is not clipped.
+ */
+class VoiceGate
+{
+public:
+    enum Transition
+    {
+        NONE,
+        SPEECH_START,
+        SPEECH_STOP
+    };
+
+    VoiceGate(const VoiceGateConfig &config, size_t bytes_per_ms);
+
+    /* classifies one L16 packet and advances the gate state */
+    Transition update(const uint8_t *data, size_t len);
+
+    /* true while packets should be forwarded */
+    bool active() const
+    {
+        return m_active;
+    }
+
+    /* level of the last packet in dBFS */
+    double level() const
+    {
+        return m_level;
+    }
+
+    /* holds back a suppressed packet for pre-roll */
+    void remember(const uint8_t *data, size_t len);
+
+    /* pre-roll contents, oldest first, made contiguous by the call; cleared by clearPreroll() */
+    const uint8_t *preroll();
+    size_t prerollSize() const
+    {
+        return m_preroll_size;
+    }
+    void clearPreroll()
+    {
+        m_preroll_start = 0;
+        m_preroll_size = 0;
+    }
+
+    /* true once every keepalive_ms of continuous silence */
+    bool keepaliveDue();
+
+private:
+    const VoiceGateConfig m_config;
+    const size_t m_bytes_per_ms;
+    const size_t m_preroll_cap;
+    double m_threshold; /* mean square energy equivalent of threshold_dbfs */
+    double m_level;
+    bool m_active;
+    size_t m_hangover_left; /* ms */
+    size_t m_silence_ms;
+    size_t m_last_packet_ms;
+    std::vector<uint8_t> m_preroll; /* ring of m_preroll_cap bytes */
+    size_t m_preroll_start;         /* oldest byte */
+    size_t m_preroll_size;
+};
+
+/* sum of squares of count 16 bit samples */
+uint64_t vad_sum_squares(const int16_t *samples, size_t count);
+
+#endif // AUDIO_VAD_H
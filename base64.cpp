@@ -261,6 +261,41 @@ static std::string decode(String const &encoded_string, bool remove_linebreaks)
    return ret;
 }
 
+size_t base64_decode_into(char const *encoded, size_t len, unsigned char *out)
+{
+   //
+   // mod_video_stream addition: same chunk rules as decode(…) above, but
+   // writes into a caller supplied buffer so that long payloads can be
+   // decoded block by block into reusable scratch memory.
+   //
+   size_t pos = 0;
+   unsigned char *p = out;
+
+   while (pos < len)
+   {
+      if (pos + 1 >= len)
+         throw std::runtime_error("Input is not valid base64-encoded data.");
+
+      unsigned int pos_of_char_1 = pos_of_char(encoded[pos + 1]);
+      *p++ = static_cast<unsigned char>((pos_of_char(encoded[pos + 0]) << 2) + ((pos_of_char_1 & 0x30) >> 4));
+
+      if ((pos + 2 < len) && encoded[pos + 2] != '=' && encoded[pos + 2] != '.')
+      {
+         unsigned int pos_of_char_2 = pos_of_char(encoded[pos + 2]);
+         *p++ = static_cast<unsigned char>(((pos_of_char_1 & 0x0f) << 4) + ((pos_of_char_2 & 0x3c) >> 2));
+
+         if ((pos + 3 < len) && encoded[pos + 3] != '=' && encoded[pos + 3] != '.')
+         {
+            *p++ = static_cast<unsigned char>(((pos_of_char_2 & 0x03) << 6) + pos_of_char(encoded[pos + 3]));
+         }
+      }
+
+      pos += 4;
+   }
+
+   return static_cast<size_t>(p - out);
+}
+
 std::string base64_decode(std::string const &s, bool remove_linebreaks)
 {
    return decode(s, remove_linebreaks);
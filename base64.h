@@ -19,6 +19,14 @@ std::string base64_encode_mime(std::string const &s);
 std::string base64_decode(std::string const &s, bool remove_linebreaks = false);
 std::string base64_encode(unsigned char const *, size_t len, bool url = false);
 
+//
+// mod_video_stream addition: decode len characters of encoded into out
+// without allocating. len must be a multiple of 4 unless it is the final
+// chunk of the input; out must hold at least len / 4 * 3 bytes.
+// Returns the number of bytes written.
+//
+size_t base64_decode_into(char const *encoded, size_t len, unsigned char *out);
+
 #if __cplusplus >= 201703L
 //
 // Interface with std::string_view rather than const std::string&
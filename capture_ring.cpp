@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cstring>
+#include "capture_ring.h"
+
+namespace
+{
+    size_t limit_bytes(int ms, size_t bytes_per_ms, size_t frame_bytes)
+    {
+        const size_t bytes = std::min((size_t)std::max(0, ms) * bytes_per_ms, (size_t)CAPTURE_MAX_BYTES);
+        return bytes / frame_bytes * frame_bytes;
+    }
+}
+
+CaptureRing::CaptureRing(const CaptureConfig &config, size_t bytes_per_ms, size_t frame_bytes)
+    : m_frame_bytes(frame_bytes ? frame_bytes : 1),
+      m_connect_limit(limit_bytes(config.connect_ms, bytes_per_ms, m_frame_bytes)),
+      m_pause_limit(limit_bytes(config.pause_ms, bytes_per_ms, m_frame_bytes)),
+      m_replay_limit(limit_bytes(config.replay_ms, bytes_per_ms, m_frame_bytes)),
+      m_capacity(std::max(std::max(m_connect_limit, m_pause_limit), m_replay_limit)),
+      m_head(0), m_size(0), m_dropped(0), m_connected_once(false)
+{
+}
+
+void CaptureRing::grow(size_t size)
+{
+    std::vector<uint8_t> buffer(size);
+    if (m_size == 0)
+    {
+        m_buffer.swap(buffer);
+        m_head = 0;
+        return;
+    }
+    const size_t first = std::min(m_size, m_buffer.size() - m_head);
+    memcpy(buffer.data(), m_buffer.data() + m_head, first);
+    memcpy(buffer.data() + first, m_buffer.data(), m_size - first);
+    m_buffer.swap(buffer);
+    m_head = 0;
+}
+
+void CaptureRing::push(const uint8_t *data, size_t len, size_t limit)
+{
+    limit = std::min(limit, m_capacity) / m_frame_bytes * m_frame_bytes;
+    if (limit == 0)
+    {
+        m_dropped += m_size + len;
+        m_head = 0;
+        m_size = 0;
+        return;
+    }
+    if (m_buffer.size() < limit)
+        grow(limit);
+    const size_t cap = m_buffer.size();
+
+    if (len > limit)
+    {
+        m_dropped += len - limit;
+        data += len - limit;
+        len = limit;
+    }
+
+    // make room first, whole frames only
+    if (m_size + len > limit)
+    {
+        const size_t drop = m_size + len - limit;
+        m_head = (m_head + drop) % cap;
+        m_size -= drop;
+        m_dropped += drop;
+    }
+
+    size_t tail = (m_head + m_size) % cap;
+    const size_t first = std::min(len, cap - tail);
+    memcpy(m_buffer.data() + tail, data, first);
+    memcpy(m_buffer.data(), data + first, len - first);
+    m_size += len;
+}
+
+size_t CaptureRing::peekAt(size_t offset, const uint8_t **data, size_t max) const
+{
+    if (offset >= m_size)
+        return 0;
+    const size_t pos = (m_head + offset) % m_buffer.size();
+    *data = m_buffer.data() + pos;
+    return std::min(max, std::min(m_size - offset, m_buffer.size() - pos));
+}
+
+void CaptureRing::consume(size_t len)
+{
+    len = std::min(len, m_size);
+    m_head = m_size == len ? 0 : (m_head + len) % m_buffer.size();
+    m_size -= len;
+}
@@ -0,0 +1,105 @@
+#ifndef CAPTURE_RING_H
+#define CAPTURE_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define CAPTURE_DRAIN_PACKETS 4           /* packets sent per frame while catching up, 4x real time at 20ms */
+#define CAPTURE_MAX_BYTES (4 * 1024 * 1024) /* per session, whatever the configured durations */
+
+struct CaptureConfig
+{
+    int connect_ms = 2000; /* audio kept from start until the websocket opens */
+    int pause_ms = 0;      /* tail of paused audio sent on resume, 0 keeps pause silent */
+    int replay_ms = 5000;  /* audio kept while reconnecting and replayed afterwards */
+};
+
+/*
+ * Outbound audio that could not be sent when it was captured: everything
+ * from start until the websocket opens, the last replay_ms while a dropped
+ * connection is being reopened and, optionally, the last pause_ms of a
+ * pause. Once sending is possible the ring is drained a few packets
+ * per frame ahead of live audio, which queues behind it, so the server gets
+ * the audio in order and catches up faster than real time.
+ *
+ * Only used by the media thread with tech_pvt->mutex held.
+ */
+class CaptureRing
+{
+public:
+    CaptureRing(const CaptureConfig &config, size_t bytes_per_ms, size_t frame_bytes);
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    /* appends len bytes and drops the oldest audio beyond limit bytes */
+    void push(const uint8_t *data, size_t len, size_t limit);
+
+    /* contiguous readable bytes at the head, at most max */
+    size_t peek(const uint8_t **data, size_t max) const
+    {
+        return peekAt(0, data, max);
+    }
+
+    /* the same, offset bytes past the head, to gather several packets before consuming */
+    size_t peekAt(size_t offset, const uint8_t **data, size_t max) const;
+
+    void consume(size_t len);
+
+    size_t connectLimit() const
+    {
+        return m_connect_limit;
+    }
+    size_t pauseLimit() const
+    {
+        return m_pause_limit;
+    }
+    size_t replayLimit() const
+    {
+        return m_replay_limit;
+    }
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    uint64_t dropped() const
+    {
+        return m_dropped;
+    }
+
+    /* the websocket has been open at least once; replayLimit applies from now on */
+    void markConnected()
+    {
+        m_connected_once = true;
+    }
+    bool connectedOnce() const
+    {
+        return m_connected_once;
+    }
+
+private:
+    /* the buffer is sized for the largest limit used so far, not the capacity */
+    void grow(size_t size);
+
+    const size_t m_frame_bytes;
+    const size_t m_connect_limit;
+    const size_t m_pause_limit;
+    const size_t m_replay_limit;
+    const size_t m_capacity;
+    std::vector<uint8_t> m_buffer;
+    size_t m_head;
+    size_t m_size;
+    uint64_t m_dropped; /* bytes trimmed to stay within the limit */
+    bool m_connected_once;
+};
+
+#endif // CAPTURE_RING_H
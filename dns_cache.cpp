@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <resolv.h>
+#include <sys/socket.h>
+#include "dns_cache.h"
+
+#define DNS_REFRESH_PERCENT 80 /* share of the TTL after which a used name is resolved again */
+#define DNS_IDLE_WAKEUP_MS 1000
+
+bool DnsConfig::set(const char *name, const char *value)
+{
+    if (!strcasecmp(name, "dns-cache"))
+        enabled = !strcasecmp(value, "true") || !strcmp(value, "1");
+    else if (!strcasecmp(name, "dns-resolver"))
+    {
+        if (strcasecmp(value, "dns") && strcasecmp(value, "system") && strncasecmp(value, "hosts:", 6))
+            return false;
+        resolver = value;
+    }
+    else if (!strcasecmp(name, "dns-ttl"))
+        default_ttl_s = std::max(1, atoi(value));
+    else if (!strcasecmp(name, "dns-min-ttl"))
+        min_ttl_s = std::max(0, atoi(value));
+    else if (!strcasecmp(name, "dns-max-ttl"))
+        max_ttl_s = std::max(1, atoi(value));
+    else if (!strcasecmp(name, "dns-negative-ttl"))
+        negative_ttl_s = std::max(0, atoi(value));
+    else if (!strcasecmp(name, "dns-rewrite-urls"))
+        rewrite = !strcasecmp(value, "true") || !strcmp(value, "1");
+    else
+        return false;
+    return true;
+}
+
+namespace
+{
+    void add_address(std::vector<std::string> &addresses, const std::string &address)
+    {
+        if (std::find(addresses.begin(), addresses.end(), address) != addresses.end())
+            return;
+        // IPv4 first, url rewriting only uses those
+        if (address.find(':') == std::string::npos)
+        {
+            auto v6 = std::find_if(addresses.begin(), addresses.end(), [](const std::string &a)
+                                   { return a.find(':') != std::string::npos; });
+            addresses.insert(v6, address);
+        }
+        else
+        {
+            addresses.push_back(address);
+        }
+    }
+
+    // getaddrinfo: honours nsswitch and /etc/hosts but reports no TTL
+    DnsAnswer resolve_system(const std::string &host)
+    {
+        DnsAnswer answer;
+        struct addrinfo hints;
+        struct addrinfo *result = nullptr;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        const int rc = getaddrinfo(host.c_str(), nullptr, &hints, &result);
+        if (rc == EAI_NONAME
+#ifdef EAI_NODATA
+            || rc == EAI_NODATA
+#endif
+        )
+        {
+            answer.status = DnsAnswer::NOT_FOUND;
+            return answer;
+        }
+        if (rc != 0)
+            return answer;
+
+        for (struct addrinfo *ai = result; ai; ai = ai->ai_next)
+        {
+            char buf[INET6_ADDRSTRLEN];
+            const void *addr = ai->ai_family == AF_INET ? (const void *)&((struct sockaddr_in *)ai->ai_addr)->sin_addr
+                                                        : (const void *)&((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr;
+            if ((ai->ai_family == AF_INET || ai->ai_family == AF_INET6) && inet_ntop(ai->ai_family, addr, buf, sizeof(buf)))
+                add_address(answer.addresses, buf);
+        }
+        freeaddrinfo(result);
+        answer.status = answer.addresses.empty() ? DnsAnswer::NOT_FOUND : DnsAnswer::FOUND;
+        return answer;
+    }
+
+    // one query type; no records, no such name and resolver errors all add nothing
+    void query_records(res_state state, const std::string &host, int type, DnsAnswer &answer)
+    {
+        unsigned char buf[4096];
+        const int len = res_nquery(state, host.c_str(), ns_c_in, type, buf, sizeof(buf));
+        ns_msg msg;
+        if (len < 0 || ns_initparse(buf, len, &msg) < 0)
+            return;
+        for (int i = 0; i < ns_msg_count(msg, ns_s_an); i++)
+        {
+            ns_rr rr;
+            if (ns_parserr(&msg, ns_s_an, i, &rr) < 0 || ns_rr_type(rr) != type)
+                continue;
+            char address[INET6_ADDRSTRLEN];
+            const int family = type == ns_t_a ? AF_INET : AF_INET6;
+            if ((size_t)ns_rr_rdlen(rr) != (type == ns_t_a ? 4u : 16u) || !inet_ntop(family, ns_rr_rdata(rr), address, sizeof(address)))
+                continue;
+            add_address(answer.addresses, address);
+            const int ttl = (int)ns_rr_ttl(rr);
+            answer.ttl_s = answer.ttl_s < 0 ? ttl : std::min(answer.ttl_s, ttl);
+        }
+    }
+
+    // res_nquery for A and AAAA, so the record TTLs are known. Without an
+    // answer getaddrinfo decides, which also covers /etc/hosts and tells a
+    // name that does not exist from an unreachable server.
+    DnsAnswer resolve_dns(const std::string &host)
+    {
+        DnsAnswer answer;
+        struct __res_state state;
+        memset(&state, 0, sizeof(state));
+        if (res_ninit(&state) != 0)
+            return resolve_system(host);
+
+        query_records(&state, host, ns_t_a, answer);
+        query_records(&state, host, ns_t_aaaa, answer);
+        res_nclose(&state);
+
+        if (answer.addresses.empty())
+            return resolve_system(host);
+        answer.status = DnsAnswer::FOUND;
+        return answer;
+    }
+
+    // "address name [name ...]" lines, read on every resolve so edits apply at once
+    DnsAnswer resolve_hosts_file(const std::string &path, const std::string &host)
+    {
+        DnsAnswer answer;
+        std::ifstream file(path);
+        if (!file)
+            return answer;
+        answer.status = DnsAnswer::NOT_FOUND;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            std::string address, name;
+            if (!(fields >> address))
+                continue;
+            while (fields >> name)
+            {
+                if (!strcasecmp(name.c_str(), host.c_str()))
+                    add_address(answer.addresses, address);
+            }
+        }
+        if (!answer.addresses.empty())
+            answer.status = DnsAnswer::FOUND;
+        return answer;
+    }
+}
+
+DnsResolver DnsCache::makeResolver(const DnsConfig &config)
+{
+    if (!strncasecmp(config.resolver.c_str(), "hosts:", 6))
+    {
+        const std::string path = config.resolver.substr(6);
+        return [path](const std::string &host)
+        { return resolve_hosts_file(path, host); };
+    }
+    if (!strcasecmp(config.resolver.c_str(), "system"))
+        return resolve_system;
+    return resolve_dns;
+}
+
+bool DnsCache::isNumeric(const std::string &host)
+{
+    unsigned char buf[sizeof(struct in6_addr)];
+    return inet_pton(AF_INET, host.c_str(), buf) == 1 || inet_pton(AF_INET6, host.c_str(), buf) == 1;
+}
+
+std::string DnsCache::hostOf(const std::string &url)
+{
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    if (start < url.size() && url[start] == '[')
+    {
+        const size_t close = url.find(']', start);
+        return close == std::string::npos ? std::string() : url.substr(start + 1, close - start - 1);
+    }
+    const size_t end = url.find_first_of(":/?#", start);
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+std::string DnsCache::withHost(const std::string &url, const std::string &address)
+{
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    const size_t end = url.find_first_of(":/?#", start);
+    const std::string host = address.find(':') != std::string::npos ? "[" + address + "]" : address;
+    return url.substr(0, start) + host + (end == std::string::npos ? std::string() : url.substr(end));
+}
+
+DnsCache::DnsCache(const DnsConfig &config, DnsResolver resolver)
+    : m_config(config), m_resolver(std::move(resolver)), m_stopping(false), m_stats()
+{
+    m_thread = std::thread(&DnsCache::run, this);
+}
+
+DnsCache::~DnsCache()
+{
+    shutdown();
+}
+
+void DnsCache::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void DnsCache::queue(const std::string &host, Entry &entry)
+{
+    if (entry.resolving)
+        return;
+    entry.resolving = true;
+    m_queue.push_back(host);
+    m_cv.notify_all();
+}
+
+DnsCache::Result DnsCache::lookup(const std::string &host, std::string *address, bool ipv4)
+{
+    if (host.empty())
+        return MISS;
+    if (isNumeric(host))
+    {
+        if (address && !(ipv4 && host.find(':') != std::string::npos))
+            *address = host;
+        return POSITIVE;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(host);
+    if (it == m_entries.end() || (it->second.addresses.empty() && !it->second.negative) || clock::now() >= it->second.expires)
+    {
+        m_stats.misses++;
+        Entry &entry = m_entries[host];
+        entry.used = true;
+        queue(host, entry);
+        return MISS;
+    }
+
+    Entry &entry = it->second;
+    // the resolver thread has already passed the refresh time of an unused name
+    if (!entry.used && clock::now() >= entry.refresh)
+        queue(host, entry);
+    entry.used = true;
+    if (entry.negative)
+    {
+        m_stats.negative_hits++;
+        return NEGATIVE;
+    }
+    m_stats.hits++;
+    // IPv4 addresses are kept in front
+    const size_t count = ipv4 ? std::count_if(entry.addresses.begin(), entry.addresses.end(), [](const std::string &a)
+                                              { return a.find(':') == std::string::npos; })
+                              : entry.addresses.size();
+    if (address && count > 0)
+        *address = entry.addresses[entry.next++ % count];
+    return POSITIVE;
+}
+
+void DnsCache::prefetch(const std::string &host)
+{
+    if (host.empty() || isNumeric(host))
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry &entry = m_entries[host];
+    if (entry.addresses.empty() && !entry.negative)
+    {
+        entry.used = true; // keep it warm until first expiry even if no call comes
+        queue(host, entry);
+    }
+}
+
+void DnsCache::store(const std::string &host, const DnsAnswer &answer)
+{
+    Entry &entry = m_entries[host];
+    const bool refresh = !entry.addresses.empty() || entry.negative;
+    const clock::time_point now = clock::now();
+    entry.resolving = false;
+    entry.used = false;
+    m_stats.resolves++;
+    if (refresh)
+        m_stats.refreshes++;
+
+    if (answer.status == DnsAnswer::FAILED)
+    {
+        // keep serving what we had; try again in a little while
+        m_stats.failures++;
+        entry.used = true;
+        entry.refresh = now + std::chrono::seconds(std::max(1, m_config.min_ttl_s));
+        if (entry.addresses.empty() && !entry.negative)
+            entry.expires = entry.refresh;
+        return;
+    }
+
+    int ttl;
+    if (answer.status == DnsAnswer::NOT_FOUND)
+    {
+        entry.negative = true;
+        entry.addresses.clear();
+        ttl = m_config.negative_ttl_s;
+    }
+    else
+    {
+        entry.negative = false;
+        entry.addresses = answer.addresses;
+        ttl = answer.ttl_s >= 0 ? answer.ttl_s : m_config.default_ttl_s;
+        ttl = std::min(std::max(ttl, m_config.min_ttl_s), std::max(m_config.min_ttl_s, m_config.max_ttl_s));
+    }
+    entry.expires = now + std::chrono::seconds(ttl);
+    entry.refresh = now + std::chrono::milliseconds((int64_t)ttl * 1000 * DNS_REFRESH_PERCENT / 100);
+}
+
+void DnsCache::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping)
+    {
+        if (!m_queue.empty())
+        {
+            const std::string host = m_queue.front();
+            m_queue.pop_front();
+            lock.unlock();
+            const DnsAnswer answer = m_resolver(host);
+            lock.lock();
+            store(host, answer);
+            continue;
+        }
+
+        // refresh used names before they expire, drop unused expired ones
+        const clock::time_point now = clock::now();
+        clock::time_point wake = now + std::chrono::milliseconds(DNS_IDLE_WAKEUP_MS);
+        for (auto it = m_entries.begin(); it != m_entries.end();)
+        {
+            Entry &entry = it->second;
+            if (entry.resolving)
+            {
+                ++it;
+                continue;
+            }
+            if (entry.used && now >= entry.refresh)
+            {
+                queue(it->first, entry);
+            }
+            else if (!entry.used && now >= entry.expires)
+            {
+                it = m_entries.erase(it);
+                continue;
+            }
+            else
+            {
+                // a lookup may mark an unused name used meanwhile, so wake
+                // up at its refresh time too, not only when it expires
+                wake = std::min(wake, now < entry.refresh ? entry.refresh : entry.expires);
+            }
+            ++it;
+        }
+        if (m_queue.empty())
+            m_cv.wait_until(lock, wake);
+    }
+}
+
+DnsCache::Stats DnsCache::stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats = m_stats;
+    stats.entries = m_entries.size();
+    return stats;
+}
@@ -0,0 +1,133 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct DnsConfig
+{
+    bool enabled = true;
+    std::string resolver = "dns"; /* dns, system or hosts:<file> */
+    int default_ttl_s = 60;       /* when the resolver gives no TTL (system, hosts file) */
+    int min_ttl_s = 5;
+    int max_ttl_s = 3600;
+    int negative_ttl_s = 10; /* how long a name that does not exist stays cached */
+    bool rewrite = false;    /* ws:// urls connect to a cached IPv4 address */
+
+    /* one setting by its video_stream.conf name, false if unknown or invalid */
+    bool set(const char *name, const char *value);
+};
+
+struct DnsAnswer
+{
+    enum Status
+    {
+        FOUND,
+        NOT_FOUND, /* the name does not exist, cached negatively */
+        FAILED     /* resolver unreachable or timed out, nothing learnt */
+    };
+    Status status = FAILED;
+    std::vector<std::string> addresses; /* numeric, IPv4 first */
+    int ttl_s = -1;                     /* -1 when the resolver does not report one */
+};
+
+typedef std::function<DnsAnswer(const std::string &host)> DnsResolver;
+
+/*
+ * Module wide cache of websocket host addresses. Lookups never block: a
+ * miss returns at once and queues the name for the resolver thread, so the
+ * connect path does not wait on DNS. Answers are kept for their TTL
+ * (clamped to min/max), names that do not exist for negative_ttl_s. Names
+ * that were looked up since their last resolve are resolved again in the
+ * background once 80% of the TTL has passed, so busy hosts never expire;
+ * unused ones are dropped after they expire. A failed refresh keeps
+ * serving the old addresses until they expire.
+ *
+ * The resolver is a plain function so tests can use a hosts file or a stub.
+ */
+class DnsCache
+{
+public:
+    enum Result
+    {
+        MISS,
+        POSITIVE,
+        NEGATIVE
+    };
+
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t negative_hits;
+        uint64_t misses;
+        uint64_t resolves;
+        uint64_t failures;
+        uint64_t refreshes;
+        size_t entries;
+    };
+
+    DnsCache(const DnsConfig &config, DnsResolver resolver);
+    ~DnsCache();
+
+    /*
+     * address gets one of the cached addresses, rotating, when POSITIVE;
+     * with ipv4 only IPv4 ones, and it stays empty if there are none.
+     * Numeric hosts are answered as they are.
+     */
+    Result lookup(const std::string &host, std::string *address = nullptr, bool ipv4 = false);
+
+    /* queues a resolve unless the name is cached or already queued */
+    void prefetch(const std::string &host);
+
+    Stats stats();
+    void shutdown();
+
+    /* resolver for DnsConfig::resolver; dns falls back to system for names DNS does not know */
+    static DnsResolver makeResolver(const DnsConfig &config);
+
+    /* host of a ws:// or wss:// url, without port or brackets */
+    static std::string hostOf(const std::string &url);
+
+    /* the url with its host replaced by address */
+    static std::string withHost(const std::string &url, const std::string &address);
+
+    static bool isNumeric(const std::string &host);
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Entry
+    {
+        std::vector<std::string> addresses;
+        bool negative = false;
+        bool resolving = false;
+        bool used = false; /* looked up since the last resolve */
+        size_t next = 0;   /* round robin over addresses */
+        clock::time_point expires;
+        clock::time_point refresh;
+    };
+
+    void run();
+    void store(const std::string &host, const DnsAnswer &answer);
+    void queue(const std::string &host, Entry &entry);
+
+    const DnsConfig m_config;
+    const DnsResolver m_resolver;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::unordered_map<std::string, Entry> m_entries;
+    std::deque<std::string> m_queue;
+    bool m_stopping;
+    Stats m_stats;
+    std::thread m_thread;
+};
+
+#endif // DNS_CACHE_H
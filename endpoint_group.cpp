@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <chrono>
+#include <strings.h>
+#include "mod_video_stream.h"
+#include "ws_transport.h"
+#include "endpoint_group.h"
+
+#define ENDPOINT_RTT_WEIGHT 0.3 /* weight of a new sample in the smoothed RTT */
+
+namespace
+{
+    // FNV-1a, stable across builds and restarts so a call keeps hashing to
+    // the same node after the module is reloaded
+    uint64_t hash_key(const std::string &key)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : key)
+        {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        // spread the low entropy of similar keys (url#n) over the ring
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+}
+
+EndpointGroup::EndpointGroup(const std::string &name, Policy policy, const std::vector<std::string> &urls)
+    : m_name(name), m_policy(policy), m_urls(urls), m_connect_set(false), m_probed(true), m_endpoints(urls.size())
+{
+    if (m_policy != HASH)
+        return;
+    m_ring.reserve(m_urls.size() * ENDPOINT_HASH_REPLICAS);
+    for (size_t i = 0; i < m_urls.size(); i++)
+    {
+        for (int replica = 0; replica < ENDPOINT_HASH_REPLICAS; replica++)
+            m_ring.emplace_back(hash_key(m_urls[i] + "#" + std::to_string(replica)), i);
+    }
+    std::sort(m_ring.begin(), m_ring.end());
+}
+
+std::vector<std::string> EndpointGroup::route(const std::string &key) const
+{
+    std::vector<size_t> order;
+    order.reserve(m_urls.size());
+
+    if (m_policy == HASH && !m_ring.empty())
+    {
+        // walk the ring clockwise from the key, each endpoint once
+        std::vector<bool> seen(m_urls.size(), false);
+        auto it = std::lower_bound(m_ring.begin(), m_ring.end(), std::make_pair(hash_key(key), (size_t)0));
+        for (size_t n = 0; n < m_ring.size() && order.size() < m_urls.size(); n++, it++)
+        {
+            if (it == m_ring.end())
+                it = m_ring.begin();
+            if (!seen[it->second])
+            {
+                seen[it->second] = true;
+                order.push_back(it->second);
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < m_urls.size(); i++)
+            order.push_back(i);
+    }
+
+    std::vector<std::string> route;
+    route.reserve(order.size());
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_policy == LEAST_LATENCY)
+        {
+            // unmeasured endpoints after measured ones, in configured order
+            std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b)
+                             {
+                const double ra = m_endpoints[a].rtt_ms, rb = m_endpoints[b].rtt_ms;
+                if ((ra < 0) != (rb < 0))
+                    return rb < 0;
+                return ra < rb; });
+        }
+        std::stable_partition(order.begin(), order.end(), [this](size_t i)
+                              { return m_endpoints[i].healthy; });
+    }
+    for (size_t i : order)
+        route.push_back(m_urls[i]);
+    return route;
+}
+
+void EndpointGroup::report(const std::string &url, bool ok, double rtt_ms)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_urls.size(); i++)
+    {
+        if (m_urls[i] != url)
+            continue;
+        Endpoint &endpoint = m_endpoints[i];
+        if (ok)
+        {
+            endpoint.connects++;
+            endpoint.failures = 0;
+            endpoint.rtt_ms = endpoint.rtt_ms < 0 ? rtt_ms : endpoint.rtt_ms + ENDPOINT_RTT_WEIGHT * (rtt_ms - endpoint.rtt_ms);
+            if (!endpoint.healthy)
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "endpoint group %s: %s is up\n", m_name.c_str(), url.c_str());
+            endpoint.healthy = true;
+        }
+        else
+        {
+            endpoint.errors++;
+            if (++endpoint.failures >= ENDPOINT_FAIL_THRESHOLD && endpoint.healthy)
+            {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "endpoint group %s: %s is down\n", m_name.c_str(), url.c_str());
+                endpoint.healthy = false;
+            }
+        }
+    }
+}
+
+void EndpointGroup::useConnectOptions(const EndpointConnectOptions &options)
+{
+    if (!m_connect_set)
+    {
+        m_connect = options;
+        m_connect_set = true;
+    }
+    else if (m_probed && !(m_connect == options))
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                          "endpoint group %s: profiles differ in TLS or headers, the group is not probed\n", m_name.c_str());
+        m_probed = false;
+    }
+}
+
+void EndpointGroup::inherit(const EndpointGroup &old)
+{
+    std::lock(m_mutex, old.m_mutex);
+    std::lock_guard<std::mutex> lock(m_mutex, std::adopt_lock);
+    std::lock_guard<std::mutex> old_lock(old.m_mutex, std::adopt_lock);
+    for (size_t i = 0; i < m_urls.size(); i++)
+    {
+        auto it = std::find(old.m_urls.begin(), old.m_urls.end(), m_urls[i]);
+        if (it != old.m_urls.end())
+            m_endpoints[i] = old.m_endpoints[it - old.m_urls.begin()];
+    }
+}
+
+std::vector<EndpointGroup::EndpointStatus> EndpointGroup::status() const
+{
+    std::vector<EndpointStatus> status;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_urls.size(); i++)
+    {
+        const Endpoint &endpoint = m_endpoints[i];
+        status.push_back(EndpointStatus{m_urls[i], endpoint.healthy, endpoint.rtt_ms, endpoint.failures,
+                                        endpoint.connects, endpoint.errors});
+    }
+    return status;
+}
+
+bool EndpointGroup::parsePolicy(const char *value, Policy &policy)
+{
+    if (!strcasecmp(value, "failover"))
+        policy = FAILOVER;
+    else if (!strcasecmp(value, "least-latency"))
+        policy = LEAST_LATENCY;
+    else if (!strcasecmp(value, "hash"))
+        policy = HASH;
+    else
+        return false;
+    return true;
+}
+
+const char *EndpointGroup::policyName(Policy policy)
+{
+    switch (policy)
+    {
+    case LEAST_LATENCY:
+        return "least-latency";
+    case HASH:
+        return "hash";
+    default:
+        return "failover";
+    }
+}
+
+EndpointProber::EndpointProber(const ProbeConfig &config, GroupSource source)
+    : m_config(config), m_source(std::move(source)), m_stopping(false)
+{
+    if (m_config.interval_ms > 0)
+        m_thread = std::thread(&EndpointProber::run, this);
+}
+
+EndpointProber::~EndpointProber()
+{
+    shutdown();
+}
+
+void EndpointProber::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void EndpointProber::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping)
+    {
+        lock.unlock();
+        // groups replaced by reloadxml meanwhile are still probed to the end
+        // of this round; their results are simply not looked at any more
+        std::shared_ptr<const EndpointGroupMap> groups = m_source();
+        if (groups)
+        {
+            for (const auto &entry : *groups)
+            {
+                if (!entry.second->probed())
+                    continue;
+                for (const auto &url : entry.second->urls())
+                {
+                    if (m_stopping)
+                        return;
+                    double rtt_ms = 0;
+                    const bool ok = probe(url, entry.second->connectOptions(), rtt_ms);
+                    entry.second->report(url, ok, rtt_ms);
+                }
+            }
+        }
+        lock.lock();
+        m_cv.wait_for(lock, std::chrono::milliseconds(m_config.interval_ms), [this]
+                      { return m_stopping.load(); });
+    }
+}
+
+bool EndpointProber::probe(const std::string &url, const EndpointConnectOptions &options, double &rtt_ms)
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    int state = 0; /* 1 open, -1 failed */
+
+    std::unique_ptr<WsTransport> client = WsTransport::create(url);
+    client->setUrl(url);
+
+    // the handshake a stream of the group would make, so endpoints that
+    // require a client certificate or an auth header are not marked down
+    WebSocketTLSOptions tls;
+    if (!options.tls_cafile.empty())
+        tls.caFile = options.tls_cafile;
+    if (!options.tls_keyfile.empty())
+        tls.keyFile = options.tls_keyfile;
+    if (!options.tls_certfile.empty())
+        tls.certFile = options.tls_certfile;
+    tls.disableHostnameValidation = options.tls_disable_hostname_validation;
+    client->setTLSOptions(tls);
+    if (!options.headers.empty())
+        client->setHeaders(options.headers);
+
+    client->setOpenCallback([&]()
+                           {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (state == 0)
+            state = 1;
+        cv.notify_all(); });
+    client->setErrorCallback([&](int, const std::string &)
+                            {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (state == 0)
+            state = -1;
+        cv.notify_all(); });
+    client->setCloseCallback([&](int, const std::string &)
+                            {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (state == 0)
+            state = -1;
+        cv.notify_all(); });
+
+    const auto start = std::chrono::steady_clock::now();
+    client->connect();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait_for(lock, std::chrono::milliseconds(m_config.timeout_ms), [&]
+                    { return state != 0; });
+        rtt_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    // joins the client thread, so the callbacks are done with the locals
+    client->disconnect();
+    return state == 1;
+}
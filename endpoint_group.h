@@ -0,0 +1,168 @@
+#ifndef ENDPOINT_GROUP_H
+#define ENDPOINT_GROUP_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define ENDPOINT_FAIL_THRESHOLD 2 /* consecutive failures that mark an endpoint down */
+#define ENDPOINT_HASH_REPLICAS 64 /* points per endpoint on the hash ring */
+
+struct ProbeConfig
+{
+    int interval_ms = 5000; /* time between probe rounds, 0 disables probing */
+    int timeout_ms = 2000;  /* a handshake not done by then counts as a failure */
+};
+
+/* TLS files and headers a probe connects with, empty values are not passed to the client */
+struct EndpointConnectOptions
+{
+    std::string tls_cafile;
+    std::string tls_keyfile;
+    std::string tls_certfile;
+    bool tls_disable_hostname_validation = false;
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    bool operator==(const EndpointConnectOptions &other) const
+    {
+        return tls_cafile == other.tls_cafile && tls_keyfile == other.tls_keyfile && tls_certfile == other.tls_certfile &&
+               tls_disable_hostname_validation == other.tls_disable_hostname_validation && headers == other.headers;
+    }
+};
+
+/*
+ * A named list of websocket urls and the policy that orders them for a new
+ * stream. The stream connects to the first url of its route and fails over
+ * to the next ones in turn. Endpoints that are down are moved to the end of
+ * the route rather than removed, so a group with every node down still
+ * tries all of them.
+ *
+ * Health and handshake RTT come from the background prober and from the
+ * connects of live streams. Methods are safe to call from any thread,
+ * except useConnectOptions which is only called while loading.
+ */
+class EndpointGroup
+{
+public:
+    enum Policy
+    {
+        FAILOVER,      /* configured order */
+        LEAST_LATENCY, /* lowest handshake RTT first */
+        HASH           /* consistent hash of the call uuid, for server side cache locality */
+    };
+
+    struct EndpointStatus
+    {
+        std::string url;
+        bool healthy;
+        double rtt_ms; /* smoothed handshake RTT, negative until measured */
+        uint32_t failures; /* consecutive */
+        uint64_t connects;
+        uint64_t errors;
+    };
+
+    EndpointGroup(const std::string &name, Policy policy, const std::vector<std::string> &urls);
+
+    const std::string &name() const
+    {
+        return m_name;
+    }
+    Policy policy() const
+    {
+        return m_policy;
+    }
+    const std::vector<std::string> &urls() const
+    {
+        return m_urls;
+    }
+
+    /* every url of the group, in the order a stream for key should try them */
+    std::vector<std::string> route(const std::string &key) const;
+
+    /* outcome of a handshake to url; rtt_ms is only used when ok */
+    void report(const std::string &url, bool ok, double rtt_ms);
+
+    /*
+     * Once for every profile that names the group, before the group is
+     * used. The prober connects with these options; profiles that disagree
+     * leave the group unprobed, its health then comes from live streams.
+     */
+    void useConnectOptions(const EndpointConnectOptions &options);
+
+    bool probed() const
+    {
+        return m_probed;
+    }
+    const EndpointConnectOptions &connectOptions() const
+    {
+        return m_connect;
+    }
+
+    /* keeps the health of urls that were already in the group before reloadxml */
+    void inherit(const EndpointGroup &old);
+
+    std::vector<EndpointStatus> status() const;
+
+    static bool parsePolicy(const char *value, Policy &policy);
+    static const char *policyName(Policy policy);
+
+private:
+    struct Endpoint
+    {
+        bool healthy = true;
+        double rtt_ms = -1;
+        uint32_t failures = 0;
+        uint64_t connects = 0;
+        uint64_t errors = 0;
+    };
+
+    const std::string m_name;
+    const Policy m_policy;
+    const std::vector<std::string> m_urls;
+    std::vector<std::pair<uint64_t, size_t>> m_ring; /* HASH only, sorted by point */
+    EndpointConnectOptions m_connect;
+    bool m_connect_set;
+    bool m_probed;
+    mutable std::mutex m_mutex;
+    std::vector<Endpoint> m_endpoints; /* parallel to m_urls */
+};
+
+typedef std::unordered_map<std::string, std::shared_ptr<EndpointGroup>> EndpointGroupMap;
+
+/*
+ * Background thread that opens and closes a websocket to every endpoint
+ * of every probed group once per interval and reports the handshake RTT,
+ * using the TLS files and headers of the profiles that name the group. Probes
+ * run one at a time, so a round of n endpoints may take up to n timeouts.
+ */
+class EndpointProber
+{
+public:
+    typedef std::function<std::shared_ptr<const EndpointGroupMap>()> GroupSource;
+
+    EndpointProber(const ProbeConfig &config, GroupSource source);
+    ~EndpointProber();
+
+    void shutdown();
+
+private:
+    void run();
+    bool probe(const std::string &url, const EndpointConnectOptions &options, double &rtt_ms);
+
+    const ProbeConfig m_config;
+    const GroupSource m_source;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::atomic<bool> m_stopping;
+    std::thread m_thread;
+};
+
+#endif // ENDPOINT_GROUP_H
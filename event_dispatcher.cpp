@@ -0,0 +1,101 @@
+#include <cstring>
+#include "event_dispatcher.h"
+
+void EventDispatchConfig::parseList(const char *list, std::unordered_set<std::string> &out)
+{
+    const char *p = list;
+    while (p && *p)
+    {
+        const char *end = strchr(p, ',');
+        const size_t len = end ? (size_t)(end - p) : strlen(p);
+        std::string item(p, len);
+        const size_t first = item.find_first_not_of(" \t");
+        const size_t last = item.find_last_not_of(" \t");
+        out.insert(first == std::string::npos ? std::string() : item.substr(first, last - first + 1));
+        p = end ? end + 1 : nullptr;
+    }
+}
+
+EventDispatcher::EventDispatcher(const EventDispatchConfig &config)
+    : m_config(config), m_pending_set(false)
+{
+}
+
+bool EventDispatcher::takePending(std::string &message)
+{
+    if (!m_pending_set.load(std::memory_order_relaxed))
+        return false;
+    message.swap(m_pending);
+    m_pending.clear();
+    m_pending_set.store(false, std::memory_order_relaxed);
+    return true;
+}
+
+EventDispatcher::Action EventDispatcher::dispatch(const std::string &type, const std::string &message, std::string &flush)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_config.filter && m_config.allow.find(type) == m_config.allow.end())
+        return DROP;
+
+    const clock::time_point now = clock::now();
+
+    // keep ordering: a held message of another type goes out before this one
+    if (m_window_type != type)
+        takePending(flush);
+
+    if (m_config.coalesce_ms > 0 && m_config.coalesce.find(type) != m_config.coalesce.end())
+    {
+        if (m_window_type == type && now < m_window_end)
+        {
+            m_pending = message;
+            m_pending_set.store(true, std::memory_order_relaxed);
+            return HELD;
+        }
+        // a held message of this type is superseded by the one firing now
+        std::string superseded;
+        takePending(superseded);
+        m_window_type = type;
+        m_window_end = now + std::chrono::milliseconds(m_config.coalesce_ms);
+        return FIRE;
+    }
+
+    m_window_type.clear();
+    return FIRE;
+}
+
+bool EventDispatcher::takeDue(std::string &message)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const clock::time_point now = clock::now();
+    if (!m_pending_set.load(std::memory_order_relaxed) || now < m_window_end)
+        return false;
+    // the released message opens the next window
+    m_window_end = now + std::chrono::milliseconds(m_config.coalesce_ms);
+    return takePending(message);
+}
+
+void EventDispatcher::enqueue(const std::string &message)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_queue.size() >= m_config.queue_max)
+        m_queue.pop_front();
+    m_queue.push_back(message);
+}
+
+std::string EventDispatcher::drain(size_t max, size_t *count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string out;
+    size_t n = 0;
+    while (!m_queue.empty() && (max == 0 || n < max))
+    {
+        out.append(m_queue.front());
+        out.push_back('\n');
+        m_queue.pop_front();
+        n++;
+    }
+    if (count)
+        *count = n;
+    return out;
+}
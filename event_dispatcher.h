@@ -0,0 +1,80 @@
+#ifndef EVENT_DISPATCHER_H
+#define EVENT_DISPATCHER_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+struct EventDispatchConfig
+{
+    bool filter = false;                   /* only types in allow become events */
+    std::unordered_set<std::string> allow; /* message "type" values, "" matches untyped messages */
+    std::unordered_set<std::string> coalesce;
+    int coalesce_ms = 0;  /* window in which only the latest message of a coalesced type fires */
+    size_t queue_max = 0; /* per-session response queue, 0 disables it */
+
+    /* fills a set from a comma separated list */
+    static void parseList(const char *list, std::unordered_set<std::string> &out);
+};
+
+/*
+ * Decides which websocket responses become mod_video_stream::json events.
+ * Types outside the allowlist are dropped, chatty types (e.g. ASR partial
+ * results) are coalesced so that at most one fires per window, and every
+ * response can additionally be kept in a bounded queue that the API drains.
+ *
+ * Called from the websocket thread, the write frame thread (to release
+ * coalesced messages whose window ended) and API threads.
+ */
+class EventDispatcher
+{
+public:
+    enum Action
+    {
+        FIRE,
+        DROP,
+        HELD
+    };
+
+    explicit EventDispatcher(const EventDispatchConfig &config);
+
+    /* classifies one response; a held message that must go out first is moved to flush */
+    Action dispatch(const std::string &type, const std::string &message, std::string &flush);
+
+    /* true while a coalesced message is held back */
+    bool pending() const
+    {
+        return m_pending_set.load(std::memory_order_relaxed);
+    }
+
+    /* moves the held message to message once its window has ended */
+    bool takeDue(std::string &message);
+
+    bool queueEnabled() const
+    {
+        return m_config.queue_max > 0;
+    }
+
+    void enqueue(const std::string &message);
+
+    /* removes up to max queued responses (0 = all), newline separated, oldest first */
+    std::string drain(size_t max, size_t *count);
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    bool takePending(std::string &message);
+
+    const EventDispatchConfig m_config;
+    std::mutex m_mutex;
+    std::string m_window_type;
+    clock::time_point m_window_end;
+    std::string m_pending;
+    std::atomic<bool> m_pending_set;
+    std::deque<std::string> m_queue;
+};
+
+#endif // EVENT_DISPATCHER_H
@@ -0,0 +1,77 @@
+#include <memory>
+#include "fanout.h"
+#include "audio_resampler.h"
+
+FanoutRates::FanoutRates(int sampling, int primary_rate, int channels, int rtp_packets)
+    : m_sampling(sampling), m_primary_rate(primary_rate), m_channels(channels), m_rtp_packets(rtp_packets > 0 ? rtp_packets : 1)
+{
+}
+
+FanoutRates::~FanoutRates()
+{
+    for (auto &rate : m_rates)
+    {
+        if (rate.resampler)
+            stream_resampler_destroy(rate.resampler);
+    }
+}
+
+int FanoutRates::group(int rate)
+{
+    for (size_t i = 0; i < m_rates.size(); i++)
+    {
+        if (m_rates[i].rate == rate)
+            return (int)i;
+    }
+
+    Rate entry{rate, RESAMPLED, nullptr, std::string(), (size_t)rate / 50 * m_channels * sizeof(spx_int16_t) * m_rtp_packets};
+    if (rate == m_sampling)
+    {
+        entry.source = RAW;
+    }
+    else if (rate == m_primary_rate)
+    {
+        entry.source = PRIMARY;
+    }
+    else
+    {
+        int err = 0;
+        entry.resampler = stream_resampler_create(m_channels, m_sampling, rate, SWITCH_RESAMPLE_QUALITY, &err);
+        if (!entry.resampler)
+            return -1;
+    }
+    entry.pending.reserve(entry.packet);
+    m_rates.push_back(std::move(entry));
+    return (int)m_rates.size() - 1;
+}
+
+void FanoutRates::feed(const spx_int16_t *raw, size_t raw_frames, const spx_int16_t *primary, size_t primary_frames)
+{
+    for (size_t i = 0; i < m_rates.size(); i++)
+    {
+        Rate &rate = m_rates[i];
+        const spx_int16_t *samples = raw;
+        size_t frames = raw_frames;
+        if (rate.source == PRIMARY)
+        {
+            samples = primary;
+            frames = primary_frames;
+        }
+        else if (rate.source == RESAMPLED)
+        {
+            spx_uint32_t in_len = raw_frames;
+            spx_uint32_t out_len = raw_frames * rate.rate / m_sampling + 16;
+            m_scratch.resize((size_t)out_len * m_channels);
+            rate.resampler->process(raw, &in_len, m_scratch.data(), &out_len);
+            samples = m_scratch.data();
+            frames = out_len;
+        }
+
+        rate.pending.append(reinterpret_cast<const char *>(samples), frames * m_channels * sizeof(spx_int16_t));
+        while (rate.pending.size() >= rate.packet)
+        {
+            m_ready.emplace_back(i, std::make_shared<const std::string>(rate.pending, 0, rate.packet));
+            rate.pending.erase(0, rate.packet);
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "mod_video_stream.h"
+#include "send_queue.h"
+
+#define FANOUT_QUEUE_MS 2000 /* send queue cap of a destination that has none configured */
+
+struct FanoutTarget
+{
+    std::string url;
+    int rate = 0; /* 0 for the stream's websocket rate */
+};
+
+/*
+ * Packets of the session audio for the fan-out destinations of a stream,
+ * one resampler and packet buffer per distinct rate. A destination at the
+ * session rate takes the audio as read, one at the websocket rate of the
+ * stream reuses what was resampled for it, and every destination of a
+ * rate is handed the same immutable packet.
+ *
+ * Only used by the media thread with tech_pvt->mutex held.
+ */
+class FanoutRates
+{
+public:
+    FanoutRates(int sampling, int primary_rate, int channels, int rtp_packets);
+    ~FanoutRates();
+
+    FanoutRates(const FanoutRates &) = delete;
+    FanoutRates &operator=(const FanoutRates &) = delete;
+
+    /* the group of rate, added on first use; -1 when it cannot be resampled to */
+    int group(int rate);
+
+    /*
+     * One frame of session audio, raw at the session rate and as sent to
+     * the stream's own websocket; completed packets are added to ready()
+     */
+    void feed(const spx_int16_t *raw, size_t raw_frames, const spx_int16_t *primary, size_t primary_frames);
+
+    /* completed packets and their group, oldest first; the caller clears it */
+    std::vector<std::pair<size_t, SharedFrame>> &ready()
+    {
+        return m_ready;
+    }
+
+private:
+    enum Source
+    {
+        RAW,
+        PRIMARY,
+        RESAMPLED
+    };
+
+    struct Rate
+    {
+        int rate;
+        Source source;
+        stream_resampler_t *resampler;
+        std::string pending;
+        size_t packet; /* bytes per packet */
+    };
+
+    const int m_sampling;
+    const int m_primary_rate;
+    const int m_channels;
+    const int m_rtp_packets;
+    std::vector<Rate> m_rates;
+    std::vector<spx_int16_t> m_scratch;
+    std::vector<std::pair<size_t, SharedFrame>> m_ready;
+};
+
+#endif // FANOUT_H
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <pthread.h>
+#include "mod_video_stream.h"
+#include "media_worker.h"
+
+namespace
+{
+    size_t queue_bytes(int queue_ms, int rate, int channels)
+    {
+        // audio plus the length of a frame every 10ms
+        const size_t wanted = (size_t)queue_ms * rate / 1000 * channels * sizeof(int16_t) + (size_t)queue_ms / 10 * sizeof(uint32_t);
+        size_t size = 4096;
+        while (size < wanted)
+            size <<= 1;
+        return size;
+    }
+
+    // "2,3" or "4-7"; false on anything else
+    bool parse_cpus(const char *value, std::vector<int> &cpus)
+    {
+        std::vector<int> parsed;
+        const char *p = value;
+        while (*p)
+        {
+            char *end;
+            const long first = strtol(p, &end, 10);
+            if (end == p || first < 0)
+                return false;
+            long last = first;
+            p = end;
+            if (*p == '-')
+            {
+                last = strtol(p + 1, &end, 10);
+                if (end == p + 1 || last < first)
+                    return false;
+                p = end;
+            }
+            for (long cpu = first; cpu <= last; cpu++)
+                parsed.push_back((int)cpu);
+            if (*p == ',')
+                p++;
+            else if (*p)
+                return false;
+        }
+        cpus.swap(parsed);
+        return true;
+    }
+}
+
+bool MediaWorkerConfig::set(const char *name, const char *value)
+{
+    if (!strcasecmp(name, "media-workers"))
+        workers = std::max(0, atoi(value));
+    else if (!strcasecmp(name, "media-worker-cpus"))
+        return parse_cpus(value, cpus);
+    else if (!strcasecmp(name, "media-queue-ms"))
+        queue_ms = std::max(100, atoi(value));
+    else if (!strcasecmp(name, "media-batch-sends"))
+        batch_sends = !strcasecmp(value, "true") || !strcmp(value, "1");
+    else
+        return false;
+    return true;
+}
+
+MediaQueue::MediaQueue(int queue_ms, int rate, int channels) : m_memory(nullptr)
+{
+    const size_t size = queue_bytes(queue_ms, rate, channels);
+    void *memory = nullptr;
+    if (posix_memalign(&memory, alignof(ShmRingHeader), sizeof(ShmRingHeader) + size) != 0)
+        throw std::bad_alloc();
+    m_memory = static_cast<uint8_t *>(memory);
+    new (m_memory) ShmRingHeader();
+    m_ring.attach(m_memory, size);
+    m_record.reserve(SWITCH_RECOMMENDED_BUFFER_SIZE + sizeof(uint32_t));
+}
+
+MediaQueue::~MediaQueue()
+{
+    reinterpret_cast<ShmRingHeader *>(m_memory)->~ShmRingHeader();
+    free(m_memory);
+}
+
+bool MediaQueue::push(const void *data, uint32_t len)
+{
+    m_record.resize(sizeof(len) + len);
+    memcpy(m_record.data(), &len, sizeof(len));
+    memcpy(m_record.data() + sizeof(len), data, len);
+    if (m_ring.write(m_record.data(), m_record.size()))
+        return true;
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void MediaQueue::take(void *out, size_t len)
+{
+    uint8_t *dest = static_cast<uint8_t *>(out);
+    while (len > 0)
+    {
+        const uint8_t *data;
+        const size_t n = m_ring.peek(&data, len);
+        if (n == 0)
+            return;
+        if (dest)
+        {
+            memcpy(dest, data, n);
+            dest += n;
+        }
+        m_ring.consume(n);
+        len -= n;
+    }
+}
+
+size_t MediaQueue::pop(uint8_t *out, size_t max)
+{
+    for (;;)
+    {
+        // a frame is written in one go, its length and data are there together
+        const uint8_t *data;
+        if (m_ring.peek(&data, 1) == 0)
+            return 0;
+        uint32_t len;
+        take(&len, sizeof(len));
+        if (len <= max)
+        {
+            take(out, len);
+            return len;
+        }
+        take(nullptr, len);
+    }
+}
+
+MediaWorkerPool::MediaWorkerPool(const MediaWorkerConfig &config) : m_config(config)
+{
+    const size_t count = config.workers > 0 ? (size_t)config.workers : 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        m_workers.emplace_back(new Worker());
+        if (config.batch_sends)
+            m_workers.back()->batch.reset(new SendBatch());
+    }
+    if (config.batch_sends && !m_workers[0]->batch->usesRing())
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "media workers: io_uring not available, batches take a send per stream\n");
+    for (size_t i = 0; i < count; i++)
+        m_workers[i]->thread = std::thread(&MediaWorkerPool::work, this, i);
+}
+
+MediaWorkerPool::~MediaWorkerPool()
+{
+    shutdown();
+}
+
+MediaWorkerPool::Stream *MediaWorkerPool::add(int rate, int channels, std::function<bool()> run)
+{
+    Stream *stream = new Stream(m_config, rate, channels, std::move(run));
+    size_t chosen = 0;
+    size_t fewest = SIZE_MAX;
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        std::lock_guard<std::mutex> lock(m_workers[i]->mutex);
+        if (m_workers[i]->streams.size() < fewest)
+        {
+            fewest = m_workers[i]->streams.size();
+            chosen = i;
+        }
+    }
+    stream->m_worker = chosen;
+    std::lock_guard<std::mutex> lock(m_workers[chosen]->mutex);
+    m_workers[chosen]->streams.push_back(stream);
+    return stream;
+}
+
+void MediaWorkerPool::remove(Stream *stream)
+{
+    Worker &worker = *m_workers[stream->m_worker];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.streams.erase(std::find(worker.streams.begin(), worker.streams.end(), stream));
+    }
+    m_dropped += stream->m_queue.dropped();
+    delete stream;
+}
+
+void MediaWorkerPool::wake(Stream *stream)
+{
+    if (stream->m_pending.exchange(true))
+        return;
+    Worker &worker = *m_workers[stream->m_worker];
+    worker.signaled.store(true);
+    // a notify that races the worker going to sleep is caught by its tick
+    if (worker.sleeping.load())
+        worker.cv.notify_one();
+}
+
+MediaWorkerPool::Stats MediaWorkerPool::stats()
+{
+    Stats stats = {m_workers.size(), 0, m_runs.load(), m_retries.load(), m_dropped.load(), false, {0, 0, 0, 0}};
+    for (auto &worker : m_workers)
+    {
+        if (worker->batch)
+        {
+            const SendBatch::Stats sends = worker->batch->stats();
+            stats.batch_ring = stats.batch_ring || worker->batch->usesRing();
+            stats.sends.frames += sends.frames;
+            stats.sends.writes += sends.writes;
+            stats.sends.syscalls += sends.syscalls;
+            stats.sends.failures += sends.failures;
+        }
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        stats.streams += worker->streams.size();
+        for (auto *stream : worker->streams)
+            stats.dropped_frames += stream->m_queue.dropped();
+    }
+    return stats;
+}
+
+void MediaWorkerPool::shutdown()
+{
+    if (m_stopping.exchange(true))
+        return;
+    for (auto &worker : m_workers)
+    {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->signaled = true;
+        }
+        worker->cv.notify_one();
+    }
+    for (auto &worker : m_workers)
+    {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+}
+
+void MediaWorkerPool::work(size_t index)
+{
+    Worker &worker = *m_workers[index];
+    if (!m_config.cpus.empty())
+    {
+        const int cpu = m_config.cpus[index % m_config.cpus.size()];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "media worker %zu: cannot pin to cpu %d\n", index, cpu);
+    }
+
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    while (!m_stopping)
+    {
+        worker.sleeping = true;
+        worker.cv.wait_for(lock, std::chrono::milliseconds(MEDIA_WORKER_TICK_MS), [&worker]
+                           { return worker.signaled.load(); });
+        worker.sleeping = false;
+        worker.signaled = false;
+
+        // ws+unix audio of the pass goes out together when the scope ends
+        SendBatch::Scope scope(worker.batch.get());
+        for (auto *stream : worker.streams)
+        {
+            if (!stream->m_pending.exchange(false))
+                continue;
+            m_runs++;
+            if (!stream->m_run())
+            {
+                stream->m_pending = true;
+                m_retries++;
+            }
+        }
+    }
+}
@@ -0,0 +1,159 @@
+#ifndef MEDIA_WORKER_H
+#define MEDIA_WORKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "send_batch.h"
+#include "shm_audio.h"
+
+#define MEDIA_WORKER_TICK_MS 10 /* longest a worker sleeps, covers a wakeup it missed */
+
+struct MediaWorkerConfig
+{
+    int workers = 0;         /* threads running the frame pipeline, 0 runs it on the media thread */
+    std::vector<int> cpus;   /* cores the workers are pinned to in turn, empty leaves them to the scheduler */
+    int queue_ms = 400;      /* raw audio a stream may have waiting for its worker */
+    bool batch_sends = true; /* ws+unix audio of a pass written together, see SendBatch */
+
+    /* one setting by its video_stream.conf name, false if unknown or invalid */
+    bool set(const char *name, const char *value);
+};
+
+/*
+ * Raw frames of one stream, read from the media bug by the call's media
+ * thread and handled by a media worker. A lock free ShmRing over heap
+ * memory, each frame stored behind its length so the worker sees the
+ * frames the media thread read. A full queue drops the new frame.
+ */
+class MediaQueue
+{
+public:
+    MediaQueue(int queue_ms, int rate, int channels);
+    ~MediaQueue();
+
+    MediaQueue(const MediaQueue &) = delete;
+    MediaQueue &operator=(const MediaQueue &) = delete;
+
+    /* media thread */
+    bool push(const void *data, uint32_t len);
+
+    /* worker: copies the next frame to out, 0 when there is none; a frame longer than max is skipped */
+    size_t pop(uint8_t *out, size_t max);
+
+    uint64_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    void take(void *out, size_t len);
+
+    uint8_t *m_memory; /* ring header, then the data */
+    ShmRing m_ring;
+    std::vector<uint8_t> m_record; /* media thread, length and frame written in one go */
+    std::atomic<uint64_t> m_dropped{0};
+};
+
+/*
+ * Takes the frame pipeline of streams (resampling, packetization, voice
+ * gate, sending) off the FreeSWITCH media threads. Each stream is given to
+ * the worker with the fewest streams and stays there, so its frames are
+ * handled in order by one thread.
+ *
+ * wake() is all a media thread does besides the queue push: it flags the
+ * stream and notifies its worker only if that worker is asleep, without
+ * taking a lock. A worker runs every flagged stream of its own; a run that
+ * returns false (the stream is busy) is retried on the next pass.
+ *
+ * With batch_sends a pass runs inside a SendBatch of its worker, so the
+ * ws+unix:// audio of all its streams goes out in one io_uring submission
+ * at the end of the pass instead of a system call per frame.
+ */
+class MediaWorkerPool
+{
+public:
+    class Stream
+    {
+    public:
+        MediaQueue &queue()
+        {
+            return m_queue;
+        }
+
+    private:
+        friend class MediaWorkerPool;
+
+        Stream(const MediaWorkerConfig &config, int rate, int channels, std::function<bool()> run)
+            : m_queue(config.queue_ms, rate, channels), m_run(std::move(run)), m_worker(0)
+        {
+        }
+
+        MediaQueue m_queue;
+        std::function<bool()> m_run;
+        std::atomic<bool> m_pending{false};
+        size_t m_worker;
+    };
+
+    struct Stats
+    {
+        size_t workers;
+        size_t streams;
+        uint64_t runs;           /* stream runs since start */
+        uint64_t retries;        /* runs put off because the stream was busy */
+        uint64_t dropped_frames; /* frames that found their stream's queue full */
+        bool batch_ring;         /* batches go out on io_uring */
+        SendBatch::Stats sends;  /* of all workers' batches */
+    };
+
+    explicit MediaWorkerPool(const MediaWorkerConfig &config);
+    ~MediaWorkerPool();
+
+    MediaWorkerPool(const MediaWorkerPool &) = delete;
+    MediaWorkerPool &operator=(const MediaWorkerPool &) = delete;
+
+    /*
+     * A stream with a queue for queue_ms of raw audio at rate; run handles
+     * what is queued and returns false to be called again
+     */
+    Stream *add(int rate, int channels, std::function<bool()> run);
+
+    /* deletes the stream once no worker runs it */
+    void remove(Stream *stream);
+
+    /* media thread, after pushing to the stream's queue */
+    void wake(Stream *stream);
+
+    Stats stats();
+
+    void shutdown();
+
+private:
+    struct Worker
+    {
+        std::mutex mutex; /* streams, held while they run */
+        std::condition_variable cv;
+        std::vector<Stream *> streams;
+        std::atomic<bool> signaled{false};
+        std::atomic<bool> sleeping{false};
+        std::unique_ptr<SendBatch> batch; /* null without batch_sends */
+        std::thread thread;
+    };
+
+    void work(size_t index);
+
+    const MediaWorkerConfig m_config;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<bool> m_stopping{false};
+    std::atomic<uint64_t> m_runs{0};
+    std::atomic<uint64_t> m_retries{0};
+    std::atomic<uint64_t> m_dropped{0};
+};
+
+#endif // MEDIA_WORKER_H
@@ -0,0 +1,96 @@
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "message_arena.h"
+
+#define ARENA_ALIGN 16
+
+const size_t MessageArena::HEADER = (sizeof(MessageArena::Chunk) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+MessageArena::MessageArena(size_t chunk_size, size_t retain)
+    : m_chunk_size(chunk_size), m_retain(retain), m_head(nullptr), m_used(0), m_peak(0),
+      m_messages(0), m_allocations(0), m_heap_allocations(0)
+{
+}
+
+MessageArena::~MessageArena()
+{
+    while (m_head)
+    {
+        Chunk *next = m_head->next;
+        free(m_head);
+        m_head = next;
+    }
+}
+
+void *MessageArena::allocate(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    m_allocations++;
+    m_used += size;
+
+    if (!m_head || m_head->size - m_head->used < size)
+    {
+        // a retained chunk further down the list may be free already
+        Chunk **link = &m_head;
+        while (*link && ((*link)->used != 0 || (*link)->size < size))
+            link = &(*link)->next;
+
+        Chunk *chunk = *link;
+        if (chunk)
+        {
+            *link = chunk->next;
+        }
+        else
+        {
+            const size_t capacity = size > m_chunk_size ? size : m_chunk_size;
+            chunk = static_cast<Chunk *>(malloc(HEADER + capacity));
+            if (!chunk)
+                throw std::bad_alloc();
+            chunk->size = capacity;
+            chunk->used = 0;
+            m_heap_allocations++;
+        }
+        chunk->next = m_head;
+        m_head = chunk;
+    }
+
+    void *block = reinterpret_cast<char *>(m_head) + HEADER + m_head->used;
+    m_head->used += size;
+    return block;
+}
+
+char *MessageArena::strdup(const char *str, size_t len)
+{
+    char *copy = static_cast<char *>(allocate(len + 1));
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void MessageArena::reset()
+{
+    if (m_used > m_peak)
+        m_peak = m_used;
+    m_used = 0;
+    m_messages++;
+
+    // keep chunks up to the retain budget, largest messages give back the rest
+    size_t kept = 0;
+    Chunk **link = &m_head;
+    while (*link)
+    {
+        Chunk *chunk = *link;
+        if (kept + chunk->size <= m_retain)
+        {
+            kept += chunk->size;
+            chunk->used = 0;
+            link = &chunk->next;
+        }
+        else
+        {
+            *link = chunk->next;
+            free(chunk);
+        }
+    }
+}
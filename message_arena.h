@@ -0,0 +1,71 @@
+#ifndef MESSAGE_ARENA_H
+#define MESSAGE_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Bump allocator for the temporaries of one inbound websocket message.
+ * Everything allocated while a message is processed is released at once
+ * by reset(); the chunks are kept for the next message up to retain bytes,
+ * so a session settles on one or two chunks instead of a malloc/free burst
+ * per message. Only used from the websocket thread of its session.
+ */
+class MessageArena
+{
+public:
+    explicit MessageArena(size_t chunk_size = 16 * 1024, size_t retain = 256 * 1024);
+    ~MessageArena();
+
+    MessageArena(const MessageArena &) = delete;
+    MessageArena &operator=(const MessageArena &) = delete;
+
+    /* 16 byte aligned; throws std::bad_alloc */
+    void *allocate(size_t size);
+
+    char *strdup(const char *str, size_t len);
+
+    /* releases everything allocated since the previous reset */
+    void reset();
+
+    uint64_t messages() const
+    {
+        return m_messages;
+    }
+    /* arena allocations over all messages */
+    uint64_t allocations() const
+    {
+        return m_allocations;
+    }
+    /* allocations that needed a new chunk from the heap */
+    uint64_t heapAllocations() const
+    {
+        return m_heap_allocations;
+    }
+    /* most bytes used by a single message */
+    size_t peak() const
+    {
+        return m_peak;
+    }
+
+private:
+    struct Chunk
+    {
+        Chunk *next;
+        size_t size;
+        size_t used;
+    };
+
+    static const size_t HEADER;
+
+    const size_t m_chunk_size;
+    const size_t m_retain;
+    Chunk *m_head; /* chunk being filled, older chunks follow */
+    size_t m_used;
+    size_t m_peak;
+    uint64_t m_messages;
+    uint64_t m_allocations;
+    uint64_t m_heap_allocations;
+};
+
+#endif // MESSAGE_ARENA_H
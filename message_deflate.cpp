@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <zlib.h>
+#include "message_deflate.h"
+
+namespace
+{
+    const unsigned char TAIL[4] = {0x00, 0x00, 0xff, 0xff};
+    const size_t CHUNK = 4096;
+
+    std::string trim(const std::string &s)
+    {
+        size_t start = 0, stop = s.size();
+        while (start < stop && (s[start] == ' ' || s[start] == '\t'))
+            start++;
+        while (stop > start && (s[stop - 1] == ' ' || s[stop - 1] == '\t'))
+            stop--;
+        return s.substr(start, stop - start);
+    }
+
+    // "10" or the quoted form "\"10\"" of a window bits parameter, 0 if invalid
+    int window_bits_value(std::string value)
+    {
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+            value = value.substr(1, value.size() - 2);
+        if (value.empty() || value.size() > 2 || strspn(value.c_str(), "0123456789") != value.size())
+            return 0;
+        return atoi(value.c_str());
+    }
+}
+
+MessageDeflate::MessageDeflate(const DeflateConfig &config)
+    : m_config(config), m_active(false), m_window_bits(DEFLATE_MAX_WINDOW_BITS), m_no_context_takeover(false),
+      m_deflate(nullptr), m_inflate(nullptr)
+{
+}
+
+MessageDeflate::~MessageDeflate()
+{
+    release();
+}
+
+void MessageDeflate::release()
+{
+    if (m_deflate)
+    {
+        deflateEnd(m_deflate);
+        delete m_deflate;
+        m_deflate = nullptr;
+    }
+    if (m_inflate)
+    {
+        inflateEnd(m_inflate);
+        delete m_inflate;
+        m_inflate = nullptr;
+    }
+    m_active = false;
+}
+
+std::string MessageDeflate::offer() const
+{
+    if (!m_config.text && !m_config.binary)
+        return std::string();
+    const int bits = std::max(DEFLATE_MIN_WINDOW_BITS, std::min(DEFLATE_MAX_WINDOW_BITS, m_config.window_bits));
+    std::string offer = "permessage-deflate; client_max_window_bits=" + std::to_string(bits);
+    if (m_config.no_context_takeover)
+        offer += "; client_no_context_takeover";
+    return offer;
+}
+
+bool MessageDeflate::accept(const std::string &response)
+{
+    release();
+    const std::string value = trim(response);
+    if (value.empty())
+        return true; // declined, everything goes out as it is
+    if (offer().empty() || value.find(',') != std::string::npos)
+        return false; // not offered, or more than the one extension
+
+    int window_bits = std::max(DEFLATE_MIN_WINDOW_BITS, std::min(DEFLATE_MAX_WINDOW_BITS, m_config.window_bits));
+    bool no_context_takeover = m_config.no_context_takeover;
+    bool seen_window = false, seen_client_nct = false, seen_server_nct = false;
+    size_t start = 0;
+    for (bool first = true; start <= value.size(); first = false)
+    {
+        size_t end = value.find(';', start);
+        if (end == std::string::npos)
+            end = value.size();
+        const std::string param = trim(value.substr(start, end - start));
+        start = end + 1;
+
+        const size_t eq = param.find('=');
+        const std::string name = trim(param.substr(0, eq));
+        const std::string arg = eq == std::string::npos ? std::string() : trim(param.substr(eq + 1));
+        if (first)
+        {
+            if (strcasecmp(name.c_str(), "permessage-deflate") || eq != std::string::npos)
+                return false;
+        }
+        else if (!strcasecmp(name.c_str(), "client_max_window_bits") && !seen_window)
+        {
+            // a server may only lower the window we offered
+            const int bits = window_bits_value(arg);
+            if (bits < DEFLATE_MIN_WINDOW_BITS || bits > DEFLATE_MAX_WINDOW_BITS)
+                return false;
+            window_bits = std::min(window_bits, bits);
+            seen_window = true;
+        }
+        else if (!strcasecmp(name.c_str(), "client_no_context_takeover") && !seen_client_nct && arg.empty())
+        {
+            no_context_takeover = true;
+            seen_client_nct = true;
+        }
+        else if (!strcasecmp(name.c_str(), "server_no_context_takeover") && !seen_server_nct && arg.empty())
+        {
+            // only changes what the server does; inflating works either way
+            seen_server_nct = true;
+        }
+        else
+        {
+            // server_max_window_bits was not offered, anything else is unknown
+            return false;
+        }
+    }
+
+    m_deflate = new z_stream();
+    const int mem_level = std::min(8, window_bits - 7); // deflate state grows with both
+    if (deflateInit2(m_deflate, std::max(1, std::min(9, m_config.level)), Z_DEFLATED, -window_bits, mem_level,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        delete m_deflate;
+        m_deflate = nullptr;
+        return false;
+    }
+    m_inflate = new z_stream();
+    if (inflateInit2(m_inflate, -DEFLATE_MAX_WINDOW_BITS) != Z_OK)
+    {
+        delete m_inflate;
+        m_inflate = nullptr;
+        release();
+        return false;
+    }
+    m_window_bits = window_bits;
+    m_no_context_takeover = no_context_takeover;
+    m_active = true;
+    return true;
+}
+
+bool MessageDeflate::compress(const void *data, size_t len, std::string &out)
+{
+    if (!m_deflate)
+        return false;
+    out.clear();
+    if (len == 0)
+    {
+        // an empty stored block; zlib has nothing to flush after the last message
+        out.assign(1, '\0');
+        return true;
+    }
+    m_deflate->next_in = (Bytef *)data;
+    m_deflate->avail_in = (uInt)len;
+    do
+    {
+        const size_t old = out.size();
+        out.resize(old + std::max(CHUNK, (size_t)deflateBound(m_deflate, m_deflate->avail_in)));
+        m_deflate->next_out = (Bytef *)&out[old];
+        m_deflate->avail_out = (uInt)(out.size() - old);
+        if (deflate(m_deflate, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+        {
+            out.clear();
+            return false;
+        }
+        out.resize(out.size() - m_deflate->avail_out);
+    } while (m_deflate->avail_out == 0 || m_deflate->avail_in > 0);
+
+    // a sync flush always ends in an empty stored block, which the
+    // receiver appends again
+    if (out.size() < sizeof(TAIL) || memcmp(out.data() + out.size() - sizeof(TAIL), TAIL, sizeof(TAIL)))
+    {
+        out.clear();
+        return false;
+    }
+    out.resize(out.size() - sizeof(TAIL));
+    if (m_no_context_takeover)
+        deflateReset(m_deflate);
+    return true;
+}
+
+bool MessageDeflate::decompress(const void *data, size_t len, size_t max, std::string &out)
+{
+    if (!m_inflate)
+        return false;
+    out.clear();
+    const Bytef *input[2] = {(const Bytef *)data, TAIL};
+    const size_t input_len[2] = {len, sizeof(TAIL)};
+    for (int part = 0; part < 2; part++)
+    {
+        m_inflate->next_in = (Bytef *)input[part];
+        m_inflate->avail_in = (uInt)input_len[part];
+        do
+        {
+            const size_t old = out.size();
+            out.resize(old + CHUNK);
+            m_inflate->next_out = (Bytef *)&out[old];
+            m_inflate->avail_out = CHUNK;
+            const int rc = inflate(m_inflate, Z_SYNC_FLUSH);
+            out.resize(out.size() - m_inflate->avail_out);
+            if ((rc != Z_OK && rc != Z_BUF_ERROR && rc != Z_STREAM_END) || out.size() > max)
+            {
+                out.clear();
+                inflateReset(m_inflate); // the connection cannot go on, the caller closes it
+                return false;
+            }
+            if (rc == Z_STREAM_END)
+            {
+                // a final block ends the message, the next one starts over
+                inflateReset(m_inflate);
+                return true;
+            }
+        } while (m_inflate->avail_out == 0);
+    }
+    return true;
+}
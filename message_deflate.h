@@ -0,0 +1,87 @@
+#ifndef MESSAGE_DEFLATE_H
+#define MESSAGE_DEFLATE_H
+
+#include <cstddef>
+#include <string>
+
+#define DEFLATE_MIN_WINDOW_BITS 9 /* zlib raw deflate does not do 8 */
+#define DEFLATE_MAX_WINDOW_BITS 15
+
+struct DeflateConfig
+{
+    bool text = true;    /* JSON and other text messages */
+    bool binary = false; /* audio; raw PCM barely compresses */
+    int level = 1;       /* zlib level 1..9 */
+    int window_bits = DEFLATE_MAX_WINDOW_BITS; /* client_max_window_bits offered */
+    bool no_context_takeover = false; /* each message compressed on its own */
+};
+
+/*
+ * permessage-deflate (RFC 7692) for one connection: the extension offer,
+ * the server's answer, and the zlib streams both ways. The compressor
+ * only exists once the server has accepted the offer; its memory grows
+ * with window_bits, and without context takeover it is reset after each
+ * message, trading ratio for state that does not carry across messages.
+ * Received messages are inflated with a full window, so whatever the
+ * server picks for itself is accepted.
+ *
+ * Not thread safe: compress() keeps message order in its state, so the
+ * caller holds one lock across compressing and sending.
+ */
+class MessageDeflate
+{
+public:
+    explicit MessageDeflate(const DeflateConfig &config = DeflateConfig());
+    ~MessageDeflate();
+
+    MessageDeflate(const MessageDeflate &) = delete;
+    MessageDeflate &operator=(const MessageDeflate &) = delete;
+
+    /* Sec-WebSocket-Extensions value of the upgrade request, empty when nothing is compressed */
+    std::string offer() const;
+
+    /*
+     * Applies the Sec-WebSocket-Extensions value of the upgrade response,
+     * empty when the server declined, and starts over with fresh streams.
+     * False if the answer is not one the offer allows.
+     */
+    bool accept(const std::string &response);
+
+    /* negotiated for this connection */
+    bool active() const
+    {
+        return m_active;
+    }
+    /* messages of this type go out compressed */
+    bool compresses(bool binary) const
+    {
+        return m_active && (binary ? m_config.binary : m_config.text);
+    }
+    /* negotiated client_max_window_bits */
+    int windowBits() const
+    {
+        return m_window_bits;
+    }
+    bool noContextTakeover() const
+    {
+        return m_no_context_takeover;
+    }
+
+    /* payload of one compressed message, the trailing 00 00 ff ff removed; false on a zlib error */
+    bool compress(const void *data, size_t len, std::string &out);
+
+    /* a whole compressed message as received; false if it is corrupt or inflates beyond max bytes */
+    bool decompress(const void *data, size_t len, size_t max, std::string &out);
+
+private:
+    void release();
+
+    const DeflateConfig m_config;
+    bool m_active;
+    int m_window_bits;
+    bool m_no_context_takeover;
+    struct z_stream_s *m_deflate;
+    struct z_stream_s *m_inflate;
+};
+
+#endif // MESSAGE_DEFLATE_H
@@ -10,21 +10,39 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_video_stream_load);
 
 SWITCH_MODULE_DEFINITION(mod_video_stream, mod_video_stream_load, mod_video_stream_shutdown, NULL /*mod_video_stream_runtime*/);
 
-static void responseHandler(switch_core_session_t *session, const char *eventName, const char *json)
+static void fire_response(switch_core_session_t *session, const char *eventName, const char *json, switch_bool_t light)
 {
     switch_event_t *event = NULL;
-    switch_channel_t *channel = switch_core_session_get_channel(session);
     if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, eventName) != SWITCH_STATUS_SUCCESS || !event)
     {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "mod_video_stream: failed to create event for %s\n", eventName);
         return;
     }
-    switch_channel_event_set_data(channel, event);
+    if (light)
+    {
+        /* STREAM_EVENT_LIGHT: skip the full channel variable dump */
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", switch_core_session_get_uuid(session));
+    }
+    else
+    {
+        switch_channel_event_set_data(switch_core_session_get_channel(session), event);
+    }
     if (json)
         switch_event_add_body(event, "%s", json);
     switch_event_fire(&event);
 }
 
+static void responseHandler(switch_core_session_t *session, const char *eventName, const char *json)
+{
+    fire_response(session, eventName, json, SWITCH_FALSE);
+}
+
+/* chosen at start for STREAM_EVENT_LIGHT, so no event has to look up the stream */
+static void lightResponseHandler(switch_core_session_t *session, const char *eventName, const char *json)
+{
+    fire_response(session, eventName, json, SWITCH_TRUE);
+}
+
 static switch_bool_t capture_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type)
 {
     switch_core_session_t *session = switch_core_media_bug_get_session(bug);
@@ -64,7 +82,9 @@ static switch_status_t start_capture(switch_core_session_t *session,
                                      switch_media_bug_flag_t flags,
                                      char *wsUri,
                                      int wsSampling,
-                                     char *metadata)
+                                     char *metadata,
+                                     const char *profile,
+                                     const char *fanout)
 {
     switch_channel_t *channel = switch_core_session_get_channel(session);
     switch_media_bug_t *bug;
@@ -94,8 +114,8 @@ static switch_status_t start_capture(switch_core_session_t *session,
     }
 
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "calling stream_session_init.\n");
-    if (SWITCH_STATUS_FALSE == stream_session_init(session, responseHandler, read_codec->implementation->actual_samples_per_second,
-                                                   wsUri, wsSampling, channels, metadata, &pUserData))
+    if (SWITCH_STATUS_FALSE == stream_session_init(session, responseHandler, lightResponseHandler, read_codec->implementation->actual_samples_per_second,
+                                                   wsUri, wsSampling, channels, metadata, profile, fanout, &pUserData))
     {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Error initializing mod_video_stream session.\n");
         return SWITCH_STATUS_FALSE;
@@ -104,6 +124,8 @@ static switch_status_t start_capture(switch_core_session_t *session,
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "adding bug.\n");
     if ((status = switch_core_media_bug_add(session, MY_BUG_NAME, NULL, capture_callback, pUserData, 0, flags, &bug)) != SWITCH_STATUS_SUCCESS)
     {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "error adding media bug.\n");
+        stream_session_destroy(pUserData);
         return status;
     }
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "setting bug private data.\n");
@@ -143,6 +165,12 @@ static switch_status_t do_pauseresume(switch_core_session_t *session, int pause)
     return status;
 }
 
+static switch_status_t do_clear(switch_core_session_t *session)
+{
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "mod_video_stream: clear\n");
+    return stream_session_clear(session);
+}
+
 static switch_status_t send_text(switch_core_session_t *session, char *text)
 {
     switch_status_t status = SWITCH_STATUS_FALSE;
@@ -161,7 +189,7 @@ static switch_status_t send_text(switch_core_session_t *session, char *text)
     return status;
 }
 
-#define STREAM_API_SYNTAX "<uuid> [start | stop | send_text | pause | resume | graceful-shutdown ] [wss-url | path] [mono | mixed | stereo] [8000 | 16000] [metadata]"
+#define STREAM_API_SYNTAX "<uuid> [start | stop | send_text | pause | resume | clear | responses | graceful-shutdown ] [wss-url | path | profile | group][,fan-out-url[|rate]...] [mono | mixed | stereo] [8000 | 16000] [metadata]"
 SWITCH_STANDARD_API(stream_function)
 {
     char *mycmd = NULL, *argv[6] = {0};
@@ -206,6 +234,26 @@ SWITCH_STANDARD_API(stream_function)
             {
                 status = do_pauseresume(lsession, 0);
             }
+            else if (!strcasecmp(argv[1], "clear"))
+            {
+                status = do_clear(lsession);
+            }
+            else if (!strcasecmp(argv[1], "responses"))
+            {
+                char *responses = stream_session_responses(lsession, argc > 2 ? atoi(argv[2]) : 0);
+                if (responses)
+                {
+                    stream->write_function(stream, "%s", responses);
+                    free(responses);
+                }
+                else
+                {
+                    /* no stream on the channel, or it is stopping */
+                    stream->write_function(stream, "-ERR not running\n");
+                }
+                switch_core_session_rwunlock(lsession);
+                goto done;
+            }
             else if (!strcasecmp(argv[1], "send_text"))
             {
                 if (argc < 3)
@@ -229,6 +277,12 @@ SWITCH_STANDARD_API(stream_function)
                 // switch_channel_t *channel = switch_core_session_get_channel(lsession);
                 char wsUri[MAX_WS_URI];
                 int wsSampling = 8000;
+                /* further comma separated urls get the same audio (fan-out) */
+                char *fanout = strchr(argv[2], ',');
+                if (fanout)
+                    *fanout++ = '\0';
+                /* argv[2] is either a websocket url or the name of a profile or endpoint group from video_stream.conf */
+                int use_profile = stream_profile_lookup(argv[2], wsUri, &wsSampling);
                 switch_media_bug_flag_t flags = SMBF_READ_STREAM;
                 char *metadata = argc > 5 ? argv[5] : NULL;
                 if (metadata && (is_valid_utf8(argv[2]) != SWITCH_STATUS_SUCCESS))
@@ -269,7 +323,12 @@ SWITCH_STANDARD_API(stream_function)
                         wsSampling = atoi(argv[4]);
                     }
                 }
-                if (!validate_ws_uri(argv[2], &wsUri[0]))
+                if (use_profile && !*wsUri)
+                {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                                      "stream profile %s has no url\n", argv[2]);
+                }
+                else if (!use_profile && !validate_ws_uri(argv[2], &wsUri[0]))
                 {
                     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
                                       "invalid websocket uri: %s\n", argv[2]);
@@ -281,7 +340,7 @@ SWITCH_STANDARD_API(stream_function)
                 }
                 else
                 {
-                    status = start_capture(lsession, flags, wsUri, wsSampling, metadata);
+                    status = start_capture(lsession, flags, wsUri, wsSampling, metadata, use_profile ? argv[2] : NULL, fanout);
                 }
             }
             else
@@ -312,6 +371,73 @@ done:
     return SWITCH_STATUS_SUCCESS;
 }
 
+static switch_event_node_t *reload_node = NULL;
+
+static void reload_handler(switch_event_t *event)
+{
+    stream_module_reload();
+}
+
+SWITCH_STANDARD_API(status_function)
+{
+    char *status = stream_module_status();
+    if (status)
+    {
+        stream->write_function(stream, "%s\n", status);
+        free(status);
+    }
+    else
+    {
+        stream->write_function(stream, "-ERR not running\n");
+    }
+    return SWITCH_STATUS_SUCCESS;
+}
+
+#define ADMISSION_API_SYNTAX "[admission-rate=<per sec>] [admission-burst=<n>] [endpoint-max-streams=<n>] [node-max-streams=<n>] [admission-policy=queue|reject] [admission-max-wait-ms=<ms>]"
+
+SWITCH_STANDARD_API(admission_function)
+{
+    char *mycmd = NULL, *argv[6] = {0};
+    char *status;
+    int argc = 0, i;
+
+    if (!zstr(cmd) && (mycmd = strdup(cmd)))
+    {
+        argc = switch_separate_string(mycmd, ' ', argv, (sizeof(argv) / sizeof(argv[0])));
+    }
+
+    /* name=value pairs change the limits, then the current state is printed */
+    for (i = 0; i < argc; i++)
+    {
+        char *value = strchr(argv[i], '=');
+        if (!value)
+        {
+            stream->write_function(stream, "-USAGE: %s\n", ADMISSION_API_SYNTAX);
+            goto done;
+        }
+        *value++ = '\0';
+        if (stream_admission_set(argv[i], value) != SWITCH_STATUS_SUCCESS)
+        {
+            stream->write_function(stream, "-ERR invalid %s=%s\n", argv[i], value);
+            goto done;
+        }
+    }
+
+    if ((status = stream_admission_status()))
+    {
+        stream->write_function(stream, "%s\n", status);
+        free(status);
+    }
+    else
+    {
+        stream->write_function(stream, "-ERR not running\n");
+    }
+
+done:
+    switch_safe_free(mycmd);
+    return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_video_stream_load)
 {
     switch_api_interface_t *api_interface;
@@ -325,17 +451,30 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_video_stream_load)
     if (switch_event_reserve_subclass(EVENT_JSON) != SWITCH_STATUS_SUCCESS ||
         switch_event_reserve_subclass(EVENT_CONNECT) != SWITCH_STATUS_SUCCESS ||
         switch_event_reserve_subclass(EVENT_ERROR) != SWITCH_STATUS_SUCCESS ||
-        switch_event_reserve_subclass(EVENT_DISCONNECT) != SWITCH_STATUS_SUCCESS)
+        switch_event_reserve_subclass(EVENT_DISCONNECT) != SWITCH_STATUS_SUCCESS ||
+        switch_event_reserve_subclass(EVENT_SPEECH_START) != SWITCH_STATUS_SUCCESS ||
+        switch_event_reserve_subclass(EVENT_SPEECH_STOP) != SWITCH_STATUS_SUCCESS ||
+        switch_event_reserve_subclass(EVENT_CLEAR) != SWITCH_STATUS_SUCCESS ||
+        switch_event_reserve_subclass(EVENT_CONGESTION) != SWITCH_STATUS_SUCCESS)
     {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't register an event subclass for mod_video_stream API.\n");
         return SWITCH_STATUS_TERM;
     }
+    stream_module_init();
+    if (switch_event_bind_removable(modname, SWITCH_EVENT_RELOADXML, NULL, reload_handler, NULL, &reload_node) != SWITCH_STATUS_SUCCESS)
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Couldn't bind to reloadxml, stream profiles will not be reloaded.\n");
+    }
     SWITCH_ADD_API(api_interface, "uuid_video_stream", "video_stream API", stream_function, STREAM_API_SYNTAX);
+    SWITCH_ADD_API(api_interface, "video_stream_status", "video_stream module status", status_function, "");
+    SWITCH_ADD_API(api_interface, "video_stream_admission", "video_stream connection admission limits", admission_function, ADMISSION_API_SYNTAX);
     switch_console_set_complete("add uuid_video_stream ::console::list_uuid start wss-url metadata");
     switch_console_set_complete("add uuid_video_stream ::console::list_uuid start wss-url");
     switch_console_set_complete("add uuid_video_stream ::console::list_uuid stop");
     switch_console_set_complete("add uuid_video_stream ::console::list_uuid pause");
     switch_console_set_complete("add uuid_video_stream ::console::list_uuid resume");
+    switch_console_set_complete("add uuid_video_stream ::console::list_uuid clear");
+    switch_console_set_complete("add uuid_video_stream ::console::list_uuid responses");
     switch_console_set_complete("add uuid_video_stream ::console::list_uuid send_text");
 
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "mod_video_stream API successfully loaded\n");
@@ -349,10 +488,17 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_video_stream_load)
   Macro expands to: switch_status_t mod_video_stream_shutdown() */
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_video_stream_shutdown)
 {
+    switch_event_unbind(&reload_node);
+    stream_module_shutdown();
+
     switch_event_free_subclass(EVENT_JSON);
     switch_event_free_subclass(EVENT_CONNECT);
     switch_event_free_subclass(EVENT_DISCONNECT);
     switch_event_free_subclass(EVENT_ERROR);
+    switch_event_free_subclass(EVENT_SPEECH_START);
+    switch_event_free_subclass(EVENT_SPEECH_STOP);
+    switch_event_free_subclass(EVENT_CLEAR);
+    switch_event_free_subclass(EVENT_CONGESTION);
 
     return SWITCH_STATUS_SUCCESS;
 }
@@ -5,38 +5,76 @@
 #include <speex/speex_resampler.h>
 
 #define MY_BUG_NAME "video_stream"
-#define MAX_SESSION_ID (256)
 #define MAX_WS_URI (4096)
-#define MAX_METADATA_LEN (8192)
 
 #define EVENT_CONNECT "mod_video_stream::connect"
 #define EVENT_DISCONNECT "mod_video_stream::disconnect"
 #define EVENT_ERROR "mod_video_stream::error"
 #define EVENT_JSON "mod_video_stream::json"
 #define EVENT_PLAY "mod_video_stream::play"
+#define EVENT_SPEECH_START "mod_video_stream::speech_start"
+#define EVENT_SPEECH_STOP "mod_video_stream::speech_stop"
+#define EVENT_CLEAR "mod_video_stream::clear"
+#define EVENT_CONGESTION "mod_video_stream::congestion"
+
+typedef struct stream_resampler stream_resampler_t;
 
 typedef void (*responseHandler_t)(switch_core_session_t *session, const char *eventName, const char *json);
 
+struct private_data;
+/* one frame of L16 audio read from the media bug */
+typedef void (*frameHandler_t)(struct private_data *tech_pvt, switch_core_session_t *session, const uint8_t *data, uint32_t len);
+
+/*
+ * Per-stream state, allocated from the session pool. Fields are grouped by
+ * the thread that touches them so each path reads a contiguous block: what
+ * the media bug uses on every frame first, then the playback path guarded
+ * by write_mutex, then what is only used at setup and teardown. The
+ * session pool gives no cache line alignment, so the groups are not
+ * padded to one. The strings are copied into the session pool at their
+ * actual length.
+ */
 struct private_data
 {
+    /* media thread, every frame */
     switch_mutex_t *mutex;
-    char sessionId[MAX_SESSION_ID];
-    SpeexResamplerState *read_resampler;
-    SpeexResamplerState *write_resampler;
-    responseHandler_t responseHandler;
+    frameHandler_t frameHandler;
     void *pVideoStreamer;
-    char ws_uri[MAX_WS_URI];
-    int sampling;
-    int wsSampling;
-    int channels;
+    stream_resampler_t *read_resampler;
+    switch_buffer_t *read_sbuffer;
+    void *pVoiceGate;
+    void *pCapture;
+    void *pShm; /* STREAM_SHM_AUDIO segment, audio bypasses the websocket */
+    void *pFanout; /* further destinations of the same audio, null without */
+    void *pMedia;  /* place in the media worker pool, null when frames are handled on the media thread */
+    uint8_t *read_frame;   /* SWITCH_RECOMMENDED_BUFFER_SIZE bytes the media thread reads frames into */
+    uint8_t *queued_frame; /* the same for a media worker taking queued frames, null without media workers */
+    int16_t *resampled;    /* SWITCH_RECOMMENDED_BUFFER_SIZE samples of read_resampler output, null without */
+    uint64_t media_ns;     /* media thread time spent in stream_frame */
+    uint64_t media_max_ns; /* longest single call */
+    uint32_t media_frames; /* frames read in that time */
     int audio_paused : 1;
     int close_requested : 1;
-    char initialMetadata[8192];
-    switch_buffer_t *read_sbuffer;
-    switch_buffer_t *write_sbuffer;
+    int coalesce_events : 1; /* the write thread releases coalesced events */
+    int reconnect : 1;       /* the write thread reopens dropped connections */
+    int channels;
+
+    /* write frame thread and playback */
     switch_mutex_t *write_mutex;
-    switch_thread_t *write_thread;
+    switch_buffer_t *write_sbuffer;
+    void *pPlayout;
+    stream_resampler_t *write_resampler;
+    uint32_t playback_generation;
     int rtp_packets;
+    int sampling;
+    int wsSampling;
+
+    /* setup and teardown */
+    switch_thread_t *write_thread;
+    responseHandler_t responseHandler;
+    char *sessionId;
+    char *ws_uri;
+    char *initialMetadata; /* NULL when no metadata was given */
 };
 
 typedef struct private_data private_t;
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include "playout_buffer.h"
+
+#define PLAYOUT_UNDERRUN_WINDOW_MS 200 /* data arriving this soon after running dry counts as an underrun */
+#define PLAYOUT_SHRINK_AFTER_MS 10000  /* stable playback after which a grown target steps back down */
+
+PlayoutBuffer::PlayoutBuffer(const PlayoutConfig &config, uint32_t rate, uint32_t channels)
+    : m_config(config), m_rate(rate), m_channels(channels),
+      m_bytes_per_ms(rate / 1000 * channels * sizeof(int16_t)),
+      m_min_target_frames(config.target_ms * rate / 1000), m_target_frames(m_min_target_frames),
+      m_playing(false), m_depth(0.0), m_last_inuse(0), m_dry_ms(PLAYOUT_UNDERRUN_WINDOW_MS), m_stable_ms(0),
+      m_last(channels, 0), m_backlog_head(0), m_written(0), m_played(0), m_underruns(0), m_overruns(0)
+{
+}
+
+void PlayoutBuffer::reset(std::vector<std::string> *cleared)
+{
+    for (const auto &mark : m_marks)
+    {
+        if (mark.position > m_played && cleared)
+            cleared->push_back(mark.name);
+    }
+    // marks already reached are still reported by takeReachedMarks
+    while (!m_marks.empty() && m_marks.back().position > m_played)
+        m_marks.pop_back();
+    m_written = m_played;
+    m_backlog.clear();
+    m_backlog_head = 0;
+    m_playing = false;
+    m_depth = 0.0;
+    m_last_inuse = 0;
+    m_dry_ms = PLAYOUT_UNDERRUN_WINDOW_MS;
+    std::fill(m_last.begin(), m_last.end(), 0);
+}
+
+void PlayoutBuffer::conceal(int16_t *out, uint32_t from, uint32_t frames)
+{
+    const uint32_t len = frames - from;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        for (uint32_t c = 0; c < m_channels; c++)
+        {
+            out[(from + i) * m_channels + c] = (int16_t)((int32_t)m_last[c] * (int32_t)(len - 1 - i) / (int32_t)len);
+        }
+    }
+    std::fill(m_last.begin(), m_last.end(), 0);
+}
+
+void PlayoutBuffer::read(switch_buffer_t *buffer, void *out, size_t len)
+{
+    m_played += switch_buffer_read(buffer, out, len);
+}
+
+size_t PlayoutBuffer::defer(const uint8_t *data, size_t len)
+{
+    const size_t taken = std::min(len, capacityBytes() - std::min(capacityBytes(), backlogBytes()));
+    if (taken == 0)
+        return 0;
+    // drop what was moved on before growing, the string is reused for the whole call
+    if (m_backlog_head > 0 && m_backlog.size() + taken > m_backlog.capacity())
+    {
+        m_backlog.erase(0, m_backlog_head);
+        m_backlog_head = 0;
+    }
+    m_backlog.append(reinterpret_cast<const char *>(data), taken);
+    m_written += taken;
+    return taken;
+}
+
+void PlayoutBuffer::refill(switch_buffer_t *buffer)
+{
+    const size_t len = std::min<size_t>(backlogBytes(), switch_buffer_freespace(buffer));
+    if (len == 0)
+        return;
+    switch_buffer_write(buffer, m_backlog.data() + m_backlog_head, len);
+    m_backlog_head += len;
+    if (m_backlog_head == m_backlog.size())
+    {
+        m_backlog.clear();
+        m_backlog_head = 0;
+    }
+}
+
+void PlayoutBuffer::takeReachedMarks(std::vector<std::string> &reached)
+{
+    while (!m_marks.empty() && m_marks.front().position <= m_played)
+    {
+        reached.push_back(m_marks.front().name);
+        m_marks.pop_front();
+    }
+}
+
+bool PlayoutBuffer::pull(switch_buffer_t *buffer, int16_t *out, uint32_t frames)
+{
+    refill(buffer);
+    const size_t frame_bytes = m_channels * sizeof(int16_t);
+    const size_t inuse = switch_buffer_inuse(buffer) / frame_bytes;
+    const uint32_t tick_ms = frames * 1000 / m_rate;
+    const uint32_t max_target = std::min<uint32_t>(m_config.max_ms / 2, 500) * m_rate / 1000;
+
+    if (!m_playing)
+    {
+        if (inuse == 0)
+        {
+            m_last_inuse = 0;
+            if (m_dry_ms < PLAYOUT_UNDERRUN_WINDOW_MS)
+                m_dry_ms += tick_ms;
+            return false;
+        }
+        // start at the target depth, or once the writer has stopped adding (short prompts)
+        if (inuse < m_target_frames && inuse != m_last_inuse)
+        {
+            m_last_inuse = inuse;
+            return false;
+        }
+        if (m_dry_ms < PLAYOUT_UNDERRUN_WINDOW_MS)
+        {
+            m_underruns++;
+            m_stable_ms = 0;
+            m_target_frames = std::min(m_target_frames + frames, std::max(max_target, m_min_target_frames));
+        }
+        m_playing = true;
+        m_depth = (double)inuse;
+    }
+
+    m_depth = 0.95 * m_depth + 0.05 * (double)inuse;
+
+    // drift correction: consume one step more or less per packet while the
+    // depth strays from the target, but leave bursts well above it alone
+    const uint32_t step = std::max<uint32_t>(1, frames / 160);
+    uint32_t need = frames;
+    if (frames > 2 * step)
+    {
+        if (m_depth > m_target_frames * 1.5 && m_depth < m_target_frames * 4.0 && inuse >= frames + step)
+            need = frames + step;
+        else if (m_depth < m_target_frames * 0.75)
+            need = frames - step;
+    }
+
+    if (inuse < need)
+    {
+        if (inuse >= frames)
+        {
+            need = frames;
+        }
+        else
+        {
+            // ran dry: play what is left and fade out
+            read(buffer, out, inuse * frame_bytes);
+            if (inuse > 0)
+                std::copy(out + (inuse - 1) * m_channels, out + inuse * m_channels, m_last.begin());
+            const bool audible = inuse > 0 || std::any_of(m_last.begin(), m_last.end(), [](int16_t v)
+                                                          { return v != 0; });
+            conceal(out, (uint32_t)inuse, frames);
+            m_playing = false;
+            m_last_inuse = 0;
+            m_dry_ms = 0;
+            return audible;
+        }
+    }
+
+    if (need == frames)
+    {
+        read(buffer, out, frames * frame_bytes);
+    }
+    else
+    {
+        if (m_scratch.size() < (size_t)need * m_channels)
+            m_scratch.resize((size_t)need * m_channels);
+        read(buffer, m_scratch.data(), need * frame_bytes);
+        const double ratio = (double)(need - 1) / (double)(frames - 1);
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            const double pos = i * ratio;
+            const uint32_t idx = std::min<uint32_t>((uint32_t)pos, need - 2);
+            const double frac = pos - idx;
+            for (uint32_t c = 0; c < m_channels; c++)
+            {
+                const double a = m_scratch[idx * m_channels + c];
+                const double b = m_scratch[(idx + 1) * m_channels + c];
+                out[i * m_channels + c] = (int16_t)(a + (b - a) * frac);
+            }
+        }
+    }
+    std::copy(out + (frames - 1) * m_channels, out + frames * m_channels, m_last.begin());
+
+    m_stable_ms += tick_ms;
+    if (m_stable_ms >= PLAYOUT_SHRINK_AFTER_MS)
+    {
+        m_stable_ms = 0;
+        if (m_target_frames > m_min_target_frames)
+            m_target_frames = std::max(m_min_target_frames, m_target_frames - frames);
+    }
+    return true;
+}
@@ -0,0 +1,129 @@
+#ifndef PLAYOUT_BUFFER_H
+#define PLAYOUT_BUFFER_H
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+#include "mod_video_stream.h"
+
+struct PlayoutConfig
+{
+    int target_ms = 60; /* depth kept in write_sbuffer before and during playback */
+    int max_ms = 2000;  /* capacity of write_sbuffer and of the backlog behind it, writers block beyond both */
+};
+
+/*
+ * Playout side of write_sbuffer. The write frame thread pulls one packet
+ * per timer tick; the buffer waits for the target depth before starting,
+ * absorbs clock drift between the server and the FreeSWITCH timer with
+ * +-0.6% linear resampling corrections, conceals underruns with a short
+ * fade and grows the target after each underrun.
+ *
+ * Audio that does not fit in write_sbuffer waits in a backlog of the same
+ * size that pull() moves on as room frees up, so the websocket client
+ * thread writing it only blocks once both are full and a clearAudio
+ * behind it is read promptly.
+ *
+ * Playback marks are tracked by byte position so the server can be told
+ * when the last sample of a tagged chunk has been written to the channel.
+ *
+ * All methods are called with write_mutex held.
+ */
+class PlayoutBuffer
+{
+public:
+    PlayoutBuffer(const PlayoutConfig &config, uint32_t rate, uint32_t channels);
+
+    size_t capacityBytes() const
+    {
+        return (size_t)m_config.max_ms * m_bytes_per_ms;
+    }
+
+    /* fills out with frames frames; returns false when nothing should be written this tick */
+    bool pull(switch_buffer_t *buffer, int16_t *out, uint32_t frames);
+
+    /* drops playback state after write_sbuffer was emptied externally;
+       marks that will never be played are moved to cleared */
+    void reset(std::vector<std::string> *cleared = nullptr);
+
+    /* accounts len bytes appended to write_sbuffer */
+    void noteWritten(size_t len)
+    {
+        m_written += len;
+    }
+
+    /* appends up to the backlog's free space of data behind write_sbuffer; returns the bytes taken */
+    size_t defer(const uint8_t *data, size_t len);
+
+    size_t backlogBytes() const
+    {
+        return m_backlog.size() - m_backlog_head;
+    }
+
+    /* tags the last byte written so far; reported once it has been pulled */
+    void addMark(const std::string &name)
+    {
+        m_marks.push_back(Mark{name, m_written});
+    }
+
+    bool hasMarks() const
+    {
+        return !m_marks.empty();
+    }
+
+    /* moves the marks whose audio has been pulled to reached */
+    void takeReachedMarks(std::vector<std::string> &reached);
+
+    void noteOverrun()
+    {
+        m_overruns++;
+    }
+
+    uint32_t underruns() const
+    {
+        return m_underruns.load();
+    }
+    uint32_t overruns() const
+    {
+        return m_overruns.load();
+    }
+    uint32_t targetMs() const
+    {
+        return m_target_frames * 1000 / m_rate;
+    }
+
+private:
+    struct Mark
+    {
+        std::string name;
+        uint64_t position; /* byte offset into the playback stream */
+    };
+
+    void conceal(int16_t *out, uint32_t from, uint32_t frames);
+    void read(switch_buffer_t *buffer, void *out, size_t len);
+    void refill(switch_buffer_t *buffer);
+
+    const PlayoutConfig m_config;
+    const uint32_t m_rate;
+    const uint32_t m_channels;
+    const size_t m_bytes_per_ms;
+    const uint32_t m_min_target_frames;
+    uint32_t m_target_frames;
+    bool m_playing;
+    double m_depth; /* smoothed depth in frames */
+    size_t m_last_inuse;
+    uint32_t m_dry_ms;
+    uint32_t m_stable_ms;
+    std::vector<int16_t> m_last;    /* last sample written per channel, start of the concealment fade */
+    std::vector<int16_t> m_scratch; /* input frames for drift corrected packets */
+    std::string m_backlog;           /* audio waiting for room in write_sbuffer, from m_backlog_head */
+    size_t m_backlog_head;
+    uint64_t m_written;              /* bytes ever appended to write_sbuffer or its backlog */
+    uint64_t m_played;               /* bytes ever pulled from it */
+    std::deque<Mark> m_marks;
+    std::atomic<uint32_t> m_underruns;
+    std::atomic<uint32_t> m_overruns;
+};
+
+#endif // PLAYOUT_BUFFER_H
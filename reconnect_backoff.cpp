@@ -0,0 +1,19 @@
+#include <algorithm>
+#include "reconnect_backoff.h"
+
+ReconnectBackoff::ReconnectBackoff(const ReconnectConfig &config)
+    : m_config(config), m_attempt(0), m_random(std::random_device{}())
+{
+}
+
+std::chrono::milliseconds ReconnectBackoff::next()
+{
+    const int64_t initial = std::max(1, m_config.initial_ms);
+    const int64_t cap = std::max<int64_t>(initial, m_config.max_ms);
+    // 2^attempt without overflowing; the cap is reached long before that
+    const int64_t base = std::min(cap, initial << std::min<uint32_t>(m_attempt, 20));
+    m_attempt++;
+
+    std::uniform_int_distribution<int64_t> jitter(base / 2, base);
+    return std::chrono::milliseconds(jitter(m_random));
+}
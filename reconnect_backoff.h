@@ -0,0 +1,54 @@
+#ifndef RECONNECT_BACKOFF_H
+#define RECONNECT_BACKOFF_H
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+struct ReconnectConfig
+{
+    bool enabled = true;   /* STREAM_NO_RECONNECT turns it off */
+    int initial_ms = 250;  /* delay before the first attempt */
+    int max_ms = 8000;     /* cap of the doubling delay */
+    int attempts = 10;     /* attempts per drop, 0 keeps trying until the stream ends */
+};
+
+/*
+ * Delays between reconnect attempts. The base delay doubles per attempt up
+ * to max_ms and each delay is drawn from [base/2, base], so calls dropped
+ * together by one load balancer reset do not all come back at once.
+ */
+class ReconnectBackoff
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    explicit ReconnectBackoff(const ReconnectConfig &config);
+
+    /* true once the configured number of attempts has been used */
+    bool exhausted() const
+    {
+        return m_config.attempts > 0 && m_attempt >= (uint32_t)m_config.attempts;
+    }
+
+    /* delay before the next attempt; counts the attempt */
+    std::chrono::milliseconds next();
+
+    /* the connection is open again, the next drop starts from initial_ms */
+    void reset()
+    {
+        m_attempt = 0;
+    }
+
+    uint32_t attempt() const
+    {
+        return m_attempt;
+    }
+
+private:
+    const ReconnectConfig m_config;
+    uint32_t m_attempt;
+    std::minstd_rand m_random;
+};
+
+#endif // RECONNECT_BACKOFF_H
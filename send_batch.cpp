@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "send_batch.h"
+
+namespace
+{
+    thread_local SendBatch *current_batch = nullptr;
+
+    int64_t now_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+/*
+ * The part of io_uring a batch needs, on the raw system calls: sends that
+ * do not wait for room, submitted together and waited for together.
+ */
+class SendBatch::Ring
+{
+public:
+    static Ring *create()
+    {
+        std::unique_ptr<Ring> ring(new Ring());
+        return ring->setup() ? ring.release() : nullptr;
+    }
+
+    ~Ring()
+    {
+        if (m_sqes != MAP_FAILED)
+            munmap(m_sqes, m_sqes_size);
+        if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+            munmap(m_cq_ring, m_cq_size);
+        if (m_sq_ring != MAP_FAILED)
+            munmap(m_sq_ring, m_sq_size);
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+
+    /* queues a send of len bytes at data that takes what fits without waiting */
+    void send(int fd, const void *data, size_t len, uint64_t user_data)
+    {
+        const unsigned tail = *m_sq_tail;
+        struct io_uring_sqe *sqe = next(tail);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)data;
+        sqe->len = (uint32_t)std::min<size_t>(len, UINT32_MAX);
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+        sqe->user_data = user_data;
+        __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        m_queued++;
+    }
+
+    /*
+     * Submits what is queued and waits for all of it, calling
+     * done(user_data, result) for each send. Returns the number of
+     * io_uring_enter calls, or -1 if the ring failed: whatever it did
+     * submit has completed, the rest was not sent and the ring is unusable.
+     */
+    template <typename Done>
+    int submit(Done done)
+    {
+        const unsigned expected = m_queued;
+        unsigned submitted = 0, completed = 0;
+        int calls = 0;
+        bool broken = false;
+        while (completed < (broken ? submitted : expected))
+        {
+            const unsigned to_submit = broken ? 0 : expected - submitted;
+            const int rc = (int)syscall(__NR_io_uring_enter, m_fd, to_submit, (broken ? submitted : expected) - completed,
+                                        IORING_ENTER_GETEVENTS, nullptr, 0);
+            calls++;
+            if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                if (broken)
+                    return -1; // cannot even wait; the ring is dropped with what it holds
+                broken = true;
+            }
+            else if (rc > 0 && !broken)
+            {
+                submitted += rc;
+            }
+
+            unsigned head = *m_cq_head;
+            const unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++)
+            {
+                const struct io_uring_cqe *cqe = &m_cqes[head & m_cq_mask];
+                done(cqe->user_data, cqe->res);
+                completed++;
+            }
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        }
+        m_queued = 0;
+        return broken ? -1 : calls;
+    }
+
+private:
+    Ring()
+        : m_fd(-1), m_sq_ring(MAP_FAILED), m_cq_ring(MAP_FAILED), m_sqes(MAP_FAILED), m_sq_size(0), m_cq_size(0),
+          m_sqes_size(0), m_queued(0)
+    {
+    }
+
+    bool setup()
+    {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        m_fd = (int)syscall(__NR_io_uring_setup, SEND_BATCH_RING_SOCKETS, &params);
+        // native workers (5.12) also means IORING_OP_SEND is there and
+        // honours MSG_DONTWAIT rather than polling until the socket has room
+        if (m_fd < 0 || !(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_NATIVE_WORKERS))
+            return false;
+
+        m_sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+        m_sq_ring = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_sq_ring == MAP_FAILED)
+            return false;
+        m_cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP)
+                        ? m_sq_ring
+                        : mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ring == MAP_FAILED)
+            return false;
+        m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        m_sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if (m_sqes == MAP_FAILED)
+            return false;
+
+        uint8_t *sq = static_cast<uint8_t *>(m_sq_ring);
+        uint8_t *cq = static_cast<uint8_t *>(m_cq_ring);
+        m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    struct io_uring_sqe *next(unsigned tail)
+    {
+        const unsigned index = tail & m_sq_mask;
+        struct io_uring_sqe *sqe = &static_cast<struct io_uring_sqe *>(m_sqes)[index];
+        memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[index] = index;
+        return sqe;
+    }
+
+    int m_fd;
+    void *m_sq_ring;
+    void *m_cq_ring;
+    void *m_sqes;
+    size_t m_sq_size;
+    size_t m_cq_size;
+    size_t m_sqes_size;
+    unsigned *m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+    unsigned m_queued;
+};
+
+SendBatch::SendBatch(bool use_ring) : m_ring(use_ring ? Ring::create() : nullptr), m_uses_ring(m_ring != nullptr), m_used(0)
+{
+}
+
+SendBatch::~SendBatch()
+{
+    flush();
+}
+
+SendBatch *SendBatch::current()
+{
+    return current_batch;
+}
+
+SendBatch::Scope::Scope(SendBatch *batch) : m_batch(batch), m_previous(current_batch)
+{
+    if (m_batch)
+        current_batch = m_batch;
+}
+
+SendBatch::Scope::~Scope()
+{
+    if (!m_batch)
+        return;
+    current_batch = m_previous;
+    m_batch->flush();
+}
+
+void SendBatch::add(const std::shared_ptr<BatchSocket> &socket, const void *header, size_t header_len, const void *data,
+                    size_t len)
+{
+    auto found = m_index.find(socket.get());
+    size_t slot;
+    if (found != m_index.end())
+    {
+        slot = found->second;
+    }
+    else
+    {
+        slot = m_used++;
+        if (slot == m_pending.size())
+            m_pending.emplace_back();
+        Pending &pending = m_pending[slot];
+        pending.socket = socket;
+        pending.bytes.clear();
+        pending.frames = 0;
+        pending.offset = 0;
+        m_index.emplace(socket.get(), slot);
+    }
+    Pending &pending = m_pending[slot];
+    pending.bytes.append(static_cast<const char *>(header), header_len);
+    pending.bytes.append(static_cast<const char *>(data), len);
+    pending.frames++;
+}
+
+void SendBatch::flush(const BatchSocket *socket)
+{
+    auto found = m_index.find(socket);
+    if (found == m_index.end())
+        return;
+    Pending &pending = m_pending[found->second];
+    if (pending.frames == 0)
+        return;
+    std::lock_guard<std::mutex> lock(pending.socket->mutex);
+    writeDirect(pending);
+    // the slot stays with its socket for frames added later in the pass
+    pending.bytes.clear();
+    pending.frames = 0;
+    pending.offset = 0;
+}
+
+void SendBatch::flush()
+{
+    std::vector<Pending *> chunk;
+    chunk.reserve(SEND_BATCH_RING_SOCKETS);
+    for (size_t slot = 0; slot < m_used; slot++)
+    {
+        Pending &pending = m_pending[slot];
+        if (pending.frames > 0)
+            chunk.push_back(&pending);
+        if (chunk.size() == SEND_BATCH_RING_SOCKETS || (slot + 1 == m_used && !chunk.empty()))
+        {
+            // locked in slot order; a direct sender only ever holds one socket
+            for (Pending *entry : chunk)
+                entry->socket->mutex.lock();
+            if (m_ring && chunk.size() > 1)
+            {
+                writeRing(chunk.data(), chunk.size());
+            }
+            else
+            {
+                for (Pending *entry : chunk)
+                    writeDirect(*entry);
+            }
+            for (Pending *entry : chunk)
+                entry->socket->mutex.unlock();
+            chunk.clear();
+        }
+    }
+    for (size_t slot = 0; slot < m_used; slot++)
+    {
+        m_pending[slot].socket.reset();
+        m_pending[slot].bytes.clear();
+        m_pending[slot].frames = 0;
+    }
+    m_used = 0;
+    m_index.clear();
+}
+
+void SendBatch::writeRing(Pending **entries, size_t count)
+{
+    size_t queued = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        Pending &pending = *entries[i];
+        pending.failed = pending.socket->fd < 0;
+        if (pending.failed)
+            continue;
+        m_ring->send(pending.socket->fd, pending.bytes.data(), pending.bytes.size(), i);
+        queued++;
+    }
+    if (queued > 0)
+    {
+        const int calls = m_ring->submit([entries](uint64_t index, int32_t result)
+                                         {
+            Pending &pending = *entries[index];
+            if (result > 0)
+                pending.offset += result;
+            else if (result != -EAGAIN)
+                pending.failed = true; });
+        if (calls < 0)
+        {
+            // the ring itself failed; what it did not send goes out directly
+            m_ring.reset();
+            m_uses_ring = false;
+        }
+        else
+        {
+            m_syscalls += calls;
+            m_writes += queued;
+        }
+    }
+    // a socket whose buffer was full waits for its peer, up to the send timeout
+    for (size_t i = 0; i < count; i++)
+    {
+        Pending &pending = *entries[i];
+        if (pending.failed)
+            finish(pending, false);
+        else if (pending.offset < pending.bytes.size())
+            writeDirect(pending);
+        else
+            finish(pending, true);
+    }
+}
+
+void SendBatch::writeDirect(Pending &pending)
+{
+    const int fd = pending.socket->fd;
+    bool ok = fd >= 0;
+    while (ok && pending.offset < pending.bytes.size())
+    {
+        const ssize_t sent = send(fd, pending.bytes.data() + pending.offset, pending.bytes.size() - pending.offset, MSG_NOSIGNAL);
+        m_syscalls++;
+        if (sent < 0 && errno == EINTR)
+            continue;
+        ok = sent > 0;
+        if (ok)
+            pending.offset += sent;
+    }
+    m_writes++;
+    finish(pending, ok);
+}
+
+void SendBatch::finish(Pending &pending, bool ok)
+{
+    if (ok)
+    {
+        m_frames += pending.frames;
+        pending.socket->last_send_ms = now_ms();
+        return;
+    }
+    // timed out or broken; a frame cut short leaves the stream unusable,
+    // the connection sees the shutdown and closes
+    if (pending.socket->fd >= 0)
+    {
+        shutdown(pending.socket->fd, SHUT_RDWR);
+        m_failures++;
+    }
+}
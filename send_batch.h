@@ -0,0 +1,128 @@
+#ifndef SEND_BATCH_H
+#define SEND_BATCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define SEND_BATCH_RING_SOCKETS 128 /* sockets per io_uring submission */
+#define SEND_BATCH_MAX_FRAME 2048 /* larger frames cost more to copy than the batch saves, senders write them directly */
+
+/*
+ * The socket of a connection whose frames can be batched. Shared with
+ * the batches holding frames for it, so a connection can go away before
+ * a batch is written; a closed socket has fd -1 and its frames are
+ * dropped.
+ */
+struct BatchSocket
+{
+    std::mutex mutex; /* held for every write, so frames never interleave, and while fd changes */
+    int fd = -1;
+    std::atomic<int64_t> last_send_ms{0}; /* steady clock of the last complete write */
+};
+
+/*
+ * Outgoing frames of many connections, gathered by the thread that owns
+ * the batch (a media worker during one pass over its streams) and written
+ * at the end: every socket's frames in order as one write, and the writes
+ * of all sockets in one io_uring submission. Where io_uring is not
+ * available (old kernel, seccomp) each socket takes one send.
+ *
+ * Frames are copied in, so a sender's buffer is free once add() returns,
+ * and count as sent from then on. The submission only takes what fits in
+ * each socket's buffer; a socket with more left gets a blocking send
+ * after it, bounded by its own SO_SNDTIMEO. A socket that fails is shut
+ * down, which its connection sees as a drop, the same as a direct send
+ * that fails.
+ *
+ * A sender that writes to a socket directly while a batch holds frames
+ * for it calls flush(socket) first, so its message does not overtake them.
+ */
+class SendBatch
+{
+public:
+    struct Stats
+    {
+        uint64_t frames;   /* frames written */
+        uint64_t writes;   /* socket writes, one per socket and pass unless cut short */
+        uint64_t syscalls; /* io_uring_enter or send calls */
+        uint64_t failures; /* sockets shut down */
+    };
+
+    /* a batch on io_uring when use_ring and the kernel allows it */
+    explicit SendBatch(bool use_ring = true);
+    ~SendBatch();
+
+    SendBatch(const SendBatch &) = delete;
+    SendBatch &operator=(const SendBatch &) = delete;
+
+    /* the batch open on the calling thread, nullptr outside a Scope */
+    static SendBatch *current();
+
+    /* opens batch on this thread and writes it when it ends; nothing for nullptr */
+    class Scope
+    {
+    public:
+        explicit Scope(SendBatch *batch);
+        ~Scope();
+
+    private:
+        SendBatch *m_batch;
+        SendBatch *m_previous;
+    };
+
+    /* queues a frame, header and payload, behind those already queued for socket */
+    void add(const std::shared_ptr<BatchSocket> &socket, const void *header, size_t header_len, const void *data, size_t len);
+
+    /* writes what is queued for socket, ahead of a direct write to it */
+    void flush(const BatchSocket *socket);
+
+    /* writes everything queued */
+    void flush();
+
+    /* any thread; false once the ring failed and the batch fell back to sends */
+    bool usesRing() const
+    {
+        return m_uses_ring.load();
+    }
+
+    Stats stats() const
+    {
+        Stats stats = {m_frames.load(), m_writes.load(), m_syscalls.load(), m_failures.load()};
+        return stats;
+    }
+
+private:
+    struct Pending
+    {
+        std::shared_ptr<BatchSocket> socket;
+        std::string bytes; /* whole frames, kept allocated across passes */
+        size_t frames;
+        size_t offset; /* written so far */
+        bool failed;
+    };
+    class Ring;
+
+    /* the socket of each entry is locked by the caller */
+    void writeRing(Pending **entries, size_t count);
+    void writeDirect(Pending &pending);
+    void finish(Pending &pending, bool ok);
+
+    std::unique_ptr<Ring> m_ring;
+    std::atomic<bool> m_uses_ring;
+    std::vector<Pending> m_pending; /* in use up to m_used */
+    size_t m_used;
+    std::unordered_map<const BatchSocket *, size_t> m_index;
+
+    std::atomic<uint64_t> m_frames{0};
+    std::atomic<uint64_t> m_writes{0};
+    std::atomic<uint64_t> m_syscalls{0};
+    std::atomic<uint64_t> m_failures{0};
+};
+
+#endif // SEND_BATCH_H
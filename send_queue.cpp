@@ -0,0 +1,271 @@
+#include "send_queue.h"
+
+#define SEND_QUEUE_SPARES 64 /* recycled message buffers kept per queue */
+
+namespace
+{
+    size_t limit_bytes(const SendQueueConfig &config, size_t bytes_per_ms)
+    {
+        size_t limit = config.max_ms > 0 ? (size_t)config.max_ms * bytes_per_ms : 0;
+        if (config.max_bytes > 0 && (limit == 0 || config.max_bytes < limit))
+            limit = config.max_bytes;
+        return limit;
+    }
+}
+
+SendQueue::SendQueue(const SendQueueConfig &config, size_t bytes_per_ms, WsTransport &transport)
+    : m_config(config), m_bytes_per_ms(bytes_per_ms ? bytes_per_ms : 1), m_limit(limit_bytes(config, m_bytes_per_ms)),
+      m_transport(transport), m_stopping(false), m_held(false), m_reopening(false), m_reopen_at(0),
+      m_depth(0), m_sent(0), m_dropped(0), m_dropped_bytes(0), m_failed(0), m_congestions(0), m_seen_dropped(0),
+      m_congested(false)
+{
+    m_thread = std::thread(&SendQueue::run, this);
+}
+
+SendQueue::~SendQueue()
+{
+    stop();
+}
+
+SendQueue::Message SendQueue::take(bool text, const void *data, size_t len, bool sticky)
+{
+    Message message{text, std::string(), clock::now(), SharedFrame(), sticky};
+    if (!m_spare.empty())
+    {
+        message.data.swap(m_spare.back());
+        m_spare.pop_back();
+    }
+    message.data.assign(static_cast<const char *>(data), len);
+    return message;
+}
+
+void SendQueue::recycle(Message &message)
+{
+    if (m_spare.size() < SEND_QUEUE_SPARES && !message.text && !message.frame)
+        m_spare.push_back(std::move(message.data));
+}
+
+bool SendQueue::admit(size_t len)
+{
+    if (m_limit > 0 && m_depth + len > m_limit && !m_config.drop_newest)
+    {
+        // oldest audio first; text and the batch being sent stay
+        for (auto it = m_queue.begin(); it != m_queue.end() && m_depth + len > m_limit;)
+        {
+            if (it->text)
+            {
+                ++it;
+                continue;
+            }
+            const size_t size = it->payload().size();
+            m_depth -= size;
+            m_dropped++;
+            m_dropped_bytes += size;
+            recycle(*it);
+            it = m_queue.erase(it);
+        }
+    }
+    if (m_limit > 0 && m_depth + len > m_limit)
+    {
+        m_dropped++;
+        m_dropped_bytes += len;
+        return false;
+    }
+    m_depth += len;
+    return true;
+}
+
+void SendQueue::pushBinary(const void *data, size_t len)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopping || !admit(len))
+        return;
+    m_queue.push_back(take(false, data, len));
+    m_cv.notify_one();
+}
+
+void SendQueue::pushShared(const SharedFrame &frame)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopping || !admit(frame->size()))
+        return;
+    m_queue.push_back(Message{false, std::string(), clock::now(), frame, false});
+    m_cv.notify_one();
+}
+
+void SendQueue::pushText(const char *text, size_t len, bool sticky)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopping)
+        return;
+    // nothing is taken off a held queue, so the position is still valid
+    if (m_reopening && m_held)
+        m_queue.insert(m_queue.begin() + m_reopen_at++, take(true, text, len, sticky));
+    else
+        m_queue.push_back(take(true, text, len, sticky));
+    m_cv.notify_one();
+}
+
+void SendQueue::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &message : m_queue)
+    {
+        if (!message.text)
+            m_depth -= message.payload().size();
+        recycle(message);
+    }
+    m_queue.clear();
+    m_held = false;
+    m_reopening = false;
+}
+
+void SendQueue::reopen()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reopening = true;
+    m_reopen_at = 0;
+    // the kept audio may be in a format the new connection has not been told of
+    if (m_held && !m_sticky.empty())
+        m_queue.insert(m_queue.begin() + m_reopen_at++, take(true, m_sticky.data(), m_sticky.size(), true));
+}
+
+void SendQueue::resume()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reopening = false;
+    m_held = false;
+    m_cv.notify_one();
+}
+
+void SendQueue::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_stopping)
+        {
+            m_stopping = true;
+            m_flush_deadline = clock::now() + std::chrono::milliseconds(SEND_QUEUE_FLUSH_MS);
+        }
+        m_cv.notify_one();
+    }
+    if (m_thread.joinable() && m_thread.get_id() != std::this_thread::get_id())
+        m_thread.join();
+}
+
+bool SendQueue::pollCongestion(bool &congested)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const bool dropped = m_dropped != m_seen_dropped;
+    m_seen_dropped = m_dropped;
+    bool state = m_congested;
+    if (!state)
+        state = dropped || m_depth * 100 >= m_limit * SEND_QUEUE_CONGESTED_PCT;
+    else
+        state = dropped || m_depth * 100 > m_limit * SEND_QUEUE_CLEAR_PCT;
+    congested = state;
+    if (state == m_congested)
+        return false;
+    m_congested = state;
+    if (state)
+        m_congestions++;
+    return true;
+}
+
+int SendQueue::delay(clock::time_point now) const
+{
+    clock::time_point oldest = m_sending_since;
+    if (oldest == clock::time_point())
+    {
+        if (m_queue.empty())
+            return 0;
+        oldest = m_queue.front().queued;
+    }
+    return (int)std::chrono::duration_cast<std::chrono::milliseconds>(now - oldest).count();
+}
+
+int SendQueue::delayMs()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return delay(clock::now());
+}
+
+SendQueue::Stats SendQueue::stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return Stats{m_depth, delay(clock::now()), m_limit, m_sent, m_dropped, m_dropped_bytes, m_failed, m_congestions, m_congested};
+}
+
+void SendQueue::run()
+{
+    std::vector<Message> batch;
+    WsTransport::Frame frames[SEND_QUEUE_BATCH];
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_cv.wait(lock, [this]
+                  { return m_stopping || (!m_held && !m_queue.empty()); });
+        if (m_queue.empty())
+            break;
+        // kept messages have no connection to go out on
+        if (m_stopping && (m_held || clock::now() > m_flush_deadline))
+        {
+            for (auto &message : m_queue)
+            {
+                if (!message.text)
+                {
+                    m_depth -= message.payload().size();
+                    m_failed++;
+                }
+            }
+            m_queue.clear();
+            break;
+        }
+
+        // one text message, or a run of binary ones; the depth keeps
+        // counting them until the transport took them
+        const bool text = m_queue.front().text;
+        do
+        {
+            batch.push_back(std::move(m_queue.front()));
+            m_queue.pop_front();
+        } while (!text && batch.size() < SEND_QUEUE_BATCH && !m_queue.empty() && !m_queue.front().text);
+        m_sending_since = batch[0].queued;
+        lock.unlock();
+
+        size_t sent = 0;
+        if (text)
+        {
+            sent = m_transport.sendMessage(batch[0].data.data(), batch[0].data.size()) ? 1 : 0;
+        }
+        else
+        {
+            for (size_t i = 0; i < batch.size(); i++)
+                frames[i] = {batch[i].payload().data(), batch[i].payload().size()};
+            sent = m_transport.sendBinaryBatch(frames, batch.size());
+        }
+
+        lock.lock();
+        m_sending_since = clock::time_point();
+        if (sent < batch.size() && m_config.keep_unsent && !m_stopping)
+        {
+            // the connection went down; the rest waits for the reconnect, in order
+            for (size_t i = batch.size(); i-- > sent;)
+                m_queue.push_front(std::move(batch[i]));
+            batch.erase(batch.begin() + sent, batch.end());
+            m_held = true;
+        }
+        if (text && sent && batch[0].sticky)
+            m_sticky = batch[0].data;
+        if (!text)
+        {
+            m_sent += sent;
+            m_failed += batch.size() - sent;
+            for (auto &message : batch)
+                m_depth -= message.payload().size();
+        }
+        for (auto &message : batch)
+            recycle(message);
+        batch.clear();
+    }
+}
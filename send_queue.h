@@ -0,0 +1,152 @@
+#ifndef SEND_QUEUE_H
+#define SEND_QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ws_transport.h"
+
+#define SEND_QUEUE_BATCH 16         /* binary messages handed to the transport at once */
+#define SEND_QUEUE_FLUSH_MS 1000    /* what stop() gives the queue to drain */
+#define SEND_QUEUE_CONGESTED_PCT 75 /* depth that raises congestion, percent of the cap */
+#define SEND_QUEUE_CLEAR_PCT 25     /* depth that clears it again */
+
+/* an audio packet shared, unchanged, by the queues of several destinations */
+typedef std::shared_ptr<const std::string> SharedFrame;
+
+struct SendQueueConfig
+{
+    int max_ms = 0;           /* audio held for a slow server, 0 sends on the media thread */
+    size_t max_bytes = 0;     /* cap in bytes as well, 0 for max_ms only */
+    bool drop_newest = false; /* a full queue drops the new packet rather than the oldest queued */
+    bool keep_unsent = false; /* set by a stream that replays its audio after a reconnect */
+};
+
+/*
+ * Outbound messages of one connection, sent by a thread of their own so a
+ * server that reads slowly holds up this queue instead of the media thread
+ * and memory. Binary audio counts against a cap in bytes and milliseconds;
+ * once the cap is reached the oldest queued packet or the new one is
+ * dropped. Text is never dropped and keeps its place among the audio.
+ *
+ * With keep_unsent, messages the transport refuses because the connection
+ * went down go back to the front of the queue in order and wait for
+ * resume() instead of being lost, so a reconnect sends them first. Text
+ * pushed between reopen() and resume() goes ahead of them, after the last
+ * sticky text (an audio format announcement) the old connection took.
+ *
+ * The depth counts audio waiting and audio being sent. The queue is
+ * congested from SEND_QUEUE_CONGESTED_PCT of the cap, or after a drop,
+ * until the depth is back under SEND_QUEUE_CLEAR_PCT without drops. The
+ * delay is how long the oldest message has been waiting or sending, the
+ * same measure whatever the format of the audio.
+ */
+class SendQueue
+{
+public:
+    struct Stats
+    {
+        size_t depth_bytes;
+        int delay_ms;
+        size_t limit_bytes;
+        uint64_t sent_packets;
+        uint64_t dropped_packets; /* by the drop policy */
+        uint64_t dropped_bytes;
+        uint64_t failed_packets; /* the transport refused them, usually while disconnected */
+        uint64_t congestions;    /* times the queue became congested */
+        bool congested;
+    };
+
+    SendQueue(const SendQueueConfig &config, size_t bytes_per_ms, WsTransport &transport);
+    ~SendQueue();
+
+    SendQueue(const SendQueue &) = delete;
+    SendQueue &operator=(const SendQueue &) = delete;
+
+    void pushBinary(const void *data, size_t len);
+    void pushShared(const SharedFrame &frame);
+    /* sticky text describes the audio after it and is sent again ahead of audio kept across a reconnect */
+    void pushText(const char *text, size_t len, bool sticky = false);
+
+    /* drops what is waiting when the connection goes away; not counted as drops */
+    void clear();
+
+    /* the connection is open again: text pushed until resume() goes ahead of the kept messages */
+    void reopen();
+    void resume();
+
+    bool keepsUnsent() const
+    {
+        return m_config.keep_unsent;
+    }
+
+    /* sends what is queued for up to SEND_QUEUE_FLUSH_MS, then stops the thread */
+    void stop();
+
+    /* true once per change of the congestion state, which is left in congested */
+    bool pollCongestion(bool &congested);
+
+    /* how long the oldest message has been waiting or sending */
+    int delayMs();
+    Stats stats();
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Message
+    {
+        bool text;
+        std::string data; /* empty when frame is set */
+        clock::time_point queued;
+        SharedFrame frame;
+        bool sticky;
+
+        const std::string &payload() const
+        {
+            return frame ? *frame : data;
+        }
+    };
+
+    void run();
+    Message take(bool text, const void *data, size_t len, bool sticky = false);
+    void recycle(Message &message);
+    /* makes room for len bytes by the drop policy, false when the new packet is dropped */
+    bool admit(size_t len);
+    int delay(clock::time_point now) const;
+
+    const SendQueueConfig m_config;
+    const size_t m_bytes_per_ms;
+    const size_t m_limit;
+    WsTransport &m_transport;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Message> m_queue;
+    std::vector<std::string> m_spare; /* buffers of sent messages, reused by the next pushes */
+    std::thread m_thread;
+    bool m_stopping;
+    clock::time_point m_flush_deadline;
+    clock::time_point m_sending_since; /* queued time of the batch being sent, epoch when none */
+    bool m_held;           /* refused messages wait at the front for resume() */
+    bool m_reopening;      /* between reopen() and resume() */
+    size_t m_reopen_at;    /* where the next text pushed while reopening goes */
+    std::string m_sticky;  /* last sticky text the transport took */
+
+    size_t m_depth;
+    uint64_t m_sent;
+    uint64_t m_dropped;
+    uint64_t m_dropped_bytes;
+    uint64_t m_failed;
+    uint64_t m_congestions;
+    uint64_t m_seen_dropped; /* m_dropped at the last pollCongestion */
+    bool m_congested;
+};
+
+#endif // SEND_QUEUE_H
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shm_audio.h"
+
+#define SHM_AUDIO_MODE 0660 /* the consumer usually runs as another user of the same group */
+
+namespace
+{
+    size_t ring_bytes(int ring_ms, int rate, int channels)
+    {
+        const size_t wanted = std::max<size_t>(4096, (size_t)ring_ms * rate / 1000 * channels * sizeof(int16_t));
+        size_t size = 4096;
+        while (size < wanted)
+            size <<= 1;
+        return size;
+    }
+
+    size_t align_up(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+void ShmRing::attach(uint8_t *base, size_t size)
+{
+    m_header = reinterpret_cast<ShmRingHeader *>(base);
+    m_data = base + sizeof(ShmRingHeader);
+    m_size = size;
+}
+
+bool ShmRing::write(const void *data, size_t len)
+{
+    const uint64_t write = m_header->write.load(std::memory_order_relaxed);
+    const uint64_t read = m_header->read.load(std::memory_order_acquire);
+    // read comes from the other process; a value ahead of write counts as full
+    const uint64_t used = write - read;
+    if (used > m_size || len > m_size - used)
+    {
+        m_header->dropped.fetch_add(len, std::memory_order_relaxed);
+        return false;
+    }
+    const size_t pos = write & (m_size - 1);
+    const size_t first = std::min(len, m_size - pos);
+    memcpy(m_data + pos, data, first);
+    memcpy(m_data, static_cast<const uint8_t *>(data) + first, len - first);
+    m_header->write.store(write + len, std::memory_order_release);
+    return true;
+}
+
+size_t ShmRing::peek(const uint8_t **data, size_t max)
+{
+    const uint64_t read = m_header->read.load(std::memory_order_relaxed);
+    const uint64_t write = m_header->write.load(std::memory_order_acquire);
+    const uint64_t available = write - read;
+    if (available > m_size)
+    {
+        // write comes from the other process and overran the ring
+        m_header->read.store(write, std::memory_order_release);
+        return 0;
+    }
+    if (available == 0)
+        return 0;
+    const size_t pos = read & (m_size - 1);
+    *data = m_data + pos;
+    return (size_t)std::min<uint64_t>(std::min<uint64_t>(available, m_size - pos), max);
+}
+
+void ShmRing::consume(size_t len)
+{
+    m_header->read.store(m_header->read.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+
+void ShmRing::discard()
+{
+    m_header->read.store(m_header->write.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+uint64_t ShmRing::dropped() const
+{
+    return m_header->dropped.load(std::memory_order_relaxed);
+}
+
+ShmAudioSegment::ShmAudioSegment(const std::string &name, uint8_t *base, size_t size)
+    : m_name(name), m_base(base), m_size(size)
+{
+    const ShmAudioHeader *header = reinterpret_cast<const ShmAudioHeader *>(base);
+    m_capture.attach(base + header->capture_offset, header->capture_size);
+    m_playback.attach(base + header->playback_offset, header->playback_size);
+}
+
+ShmAudioSegment *ShmAudioSegment::create(const char *uuid, const ShmAudioConfig &config, int capture_rate, int playback_rate,
+                                         int channels, std::string &error)
+{
+    const std::string name = std::string(SHM_AUDIO_PREFIX) + uuid;
+    const size_t capture_size = ring_bytes(config.ring_ms, capture_rate, channels);
+    const size_t playback_size = ring_bytes(config.ring_ms, playback_rate, channels);
+    const size_t capture_offset = align_up(sizeof(ShmAudioHeader), 64);
+    const size_t playback_offset = capture_offset + sizeof(ShmRingHeader) + capture_size;
+    const size_t size = playback_offset + sizeof(ShmRingHeader) + playback_size;
+
+    // a leftover of a crashed run under the same uuid is replaced
+    shm_unlink(name.c_str());
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, SHM_AUDIO_MODE);
+    if (fd < 0)
+    {
+        error = name + ": " + strerror(errno);
+        return nullptr;
+    }
+    fchmod(fd, SHM_AUDIO_MODE); // not narrowed by the umask
+    void *base = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        error = name + ": " + strerror(errno);
+        close(fd);
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+    close(fd);
+
+    // ftruncate zero filled it, so the ring counters start at 0
+    auto *header = new (base) ShmAudioHeader();
+    header->version = SHM_AUDIO_VERSION;
+    header->header_size = sizeof(ShmAudioHeader);
+    header->capture_rate = capture_rate;
+    header->playback_rate = playback_rate;
+    header->channels = channels;
+    header->capture_offset = capture_offset;
+    header->capture_size = capture_size;
+    header->playback_offset = playback_offset;
+    header->playback_size = playback_size;
+    new (static_cast<uint8_t *>(base) + capture_offset) ShmRingHeader();
+    new (static_cast<uint8_t *>(base) + playback_offset) ShmRingHeader();
+    // the magic last, a consumer that sees it sees the rest
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, SHM_AUDIO_MAGIC, sizeof(header->magic));
+
+    return new ShmAudioSegment(name, static_cast<uint8_t *>(base), size);
+}
+
+ShmAudioSegment::~ShmAudioSegment()
+{
+    reinterpret_cast<ShmAudioHeader *>(m_base)->closed.store(1, std::memory_order_release);
+    munmap(m_base, m_size);
+    shm_unlink(m_name.c_str());
+}
@@ -0,0 +1,134 @@
+#ifndef SHM_AUDIO_H
+#define SHM_AUDIO_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define SHM_AUDIO_MAGIC "VSAUDIO1"
+#define SHM_AUDIO_VERSION 1
+#define SHM_AUDIO_PREFIX "/video_stream."
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory rings need lock free 64 bit atomics");
+
+struct ShmAudioConfig
+{
+    bool enabled = false;
+    int ring_ms = 2000; /* audio each ring holds, rounded up to a power of two in bytes */
+};
+
+/*
+ * Segment layout, shared with the consumer process. All fields are native
+ * endian; the segment is only ever mapped on this host.
+ *
+ *   ShmAudioHeader at offset 0
+ *   capture ring:  ShmRingHeader at capture_offset, capture_size data bytes after it
+ *   playback ring: ShmRingHeader at playback_offset, playback_size data bytes after it
+ *
+ * Each ring has one producer and one consumer. write and read count bytes
+ * since the start and only grow; the producer stores write with release
+ * after copying the data, the consumer stores read with release after
+ * taking it. Data sits at (count % size) and wraps.
+ */
+struct ShmRingHeader
+{
+    alignas(64) std::atomic<uint64_t> write; /* producer only */
+    alignas(64) std::atomic<uint64_t> read;  /* consumer only */
+    alignas(64) std::atomic<uint64_t> dropped; /* bytes the producer dropped on a full ring */
+};
+
+struct ShmAudioHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t capture_rate;  /* L16 from the call, at the websocket sample rate */
+    uint32_t playback_rate; /* L16 to the call, at the session sample rate */
+    uint32_t channels;
+    uint32_t reserved;
+    uint64_t capture_offset;
+    uint64_t capture_size;
+    uint64_t playback_offset;
+    uint64_t playback_size;
+    std::atomic<uint32_t> closed; /* set when the stream ends; the name is unlinked then */
+};
+
+/* One direction of a segment, seen from the side that uses it. */
+class ShmRing
+{
+public:
+    ShmRing() : m_header(nullptr), m_data(nullptr), m_size(0) {}
+    void attach(uint8_t *base, size_t size);
+
+    /* producer: all of data or nothing, a full ring counts the bytes as dropped */
+    bool write(const void *data, size_t len);
+
+    /*
+     * consumer: the contiguous readable bytes at the read position, at most
+     * max; a producer that claims more than the ring holds is skipped over
+     */
+    size_t peek(const uint8_t **data, size_t max);
+    void consume(size_t len);
+    /* consumer: drops everything queued */
+    void discard();
+
+    size_t size() const
+    {
+        return m_size;
+    }
+    uint64_t dropped() const;
+
+private:
+    ShmRingHeader *m_header;
+    uint8_t *m_data;
+    size_t m_size;
+};
+
+/*
+ * Per-stream POSIX shared memory segment (/dev/shm) carrying the audio of
+ * a stream to and from a process on the same host, while the websocket
+ * keeps carrying JSON control and events. The module produces into the
+ * capture ring and consumes the playback ring. The segment is unlinked
+ * when the stream ends; a consumer that still has it mapped keeps its
+ * memory until it unmaps.
+ */
+class ShmAudioSegment
+{
+public:
+    /* null with error set when the segment cannot be created */
+    static ShmAudioSegment *create(const char *uuid, const ShmAudioConfig &config, int capture_rate, int playback_rate,
+                                   int channels, std::string &error);
+    ~ShmAudioSegment();
+
+    ShmAudioSegment(const ShmAudioSegment &) = delete;
+    ShmAudioSegment &operator=(const ShmAudioSegment &) = delete;
+
+    ShmRing &capture()
+    {
+        return m_capture;
+    }
+    ShmRing &playback()
+    {
+        return m_playback;
+    }
+    const std::string &name() const
+    {
+        return m_name;
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    ShmAudioSegment(const std::string &name, uint8_t *base, size_t size);
+
+    std::string m_name;
+    uint8_t *m_base;
+    size_t m_size;
+    ShmRing m_capture;
+    ShmRing m_playback;
+};
+
+#endif // SHM_AUDIO_H
@@ -0,0 +1,51 @@
+#include <algorithm>
+#include <cstdlib>
+#include "slab_allocator.h"
+
+SlabPool::SlabPool(size_t block_size, size_t blocks_per_slab)
+    : m_block_size((std::max(block_size, sizeof(FreeBlock)) + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN),
+      m_blocks_per_slab(blocks_per_slab ? blocks_per_slab : 1), m_free(nullptr)
+{
+}
+
+SlabPool::~SlabPool()
+{
+    for (void *slab : m_slabs)
+        free(slab);
+}
+
+void *SlabPool::allocate()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_free)
+    {
+        void *slab = nullptr;
+        if (posix_memalign(&slab, SLAB_ALIGN, m_block_size * m_blocks_per_slab) != 0)
+            return nullptr;
+        m_slabs.push_back(slab);
+        char *base = static_cast<char *>(slab);
+        for (size_t i = m_blocks_per_slab; i-- > 0;)
+        {
+            auto *block = reinterpret_cast<FreeBlock *>(base + i * m_block_size);
+            block->next = m_free;
+            m_free = block;
+        }
+    }
+    FreeBlock *block = m_free;
+    m_free = block->next;
+    return block;
+}
+
+void SlabPool::deallocate(void *block)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto *freed = static_cast<FreeBlock *>(block);
+    freed->next = m_free;
+    m_free = freed;
+}
+
+size_t SlabPool::reservedBytes()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_slabs.size() * m_blocks_per_slab * m_block_size;
+}
@@ -0,0 +1,84 @@
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#define SLAB_ALIGN 64 /* cache line; objects of different sessions never share one */
+
+/*
+ * Fixed size block allocator for per-session objects. Blocks are carved
+ * from slabs of blocks_per_slab and recycled through a free list, so call
+ * setup and teardown do not go through malloc and blocks of concurrent
+ * sessions stay packed together. Slabs are kept until the module unloads.
+ */
+class SlabPool
+{
+public:
+    SlabPool(size_t block_size, size_t blocks_per_slab);
+    ~SlabPool();
+
+    void *allocate();
+    void deallocate(void *block);
+
+    size_t blockSize() const
+    {
+        return m_block_size;
+    }
+
+    /* bytes reserved from the system, used or free */
+    size_t reservedBytes();
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    const size_t m_block_size;
+    const size_t m_blocks_per_slab;
+    std::mutex m_mutex;
+    FreeBlock *m_free;
+    std::vector<void *> m_slabs;
+};
+
+/*
+ * Base class routing new/delete of T through a SlabPool shared by all
+ * instances of T. Derived types of a different size fall back to the heap.
+ */
+template <typename T, size_t BlocksPerSlab = 32>
+class SlabAllocated
+{
+public:
+    static void *operator new(size_t size)
+    {
+        if (size != sizeof(T))
+            return ::operator new(size);
+        void *block = pool().allocate();
+        if (!block)
+            throw std::bad_alloc();
+        return block;
+    }
+
+    static void operator delete(void *block, size_t size)
+    {
+        if (!block)
+            return;
+        if (size != sizeof(T))
+        {
+            ::operator delete(block);
+            return;
+        }
+        pool().deallocate(block);
+    }
+
+    static SlabPool &pool()
+    {
+        static SlabPool slab(sizeof(T), BlocksPerSlab);
+        return slab;
+    }
+};
+
+#endif // SLAB_ALLOCATOR_H
@@ -0,0 +1,481 @@
+#include <algorithm>
+#include <cstdlib>
+#include <switch_json.h>
+#include "stream_profile.h"
+#include "video_streamer_glue.h"
+#include "ws_transport.h"
+
+void stream_profile_parse_headers(const char *json, std::vector<std::pair<std::string, std::string>> &headers)
+{
+    cJSON *headers_json = json ? cJSON_Parse(json) : nullptr;
+    if (!headers_json)
+        return;
+    cJSON *iterator = headers_json->child;
+    while (iterator)
+    {
+        if (iterator->type == cJSON_String && iterator->valuestring != nullptr)
+        {
+            headers.emplace_back(iterator->string, iterator->valuestring);
+        }
+        iterator = iterator->next;
+    }
+    cJSON_Delete(headers_json);
+}
+
+bool stream_profile_parse_fanout(const char *list, std::vector<FanoutTarget> &targets)
+{
+    const std::string value(list ? list : "");
+    size_t start = 0;
+    while (start <= value.size())
+    {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos)
+            end = value.size();
+        std::string entry = value.substr(start, end - start);
+        start = end + 1;
+        entry.erase(0, entry.find_first_not_of(" \t"));
+        entry.erase(entry.find_last_not_of(" \t") + 1);
+        if (entry.empty())
+            continue;
+
+        // '|' is not valid in a url, so it can separate the rate
+        FanoutTarget target;
+        const size_t bar = entry.find('|');
+        if (bar != std::string::npos)
+        {
+            target.rate = atoi(entry.c_str() + bar + 1);
+            if (target.rate <= 0 || target.rate % 8000 != 0)
+                return false;
+            entry.erase(bar);
+        }
+        char wsUri[MAX_WS_URI];
+        if (!validate_ws_uri(entry.c_str(), wsUri))
+            return false;
+        target.url = wsUri;
+        targets.push_back(std::move(target));
+    }
+    return true;
+}
+
+namespace
+{
+    // Applies the buffer size (ms of audio per websocket frame); shared by
+    // STREAM_BUFFER_SIZE and the buffer-size profile param.
+    void set_buffer_size(StreamProfile &profile, const char *value, const char *owner)
+    {
+        int bSize = atoi(value);
+        if (bSize % 20 != 0)
+        {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "%s: Buffer size of %s is not a multiple of 20ms. Using default 20ms.\n",
+                              owner, value);
+        }
+        else if (bSize >= 20)
+        {
+            profile.rtp_packets = bSize / 20;
+        }
+    }
+
+    void finish_playout(PlayoutConfig &playout)
+    {
+        if (playout.max_ms < playout.target_ms + 100)
+            playout.max_ms = playout.target_ms + 100;
+    }
+
+    // oldest or newest, shared by STREAM_SEND_DROP and the send-drop param
+    bool set_send_drop(SendQueueConfig &send, const char *value)
+    {
+        if (!strcasecmp(value, "oldest"))
+            send.drop_newest = false;
+        else if (!strcasecmp(value, "newest"))
+            send.drop_newest = true;
+        else
+            return false;
+        return true;
+    }
+
+    // One <param name=".." value=".."/> of a profile. Names follow the
+    // STREAM_* channel variables, lower case with dashes.
+    bool set_profile_param(StreamProfile &profile, const char *name, const char *value)
+    {
+        if (!strcasecmp(name, "url"))
+        {
+            char wsUri[MAX_WS_URI];
+            if (!validate_ws_uri(value, wsUri))
+                return false;
+            profile.ws_uri = wsUri;
+        }
+        else if (!strcasecmp(name, "group"))
+            profile.group = value;
+        else if (!strcasecmp(name, "sample-rate"))
+        {
+            profile.sampling = atoi(value);
+            if (profile.sampling <= 0 || profile.sampling % 8000 != 0)
+                return false;
+        }
+        else if (!strcasecmp(name, "message-deflate"))
+            profile.deflate = switch_true(value) ? 1 : 0;
+        else if (!strcasecmp(name, "deflate-binary"))
+            profile.compression.binary = switch_true(value);
+        else if (!strcasecmp(name, "deflate-level"))
+            profile.compression.level = std::max(1, std::min(9, atoi(value)));
+        else if (!strcasecmp(name, "deflate-window-bits"))
+            profile.compression.window_bits = std::max(DEFLATE_MIN_WINDOW_BITS, std::min(DEFLATE_MAX_WINDOW_BITS, atoi(value)));
+        else if (!strcasecmp(name, "deflate-no-context-takeover"))
+            profile.compression.no_context_takeover = switch_true(value);
+        else if (!strcasecmp(name, "heart-beat"))
+            profile.heart_beat = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "suppress-log"))
+            profile.suppress_log = switch_true(value);
+        else if (!strcasecmp(name, "no-reconnect"))
+            profile.reconnect.enabled = !switch_true(value);
+        else if (!strcasecmp(name, "reconnect-initial"))
+            profile.reconnect.initial_ms = std::max(1, atoi(value));
+        else if (!strcasecmp(name, "reconnect-max"))
+            profile.reconnect.max_ms = std::max(1, atoi(value));
+        else if (!strcasecmp(name, "reconnect-attempts"))
+            profile.reconnect.attempts = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "reconnect-buffer"))
+            profile.capture.replay_ms = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "buffer-size"))
+            set_buffer_size(profile, value, profile.name.c_str());
+        else if (!strcasecmp(name, "extra-headers"))
+            stream_profile_parse_headers(value, profile.headers);
+        else if (!strcasecmp(name, "tls-ca-file"))
+            profile.tls_cafile = value;
+        else if (!strcasecmp(name, "tls-key-file"))
+            profile.tls_keyfile = value;
+        else if (!strcasecmp(name, "tls-cert-file"))
+            profile.tls_certfile = value;
+        else if (!strcasecmp(name, "tls-disable-hostname-validation"))
+            profile.tls_disable_hostname_validation = switch_true(value);
+        else if (!strcasecmp(name, "vad"))
+            profile.vad.enabled = switch_true(value);
+        else if (!strcasecmp(name, "vad-threshold"))
+            profile.vad.threshold_dbfs = atoi(value);
+        else if (!strcasecmp(name, "vad-hangover"))
+            profile.vad.hangover_ms = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "vad-preroll"))
+            profile.vad.preroll_ms = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "vad-keepalive"))
+            profile.vad.keepalive_ms = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "playout-target"))
+            profile.playout.target_ms = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "playout-max"))
+            profile.playout.max_ms = atoi(value);
+        else if (!strcasecmp(name, "connect-buffer"))
+            profile.capture.connect_ms = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "pause-preroll"))
+            profile.capture.pause_ms = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "shm-audio"))
+            profile.shm.enabled = switch_true(value);
+        else if (!strcasecmp(name, "shm-ring"))
+            profile.shm.ring_ms = std::max(100, atoi(value));
+        else if (!strcasecmp(name, "send-queue"))
+            profile.send.max_ms = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "send-queue-bytes"))
+            profile.send.max_bytes = (size_t)std::max(0, atoi(value));
+        else if (!strcasecmp(name, "send-drop"))
+            return set_send_drop(profile.send, value);
+        else if (!strcasecmp(name, "fanout"))
+            return stream_profile_parse_fanout(value, profile.fanout);
+        else if (!strcasecmp(name, "adaptive-quality"))
+            profile.quality.enabled = switch_true(value);
+        else if (!strcasecmp(name, "adaptive-down-ms"))
+            profile.quality.down_ms = std::max(20, atoi(value));
+        else if (!strcasecmp(name, "adaptive-recover-ms"))
+            profile.quality.recover_ms = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "event-types"))
+        {
+            profile.events.filter = true;
+            EventDispatchConfig::parseList(value, profile.events.allow);
+        }
+        else if (!strcasecmp(name, "event-coalesce-types"))
+        {
+            EventDispatchConfig::parseList(value, profile.events.coalesce);
+            if (profile.events.coalesce_ms == 0)
+                profile.events.coalesce_ms = 200;
+        }
+        else if (!strcasecmp(name, "event-coalesce-ms"))
+            profile.events.coalesce_ms = std::max(0, atoi(value));
+        else if (!strcasecmp(name, "event-light"))
+            profile.event_light = switch_true(value);
+        else if (!strcasecmp(name, "response-queue"))
+            profile.events.queue_max = (size_t)std::max(0, atoi(value));
+        else
+            return false;
+        return true;
+    }
+}
+
+bool stream_profiles_load(StreamModuleConfig &config)
+{
+    switch_xml_t cfg, xml, settings, groups, profiles;
+
+    if (!(xml = switch_xml_open_cfg(STREAM_PROFILE_CONF, &cfg, NULL)))
+    {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s not found, no stream profiles defined\n", STREAM_PROFILE_CONF);
+        return false;
+    }
+
+    if ((settings = switch_xml_child(cfg, "settings")))
+    {
+        for (switch_xml_t param = switch_xml_child(settings, "param"); param; param = param->next)
+        {
+            const char *name = switch_xml_attr_soft(param, "name");
+            const char *value = switch_xml_attr_soft(param, "value");
+            if (!strcasecmp(name, "teardown-workers"))
+                config.teardown.workers = std::max(1, atoi(value));
+            else if (!strcasecmp(name, "close-deadline-ms"))
+                config.teardown.close_deadline_ms = std::max(100, atoi(value));
+            else if (!strcasecmp(name, "probe-interval-ms"))
+                config.probe.interval_ms = std::max(0, atoi(value));
+            else if (!strcasecmp(name, "probe-timeout-ms"))
+                config.probe.timeout_ms = std::max(100, atoi(value));
+            else if (config.admission.set(name, value) || config.dns.set(name, value) || config.media.set(name, value))
+                continue;
+            else
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "%s: unknown setting %s\n", STREAM_PROFILE_CONF, name);
+        }
+    }
+
+    // groups first, profiles refer to them by name
+    if ((groups = switch_xml_child(cfg, "groups")))
+    {
+        for (switch_xml_t xgroup = switch_xml_child(groups, "group"); xgroup; xgroup = xgroup->next)
+        {
+            const char *group_name = switch_xml_attr_soft(xgroup, "name");
+            const char *policy_name = switch_xml_attr(xgroup, "policy");
+            EndpointGroup::Policy policy = EndpointGroup::FAILOVER;
+            if (zstr(group_name) || (policy_name && !EndpointGroup::parsePolicy(policy_name, policy)))
+            {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "%s: group %s: missing name or unknown policy, ignored\n",
+                                  STREAM_PROFILE_CONF, group_name);
+                continue;
+            }
+
+            std::vector<std::string> urls;
+            bool valid = true;
+            for (switch_xml_t endpoint = switch_xml_child(xgroup, "endpoint"); endpoint; endpoint = endpoint->next)
+            {
+                const char *url = switch_xml_attr_soft(endpoint, "url");
+                char wsUri[MAX_WS_URI];
+                if (!validate_ws_uri(url, wsUri))
+                {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "%s: group %s: invalid endpoint %s\n",
+                                      STREAM_PROFILE_CONF, group_name, url);
+                    valid = false;
+                }
+                else if (std::find(urls.begin(), urls.end(), wsUri) == urls.end())
+                {
+                    urls.push_back(wsUri);
+                }
+            }
+            if (valid && std::any_of(urls.begin(), urls.end(), WsTransport::isUnix) &&
+                !std::all_of(urls.begin(), urls.end(), WsTransport::isUnix))
+            {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "%s: group %s mixes ws+unix:// with network urls\n",
+                                  STREAM_PROFILE_CONF, group_name);
+                valid = false;
+            }
+            if (!valid || urls.empty())
+            {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "%s: group %s not loaded\n", STREAM_PROFILE_CONF, group_name);
+                continue;
+            }
+            config.groups[group_name] = std::make_shared<EndpointGroup>(group_name, policy, urls);
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s: loaded group %s, %zu endpoints, %s\n",
+                              STREAM_PROFILE_CONF, group_name, urls.size(), EndpointGroup::policyName(policy));
+        }
+    }
+
+    if ((profiles = switch_xml_child(cfg, "profiles")))
+    {
+        for (switch_xml_t xprofile = switch_xml_child(profiles, "profile"); xprofile; xprofile = xprofile->next)
+        {
+            const char *profile_name = switch_xml_attr_soft(xprofile, "name");
+            if (zstr(profile_name))
+            {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "%s: profile without a name ignored\n", STREAM_PROFILE_CONF);
+                continue;
+            }
+
+            auto profile = std::make_shared<StreamProfile>();
+            profile->name = profile_name;
+            bool valid = true;
+            for (switch_xml_t param = switch_xml_child(xprofile, "param"); param; param = param->next)
+            {
+                const char *name = switch_xml_attr_soft(param, "name");
+                const char *value = switch_xml_attr_soft(param, "value");
+                if (!set_profile_param(*profile, name, value))
+                {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "%s: profile %s: invalid param %s=%s\n",
+                                      STREAM_PROFILE_CONF, profile_name, name, value);
+                    valid = false;
+                }
+            }
+            if (switch_xml_t headers = switch_xml_child(xprofile, "headers"))
+            {
+                for (switch_xml_t header = switch_xml_child(headers, "header"); header; header = header->next)
+                {
+                    const char *name = switch_xml_attr_soft(header, "name");
+                    if (!zstr(name))
+                        profile->headers.emplace_back(name, switch_xml_attr_soft(header, "value"));
+                }
+            }
+            finish_playout(profile->playout);
+
+            if (!profile->group.empty() && !config.groups.count(profile->group))
+            {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "%s: profile %s: unknown group %s\n",
+                                  STREAM_PROFILE_CONF, profile_name, profile->group.c_str());
+                valid = false;
+            }
+            if (!valid)
+            {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "%s: profile %s not loaded\n", STREAM_PROFILE_CONF, profile_name);
+                continue;
+            }
+            if (!profile->group.empty())
+            {
+                EndpointConnectOptions options;
+                options.tls_cafile = profile->tls_cafile;
+                options.tls_keyfile = profile->tls_keyfile;
+                options.tls_certfile = profile->tls_certfile;
+                options.tls_disable_hostname_validation = profile->tls_disable_hostname_validation;
+                options.headers = profile->headers;
+                config.groups[profile->group]->useConnectOptions(options);
+            }
+            config.profiles[profile->name] = profile;
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s: loaded profile %s\n", STREAM_PROFILE_CONF, profile_name);
+        }
+    }
+
+    switch_xml_free(xml);
+    return true;
+}
+
+void stream_profile_from_channel(switch_core_session_t *session, StreamProfile &profile)
+{
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    const char *value;
+
+    if (switch_channel_var_true(channel, "STREAM_MESSAGE_DEFLATE"))
+    {
+        profile.deflate = 1;
+    }
+    if (switch_channel_var_true(channel, "STREAM_DEFLATE_BINARY"))
+        profile.compression.binary = true;
+    if ((value = switch_channel_get_variable(channel, "STREAM_DEFLATE_LEVEL")))
+        profile.compression.level = std::max(1, std::min(9, atoi(value)));
+    if ((value = switch_channel_get_variable(channel, "STREAM_DEFLATE_WINDOW_BITS")))
+        profile.compression.window_bits = std::max(DEFLATE_MIN_WINDOW_BITS, std::min(DEFLATE_MAX_WINDOW_BITS, atoi(value)));
+    if (switch_channel_var_true(channel, "STREAM_DEFLATE_NO_CONTEXT_TAKEOVER"))
+        profile.compression.no_context_takeover = true;
+
+    if (switch_channel_var_true(channel, "STREAM_SUPPRESS_LOG"))
+    {
+        profile.suppress_log = true;
+    }
+
+    if (switch_channel_var_true(channel, "STREAM_NO_RECONNECT"))
+    {
+        profile.reconnect.enabled = false;
+    }
+    if ((value = switch_channel_get_variable(channel, "STREAM_RECONNECT_INITIAL")))
+        profile.reconnect.initial_ms = std::max(1, atoi(value));
+    if ((value = switch_channel_get_variable(channel, "STREAM_RECONNECT_MAX")))
+        profile.reconnect.max_ms = std::max(1, atoi(value));
+    if ((value = switch_channel_get_variable(channel, "STREAM_RECONNECT_ATTEMPTS")))
+        profile.reconnect.attempts = std::max(0, atoi(value));
+    if ((value = switch_channel_get_variable(channel, "STREAM_RECONNECT_BUFFER")))
+        profile.capture.replay_ms = std::max(0, atoi(value));
+
+    if ((value = switch_channel_get_variable(channel, "STREAM_TLS_CA_FILE")))
+        profile.tls_cafile = value;
+    if ((value = switch_channel_get_variable(channel, "STREAM_TLS_KEY_FILE")))
+        profile.tls_keyfile = value;
+    if ((value = switch_channel_get_variable(channel, "STREAM_TLS_CERT_FILE")))
+        profile.tls_certfile = value;
+
+    if (switch_channel_var_true(channel, "STREAM_TLS_DISABLE_HOSTNAME_VALIDATION"))
+    {
+        profile.tls_disable_hostname_validation = true;
+    }
+
+    if ((value = switch_channel_get_variable(channel, "STREAM_HEART_BEAT")))
+    {
+        char *endptr;
+        long heart_beat = strtol(value, &endptr, 10);
+        if (*endptr == '\0' && heart_beat <= INT_MAX && heart_beat >= INT_MIN)
+        {
+            profile.heart_beat = (int)heart_beat;
+        }
+    }
+
+    if ((value = switch_channel_get_variable(channel, "STREAM_BUFFER_SIZE")))
+        set_buffer_size(profile, value, switch_channel_get_name(channel));
+
+    stream_profile_parse_headers(switch_channel_get_variable(channel, "STREAM_EXTRA_HEADERS"), profile.headers);
+
+    if (switch_channel_var_true(channel, "STREAM_VAD"))
+    {
+        profile.vad.enabled = true;
+        if ((value = switch_channel_get_variable(channel, "STREAM_VAD_THRESHOLD")))
+            profile.vad.threshold_dbfs = atoi(value);
+        if ((value = switch_channel_get_variable(channel, "STREAM_VAD_HANGOVER")))
+            profile.vad.hangover_ms = std::max(0, atoi(value));
+        if ((value = switch_channel_get_variable(channel, "STREAM_VAD_PREROLL")))
+            profile.vad.preroll_ms = std::max(0, atoi(value));
+        if ((value = switch_channel_get_variable(channel, "STREAM_VAD_KEEPALIVE")))
+            profile.vad.keepalive_ms = std::max(0, atoi(value));
+    }
+
+    if ((value = switch_channel_get_variable(channel, "STREAM_PLAYOUT_TARGET")))
+        profile.playout.target_ms = std::max(0, atoi(value));
+    if ((value = switch_channel_get_variable(channel, "STREAM_PLAYOUT_MAX")))
+        profile.playout.max_ms = atoi(value);
+    finish_playout(profile.playout);
+
+    if ((value = switch_channel_get_variable(channel, "STREAM_CONNECT_BUFFER")))
+        profile.capture.connect_ms = std::max(0, atoi(value));
+    if ((value = switch_channel_get_variable(channel, "STREAM_PAUSE_PREROLL")))
+        profile.capture.pause_ms = std::max(0, atoi(value));
+
+    if (switch_channel_var_true(channel, "STREAM_SHM_AUDIO"))
+        profile.shm.enabled = true;
+    if ((value = switch_channel_get_variable(channel, "STREAM_SHM_RING")))
+        profile.shm.ring_ms = std::max(100, atoi(value));
+
+    if ((value = switch_channel_get_variable(channel, "STREAM_SEND_QUEUE")))
+        profile.send.max_ms = std::max(0, atoi(value));
+    if ((value = switch_channel_get_variable(channel, "STREAM_SEND_QUEUE_BYTES")))
+        profile.send.max_bytes = (size_t)std::max(0, atoi(value));
+    if ((value = switch_channel_get_variable(channel, "STREAM_SEND_DROP")) && !set_send_drop(profile.send, value))
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING, "STREAM_SEND_DROP: expected oldest or newest, got %s\n", value);
+
+    if ((value = switch_channel_get_variable(channel, "STREAM_FANOUT")) && !stream_profile_parse_fanout(value, profile.fanout))
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING, "STREAM_FANOUT: invalid destination in %s\n", value);
+
+    if (switch_channel_var_true(channel, "STREAM_ADAPTIVE_QUALITY"))
+        profile.quality.enabled = true;
+    if ((value = switch_channel_get_variable(channel, "STREAM_ADAPTIVE_DOWN_MS")))
+        profile.quality.down_ms = std::max(20, atoi(value));
+    if ((value = switch_channel_get_variable(channel, "STREAM_ADAPTIVE_RECOVER_MS")))
+        profile.quality.recover_ms = std::max(0, atoi(value));
+
+    if ((value = switch_channel_get_variable(channel, "STREAM_EVENT_TYPES")))
+    {
+        profile.events.filter = true;
+        EventDispatchConfig::parseList(value, profile.events.allow);
+    }
+    if ((value = switch_channel_get_variable(channel, "STREAM_EVENT_COALESCE_TYPES")))
+    {
+        EventDispatchConfig::parseList(value, profile.events.coalesce);
+        profile.events.coalesce_ms = 200;
+        if ((value = switch_channel_get_variable(channel, "STREAM_EVENT_COALESCE_MS")))
+            profile.events.coalesce_ms = std::max(0, atoi(value));
+    }
+    if ((value = switch_channel_get_variable(channel, "STREAM_RESPONSE_QUEUE")))
+        profile.events.queue_max = (size_t)std::max(0, atoi(value));
+    profile.event_light = switch_channel_var_true(channel, "STREAM_EVENT_LIGHT");
+}
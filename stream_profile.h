@@ -0,0 +1,91 @@
+#ifndef STREAM_PROFILE_H
+#define STREAM_PROFILE_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "mod_video_stream.h"
+#include "audio_vad.h"
+#include "playout_buffer.h"
+#include "event_dispatcher.h"
+#include "teardown_pool.h"
+#include "media_worker.h"
+#include "capture_ring.h"
+#include "reconnect_backoff.h"
+#include "endpoint_group.h"
+#include "admission.h"
+#include "dns_cache.h"
+#include "shm_audio.h"
+#include "send_queue.h"
+#include "audio_quality.h"
+#include "fanout.h"
+#include "message_deflate.h"
+
+#define STREAM_PROFILE_CONF "video_stream.conf"
+
+/*
+ * Everything a stream needs besides the session: connection, TLS, headers,
+ * buffering and the optional audio/event features. Built either once per
+ * named profile from video_stream.conf, or per start from the STREAM_*
+ * channel variables when no profile is used. Never modified once built.
+ */
+struct StreamProfile
+{
+    std::string name;
+    std::string ws_uri; /* validated; empty when the start command supplies it */
+    std::string group;  /* endpoint group used instead of ws_uri */
+    int sampling = 0;   /* websocket sample rate, 0 when the start command supplies it */
+
+    std::string tls_cafile; /* empty values are not passed to the client */
+    std::string tls_keyfile;
+    std::string tls_certfile;
+    bool tls_disable_hostname_validation = false;
+
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    int deflate = 0; /* 1 disables per message deflate */
+    DeflateConfig compression; /* what is deflated, and how, unless disabled */
+    int heart_beat = 0;
+    bool suppress_log = false;
+    int rtp_packets = 1; /* 20ms packets per websocket frame */
+
+    VoiceGateConfig vad;
+    PlayoutConfig playout;
+    CaptureConfig capture;
+    ReconnectConfig reconnect;
+    ShmAudioConfig shm;
+    SendQueueConfig send;
+    AdaptiveQualityConfig quality;
+    std::vector<FanoutTarget> fanout; /* destinations that get the same audio */
+    EventDispatchConfig events;
+    bool event_light = false;
+};
+
+typedef std::unordered_map<std::string, std::shared_ptr<const StreamProfile>> StreamProfileMap;
+
+struct StreamModuleConfig
+{
+    TeardownConfig teardown;
+    MediaWorkerConfig media;
+    ProbeConfig probe;
+    AdmissionConfig admission;
+    DnsConfig dns;
+    StreamProfileMap profiles;
+    EndpointGroupMap groups;
+};
+
+/* reads STREAM_PROFILE_CONF; a missing file leaves the defaults and no profiles */
+bool stream_profiles_load(StreamModuleConfig &config);
+
+/* builds the per-start settings from the STREAM_* channel variables */
+void stream_profile_from_channel(switch_core_session_t *session, StreamProfile &profile);
+
+/* adds the string members of a JSON object as headers, as in STREAM_EXTRA_HEADERS */
+void stream_profile_parse_headers(const char *json, std::vector<std::pair<std::string, std::string>> &headers);
+
+/* adds the destinations of a comma separated url[|rate] list, as in STREAM_FANOUT; false if one is invalid */
+bool stream_profile_parse_fanout(const char *list, std::vector<FanoutTarget> &targets);
+
+#endif // STREAM_PROFILE_H
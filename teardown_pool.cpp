@@ -0,0 +1,158 @@
+#include "mod_video_stream.h"
+#include "teardown_pool.h"
+
+#define TEARDOWN_MONITOR_MS 250
+
+TeardownPool::TeardownPool(const TeardownConfig &config)
+    : m_config(config), m_workers(config.workers > 0 ? (size_t)config.workers : 1),
+      m_slots(2 * m_workers), m_threads(2 * m_workers), m_stopping(false), m_completed(0), m_late(0)
+{
+    for (size_t i = 0; i < m_workers; i++)
+    {
+        m_slots[i].running = true;
+        m_threads[i] = std::thread(&TeardownPool::work, this, i, false);
+    }
+    m_monitor = std::thread(&TeardownPool::monitor, this);
+}
+
+TeardownPool::~TeardownPool()
+{
+    shutdown();
+}
+
+void TeardownPool::submit(const std::string &name, std::function<void()> job)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(Job{name, std::move(job), clock::now() + std::chrono::milliseconds(m_config.close_deadline_ms)});
+    m_cv.notify_one();
+}
+
+TeardownPool::Stats TeardownPool::stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const clock::time_point now = clock::now();
+    Stats stats = {m_queue.size(), 0, 0, 0, m_completed, m_late};
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+        if (i >= m_workers && m_slots[i].running)
+            stats.spares++;
+        if (m_slots[i].busy)
+        {
+            stats.active++;
+            if (now > m_slots[i].deadline)
+                stats.overdue++;
+        }
+    }
+    return stats;
+}
+
+void TeardownPool::work(size_t slot, bool spare)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        if (spare)
+        {
+            // spares only help out while the queue is backed up
+            if (m_queue.empty())
+                break;
+        }
+        else
+        {
+            m_cv.wait(lock, [this]
+                      { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty())
+                break;
+        }
+
+        Job job = std::move(m_queue.front());
+        m_queue.pop_front();
+        Slot &s = m_slots[slot];
+        s.busy = true;
+        s.reported = false;
+        s.name = job.name;
+        s.deadline = job.deadline;
+        lock.unlock();
+
+        try
+        {
+            job.run();
+        }
+        catch (const std::exception &e)
+        {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "(%s) teardown failed: %s\n", job.name.c_str(), e.what());
+        }
+        job.run = nullptr; // release the streamer before the slot is free again
+
+        lock.lock();
+        s.busy = false;
+        m_completed++;
+        if (clock::now() > job.deadline)
+            m_late++;
+    }
+    m_slots[slot].running = false;
+}
+
+void TeardownPool::monitor()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping)
+    {
+        m_monitor_cv.wait_for(lock, std::chrono::milliseconds(TEARDOWN_MONITOR_MS));
+
+        const clock::time_point now = clock::now();
+        size_t stuck = 0, running = 0;
+        for (auto &s : m_slots)
+        {
+            if (!s.running)
+                continue;
+            running++;
+            if (s.busy && now > s.deadline)
+            {
+                stuck++;
+                if (!s.reported)
+                {
+                    s.reported = true;
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING,
+                                      "(%s) websocket close exceeded %dms, %zu teardowns queued\n",
+                                      s.name.c_str(), m_config.close_deadline_ms, m_queue.size());
+                }
+            }
+        }
+
+        if (m_queue.empty() || stuck < running)
+            continue;
+        for (size_t i = m_workers; i < m_slots.size(); i++)
+        {
+            if (m_slots[i].running)
+                continue;
+            // a finished spare has already released the lock for good, joining is immediate
+            if (m_threads[i].joinable())
+                m_threads[i].join();
+            m_slots[i].running = true;
+            m_threads[i] = std::thread(&TeardownPool::work, this, i, true);
+            break;
+        }
+    }
+}
+
+void TeardownPool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping)
+            return;
+        m_stopping = true;
+        if (!m_queue.empty())
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "closing %zu remaining websocket connections\n", m_queue.size());
+    }
+    m_cv.notify_all();
+    m_monitor_cv.notify_all();
+    if (m_monitor.joinable())
+        m_monitor.join();
+    for (auto &t : m_threads)
+    {
+        if (t.joinable())
+            t.join();
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef TEARDOWN_POOL_H
+#define TEARDOWN_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TeardownConfig
+{
+    int workers = 4;              /* threads closing websocket connections */
+    int close_deadline_ms = 5000; /* a close still running after this is reported overdue */
+};
+
+/*
+ * Closes finished streams off the media and API threads, and runs the
+ * reconnect attempts of live ones, which start by closing the dropped
+ * connection. A fixed set of workers takes jobs from a FIFO, so a burst of
+ * hangups costs a bounded number of threads instead of one std::thread per
+ * stream.
+ *
+ * libwsc has no way to abort a socket from outside a blocking close, so a
+ * job past its deadline cannot be cut short. It is logged as overdue, and
+ * while every regular worker is stuck on an overdue close the monitor adds
+ * a spare worker (at most as many as there are regular workers) so the
+ * queue keeps draining behind it.
+ */
+class TeardownPool
+{
+public:
+    struct Stats
+    {
+        size_t queued;      /* jobs waiting for a worker */
+        size_t active;      /* jobs being closed right now */
+        size_t overdue;     /* active jobs past their deadline */
+        size_t spares;      /* spare workers running */
+        uint64_t completed; /* jobs finished since start */
+        uint64_t late;      /* finished jobs that missed their deadline */
+    };
+
+    explicit TeardownPool(const TeardownConfig &config);
+    ~TeardownPool();
+
+    /* queues a close; name is only used for logging */
+    void submit(const std::string &name, std::function<void()> job);
+
+    Stats stats();
+
+    /* runs the jobs still queued, then stops all workers */
+    void shutdown();
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct Job
+    {
+        std::string name;
+        std::function<void()> run;
+        clock::time_point deadline;
+    };
+
+    struct Slot
+    {
+        bool running = false;
+        bool busy = false;
+        bool reported = false;
+        std::string name;
+        clock::time_point deadline;
+    };
+
+    void work(size_t slot, bool spare);
+    void monitor();
+
+    const TeardownConfig m_config;
+    const size_t m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::condition_variable m_monitor_cv;
+    std::deque<Job> m_queue;
+    std::vector<Slot> m_slots;          /* regular workers first, then spares */
+    std::vector<std::thread> m_threads; /* one per slot */
+    std::thread m_monitor;
+    bool m_stopping;
+    uint64_t m_completed;
+    uint64_t m_late;
+};
+
+#endif // TEARDOWN_POOL_H
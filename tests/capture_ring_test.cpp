@@ -0,0 +1,191 @@
+// CaptureRing limits: the connect buffer, the replay cap after a drop and
+// the pause pre-roll, with the ring wrapping around.
+#include <cstdio>
+#include <vector>
+#include "capture_ring.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+namespace
+{
+    // 8 kHz mono: 16 bytes per ms, 320 byte packets of 20ms
+    const size_t BYTES_PER_MS = 16;
+    const size_t FRAME = 2;
+    const size_t PACKET = 20 * BYTES_PER_MS;
+
+    // packet n is filled with the byte n, so what is left tells which packets survived
+    void push_packets(CaptureRing &ring, int first, int last, size_t limit)
+    {
+        std::vector<uint8_t> packet(PACKET);
+        for (int i = first; i <= last; i++)
+        {
+            packet.assign(PACKET, (uint8_t)i);
+            ring.push(packet.data(), packet.size(), limit);
+        }
+    }
+
+    // drains the ring the way the stream does and returns the packet numbers
+    std::vector<int> drain(CaptureRing &ring)
+    {
+        std::vector<int> out;
+        std::vector<uint8_t> packet;
+        while (!ring.empty())
+        {
+            packet.clear();
+            while (packet.size() < PACKET && !ring.empty())
+            {
+                const uint8_t *data;
+                const size_t len = ring.peek(&data, PACKET - packet.size());
+                packet.insert(packet.end(), data, data + len);
+                ring.consume(len);
+            }
+            bool whole = packet.size() == PACKET;
+            for (uint8_t b : packet)
+                whole = whole && b == packet[0];
+            out.push_back(whole ? packet[0] : -1);
+        }
+        return out;
+    }
+
+    std::vector<int> range(int first, int last)
+    {
+        std::vector<int> out;
+        for (int i = first; i <= last; i++)
+            out.push_back(i);
+        return out;
+    }
+
+    CaptureConfig config(int connect_ms, int pause_ms, int replay_ms)
+    {
+        CaptureConfig c;
+        c.connect_ms = connect_ms;
+        c.pause_ms = pause_ms;
+        c.replay_ms = replay_ms;
+        return c;
+    }
+
+    void test_limits()
+    {
+        CaptureRing ring(config(100, 60, 200), BYTES_PER_MS, FRAME);
+        CHECK(ring.connectLimit() == 100 * BYTES_PER_MS);
+        CHECK(ring.pauseLimit() == 60 * BYTES_PER_MS);
+        CHECK(ring.replayLimit() == 200 * BYTES_PER_MS);
+        CHECK(ring.capacity() == ring.replayLimit());
+
+        // whole frames of stereo audio only
+        CaptureRing odd(config(1, 0, 0), 7, 4);
+        CHECK(odd.connectLimit() == 4);
+        CHECK(odd.pauseLimit() == 0);
+
+        // whatever the durations, a session keeps at most CAPTURE_MAX_BYTES
+        CaptureRing big(config(3600 * 1000, 0, 0), BYTES_PER_MS, FRAME);
+        CHECK(big.capacity() == CAPTURE_MAX_BYTES);
+    }
+
+    // before the first connect the most recent connect_ms is kept, in order
+    void test_connect_buffer()
+    {
+        CaptureRing ring(config(100, 0, 200), BYTES_PER_MS, FRAME);
+        push_packets(ring, 1, 12, ring.connectLimit());
+        CHECK(ring.size() == 5 * PACKET);
+        CHECK(ring.dropped() == 7 * PACKET);
+        CHECK(drain(ring) == range(8, 12));
+    }
+
+    // after a drop the replay cap applies; the ring wraps while it is
+    // drained in part and filled again
+    void test_replay_cap()
+    {
+        CaptureRing ring(config(100, 0, 200), BYTES_PER_MS, FRAME);
+        ring.markConnected();
+        CHECK(ring.connectedOnce());
+        push_packets(ring, 1, 10, ring.replayLimit());
+        CHECK(ring.size() == ring.replayLimit());
+
+        // the connection is back: three packets go out, then it drops again
+        const uint8_t *data;
+        for (int i = 0; i < 3; i++)
+        {
+            CHECK(ring.peekAt(0, &data, PACKET) == PACKET && data[0] == i + 1);
+            ring.consume(PACKET);
+        }
+        push_packets(ring, 11, 25, ring.replayLimit());
+        CHECK(ring.size() == ring.replayLimit());
+        CHECK(ring.dropped() == 12 * PACKET); // 4..15
+
+        // packets can be gathered across the wrap before consuming
+        size_t offset = 0;
+        int packets = 0;
+        size_t len;
+        while ((len = ring.peekAt(offset, &data, PACKET)) > 0)
+        {
+            offset += len;
+            packets++;
+        }
+        CHECK(offset == ring.size());
+        CHECK(packets >= 10);
+        CHECK(drain(ring) == range(16, 25));
+
+        // giving up on the reconnect drops what was kept
+        push_packets(ring, 26, 27, ring.replayLimit());
+        push_packets(ring, 28, 28, 0);
+        CHECK(ring.empty());
+    }
+
+    // a pause keeps only its last pause_ms, without it paused audio is dropped
+    void test_pause_preroll()
+    {
+        CaptureRing ring(config(100, 60, 200), BYTES_PER_MS, FRAME);
+        push_packets(ring, 1, 20, ring.pauseLimit());
+        CHECK(ring.size() == 3 * PACKET);
+        CHECK(drain(ring) == range(18, 20));
+
+        // audio queued before the pause that has not gone out yet is
+        // trimmed to the pre-roll as well
+        push_packets(ring, 21, 25, ring.replayLimit());
+        push_packets(ring, 26, 26, ring.pauseLimit());
+        CHECK(drain(ring) == range(24, 26));
+
+        CaptureRing silent(config(100, 0, 200), BYTES_PER_MS, FRAME);
+        CHECK(silent.pauseLimit() == 0);
+        push_packets(silent, 1, 5, silent.pauseLimit());
+        CHECK(silent.empty());
+        CHECK(silent.dropped() == 5 * PACKET);
+    }
+
+    // a packet larger than the limit keeps its tail
+    void test_oversized_push()
+    {
+        CaptureRing ring(config(10, 0, 0), BYTES_PER_MS, FRAME);
+        std::vector<uint8_t> big(1000);
+        for (size_t i = 0; i < big.size(); i++)
+            big[i] = (uint8_t)(i / 2);
+        ring.push(big.data(), big.size(), ring.connectLimit());
+        CHECK(ring.size() == 160);
+        const uint8_t *data;
+        CHECK(ring.peek(&data, 160) == 160);
+        CHECK(data[0] == (uint8_t)(840 / 2) && data[159] == (uint8_t)(999 / 2));
+    }
+}
+
+int main()
+{
+    test_limits();
+    test_connect_buffer();
+    test_replay_cap();
+    test_pause_preroll();
+    test_oversized_push();
+    if (failures)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+// CPU and ratio of permessage-deflate per setting, for the audio and the
+// JSON a call sends over a minute. Not a test: run it by hand, e.g.
+//   deflate_bench [seconds of audio, default 60] [rate, default 16000] [file of raw L16 mono]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "message_deflate.h"
+
+namespace
+{
+    struct Setting
+    {
+        int level;
+        int window_bits;
+        bool no_context_takeover;
+    };
+
+    const Setting settings[] = {
+        {1, 15, false}, {6, 15, false}, {9, 15, false}, {1, 12, false}, {1, 9, false},
+        {1, 15, true}, {6, 15, true}, {1, 9, true},
+    };
+
+    const int TEXT_PER_SECOND = 5;
+
+    // voiced stretches of a gliding pitch with harmonics, and pauses of
+    // low noise between them, roughly what a caller sends
+    std::vector<int16_t> make_audio(int rate, int seconds)
+    {
+        std::vector<int16_t> audio((size_t)rate * seconds);
+        unsigned seed = 1;
+        double phase = 0;
+        for (size_t i = 0; i < audio.size(); i++)
+        {
+            const double t = (double)i / rate;
+            const double cycle = fmod(t, 2.3);
+            seed = seed * 1103515245 + 12345;
+            const double noise = (int)(seed >> 16) % 64 - 32;
+            if (cycle > 1.6)
+            {
+                audio[i] = (int16_t)noise;
+                continue;
+            }
+            const double pitch = 120 + 60 * sin(2 * M_PI * 0.7 * t);
+            phase += 2 * M_PI * pitch / rate;
+            double voiced = 0;
+            for (int h = 1; h <= 12; h++)
+                voiced += sin(h * phase) / h;
+            const double envelope = sin(M_PI * cycle / 1.6);
+            audio[i] = (int16_t)(6000 * envelope * voiced + 4 * noise);
+        }
+        return audio;
+    }
+
+    std::vector<int16_t> read_audio(const char *path, size_t max_samples)
+    {
+        std::vector<int16_t> audio(max_samples);
+        FILE *file = fopen(path, "rb");
+        if (!file)
+            return std::vector<int16_t>();
+        audio.resize(fread(audio.data(), sizeof(int16_t), audio.size(), file));
+        fclose(file);
+        return audio;
+    }
+
+    // transcript events like the ones a server streams back
+    std::vector<std::string> make_text(int seconds)
+    {
+        std::vector<std::string> text;
+        for (int i = 0; i < seconds * TEXT_PER_SECOND; i++)
+            text.push_back("{\"type\":\"partial\",\"call\":\"9f1c2b7e-4d2a-4b8e-a6f1-3c5d7e9a1b2c\",\"seq\":" +
+                           std::to_string(i) + ",\"start_ms\":" + std::to_string(i * 200) +
+                           ",\"text\":\"thanks for calling, how can I help you with your account today\",\"confidence\":0." +
+                           std::to_string(80 + i % 20) + "}");
+        return text;
+    }
+
+    struct Result
+    {
+        double cpu_ms;
+        double ratio;
+    };
+
+    Result run(const Setting &s, const std::vector<std::string> &messages)
+    {
+        DeflateConfig config;
+        config.level = s.level;
+        config.window_bits = s.window_bits;
+        config.no_context_takeover = s.no_context_takeover;
+        MessageDeflate deflate(config);
+        deflate.accept(s.no_context_takeover ? "permessage-deflate; client_no_context_takeover" : "permessage-deflate");
+
+        std::string out;
+        size_t raw = 0, sent = 0;
+        const clock_t start = clock();
+        for (const std::string &message : messages)
+        {
+            deflate.compress(message.data(), message.size(), out);
+            raw += message.size();
+            sent += out.size();
+        }
+        const Result result = {1000.0 * (clock() - start) / CLOCKS_PER_SEC, (double)sent / raw};
+        return result;
+    }
+
+    // deflateInit2 and inflateInit2 state, from zlib's own estimate
+    size_t memory_kb(int window_bits)
+    {
+        const int mem_level = std::min(8, window_bits - 7);
+        const size_t deflate = (1u << (window_bits + 2)) + (1u << (mem_level + 9)) + 6 * 1024;
+        const size_t inflate = (1u << DEFLATE_MAX_WINDOW_BITS) + 7 * 1024;
+        return (deflate + inflate) / 1024;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const int seconds = argc > 1 ? std::max(1, atoi(argv[1])) : 60;
+    const int rate = argc > 2 ? std::max(8000, atoi(argv[2])) : 16000;
+    std::vector<int16_t> audio = argc > 3 ? read_audio(argv[3], (size_t)rate * seconds) : make_audio(rate, seconds);
+    if (audio.empty())
+    {
+        fprintf(stderr, "%s: no audio\n", argv[3]);
+        return 1;
+    }
+
+    // 20ms L16 frames as the stream sends them
+    const size_t frame = rate / 50;
+    std::vector<std::string> frames;
+    for (size_t i = 0; i + frame <= audio.size(); i += frame)
+        frames.push_back(std::string((const char *)&audio[i], frame * sizeof(int16_t)));
+    const std::vector<std::string> text = make_text(seconds);
+    const double minutes = frames.size() / 50.0 / 60.0;
+
+    printf("%.0f s of %d Hz audio in 20ms frames, %d JSON messages/s\n", minutes * 60, rate, TEXT_PER_SECOND);
+    printf("CPU ms per call minute and compressed/raw size; memory per connection\n");
+    printf("%-5s %-6s %-10s %12s %8s %12s %8s %8s\n", "level", "window", "takeover", "audio ms", "ratio", "text ms",
+           "ratio", "KB");
+    for (const Setting &s : settings)
+    {
+        run(s, frames); // warm-up
+        const Result binary = run(s, frames);
+        const Result json = run(s, text);
+        printf("%-5d %-6d %-10s %12.2f %8.3f %12.2f %8.3f %8zu\n", s.level, s.window_bits,
+               s.no_context_takeover ? "no" : "yes", binary.cpu_ms / minutes, binary.ratio, json.cpu_ms / minutes,
+               json.ratio, memory_kb(s.window_bits));
+    }
+    return 0;
+}
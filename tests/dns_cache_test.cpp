@@ -0,0 +1,155 @@
+// DnsCache against a hosts: resolver, no FreeSWITCH needed.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "dns_cache.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+namespace
+{
+    // replaced in one go, the resolver reads the file on every resolve
+    void write_hosts(const std::string &path, const std::string &content)
+    {
+        const std::string tmp = path + ".new";
+        {
+            std::ofstream file(tmp, std::ios::trunc);
+            file << content;
+        }
+        rename(tmp.c_str(), path.c_str());
+    }
+
+    // lookups never block, so wait for the resolver thread to answer
+    DnsCache::Result wait_for(DnsCache &cache, const std::string &host, std::string *address = nullptr, bool ipv4 = false)
+    {
+        DnsCache::Result result = DnsCache::MISS;
+        for (int i = 0; i < 200 && (result = cache.lookup(host, address, ipv4)) == DnsCache::MISS; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return result;
+    }
+
+    void test_urls()
+    {
+        CHECK(DnsCache::hostOf("wss://api.example.com:443/stream?x=1") == "api.example.com");
+        CHECK(DnsCache::hostOf("ws://api.example.com/stream") == "api.example.com");
+        CHECK(DnsCache::hostOf("ws://[::1]:8080/") == "::1");
+        CHECK(DnsCache::withHost("ws://api.example.com:8080/s", "10.0.0.1") == "ws://10.0.0.1:8080/s");
+        CHECK(DnsCache::withHost("ws://api.example.com/s", "fd00::1") == "ws://[fd00::1]/s");
+        CHECK(DnsCache::isNumeric("10.0.0.1"));
+        CHECK(DnsCache::isNumeric("::1"));
+        CHECK(!DnsCache::isNumeric("api.example.com"));
+    }
+
+    void test_lookups(const std::string &path)
+    {
+        write_hosts(path, "10.0.0.1 api.example.com # comment\n"
+                          "fd00::2 dual.example.com\n"
+                          "10.0.0.2 dual.example.com\n"
+                          "10.0.0.3 dual.example.com\n");
+        DnsConfig config;
+        CHECK(config.set("dns-resolver", ("hosts:" + path).c_str()));
+        DnsCache cache(config, DnsCache::makeResolver(config));
+
+        std::string address;
+        CHECK(cache.lookup("api.example.com", &address) == DnsCache::MISS);
+        CHECK(wait_for(cache, "api.example.com", &address) == DnsCache::POSITIVE);
+        CHECK(address == "10.0.0.1");
+
+        // IPv4 first, rotating; ipv4 never hands out the IPv6 one
+        CHECK(wait_for(cache, "dual.example.com") == DnsCache::POSITIVE);
+        std::string first, second;
+        cache.lookup("dual.example.com", &first, true);
+        cache.lookup("dual.example.com", &second, true);
+        CHECK(first != second);
+        CHECK(first.find(':') == std::string::npos && second.find(':') == std::string::npos);
+
+        // the negative entry is what makes a start fail at once
+        CHECK(wait_for(cache, "missing.example.com") == DnsCache::NEGATIVE);
+        CHECK(cache.lookup("missing.example.com") == DnsCache::NEGATIVE);
+
+        address.clear();
+        CHECK(cache.lookup("192.0.2.7", &address) == DnsCache::POSITIVE && address == "192.0.2.7");
+        address.clear();
+        CHECK(cache.lookup("fd00::9", &address, true) == DnsCache::POSITIVE && address.empty());
+
+        const DnsCache::Stats stats = cache.stats();
+        CHECK(stats.resolves == 3);
+        CHECK(stats.negative_hits >= 2);
+        CHECK(stats.failures == 0);
+        CHECK(stats.entries == 3);
+    }
+
+    void test_refresh(const std::string &path)
+    {
+        write_hosts(path, "10.0.0.1 api.example.com\n");
+        DnsConfig config;
+        config.set("dns-resolver", ("hosts:" + path).c_str());
+        config.set("dns-ttl", "1");
+        config.set("dns-min-ttl", "0");
+        DnsCache cache(config, DnsCache::makeResolver(config));
+
+        std::string address;
+        CHECK(wait_for(cache, "api.example.com", &address) == DnsCache::POSITIVE && address == "10.0.0.1");
+
+        // a name in use is resolved again before it expires, so it never misses
+        write_hosts(path, "10.0.0.9 api.example.com\n");
+        bool missed = false;
+        for (int i = 0; i < 150 && address != "10.0.0.9"; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            missed |= cache.lookup("api.example.com", &address) != DnsCache::POSITIVE;
+        }
+        CHECK(address == "10.0.0.9");
+        CHECK(!missed);
+        CHECK(cache.stats().refreshes >= 1);
+    }
+
+    void test_unreadable()
+    {
+        // an unreadable file is a resolver failure, not a name that does not exist
+        DnsConfig config;
+        config.set("dns-resolver", "hosts:/nonexistent/hosts");
+        DnsCache cache(config, DnsCache::makeResolver(config));
+        cache.prefetch("api.example.com");
+        for (int i = 0; i < 200 && cache.stats().failures == 0; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        CHECK(cache.stats().failures == 1);
+        CHECK(cache.lookup("api.example.com") == DnsCache::MISS);
+    }
+}
+
+int main()
+{
+    char path[] = "/tmp/dns_cache_test.XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    test_urls();
+    test_lookups(path);
+    test_refresh(path);
+    test_unreadable();
+
+    unlink(path);
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? 1 : 0;
+}
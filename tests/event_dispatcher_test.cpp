@@ -0,0 +1,143 @@
+// EventDispatcher filtering, coalescing and the response queue.
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include "event_dispatcher.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+namespace
+{
+    const int WINDOW_MS = 100;
+
+    EventDispatchConfig coalescing()
+    {
+        EventDispatchConfig config;
+        config.coalesce.insert("partial");
+        config.coalesce_ms = WINDOW_MS;
+        return config;
+    }
+
+    void test_parse_list()
+    {
+        std::unordered_set<std::string> out;
+        EventDispatchConfig::parseList(" partial, final ,,transcript", out);
+        CHECK(out.size() == 4);
+        CHECK(out.count("partial") && out.count("final") && out.count("transcript"));
+        CHECK(out.count("")); // untyped messages
+    }
+
+    void test_filter()
+    {
+        EventDispatchConfig config;
+        config.filter = true;
+        config.allow.insert("final");
+        config.allow.insert("");
+        EventDispatcher events(config);
+        std::string flush;
+        CHECK(events.dispatch("final", "f", flush) == EventDispatcher::FIRE);
+        CHECK(events.dispatch("", "untyped", flush) == EventDispatcher::FIRE);
+        CHECK(events.dispatch("partial", "p", flush) == EventDispatcher::DROP);
+        CHECK(flush.empty());
+    }
+
+    // within a window only the first fires and the latest is held
+    void test_coalescing_window()
+    {
+        EventDispatcher events(coalescing());
+        std::string flush, due;
+        CHECK(events.dispatch("partial", "p1", flush) == EventDispatcher::FIRE);
+        CHECK(events.dispatch("partial", "p2", flush) == EventDispatcher::HELD);
+        CHECK(events.dispatch("partial", "p3", flush) == EventDispatcher::HELD);
+        CHECK(flush.empty());
+        CHECK(events.pending());
+        CHECK(!events.takeDue(due));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(WINDOW_MS + 20));
+        CHECK(events.takeDue(due));
+        CHECK(due == "p3");
+        CHECK(!events.pending());
+
+        // the released message opened a new window
+        CHECK(events.dispatch("partial", "p4", flush) == EventDispatcher::HELD);
+        std::this_thread::sleep_for(std::chrono::milliseconds(WINDOW_MS + 20));
+
+        // once the window ended a new one fires and supersedes the held one
+        CHECK(events.dispatch("partial", "p5", flush) == EventDispatcher::FIRE);
+        CHECK(flush.empty());
+        CHECK(!events.pending());
+        CHECK(!events.takeDue(due));
+    }
+
+    // a held message goes out before a message of another type
+    void test_ordering()
+    {
+        EventDispatcher events(coalescing());
+        std::string flush;
+        CHECK(events.dispatch("partial", "p1", flush) == EventDispatcher::FIRE);
+        CHECK(events.dispatch("partial", "p2", flush) == EventDispatcher::HELD);
+        CHECK(events.dispatch("final", "f1", flush) == EventDispatcher::FIRE);
+        CHECK(flush == "p2");
+        CHECK(!events.pending());
+
+        // and the window starts over after it
+        flush.clear();
+        CHECK(events.dispatch("partial", "p3", flush) == EventDispatcher::FIRE);
+        CHECK(flush.empty());
+    }
+
+    void test_no_coalescing()
+    {
+        EventDispatchConfig config = coalescing();
+        config.coalesce_ms = 0;
+        EventDispatcher events(config);
+        std::string flush;
+        CHECK(events.dispatch("partial", "p1", flush) == EventDispatcher::FIRE);
+        CHECK(events.dispatch("partial", "p2", flush) == EventDispatcher::FIRE);
+        CHECK(!events.pending());
+    }
+
+    // the queue keeps the newest queue_max responses, drained oldest first
+    void test_queue_bound()
+    {
+        EventDispatchConfig config;
+        CHECK(!EventDispatcher(config).queueEnabled());
+        config.queue_max = 3;
+        EventDispatcher events(config);
+        CHECK(events.queueEnabled());
+        for (int i = 1; i <= 5; i++)
+            events.enqueue("r" + std::to_string(i));
+
+        size_t count = 0;
+        CHECK(events.drain(2, &count) == "r3\nr4\n");
+        CHECK(count == 2);
+        CHECK(events.drain(0, &count) == "r5\n");
+        CHECK(count == 1);
+        CHECK(events.drain(0, &count).empty());
+        CHECK(count == 0);
+    }
+}
+
+int main()
+{
+    test_parse_list();
+    test_filter();
+    test_coalescing_window();
+    test_ordering();
+    test_no_coalescing();
+    test_queue_bound();
+    if (failures)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+// MessageDeflate: negotiation of the permessage-deflate offer, the RFC 7692
+// examples and round trips with and without context takeover.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "message_deflate.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+namespace
+{
+    const size_t MAX = 1 << 20;
+
+    DeflateConfig config(bool text, bool binary, int window_bits = 15, bool no_context_takeover = false)
+    {
+        DeflateConfig c;
+        c.text = text;
+        c.binary = binary;
+        c.window_bits = window_bits;
+        c.no_context_takeover = no_context_takeover;
+        return c;
+    }
+
+    std::string bytes(std::initializer_list<unsigned char> list)
+    {
+        return std::string(list.begin(), list.end());
+    }
+
+    // a transcript-like JSON message, different on every call
+    std::string json(int n)
+    {
+        return "{\"type\":\"partial\",\"seq\":" + std::to_string(n) +
+               ",\"text\":\"the quick brown fox jumps over the lazy dog\",\"confidence\":0.9" + std::to_string(n % 10) + "}";
+    }
+
+    void test_offer()
+    {
+        CHECK(MessageDeflate(config(true, false)).offer() == "permessage-deflate; client_max_window_bits=15");
+        CHECK(MessageDeflate(config(false, true, 10, true)).offer() ==
+              "permessage-deflate; client_max_window_bits=10; client_no_context_takeover");
+        CHECK(MessageDeflate(config(true, false, 4)).offer() == "permessage-deflate; client_max_window_bits=9");
+        CHECK(MessageDeflate(config(false, false)).offer().empty());
+    }
+
+    void test_accept()
+    {
+        MessageDeflate d(config(true, false, 12));
+        CHECK(d.accept(""));
+        CHECK(!d.active());
+        CHECK(!d.compresses(false));
+
+        CHECK(d.accept("permessage-deflate"));
+        CHECK(d.active());
+        CHECK(d.compresses(false) && !d.compresses(true));
+        CHECK(d.windowBits() == 12);
+        CHECK(!d.noContextTakeover());
+
+        // the server may lower the window and turn off our context takeover
+        CHECK(d.accept("Permessage-Deflate; client_max_window_bits=\"10\";  client_no_context_takeover ; server_no_context_takeover"));
+        CHECK(d.windowBits() == 10);
+        CHECK(d.noContextTakeover());
+        CHECK(d.accept("permessage-deflate; client_max_window_bits=15"));
+        CHECK(d.windowBits() == 12);
+
+        // what the offer does not allow fails the connection
+        CHECK(!d.accept("permessage-deflate; server_max_window_bits=10"));
+        CHECK(!d.active());
+        CHECK(!d.accept("permessage-deflate; client_max_window_bits=8"));
+        CHECK(!d.accept("permessage-deflate; client_max_window_bits"));
+        CHECK(!d.accept("permessage-deflate; client_no_context_takeover; client_no_context_takeover"));
+        CHECK(!d.accept("permessage-deflate; mux"));
+        CHECK(!d.accept("x-webkit-deflate-frame"));
+        CHECK(!d.accept("permessage-deflate, permessage-deflate"));
+
+        MessageDeflate off(config(false, false));
+        CHECK(off.accept(""));
+        CHECK(!off.accept("permessage-deflate"));
+    }
+
+    // RFC 7692 section 7.2.3: "Hello" twice with context takeover, and a
+    // final block that ends a message
+    void test_rfc_examples()
+    {
+        MessageDeflate d(config(true, false));
+        CHECK(d.accept("permessage-deflate"));
+        std::string out;
+        CHECK(d.compress("Hello", 5, out));
+        CHECK(out == bytes({0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00}));
+        CHECK(d.compress("Hello", 5, out));
+        CHECK(out == bytes({0xf2, 0x00, 0x11, 0x00, 0x00}));
+
+        MessageDeflate r(config(true, false));
+        CHECK(r.accept("permessage-deflate"));
+        const std::string first = bytes({0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00});
+        const std::string second = bytes({0xf2, 0x00, 0x11, 0x00, 0x00});
+        CHECK(r.decompress(first.data(), first.size(), MAX, out) && out == "Hello");
+        CHECK(r.decompress(second.data(), second.size(), MAX, out) && out == "Hello");
+
+        const std::string stored = bytes({0x00, 0x05, 0x00, 0xfa, 0xff, 0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x00});
+        CHECK(r.decompress(stored.data(), stored.size(), MAX, out) && out == "Hello");
+        const std::string final_block = bytes({0xf3, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00, 0x00});
+        CHECK(r.decompress(final_block.data(), final_block.size(), MAX, out) && out == "Hello");
+        CHECK(r.decompress(first.data(), first.size(), MAX, out) && out == "Hello");
+    }
+
+    // what one side compresses the other inflates, message after message
+    void round_trip(const DeflateConfig &c, const char *response)
+    {
+        MessageDeflate tx(c), rx(c);
+        CHECK(tx.accept(response));
+        CHECK(rx.accept(response));
+        size_t raw = 0, sent = 0;
+        bool ok = true;
+        std::string wire, back;
+        for (int i = 0; i < 200; i++)
+        {
+            const std::string message = json(i);
+            ok = ok && tx.compress(message.data(), message.size(), wire);
+            ok = ok && rx.decompress(wire.data(), wire.size(), MAX, back) && back == message;
+            raw += message.size();
+            sent += wire.size();
+        }
+        CHECK(ok);
+        CHECK(sent < raw);
+
+        // empty and large messages
+        CHECK(tx.compress("", 0, wire) && rx.decompress(wire.data(), wire.size(), MAX, back) && back.empty());
+        std::string big;
+        srand(1);
+        while (big.size() < 300000)
+            big += json(rand());
+        CHECK(tx.compress(big.data(), big.size(), wire) && rx.decompress(wire.data(), wire.size(), MAX, back) && back == big);
+    }
+
+    // context takeover is what makes repeated messages cheap
+    void test_context_takeover()
+    {
+        round_trip(config(true, false), "permessage-deflate");
+        round_trip(config(true, false, 9, true), "permessage-deflate; client_max_window_bits=9; client_no_context_takeover");
+
+        MessageDeflate keep(config(true, false)), reset(config(true, false, 15, true));
+        CHECK(keep.accept("permessage-deflate"));
+        CHECK(reset.accept("permessage-deflate; client_no_context_takeover"));
+        const std::string message = json(1);
+        std::string a, b;
+        for (int i = 0; i < 3; i++)
+        {
+            CHECK(keep.compress(message.data(), message.size(), a));
+            CHECK(reset.compress(message.data(), message.size(), b));
+        }
+        CHECK(a.size() < b.size() / 4);
+
+        // without takeover every message inflates on a fresh receiver
+        MessageDeflate fresh(config(true, false));
+        std::string back;
+        CHECK(fresh.accept("permessage-deflate"));
+        CHECK(fresh.decompress(b.data(), b.size(), MAX, back) && back == message);
+    }
+
+    void test_limits()
+    {
+        MessageDeflate tx(config(true, false)), rx(config(true, false));
+        CHECK(tx.accept("permessage-deflate"));
+        CHECK(rx.accept("permessage-deflate"));
+        const std::string zeros(100000, '\0');
+        std::string wire, back;
+        CHECK(tx.compress(zeros.data(), zeros.size(), wire));
+        CHECK(wire.size() < 1000);
+        CHECK(!rx.decompress(wire.data(), wire.size(), 50000, back));
+        CHECK(back.empty());
+
+        const std::string garbage = bytes({0xff, 0xff, 0xff, 0xff});
+        MessageDeflate bad(config(true, false));
+        CHECK(bad.accept("permessage-deflate"));
+        CHECK(!bad.decompress(garbage.data(), garbage.size(), MAX, back));
+
+        // nothing negotiated, nothing to compress with
+        MessageDeflate none(config(true, false));
+        CHECK(!none.compress("a", 1, wire));
+    }
+}
+
+int main()
+{
+    test_offer();
+    test_accept();
+    test_rfc_examples();
+    test_context_takeover();
+    test_limits();
+    if (failures)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,290 @@
+// PlayoutBuffer against a writer running on its own clock: start at the
+// target depth, drift, underruns, the backlog behind write_sbuffer and marks.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "playout_buffer.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+namespace
+{
+    // 8 kHz mono, one 20ms packet per tick
+    const uint32_t RATE = 8000;
+    const uint32_t FRAMES = 160;
+    const size_t BYTES_PER_MS = RATE / 1000 * sizeof(int16_t);
+
+    // write_sbuffer as stream_data_init creates it
+    struct Playout
+    {
+        explicit Playout(const PlayoutConfig &config = PlayoutConfig(), uint32_t channels = 1)
+            : playout(config, RATE, channels), channels(channels), out(FRAMES * channels)
+        {
+            const size_t step = RATE / 10 * channels * sizeof(int16_t);
+            switch_buffer_create_dynamic(&buffer, step, step, playout.capacityBytes());
+        }
+
+        ~Playout()
+        {
+            switch_buffer_destroy(&buffer);
+        }
+
+        // what writePlayback does, minus the wait; returns the bytes taken
+        size_t write(const int16_t *samples, size_t frames)
+        {
+            const uint8_t *ptr = reinterpret_cast<const uint8_t *>(samples);
+            const size_t len = frames * channels * sizeof(int16_t);
+            size_t chunk = 0;
+            if (playout.backlogBytes() == 0)
+            {
+                chunk = std::min<size_t>(len, switch_buffer_freespace(buffer));
+                switch_buffer_write(buffer, ptr, chunk);
+                playout.noteWritten(chunk);
+            }
+            if (chunk < len)
+                chunk += playout.defer(ptr + chunk, len - chunk);
+            if (chunk < len)
+                playout.noteOverrun();
+            return chunk;
+        }
+
+        // a 20ms packet of a 400 Hz tone, continuing where the last one stopped
+        void writePacket()
+        {
+            std::vector<int16_t> packet(FRAMES * channels);
+            for (uint32_t i = 0; i < FRAMES; i++, phase++)
+            {
+                for (uint32_t c = 0; c < channels; c++)
+                    packet[i * channels + c] = (int16_t)(8000 * sin(2 * M_PI * 400 * phase / RATE));
+            }
+            write(packet.data(), FRAMES);
+        }
+
+        bool pull()
+        {
+            return playout.pull(buffer, out.data(), FRAMES);
+        }
+
+        size_t depthMs() const
+        {
+            return switch_buffer_inuse(buffer) / channels / BYTES_PER_MS;
+        }
+
+        PlayoutBuffer playout;
+        switch_buffer_t *buffer = nullptr;
+        const uint32_t channels;
+        std::vector<int16_t> out;
+        uint64_t phase = 0;
+    };
+
+    // nothing is played before the target depth, then every tick is
+    void test_start_at_target()
+    {
+        Playout p;
+        CHECK(p.playout.targetMs() == 60);
+        CHECK(!p.pull());
+        p.writePacket();
+        CHECK(!p.pull());
+        p.writePacket();
+        CHECK(!p.pull());
+        p.writePacket();
+        CHECK(p.pull());
+        CHECK(p.depthMs() == 40);
+        CHECK(p.playout.underruns() == 0);
+    }
+
+    // a short prompt below the target plays once the writer stops adding
+    void test_short_prompt()
+    {
+        Playout p;
+        p.writePacket();
+        CHECK(!p.pull());
+        CHECK(p.pull());
+        CHECK(p.depthMs() == 0);
+    }
+
+    // a server clock 0.3% off the timer neither drains nor floods the
+    // buffer over ten minutes and no tick goes unplayed
+    void test_drift(double speed)
+    {
+        Playout p;
+        double due = 0;
+        size_t max_depth = 0, min_depth = 1000;
+        int started = -1, silent = 0;
+        for (int tick = 0; tick < 50 * 600; tick++)
+        {
+            for (due += speed; due >= 1; due -= 1)
+                p.writePacket();
+            // depth ahead of the pull, once the correction has settled
+            if (tick > 50 * 60)
+            {
+                max_depth = std::max(max_depth, p.depthMs());
+                min_depth = std::min(min_depth, p.depthMs());
+            }
+            if (p.pull())
+            {
+                if (started < 0)
+                    started = tick;
+            }
+            else if (started >= 0)
+            {
+                silent++;
+            }
+        }
+        CHECK(started >= 0 && started < 5);
+        CHECK(silent == 0);
+        CHECK(p.playout.underruns() == 0);
+        CHECK(max_depth <= 120);
+        CHECK(min_depth >= 20);
+        CHECK(p.playout.targetMs() == 60);
+    }
+
+    // a gap in the server audio is faded out, and the target grows when
+    // it comes back soon after; a long silence is not an underrun
+    void test_underrun()
+    {
+        Playout p;
+        for (int i = 0; i < 3; i++)
+            p.writePacket();
+        CHECK(p.pull());
+        CHECK(p.pull());
+        const int16_t last = p.out[FRAMES - 1];
+        CHECK(p.pull());
+        CHECK(p.depthMs() == 0);
+
+        // dry: the tail of the last packet fades to silence
+        CHECK(p.pull());
+        CHECK(std::abs(p.out[0]) <= std::abs(last));
+        CHECK(p.out[FRAMES - 1] == 0);
+        CHECK(!p.pull());
+        CHECK(!p.pull());
+
+        for (int i = 0; i < 3; i++)
+            p.writePacket();
+        CHECK(p.pull());
+        CHECK(p.playout.underruns() == 1);
+        CHECK(p.playout.targetMs() == 80);
+
+        // drained again and quiet for well over the underrun window
+        while (p.depthMs() > 0)
+            p.pull();
+        for (int i = 0; i < 20; i++)
+            p.pull();
+        for (int i = 0; i < 4; i++)
+            p.writePacket();
+        CHECK(p.pull());
+        CHECK(p.playout.underruns() == 1);
+    }
+
+    // audio beyond write_sbuffer waits in the backlog, beyond both it is an overrun
+    void test_backlog()
+    {
+        PlayoutConfig config;
+        config.target_ms = 20; // the full buffer is a burst, played as is
+        config.max_ms = 200;
+        Playout p(config, 2);
+        const size_t capacity_frames = 200 * RATE / 1000;
+        CHECK(p.playout.capacityBytes() == capacity_frames * 2 * sizeof(int16_t));
+
+        // left counts up, right down
+        std::vector<int16_t> prompt(3 * capacity_frames * 2);
+        for (size_t i = 0; i < prompt.size() / 2; i++)
+        {
+            prompt[2 * i] = (int16_t)i;
+            prompt[2 * i + 1] = (int16_t)-i;
+        }
+        CHECK(p.write(prompt.data(), prompt.size() / 2) == 2 * p.playout.capacityBytes());
+        CHECK(p.playout.backlogBytes() == p.playout.capacityBytes());
+        CHECK(p.playout.overruns() == 1);
+
+        // pulls move the backlog on, in order, and room comes back
+        std::vector<int16_t> played;
+        for (int i = 0; i < 5 && p.pull(); i++)
+            played.insert(played.end(), p.out.begin(), p.out.end());
+        CHECK(played.size() == 5 * FRAMES * 2);
+        // the first pull found write_sbuffer full, the next four refilled it
+        CHECK(p.playout.backlogBytes() == p.playout.capacityBytes() - 4 * FRAMES * 2 * sizeof(int16_t));
+        CHECK(std::equal(played.begin(), played.end(), prompt.begin()));
+        CHECK(p.write(prompt.data() + 2 * capacity_frames * 2, FRAMES) == FRAMES * 2 * sizeof(int16_t));
+
+        // the channels stay apart once the depth nears the target and
+        // the drift correction resamples
+        bool paired = true;
+        int pulls = 0;
+        while (p.pull())
+        {
+            pulls++;
+            for (uint32_t f = 0; f < FRAMES; f++)
+                paired = paired && p.out[2 * f + 1] == -p.out[2 * f];
+        }
+        CHECK(paired);
+        CHECK(pulls >= 15 && pulls <= 17);
+        CHECK(p.playout.backlogBytes() == 0);
+        CHECK(p.playout.overruns() == 1);
+    }
+
+    void test_marks()
+    {
+        Playout p;
+        p.writePacket();
+        p.playout.addMark("one");
+        p.writePacket();
+        p.writePacket();
+        p.playout.addMark("three");
+        p.writePacket();
+        p.playout.addMark("four");
+
+        std::vector<std::string> reached;
+        CHECK(p.pull());
+        p.playout.takeReachedMarks(reached);
+        CHECK(reached == std::vector<std::string>{"one"});
+
+        // cleared before the others were played
+        reached.clear();
+        std::vector<std::string> cleared;
+        switch_buffer_zero(p.buffer);
+        p.playout.reset(&cleared);
+        CHECK(cleared == (std::vector<std::string>{"three", "four"}));
+        CHECK(!p.playout.hasMarks());
+
+        // positions carry on from what was played
+        p.writePacket();
+        p.playout.addMark("after");
+        CHECK(!p.pull());
+        CHECK(p.pull());
+
+        // played below the target, a frame is held back by the drift
+        // correction and goes out with the fade on the next tick
+        p.playout.takeReachedMarks(reached);
+        CHECK(reached.empty());
+        CHECK(p.pull());
+        p.playout.takeReachedMarks(reached);
+        CHECK(reached == std::vector<std::string>{"after"});
+    }
+}
+
+int main()
+{
+    test_start_at_target();
+    test_short_prompt();
+    test_drift(1.003);
+    test_drift(0.997);
+    test_underrun();
+    test_backlog();
+    test_marks();
+    if (failures)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
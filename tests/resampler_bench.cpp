@@ -0,0 +1,96 @@
+// Throughput of the fixed-ratio kernels against speex on the ratios they
+// replace. Not a test: run it by hand on the machine that matters, e.g.
+//   resampler_bench [seconds of audio per case, default 60] [quality]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "audio_resampler.h"
+
+namespace
+{
+    struct Case
+    {
+        int in_rate;
+        int out_rate;
+        int channels;
+    };
+
+    const Case cases[] = {
+        {8000, 16000, 1}, {16000, 8000, 1}, {16000, 24000, 1}, {24000, 16000, 1},
+        {8000, 48000, 1}, {48000, 8000, 1}, {8000, 16000, 2}, {16000, 8000, 2},
+    };
+
+    // a sweep plus noise, so neither kernel sees a trivial signal
+    std::vector<spx_int16_t> make_input(int rate, int channels, int seconds)
+    {
+        std::vector<spx_int16_t> input((size_t)rate * seconds * channels);
+        unsigned seed = 1;
+        for (size_t i = 0; i < input.size() / channels; i++)
+        {
+            const double t = (double)i / rate;
+            const double tone = 8000.0 * sin(2 * M_PI * (200.0 + 1500.0 * t / seconds) * t);
+            for (int c = 0; c < channels; c++)
+            {
+                seed = seed * 1103515245 + 12345;
+                input[i * channels + c] = (spx_int16_t)(tone + (int)(seed >> 16) % 600 - 300);
+            }
+        }
+        return input;
+    }
+
+    // feeds 20ms packets like the media bug does; returns ns per packet
+    double run(stream_resampler_t *resampler, const Case &c, const std::vector<spx_int16_t> &input)
+    {
+        const spx_uint32_t packet = c.in_rate / 50;
+        std::vector<spx_int16_t> out((size_t)(packet * (c.out_rate / (double)c.in_rate) + 64) * c.channels);
+        const size_t packets = input.size() / c.channels / packet;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t p = 0; p < packets; p++)
+        {
+            spx_uint32_t in_len = packet;
+            spx_uint32_t out_len = out.size() / c.channels;
+            resampler->process(&input[p * packet * c.channels], &in_len, out.data(), &out_len);
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / packets;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const int seconds = argc > 1 ? std::max(1, atoi(argv[1])) : 60;
+    const int quality = argc > 2 ? atoi(argv[2]) : SWITCH_RESAMPLE_QUALITY;
+    printf("%d s of audio per case in 20ms packets, quality %d\n", seconds, quality);
+    printf("%-16s %-4s %-10s %12s %12s %8s\n", "ratio", "ch", "kernel", "ns/packet", "speex ns", "speedup");
+
+    for (const Case &c : cases)
+    {
+        const std::vector<spx_int16_t> input = make_input(c.in_rate, c.channels, seconds);
+        int err = 0;
+        stream_resampler_t *fixed = stream_resampler_create(c.channels, c.in_rate, c.out_rate, quality, &err);
+        stream_resampler_t *speex = stream_resampler_create_speex(c.channels, c.in_rate, c.out_rate, quality, &err);
+        if (!fixed || !speex)
+        {
+            fprintf(stderr, "%d -> %d: cannot create resamplers\n", c.in_rate, c.out_rate);
+            return 1;
+        }
+
+        // one warm-up pass each for the caches and the coefficient tables
+        run(fixed, c, input);
+        run(speex, c, input);
+        const double fixed_ns = run(fixed, c, input);
+        const double speex_ns = run(speex, c, input);
+
+        char ratio[32];
+        snprintf(ratio, sizeof(ratio), "%d->%d", c.in_rate, c.out_rate);
+        printf("%-16s %-4d %-10s %12.0f %12.0f %7.2fx\n", ratio, c.channels, fixed->name(), fixed_ns, speex_ns,
+               speex_ns / fixed_ns);
+        stream_resampler_destroy(fixed);
+        stream_resampler_destroy(speex);
+    }
+    return 0;
+}
@@ -0,0 +1,335 @@
+// The fixed-ratio kernels against speex on the ratios they serve, at the
+// quality the module uses and at the longer filter tiers: passband
+// ripple, stopband and image rejection, delay, sweeps, interleaving and
+// chunking.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "audio_resampler.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+namespace
+{
+    struct Case
+    {
+        int in_rate;
+        int out_rate;
+        int quality;
+    };
+
+    const int RATIOS[][2] = {{8000, 16000}, {16000, 8000}, {16000, 24000}, {24000, 16000}, {8000, 48000}, {48000, 8000}};
+    const int QUALITIES[] = {SWITCH_RESAMPLE_QUALITY, 4, 7};
+
+    const double AMPLITUDE = 16000.0;
+    const double PASSBAND_EDGE = 0.375;       /* of the slower rate, 3 kHz at 8 kHz */
+    const double PASSBAND_RIPPLE_DB = 0.1;    /* up to PASSBAND_EDGE */
+    const double PASSBAND_VS_SPEEX_DB = 0.1;  /* up to 0.4 of the slower rate, where speex starts to roll off */
+    const double STOPBAND_VS_SPEEX_DB = 6.0;
+    const double DELAY_VS_SPEEX_MS = 0.5;
+    const double SKIP_S = 0.05; /* filter start-up left out of every measurement */
+
+    /* stopband speex documents for its quality table, bounded by the
+       rounding noise of 16 bit output around 85 dB */
+    double stopband_floor_db(int quality)
+    {
+        return quality >= 5 ? 85.0 : quality >= 3 ? 80.0 : 60.0;
+    }
+
+    double low_rate(const Case &c)
+    {
+        return std::min(c.in_rate, c.out_rate);
+    }
+
+    double db(double ratio)
+    {
+        return 20.0 * std::log10(std::max(ratio, 1e-9));
+    }
+
+    std::vector<spx_int16_t> tone(int rate, double freq, double seconds, double phase = 0.0)
+    {
+        std::vector<spx_int16_t> out((size_t)(rate * seconds));
+        for (size_t i = 0; i < out.size(); i++)
+            out[i] = (spx_int16_t)lrint(AMPLITUDE * sin(2 * M_PI * freq * i / rate + phase));
+        return out;
+    }
+
+    // linear sweep from f0 to f1
+    std::vector<spx_int16_t> sweep(int rate, double f0, double f1, double seconds)
+    {
+        std::vector<spx_int16_t> out((size_t)(rate * seconds));
+        for (size_t i = 0; i < out.size(); i++)
+        {
+            const double t = (double)i / rate;
+            out[i] = (spx_int16_t)lrint(AMPLITUDE * sin(2 * M_PI * (f0 * t + (f1 - f0) * t * t / (2 * seconds))));
+        }
+        return out;
+    }
+
+    // feeds chunks of the given sizes in turn, 20ms packets by default
+    std::vector<spx_int16_t> run(stream_resampler_t *resampler, const Case &c, const std::vector<spx_int16_t> &in,
+                                 int channels = 1, std::vector<spx_uint32_t> chunks = std::vector<spx_uint32_t>())
+    {
+        if (chunks.empty())
+            chunks.push_back(c.in_rate / 50);
+        std::vector<spx_int16_t> out;
+        std::vector<spx_int16_t> buffer;
+        const size_t frames = in.size() / channels;
+        size_t pos = 0;
+        for (size_t k = 0; pos < frames; k++)
+        {
+            spx_uint32_t in_len = std::min<size_t>(chunks[k % chunks.size()], frames - pos);
+            buffer.resize(((size_t)in_len * c.out_rate / c.in_rate + 16) * channels);
+            spx_uint32_t out_len = buffer.size() / channels;
+            resampler->process(&in[pos * channels], &in_len, buffer.data(), &out_len);
+            out.insert(out.end(), buffer.begin(), buffer.begin() + (size_t)out_len * channels);
+            pos += in_len;
+        }
+        return out;
+    }
+
+    std::vector<spx_int16_t> run(bool speex, const Case &c, const std::vector<spx_int16_t> &in)
+    {
+        int err = 0;
+        stream_resampler_t *resampler = speex ? stream_resampler_create_speex(1, c.in_rate, c.out_rate, c.quality, &err)
+                                              : stream_resampler_create(1, c.in_rate, c.out_rate, c.quality, &err);
+        if (!resampler)
+        {
+            CHECK(resampler);
+            return std::vector<spx_int16_t>();
+        }
+        CHECK(speex || std::string(resampler->name()) == "polyphase");
+        const std::vector<spx_int16_t> out = run(resampler, c, in);
+        stream_resampler_destroy(resampler);
+        return out;
+    }
+
+    // least squares fit of a sine at freq past the start-up
+    struct Fit
+    {
+        double gain_db;     /* amplitude against AMPLITUDE */
+        double delay_ms;    /* within one period of freq */
+        double residual_db; /* what the sine does not explain, against AMPLITUDE */
+    };
+
+    Fit fit(const std::vector<spx_int16_t> &y, int rate, double freq)
+    {
+        const double w = 2 * M_PI * freq / rate;
+        const size_t from = (size_t)(SKIP_S * rate);
+        double m[3][4] = {};
+        for (size_t k = from; k < y.size(); k++)
+        {
+            const double v[3] = {sin(w * k), cos(w * k), 1.0};
+            for (int i = 0; i < 3; i++)
+            {
+                for (int j = 0; j < 3; j++)
+                    m[i][j] += v[i] * v[j];
+                m[i][3] += v[i] * y[k];
+            }
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            for (int r = i + 1; r < 3; r++)
+            {
+                const double f = m[r][i] / m[i][i];
+                for (int j = i; j < 4; j++)
+                    m[r][j] -= f * m[i][j];
+            }
+        }
+        double x[3];
+        for (int i = 2; i >= 0; i--)
+        {
+            x[i] = m[i][3];
+            for (int j = i + 1; j < 3; j++)
+                x[i] -= m[i][j] * x[j];
+            x[i] /= m[i][i];
+        }
+
+        double residual = 0.0;
+        for (size_t k = from; k < y.size(); k++)
+        {
+            const double e = y[k] - (x[0] * sin(w * k) + x[1] * cos(w * k) + x[2]);
+            residual += e * e;
+        }
+        Fit out;
+        out.gain_db = db(std::sqrt(x[0] * x[0] + x[1] * x[1]) / AMPLITUDE);
+        // a sin(wk) + b cos(wk) = r sin(wk + phi), the input had phase 0
+        double delay = -atan2(x[1], x[0]) / (2 * M_PI * freq);
+        if (delay < 0)
+            delay += 1.0 / freq;
+        out.delay_ms = delay * 1000.0;
+        out.residual_db = db(std::sqrt(2.0 * residual / (y.size() - from)) / AMPLITUDE);
+        return out;
+    }
+
+    // rms in dB against a sine of AMPLITUDE, past the start-up
+    double level_db(const std::vector<spx_int16_t> &y, int rate, size_t from = 0, size_t to = 0)
+    {
+        from = std::max(from, (size_t)(SKIP_S * rate));
+        to = to ? std::min(to, y.size()) : y.size();
+        double sum = 0.0;
+        for (size_t k = from; k < to; k++)
+            sum += (double)y[k] * y[k];
+        return db(std::sqrt(2.0 * sum / std::max<size_t>(1, to - from)) / AMPLITUDE);
+    }
+
+    /* what lands outside the passband, in dB below the tone: the image of
+       a tone at freq when upsampling, a tone at freq above the output
+       Nyquist frequency when downsampling */
+    double rejection_db(bool speex, const Case &c, double freq)
+    {
+        const std::vector<spx_int16_t> out = run(speex, c, tone(c.in_rate, freq, 0.5));
+        if (c.out_rate > c.in_rate)
+        {
+            const Fit f = fit(out, c.out_rate, freq);
+            return f.gain_db - f.residual_db;
+        }
+        return -level_db(out, c.out_rate);
+    }
+
+    /* flat through the voice band of the slower rate and within
+       PASSBAND_VS_SPEEX_DB of speex up to its band edge */
+    void test_passband(const Case &c)
+    {
+        for (int k = 1; k <= 16; k++)
+        {
+            const double f = 0.025 * k;
+            const double freq = f * low_rate(c);
+            const std::vector<spx_int16_t> in = tone(c.in_rate, freq, 0.5);
+            const Fit fixed = fit(run(false, c, in), c.out_rate, freq);
+            const Fit speex = fit(run(true, c, in), c.out_rate, freq);
+            if (f <= PASSBAND_EDGE + 1e-9)
+                CHECK(std::fabs(fixed.gain_db) < PASSBAND_RIPPLE_DB);
+            CHECK(std::fabs(fixed.gain_db - speex.gain_db) < PASSBAND_VS_SPEEX_DB);
+        }
+    }
+
+    /* images when upsampling, aliases when downsampling, from the band
+       edge out: at least what speex rejects, less a margin for the
+       rounding noise both measure near, or the quality's floor */
+    void test_stopband(const Case &c)
+    {
+        const double floor_db = stopband_floor_db(c.quality);
+        const bool up = c.out_rate > c.in_rate;
+        for (double f = up ? 0.45 : 0.55; up ? f >= 0.1 - 1e-9 : f < 0.95; f += up ? -0.05 : 0.05)
+        {
+            const double freq = f * (up ? c.in_rate : c.out_rate);
+            if (freq >= 0.49 * c.in_rate)
+                break;
+            const double fixed = rejection_db(false, c, freq);
+            const double speex = rejection_db(true, c, freq);
+            CHECK(fixed >= std::min(speex - STOPBAND_VS_SPEEX_DB, floor_db));
+        }
+    }
+
+    /* the fixed kernels may not hold audio back longer than speex does */
+    void test_delay(const Case &c)
+    {
+        const double freq = 100.0; /* one period is longer than any of the filters */
+        const std::vector<spx_int16_t> in = tone(c.in_rate, freq, 0.5);
+        const Fit fixed = fit(run(false, c, in), c.out_rate, freq);
+        const Fit speex = fit(run(true, c, in), c.out_rate, freq);
+        CHECK(fixed.delay_ms <= speex.delay_ms + DELAY_VS_SPEEX_MS);
+        if (c.quality == SWITCH_RESAMPLE_QUALITY)
+            CHECK(fixed.delay_ms >= 0.5 && fixed.delay_ms <= 3.0); /* what the README promises for marks */
+    }
+
+    /* a sweep through the passband keeps its level in every 50ms block
+       like speex does; downsampling, one above the output Nyquist
+       frequency stays out in every block */
+    void test_sweep(const Case &c)
+    {
+        const size_t block = c.out_rate / 20;
+        const double lo = low_rate(c);
+        std::vector<spx_int16_t> in = sweep(c.in_rate, 0.025 * lo, PASSBAND_EDGE * lo, 1.0);
+        std::vector<spx_int16_t> fixed = run(false, c, in);
+        std::vector<spx_int16_t> speex = run(true, c, in);
+        for (size_t from = block; from + block <= std::min(fixed.size(), speex.size()); from += block)
+        {
+            const double level = level_db(fixed, c.out_rate, from, from + block);
+            CHECK(std::fabs(level) < 2 * PASSBAND_RIPPLE_DB);
+            CHECK(std::fabs(level - level_db(speex, c.out_rate, from, from + block)) < PASSBAND_VS_SPEEX_DB);
+        }
+
+        if (c.out_rate > c.in_rate)
+            return;
+        in = sweep(c.in_rate, 0.6 * c.out_rate, std::min(0.95 * c.out_rate, 0.48 * c.in_rate), 1.0);
+        fixed = run(false, c, in);
+        speex = run(true, c, in);
+        const double floor_db = stopband_floor_db(c.quality);
+        for (size_t from = block; from + block <= std::min(fixed.size(), speex.size()); from += block)
+        {
+            const double rejected = -level_db(fixed, c.out_rate, from, from + block);
+            const double speex_rejected = -level_db(speex, c.out_rate, from, from + block);
+            CHECK(rejected >= std::min(speex_rejected - STOPBAND_VS_SPEEX_DB, floor_db));
+        }
+    }
+
+    /* stereo gives each channel exactly what mono gives it, and neither
+       the chunk sizes nor a reset change a sample */
+    void test_interleave_and_chunks(const Case &c)
+    {
+        const std::vector<spx_int16_t> left = tone(c.in_rate, 0.1 * low_rate(c), 0.3);
+        const std::vector<spx_int16_t> right = sweep(c.in_rate, 0.3 * low_rate(c), 0.02 * low_rate(c), 0.3);
+        std::vector<spx_int16_t> stereo(2 * left.size());
+        for (size_t i = 0; i < left.size(); i++)
+        {
+            stereo[2 * i] = left[i];
+            stereo[2 * i + 1] = right[i];
+        }
+
+        int err = 0;
+        stream_resampler_t *resampler = stream_resampler_create(2, c.in_rate, c.out_rate, c.quality, &err);
+        CHECK(resampler && std::string(resampler->name()) == "polyphase");
+        if (!resampler)
+            return;
+        const std::vector<spx_int16_t> out = run(resampler, c, stereo, 2);
+        const std::vector<spx_int16_t> out_left = run(false, c, left);
+        const std::vector<spx_int16_t> out_right = run(false, c, right);
+        CHECK(out.size() == 2 * out_left.size() && out_left.size() == out_right.size());
+        bool same = out.size() == 2 * out_left.size();
+        for (size_t i = 0; same && i < out_left.size(); i++)
+            same = out[2 * i] == out_left[i] && out[2 * i + 1] == out_right[i];
+        CHECK(same);
+
+        // odd chunk sizes down to single frames, after a reset
+        const spx_uint32_t chunks[] = {1, 7, (spx_uint32_t)c.in_rate / 50, 3, (spx_uint32_t)c.in_rate / 50 * 3 + 1, 2};
+        resampler->reset();
+        CHECK(run(resampler, c, stereo, 2, std::vector<spx_uint32_t>(chunks, chunks + 6)) == out);
+        stream_resampler_destroy(resampler);
+    }
+}
+
+int main()
+{
+    for (int quality : QUALITIES)
+    {
+        for (const auto &ratio : RATIOS)
+        {
+            const Case c = {ratio[0], ratio[1], quality};
+            const int before = failures;
+            test_passband(c);
+            test_stopband(c);
+            test_delay(c);
+            test_sweep(c);
+            test_interleave_and_chunks(c);
+            if (failures > before)
+                fprintf(stderr, "  in %d -> %d at quality %d\n", c.in_rate, c.out_rate, quality);
+        }
+    }
+    if (failures)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
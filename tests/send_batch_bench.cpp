@@ -0,0 +1,194 @@
+// System calls and CPU of a media worker's sends per pass, one send per
+// frame as before against a SendBatch on io_uring and on plain sends.
+// Sessions are unix socket pairs drained by one reader thread. The modes
+// take turns for ROUNDS rounds and the medians are printed. Not a test:
+// build it with -DCMAKE_BUILD_TYPE=Release and run it by hand, e.g.
+//   send_batch_bench [passes, default 500] [frame bytes, default 640] [frames per session and pass, default 1]
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "send_batch.h"
+
+namespace
+{
+    const int sessions[] = {50, 200, 1000};
+    const int ROUNDS = 7;
+
+    double cpu_ms(clockid_t clock)
+    {
+        struct timespec ts;
+        clock_gettime(clock, &ts);
+        return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+    }
+
+    // the sessions' sockets and a thread reading everything sent to them
+    class Sessions
+    {
+    public:
+        explicit Sessions(int count) : m_stop(false), m_epoll(epoll_create1(0))
+        {
+            for (int i = 0; i < count; i++)
+            {
+                int fds[2];
+                if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+                {
+                    perror("socketpair");
+                    exit(1);
+                }
+                std::shared_ptr<BatchSocket> socket = std::make_shared<BatchSocket>();
+                socket->fd = fds[0];
+                sockets.push_back(socket);
+                m_peers.push_back(fds[1]);
+                struct epoll_event event = {};
+                event.events = EPOLLIN;
+                event.data.fd = fds[1];
+                epoll_ctl(m_epoll, EPOLL_CTL_ADD, fds[1], &event);
+            }
+            m_reader = std::thread(&Sessions::read, this);
+        }
+
+        ~Sessions()
+        {
+            m_stop = true;
+            m_reader.join();
+            for (size_t i = 0; i < sockets.size(); i++)
+            {
+                close(sockets[i]->fd);
+                close(m_peers[i]);
+            }
+            close(m_epoll);
+        }
+
+        std::vector<std::shared_ptr<BatchSocket>> sockets;
+
+    private:
+        void read()
+        {
+            struct epoll_event events[64];
+            char buf[65536];
+            while (!m_stop)
+            {
+                const int ready = epoll_wait(m_epoll, events, 64, 10);
+                for (int i = 0; i < ready; i++)
+                {
+                    while (recv(events[i].data.fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+                        ;
+                }
+            }
+        }
+
+        std::atomic<bool> m_stop;
+        int m_epoll;
+        std::vector<int> m_peers;
+        std::thread m_reader;
+    };
+
+    struct Result
+    {
+        double syscalls;   // per pass
+        double thread_us;  // sender CPU per frame
+        double process_us; // sender and reader CPU per frame
+    };
+
+    // what UnixWebSocketClient did for every frame: header and payload in one sendmsg
+    Result run_direct(Sessions &s, int passes, const std::string &frame, int frames)
+    {
+        const unsigned char header[4] = {0x82, 126, (unsigned char)(frame.size() >> 8), (unsigned char)frame.size()};
+        const double thread_start = cpu_ms(CLOCK_THREAD_CPUTIME_ID), process_start = cpu_ms(CLOCK_PROCESS_CPUTIME_ID);
+        uint64_t syscalls = 0;
+        for (int pass = 0; pass < passes; pass++)
+        {
+            for (const std::shared_ptr<BatchSocket> &socket : s.sockets)
+            {
+                for (int f = 0; f < frames; f++)
+                {
+                    std::lock_guard<std::mutex> lock(socket->mutex);
+                    struct iovec iov[2] = {{(void *)header, sizeof(header)}, {(void *)frame.data(), frame.size()}};
+                    struct msghdr msg = {};
+                    msg.msg_iov = iov;
+                    msg.msg_iovlen = 2;
+                    sendmsg(socket->fd, &msg, MSG_NOSIGNAL);
+                    syscalls++;
+                }
+            }
+        }
+        const double total = (double)passes * s.sockets.size() * frames;
+        const Result result = {(double)syscalls / passes, 1000 * (cpu_ms(CLOCK_THREAD_CPUTIME_ID) - thread_start) / total,
+                               1000 * (cpu_ms(CLOCK_PROCESS_CPUTIME_ID) - process_start) / total};
+        return result;
+    }
+
+    Result run_batch(Sessions &s, SendBatch &batch, int passes, const std::string &frame, int frames)
+    {
+        const unsigned char header[4] = {0x82, 126, (unsigned char)(frame.size() >> 8), (unsigned char)frame.size()};
+        const uint64_t syscalls = batch.stats().syscalls;
+        const double thread_start = cpu_ms(CLOCK_THREAD_CPUTIME_ID), process_start = cpu_ms(CLOCK_PROCESS_CPUTIME_ID);
+        for (int pass = 0; pass < passes; pass++)
+        {
+            SendBatch::Scope scope(&batch);
+            for (const std::shared_ptr<BatchSocket> &socket : s.sockets)
+            {
+                for (int f = 0; f < frames; f++)
+                    batch.add(socket, header, sizeof(header), frame.data(), frame.size());
+            }
+        }
+        const double total = (double)passes * s.sockets.size() * frames;
+        const Result result = {(double)(batch.stats().syscalls - syscalls) / passes,
+                               1000 * (cpu_ms(CLOCK_THREAD_CPUTIME_ID) - thread_start) / total,
+                               1000 * (cpu_ms(CLOCK_PROCESS_CPUTIME_ID) - process_start) / total};
+        return result;
+    }
+
+    void print(const char *name, int count, std::vector<Result> &results)
+    {
+        const size_t mid = results.size() / 2;
+        std::sort(results.begin(), results.end(), [](const Result &a, const Result &b)
+                  { return a.thread_us < b.thread_us; });
+        const double thread_us = results[mid].thread_us;
+        std::sort(results.begin(), results.end(), [](const Result &a, const Result &b)
+                  { return a.process_us < b.process_us; });
+        printf("%-8d %-8s %12.1f %14.2f %14.2f\n", count, name, results[mid].syscalls, thread_us, results[mid].process_us);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const int passes = argc > 1 ? std::max(1, atoi(argv[1])) : 500;
+    const std::string frame(argc > 2 ? std::max(1, std::min(65535, atoi(argv[2]))) : 640, 'x');
+    const int frames = argc > 3 ? std::max(1, atoi(argv[3])) : 1;
+
+    SendBatch ring(true), plain(false);
+    if (!ring.usesRing())
+        fprintf(stderr, "io_uring not available, ring runs on plain sends\n");
+    printf("%d passes, %d frame(s) of %zu bytes per session and pass\n", passes, frames, frame.size());
+    printf("%-8s %-8s %12s %14s %14s\n", "sessions", "sends", "syscalls", "worker us", "process us");
+    printf("%-8s %-8s %12s %14s %14s\n", "", "", "per pass", "per frame", "per frame");
+    for (int count : sessions)
+    {
+        Sessions s(count);
+        std::vector<Result> direct, sockets, rings;
+        run_direct(s, passes / 10 + 1, frame, frames); // warm-up
+        run_batch(s, plain, passes / 10 + 1, frame, frames);
+        run_batch(s, ring, passes / 10 + 1, frame, frames);
+        for (int round = 0; round < ROUNDS; round++)
+        {
+            direct.push_back(run_direct(s, passes, frame, frames));
+            sockets.push_back(run_batch(s, plain, passes, frame, frames));
+            rings.push_back(run_batch(s, ring, passes, frame, frames));
+        }
+        print("frame", count, direct);
+        print("socket", count, sockets);
+        print("uring", count, rings);
+    }
+    return 0;
+}
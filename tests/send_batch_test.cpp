@@ -0,0 +1,230 @@
+// SendBatch over socket pairs, on io_uring and on plain sends: order per
+// socket, flushing one socket early, closed and broken sockets, writes cut
+// short and a peer that stops reading.
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include "send_batch.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+namespace
+{
+    const int SEND_TIMEOUT_MS = 1000;
+
+    // a connection's socket and the server end of it
+    struct Pair
+    {
+        Pair() : socket(std::make_shared<BatchSocket>())
+        {
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+            socket->fd = fds[0];
+            peer = fds[1];
+            // as the websocket client does
+            const struct timeval timeout = {SEND_TIMEOUT_MS / 1000, 0};
+            setsockopt(socket->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+
+        ~Pair()
+        {
+            if (socket->fd >= 0)
+                close(socket->fd);
+            if (peer >= 0)
+                close(peer);
+        }
+
+        // everything the peer can read now
+        std::string received()
+        {
+            std::string out;
+            char buf[65536];
+            ssize_t got;
+            while ((got = recv(peer, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+                out.append(buf, got);
+            return out;
+        }
+
+        std::shared_ptr<BatchSocket> socket;
+        int peer;
+    };
+
+    void add(SendBatch &batch, Pair &pair, const std::string &header, const std::string &data)
+    {
+        batch.add(pair.socket, header.data(), header.size(), data.data(), data.size());
+    }
+
+    void test_order(bool use_ring)
+    {
+        SendBatch batch(use_ring);
+        Pair pairs[3];
+        CHECK(SendBatch::current() == nullptr);
+        {
+            SendBatch::Scope scope(&batch);
+            CHECK(SendBatch::current() == &batch);
+            for (int frame = 0; frame < 3; frame++)
+            {
+                for (int i = 0; i < 3; i++)
+                    add(batch, pairs[i], "h" + std::to_string(i), std::string(100, (char)('a' + frame)));
+            }
+            // nothing goes out before the pass ends
+            CHECK(pairs[0].received().empty());
+        }
+        CHECK(SendBatch::current() == nullptr);
+        for (int i = 0; i < 3; i++)
+        {
+            const std::string h = "h" + std::to_string(i);
+            CHECK(pairs[i].received() == h + std::string(100, 'a') + h + std::string(100, 'b') + h + std::string(100, 'c'));
+            CHECK(pairs[i].socket->last_send_ms > 0);
+        }
+        const SendBatch::Stats stats = batch.stats();
+        CHECK(stats.frames == 9);
+        CHECK(stats.writes == 3);
+        CHECK(stats.syscalls == (batch.usesRing() ? 1u : 3u));
+        CHECK(stats.failures == 0);
+
+        // the next pass starts empty
+        batch.flush();
+        CHECK(batch.stats().syscalls == stats.syscalls);
+    }
+
+    // a direct write to a socket first takes what the batch holds for it
+    void test_flush_socket(bool use_ring)
+    {
+        SendBatch batch(use_ring);
+        Pair a, b;
+        {
+            SendBatch::Scope scope(&batch);
+            add(batch, a, "", "a1");
+            add(batch, b, "", "b1");
+            batch.flush(a.socket.get());
+            CHECK(a.received() == "a1");
+            CHECK(b.received().empty());
+            add(batch, a, "", "a2");
+        }
+        CHECK(a.received() == "a2");
+        CHECK(b.received() == "b1");
+        CHECK(batch.stats().frames == 3);
+    }
+
+    // a socket closed before the batch is written loses its frames quietly,
+    // one whose peer went away is shut down
+    void test_closed(bool use_ring)
+    {
+        SendBatch batch(use_ring);
+        Pair closed, gone, fine;
+        close(closed.socket->fd);
+        closed.socket->fd = -1;
+        close(gone.peer);
+        gone.peer = -1;
+        {
+            SendBatch::Scope scope(&batch);
+            add(batch, closed, "", "x");
+            add(batch, gone, "", "y");
+            add(batch, fine, "", "z");
+        }
+        CHECK(fine.received() == "z");
+        const SendBatch::Stats stats = batch.stats();
+        CHECK(stats.frames == 1);
+        CHECK(stats.failures == 1);
+        CHECK(send(gone.socket->fd, "y", 1, MSG_NOSIGNAL) < 0);
+    }
+
+    void read_all(Pair &pair, std::string &out, size_t len)
+    {
+        char buf[65536];
+        while (out.size() < len)
+        {
+            const ssize_t got = recv(pair.peer, buf, sizeof(buf), 0);
+            if (got <= 0)
+                break;
+            out.append(buf, got);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    // more than the socket buffers take at once, finished while the peers
+    // read slowly
+    void test_large(bool use_ring)
+    {
+        SendBatch batch(use_ring);
+        Pair pairs[2];
+        std::string expected[2], got[2];
+        for (int frame = 0; frame < 64; frame++)
+        {
+            for (int i = 0; i < 2; i++)
+                expected[i] += std::to_string(frame) + std::string(32768, (char)(frame + i));
+        }
+        std::thread readers[2];
+        for (int i = 0; i < 2; i++)
+            readers[i] = std::thread(read_all, std::ref(pairs[i]), std::ref(got[i]), expected[i].size());
+        {
+            SendBatch::Scope scope(&batch);
+            for (int frame = 0; frame < 64; frame++)
+            {
+                for (int i = 0; i < 2; i++)
+                    add(batch, pairs[i], std::to_string(frame), std::string(32768, (char)(frame + i)));
+            }
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            readers[i].join();
+            CHECK(got[i] == expected[i]);
+        }
+        CHECK(batch.stats().failures == 0);
+        CHECK(batch.stats().frames == 128);
+    }
+
+    // a peer that reads nothing is given up on after its send timeout
+    // without holding up the others for longer
+    void test_stalled(bool use_ring)
+    {
+        SendBatch batch(use_ring);
+        Pair stalled, fine;
+        const auto start = std::chrono::steady_clock::now();
+        {
+            SendBatch::Scope scope(&batch);
+            add(batch, stalled, "", std::string(8 << 20, 's'));
+            add(batch, fine, "", "f");
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        CHECK(elapsed >= std::chrono::milliseconds(SEND_TIMEOUT_MS - 50));
+        CHECK(elapsed < std::chrono::milliseconds(3 * SEND_TIMEOUT_MS));
+        CHECK(fine.received() == "f");
+        CHECK(batch.stats().failures == 1);
+        CHECK(batch.stats().frames == 1);
+    }
+}
+
+int main()
+{
+    SendBatch probe;
+    if (!probe.usesRing())
+        fprintf(stderr, "io_uring not available, the ring cases run on plain sends\n");
+    for (int ring = 0; ring < 2; ring++)
+    {
+        test_order(ring);
+        test_flush_socket(ring);
+        test_closed(ring);
+        test_large(ring);
+        test_stalled(ring);
+    }
+    if (failures)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
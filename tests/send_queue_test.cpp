@@ -0,0 +1,339 @@
+// SendQueue against a fake transport that takes a set number of messages
+// and refuses the rest, as libwsc does once the connection is down.
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "send_queue.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+namespace
+{
+    class FakeTransport : public WsTransport
+    {
+    public:
+        void setUrl(const std::string &) override {}
+        void setTLSOptions(const WebSocketTLSOptions &) override {}
+        void setPingInterval(int) override {}
+        void setCompression(const DeflateConfig &) override {}
+        void setHeaders(const Headers &) override {}
+        void setMessageCallback(std::function<void(const std::string &)>) override {}
+        void setOpenCallback(std::function<void()>) override {}
+        void setErrorCallback(std::function<void(int, const std::string &)>) override {}
+        void setCloseCallback(std::function<void(int, const std::string &)>) override {}
+        void connect() override {}
+        void disconnect() override {}
+
+        bool isConnected() override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_budget != 0;
+        }
+
+        bool sendBinary(const void *data, size_t len) override
+        {
+            return take("b:" + std::string(static_cast<const char *>(data), len));
+        }
+
+        bool sendMessage(const char *text, size_t len) override
+        {
+            return take("t:" + std::string(text, len));
+        }
+
+        // messages taken before the connection goes down, -1 for no limit
+        void setBudget(int budget)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_budget = budget;
+        }
+
+        std::vector<std::string> received()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_received;
+        }
+
+        size_t batches()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_batches;
+        }
+
+        size_t sendBinaryBatch(const Frame *frames, size_t count) override
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_batches++;
+            }
+            return WsTransport::sendBinaryBatch(frames, count);
+        }
+
+    private:
+        bool take(const std::string &message)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_budget == 0)
+                return false;
+            if (m_budget > 0)
+                m_budget--;
+            m_received.push_back(message);
+            return true;
+        }
+
+        std::mutex m_mutex;
+        int m_budget = -1;
+        size_t m_batches = 0;
+        std::vector<std::string> m_received;
+    };
+
+    // the send thread works on its own, wait for it to get somewhere
+    template <typename Pred>
+    bool wait_until(Pred pred)
+    {
+        for (int i = 0; i < 200; i++)
+        {
+            if (pred())
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return pred();
+    }
+
+    // the refused batch is back at the front and the queue waits for resume()
+    void wait_held(FakeTransport &transport)
+    {
+        CHECK(wait_until([&]
+                         { return transport.batches() > 0; }));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    void push_packets(SendQueue &queue, int first, int last)
+    {
+        for (int i = first; i <= last; i++)
+        {
+            char packet[8];
+            snprintf(packet, sizeof(packet), "%04d", i); // 4 bytes of "audio"
+            queue.pushBinary(packet, 4);
+        }
+    }
+
+    std::vector<std::string> packets(int first, int last)
+    {
+        std::vector<std::string> out;
+        for (int i = first; i <= last; i++)
+        {
+            char packet[8];
+            snprintf(packet, sizeof(packet), "b:%04d", i);
+            out.push_back(packet);
+        }
+        return out;
+    }
+
+    SendQueueConfig keeping(size_t max_bytes)
+    {
+        SendQueueConfig config;
+        config.max_bytes = max_bytes;
+        config.keep_unsent = true;
+        return config;
+    }
+
+    // refused mid-batch: the rest stays queued, in order, until the
+    // reconnect, and the text of the new connection goes first
+    void test_reopen_order()
+    {
+        FakeTransport transport;
+        transport.setBudget(3);
+        SendQueue queue(keeping(1000), 1, transport);
+        queue.pushText("format", 6, true);
+        push_packets(queue, 1, 10);
+        CHECK(wait_until([&]
+                         { return queue.stats().failed_packets == 0 && transport.received().size() == 3; }));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        // held: nothing more is attempted, audio pushed meanwhile queues behind
+        CHECK(transport.received().size() == 3);
+        push_packets(queue, 11, 12);
+        SendQueue::Stats stats = queue.stats();
+        CHECK(stats.depth_bytes == 10 * 4); // 3..12, packet 3 was refused
+        CHECK(stats.sent_packets == 2);
+        CHECK(stats.failed_packets == 0);
+
+        transport.setBudget(-1);
+        queue.reopen();
+        queue.pushText("meta", 4);
+        queue.resume();
+        CHECK(wait_until([&]
+                         { return queue.stats().depth_bytes == 0; }));
+
+        std::vector<std::string> expected = {"t:format", "b:0001", "b:0002", "t:format", "t:meta"};
+        for (const auto &packet : packets(3, 12))
+            expected.push_back(packet);
+        CHECK(transport.received() == expected);
+        stats = queue.stats();
+        CHECK(stats.sent_packets == 12);
+        CHECK(stats.dropped_packets == 0);
+        CHECK(stats.failed_packets == 0);
+    }
+
+    // without keep_unsent a refused message is lost and counted as failed
+    void test_without_keeping()
+    {
+        FakeTransport transport;
+        transport.setBudget(2);
+        SendQueueConfig config;
+        config.max_bytes = 1000;
+        SendQueue queue(config, 1, transport);
+        push_packets(queue, 1, 5);
+        CHECK(wait_until([&]
+                         { return queue.stats().depth_bytes == 0; }));
+        const SendQueue::Stats stats = queue.stats();
+        CHECK(stats.sent_packets == 2);
+        CHECK(stats.failed_packets == 3);
+        CHECK(stats.dropped_packets == 0);
+        CHECK(transport.received() == packets(1, 2));
+    }
+
+    // a full queue drops the oldest audio, never text, and reports congestion
+    void test_drop_oldest()
+    {
+        FakeTransport transport;
+        transport.setBudget(0);
+        SendQueue queue(keeping(5 * 4), 1, transport);
+        push_packets(queue, 1, 1);
+        wait_held(transport);
+        queue.pushText("meta", 4);
+        push_packets(queue, 2, 9);
+
+        bool congested = false;
+        CHECK(queue.pollCongestion(congested) && congested);
+        SendQueue::Stats stats = queue.stats();
+        CHECK(stats.depth_bytes == 5 * 4);
+        CHECK(stats.dropped_packets == 4);
+        CHECK(stats.dropped_bytes == 4 * 4);
+        CHECK(stats.congestions == 1);
+
+        transport.setBudget(-1);
+        queue.reopen();
+        queue.resume();
+        CHECK(wait_until([&]
+                         { return queue.stats().depth_bytes == 0; }));
+        std::vector<std::string> expected = {"t:meta"};
+        for (const auto &packet : packets(5, 9))
+            expected.push_back(packet);
+        CHECK(transport.received() == expected);
+
+        // drained without new drops: clear again
+        CHECK(queue.pollCongestion(congested) && !congested);
+        CHECK(!queue.pollCongestion(congested));
+    }
+
+    void test_drop_newest()
+    {
+        FakeTransport transport;
+        transport.setBudget(0);
+        SendQueueConfig config = keeping(3 * 4);
+        config.drop_newest = true;
+        SendQueue queue(config, 1, transport);
+        push_packets(queue, 1, 1);
+        wait_held(transport);
+        push_packets(queue, 2, 6);
+        const SendQueue::Stats stats = queue.stats();
+        CHECK(stats.depth_bytes == 3 * 4);
+        CHECK(stats.dropped_packets == 3);
+
+        transport.setBudget(-1);
+        queue.reopen();
+        queue.resume();
+        CHECK(wait_until([&]
+                         { return queue.stats().depth_bytes == 0; }));
+        CHECK(transport.received() == packets(1, 3));
+    }
+
+    // clear() on a close without replay forgets the held audio, not as drops
+    void test_clear()
+    {
+        FakeTransport transport;
+        transport.setBudget(0);
+        SendQueue queue(keeping(1000), 1, transport);
+        push_packets(queue, 1, 4);
+        wait_held(transport);
+        queue.clear();
+        SendQueue::Stats stats = queue.stats();
+        CHECK(stats.depth_bytes == 0);
+        CHECK(stats.dropped_packets == 0);
+
+        transport.setBudget(-1);
+        push_packets(queue, 5, 5);
+        CHECK(wait_until([&]
+                         { return queue.stats().sent_packets == 1; }));
+        CHECK(transport.received() == packets(5, 5));
+    }
+
+    // stopping a held queue does not wait out the flush time for a
+    // connection that is gone; the held audio counts as failed
+    void test_stop_while_held()
+    {
+        FakeTransport transport;
+        transport.setBudget(1);
+        SendQueue queue(keeping(1000), 1, transport);
+        push_packets(queue, 1, 6);
+        CHECK(wait_until([&]
+                         { return transport.received().size() == 1 && queue.stats().depth_bytes == 5 * 4; }));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        const auto start = std::chrono::steady_clock::now();
+        queue.stop();
+        const auto took = std::chrono::steady_clock::now() - start;
+        CHECK(took < std::chrono::milliseconds(SEND_QUEUE_FLUSH_MS / 2));
+        const SendQueue::Stats stats = queue.stats();
+        CHECK(stats.depth_bytes == 0);
+        CHECK(stats.sent_packets == 1);
+        CHECK(stats.failed_packets == 5);
+
+        // nothing is taken once stopped
+        push_packets(queue, 7, 7);
+        CHECK(queue.stats().depth_bytes == 0);
+        CHECK(transport.received() == packets(1, 1));
+    }
+
+    // stop() on a live connection still sends what is queued
+    void test_stop_flushes()
+    {
+        FakeTransport transport;
+        SendQueue queue(keeping(1000), 1, transport);
+        push_packets(queue, 1, 40);
+        queue.pushText("bye", 3);
+        queue.stop();
+        std::vector<std::string> expected = packets(1, 40);
+        expected.push_back("t:bye");
+        CHECK(transport.received() == expected);
+        CHECK(queue.stats().sent_packets == 40);
+    }
+}
+
+int main()
+{
+    test_reopen_order();
+    test_without_keeping();
+    test_drop_oldest();
+    test_drop_newest();
+    test_clear();
+    test_stop_while_held();
+    test_stop_flushes();
+    if (failures)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+// VoiceGate driven the way send_packet drives it: threshold, hangover,
+// pre-roll on speech start and keepalives during silence.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "audio_vad.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+namespace
+{
+    // 8 kHz mono, 20ms packets
+    const size_t BYTES_PER_MS = 16;
+    const size_t PACKET_MS = 20;
+
+    // a constant level: 328 is -40 dBFS, 104 is -50 dBFS; small values
+    // double as packet numbers in what was sent
+    const int16_t SPEECH = 3000;
+
+    std::vector<int16_t> packet(int16_t value, size_t ms = PACKET_MS)
+    {
+        return std::vector<int16_t>(ms * BYTES_PER_MS / sizeof(int16_t), value);
+    }
+
+    struct Stream
+    {
+        explicit Stream(const VoiceGateConfig &config) : gate(config, BYTES_PER_MS) {}
+
+        // send_packet minus the websocket
+        void feed(const std::vector<int16_t> &samples)
+        {
+            const uint8_t *data = reinterpret_cast<const uint8_t *>(samples.data());
+            const size_t len = samples.size() * sizeof(int16_t);
+            switch (gate.update(data, len))
+            {
+            case VoiceGate::SPEECH_START:
+                events.push_back("start");
+                if (gate.prerollSize() > 0)
+                {
+                    const int16_t *preroll = reinterpret_cast<const int16_t *>(gate.preroll());
+                    sent.insert(sent.end(), preroll, preroll + gate.prerollSize() / sizeof(int16_t));
+                    gate.clearPreroll();
+                }
+                break;
+            case VoiceGate::SPEECH_STOP:
+                events.push_back("stop");
+                break;
+            case VoiceGate::NONE:
+                break;
+            }
+
+            if (gate.active())
+            {
+                sent.insert(sent.end(), samples.begin(), samples.end());
+            }
+            else
+            {
+                gate.remember(data, len);
+                if (gate.keepaliveDue())
+                    keepalives++;
+            }
+        }
+
+        void feed(int16_t value, int packets)
+        {
+            for (int i = 0; i < packets; i++)
+                feed(packet(value));
+        }
+
+        VoiceGate gate;
+        std::vector<int16_t> sent;
+        std::vector<std::string> events;
+        int keepalives = 0;
+    };
+
+    // packets first..last of one sample value each, as sent
+    std::vector<int16_t> numbered(int first, int last)
+    {
+        std::vector<int16_t> out;
+        for (int i = first; i <= last; i++)
+        {
+            const std::vector<int16_t> p = packet((int16_t)i);
+            out.insert(out.end(), p.begin(), p.end());
+        }
+        return out;
+    }
+
+    void test_threshold()
+    {
+        VoiceGateConfig config;
+        config.threshold_dbfs = -45;
+        Stream s(config);
+        s.feed(packet(104));
+        CHECK(std::fabs(s.gate.level() + 50.0) < 0.1);
+        CHECK(!s.gate.active());
+        CHECK(s.sent.empty());
+
+        s.feed(packet(328));
+        CHECK(std::fabs(s.gate.level() + 40.0) < 0.1);
+        CHECK(s.gate.active());
+        CHECK(s.events == std::vector<std::string>{"start"});
+
+        // digital silence
+        s.feed(packet(0));
+        CHECK(s.gate.level() == -96.0);
+    }
+
+    // sending goes on for hangover_ms of silence after the last speech
+    // packet, and speech within it starts the hangover over
+    void test_hangover()
+    {
+        VoiceGateConfig config;
+        config.hangover_ms = 500;
+        config.preroll_ms = 0;
+        Stream s(config);
+        s.feed(SPEECH, 1);
+        s.feed(1, 10);
+        s.feed(SPEECH, 1);
+        const size_t hangover = config.hangover_ms / PACKET_MS;
+        s.feed(1, hangover - 1);
+        CHECK(s.gate.active());
+        CHECK(s.events == std::vector<std::string>{"start"});
+        s.feed(2, 1);
+        CHECK(!s.gate.active());
+        CHECK(s.events == (std::vector<std::string>{"start", "stop"}));
+
+        // the packet that ends the hangover is not sent
+        CHECK(s.sent.size() == (2 + 10 + hangover - 1) * packet(0).size());
+        CHECK(s.sent.back() == 1);
+    }
+
+    // the last preroll_ms of silence goes out, oldest first, before the
+    // packet that starts speech
+    void test_preroll()
+    {
+        VoiceGateConfig config;
+        config.preroll_ms = 200;
+        config.hangover_ms = PACKET_MS;
+        Stream s(config);
+        for (int i = 1; i <= 30; i++)
+            s.feed(packet((int16_t)i));
+        CHECK(s.sent.empty());
+        CHECK(s.gate.prerollSize() == config.preroll_ms * BYTES_PER_MS);
+        s.feed(SPEECH, 1);
+
+        std::vector<int16_t> expected = numbered(21, 30);
+        const std::vector<int16_t> speech = packet(SPEECH);
+        expected.insert(expected.end(), speech.begin(), speech.end());
+        CHECK(s.sent == expected);
+        CHECK(s.gate.prerollSize() == 0);
+
+        // a short silence sends only what there was
+        s.feed(31, 1);
+        CHECK(s.events.back() == "stop");
+        s.feed(32, 1);
+        s.feed(33, 1);
+        s.sent.clear();
+        s.feed(SPEECH, 1);
+        expected = numbered(31, 33);
+        CHECK(s.sent.size() == expected.size() + speech.size());
+        CHECK(std::equal(expected.begin(), expected.end(), s.sent.begin()));
+    }
+
+    // packets that do not divide the pre-roll keep its last bytes exactly
+    void test_preroll_wrap()
+    {
+        VoiceGateConfig config;
+        config.preroll_ms = 50;
+        Stream s(config);
+        std::vector<int16_t> all;
+        for (int i = 1; i <= 7; i++)
+        {
+            const std::vector<int16_t> p = packet((int16_t)i, 30);
+            all.insert(all.end(), p.begin(), p.end());
+            s.feed(p);
+        }
+        s.feed(SPEECH, 1);
+        const size_t kept = config.preroll_ms * BYTES_PER_MS / sizeof(int16_t);
+        CHECK(s.sent.size() == kept + packet(0).size());
+        CHECK(std::equal(all.end() - kept, all.end(), s.sent.begin()));
+
+        // a packet longer than the pre-roll keeps its own tail
+        VoiceGateConfig small;
+        small.preroll_ms = 10;
+        Stream t(small);
+        t.feed(packet(5, 20));
+        CHECK(t.gate.prerollSize() == 10 * BYTES_PER_MS);
+    }
+
+    // one keepalive per keepalive_ms of continuous silence, counted again
+    // from the end of speech
+    void test_keepalive()
+    {
+        VoiceGateConfig config;
+        config.keepalive_ms = 1000;
+        config.hangover_ms = PACKET_MS;
+        Stream s(config);
+        const int per_keepalive = config.keepalive_ms / PACKET_MS;
+        s.feed(1, per_keepalive - 1);
+        CHECK(s.keepalives == 0);
+        s.feed(1, 1);
+        CHECK(s.keepalives == 1);
+        s.feed(1, per_keepalive);
+        CHECK(s.keepalives == 2);
+
+        // speech and its hangover send audio instead
+        s.feed(1, per_keepalive / 2);
+        s.feed(SPEECH, 20);
+        CHECK(s.keepalives == 2);
+        s.feed(1, 1);
+        CHECK(!s.gate.active());
+        s.feed(1, per_keepalive - 2);
+        CHECK(s.keepalives == 2);
+        s.feed(1, 1);
+        CHECK(s.keepalives == 3);
+
+        config.keepalive_ms = 0;
+        Stream quiet(config);
+        quiet.feed(1, 10 * per_keepalive);
+        CHECK(quiet.keepalives == 0);
+    }
+}
+
+int main()
+{
+    test_threshold();
+    test_hangover();
+    test_preroll();
+    test_preroll_wrap();
+    test_keepalive();
+    if (failures)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
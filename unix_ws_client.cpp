@@ -0,0 +1,692 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <fcntl.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+#include "base64.h"
+#include "unix_ws_client.h"
+
+#define UNIX_WS_READ_CHUNK 65536
+#define UNIX_WS_MAX_RESPONSE 16384 /* upgrade response headers */
+
+namespace
+{
+    enum Opcode : uint8_t
+    {
+        OP_CONTINUATION = 0x0,
+        OP_TEXT = 0x1,
+        OP_BINARY = 0x2,
+        OP_CLOSE = 0x8,
+        OP_PING = 0x9,
+        OP_PONG = 0xA
+    };
+
+    const uint8_t RSV1 = 0x40; /* compressed message, on its first frame */
+
+    int64_t now_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::string accept_key(const std::string &key)
+    {
+        const std::string input = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        SHA1(reinterpret_cast<const unsigned char *>(input.data()), input.size(), digest);
+        return base64_encode(digest, sizeof(digest));
+    }
+
+    // value of a response header, matched without case
+    std::string header_value(const std::string &response, const char *name)
+    {
+        const size_t name_len = strlen(name);
+        size_t line = response.find("\r\n");
+        while (line != std::string::npos && line + 2 < response.size())
+        {
+            line += 2;
+            const size_t end = response.find("\r\n", line);
+            if (end == std::string::npos)
+                break;
+            if (end - line > name_len && response[line + name_len] == ':' && !strncasecmp(response.c_str() + line, name, name_len))
+            {
+                size_t start = line + name_len + 1;
+                while (start < end && (response[start] == ' ' || response[start] == '\t'))
+                    start++;
+                size_t stop = end;
+                while (stop > start && (response[stop - 1] == ' ' || response[stop - 1] == '\t'))
+                    stop--;
+                return response.substr(start, stop - start);
+            }
+            line = end;
+        }
+        return std::string();
+    }
+}
+
+UnixWebSocketClient::UnixWebSocketClient()
+    : m_ping_interval(0), m_socket(std::make_shared<BatchSocket>()), m_wake{-1, -1}, m_connected(false),
+      m_stopping(false), m_close_sent(false), m_message_compressed(false), m_close_code(1006)
+{
+}
+
+UnixWebSocketClient::~UnixWebSocketClient()
+{
+    disconnect();
+    if (m_thread.joinable())
+        m_thread.detach(); // destroyed from its own callback
+}
+
+bool UnixWebSocketClient::parseUrl(const std::string &url, std::string &path, std::string &resource)
+{
+    if (!isUnix(url))
+        return false;
+    const size_t start = 10;
+    const size_t colon = url.find(':', start);
+    path = url.substr(start, colon == std::string::npos ? std::string::npos : colon - start);
+    resource = colon == std::string::npos ? "/" : url.substr(colon + 1);
+    return path.size() > 1 && path[0] == '/' && path.size() < sizeof(((struct sockaddr_un *)0)->sun_path) &&
+           !resource.empty() && resource[0] == '/';
+}
+
+void UnixWebSocketClient::setUrl(const std::string &url)
+{
+    m_url = url;
+}
+
+void UnixWebSocketClient::setPingInterval(int seconds)
+{
+    m_ping_interval = std::max(0, seconds);
+}
+
+void UnixWebSocketClient::setCompression(const DeflateConfig &config)
+{
+    m_deflate_config = config;
+}
+
+void UnixWebSocketClient::setHeaders(const Headers &headers)
+{
+    m_headers = headers;
+}
+
+void UnixWebSocketClient::setMessageCallback(std::function<void(const std::string &)> callback)
+{
+    m_on_message = std::move(callback);
+}
+
+void UnixWebSocketClient::setOpenCallback(std::function<void()> callback)
+{
+    m_on_open = std::move(callback);
+}
+
+void UnixWebSocketClient::setErrorCallback(std::function<void(int, const std::string &)> callback)
+{
+    m_on_error = std::move(callback);
+}
+
+void UnixWebSocketClient::setCloseCallback(std::function<void(int, const std::string &)> callback)
+{
+    m_on_close = std::move(callback);
+}
+
+void UnixWebSocketClient::connect()
+{
+    if (m_thread.joinable())
+        disconnect(); // the previous connection ended on its own
+    if (pipe2(m_wake, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        if (m_on_error)
+            m_on_error(errno, strerror(errno));
+        return;
+    }
+    m_stopping = false;
+    m_close_sent = false;
+    m_connected = false;
+    m_thread = std::thread(&UnixWebSocketClient::run, this);
+}
+
+void UnixWebSocketClient::disconnect()
+{
+    if (!m_thread.joinable())
+        return;
+    m_stopping = true;
+    if (m_connected && !m_close_sent)
+        sendClose(1000);
+    const char wake = 1;
+    if (write(m_wake[1], &wake, 1) < 0)
+    {
+        // the pipe is non-blocking; a full one already wakes the thread
+    }
+    if (std::this_thread::get_id() == m_thread.get_id())
+        return; // from a callback, the thread ends after it returns
+    m_thread.join();
+    close(m_wake[0]);
+    close(m_wake[1]);
+    m_wake[0] = m_wake[1] = -1;
+}
+
+bool UnixWebSocketClient::isConnected()
+{
+    return m_connected;
+}
+
+bool UnixWebSocketClient::sendBinary(const void *data, size_t len)
+{
+    return m_connected && sendData(OP_BINARY, data, len);
+}
+
+bool UnixWebSocketClient::sendMessage(const char *text, size_t len)
+{
+    return m_connected && sendData(OP_TEXT, text, len);
+}
+
+bool UnixWebSocketClient::sendData(uint8_t opcode, const void *data, size_t len)
+{
+    std::unique_lock<std::mutex> lock(m_deflate_mutex);
+    if (!m_deflate || !m_deflate->compresses(opcode == OP_BINARY))
+    {
+        lock.unlock();
+        return sendFrame(opcode, data, len);
+    }
+    // with context takeover the server inflates in the order we compress
+    if (!m_deflate->compress(data, len, m_deflated))
+        return false;
+    return sendFrame(opcode | RSV1, m_deflated.data(), m_deflated.size());
+}
+
+size_t UnixWebSocketClient::sendBinaryBatch(const Frame *frames, size_t count)
+{
+    bool compressed;
+    {
+        std::lock_guard<std::mutex> lock(m_deflate_mutex);
+        compressed = m_deflate && m_deflate->compresses(true);
+    }
+    if (compressed)
+        return WsTransport::sendBinaryBatch(frames, count); // compressed one by one
+    size_t sent = 0;
+    while (m_connected && sent < count)
+    {
+        const size_t batch = sendFrames(OP_BINARY, frames + sent, std::min<size_t>(count - sent, UNIX_WS_BATCH_FRAMES));
+        if (batch == 0)
+            break;
+        sent += batch;
+    }
+    return sent;
+}
+
+bool UnixWebSocketClient::sendFrame(uint8_t opcode, const void *data, size_t len)
+{
+    const Frame frame = {data, len};
+    return sendFrames(opcode, &frame, 1) == 1;
+}
+
+size_t UnixWebSocketClient::sendFrames(uint8_t opcode, const Frame *frames, size_t count)
+{
+    const std::shared_ptr<BatchSocket> socket = std::atomic_load(&m_socket);
+    uint8_t headers[UNIX_WS_BATCH_FRAMES][14];
+    size_t hlens[UNIX_WS_BATCH_FRAMES];
+    struct iovec iov[UNIX_WS_BATCH_FRAMES * 2];
+    size_t ends[UNIX_WS_BATCH_FRAMES]; /* iovecs up to the end of each frame */
+    size_t iovcnt = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const size_t len = frames[i].len;
+        uint8_t *header = headers[i];
+        size_t hlen = 0;
+        header[hlen++] = 0x80 | opcode;
+        if (len < 126)
+        {
+            header[hlen++] = 0x80 | (uint8_t)len;
+        }
+        else if (len <= 0xffff)
+        {
+            header[hlen++] = 0x80 | 126;
+            header[hlen++] = (uint8_t)(len >> 8);
+            header[hlen++] = (uint8_t)len;
+        }
+        else
+        {
+            header[hlen++] = 0x80 | 127;
+            for (int shift = 56; shift >= 0; shift -= 8)
+                header[hlen++] = (uint8_t)((uint64_t)len >> shift);
+        }
+        // zero masking key, the payload goes out as it is
+        memset(header + hlen, 0, 4);
+        hlen += 4;
+        hlens[i] = hlen;
+
+        iov[iovcnt++] = {header, hlen};
+        if (len)
+            iov[iovcnt++] = {const_cast<void *>(frames[i].data), len};
+        ends[i] = iovcnt;
+    }
+
+    // a media worker's audio goes out with that of its other streams at
+    // the end of the pass; anything else first pushes out what the batch
+    // holds for this connection, so it keeps its place behind it
+    SendBatch *batch = SendBatch::current();
+    if (batch && opcode == OP_BINARY)
+    {
+        bool small = true;
+        for (size_t i = 0; i < count && small; i++)
+            small = frames[i].len <= SEND_BATCH_MAX_FRAME;
+        if (small)
+        {
+            for (size_t i = 0; i < count; i++)
+                batch->add(socket, headers[i], hlens[i], frames[i].data, frames[i].len);
+            return count;
+        }
+    }
+    if (batch)
+        batch->flush(socket.get());
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    std::lock_guard<std::mutex> lock(socket->mutex);
+    if (socket->fd < 0)
+        return 0;
+    while (msg.msg_iovlen > 0)
+    {
+        ssize_t sent = sendmsg(socket->fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // timed out or broken; a frame cut short leaves the stream
+            // unusable, the client thread sees the shutdown and closes
+            shutdown(socket->fd, SHUT_RDWR);
+            const size_t done = msg.msg_iov - iov;
+            size_t complete = 0;
+            while (complete < count && ends[complete] <= done)
+                complete++;
+            return complete;
+        }
+        while (sent > 0 && msg.msg_iovlen > 0)
+        {
+            if ((size_t)sent >= msg.msg_iov->iov_len)
+            {
+                sent -= msg.msg_iov->iov_len;
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            }
+            else
+            {
+                msg.msg_iov->iov_base = static_cast<uint8_t *>(msg.msg_iov->iov_base) + sent;
+                msg.msg_iov->iov_len -= sent;
+                sent = 0;
+            }
+        }
+    }
+    socket->last_send_ms = now_ms();
+    return count;
+}
+
+void UnixWebSocketClient::sendClose(uint16_t code)
+{
+    const uint8_t payload[2] = {(uint8_t)(code >> 8), (uint8_t)code};
+    m_close_sent = true;
+    sendFrame(OP_CLOSE, payload, sizeof(payload));
+}
+
+bool UnixWebSocketClient::waitReadable(int timeout_ms)
+{
+    struct pollfd fds[2] = {{m_socket->fd, POLLIN, 0}, {m_wake[0], POLLIN, 0}};
+    for (;;)
+    {
+        const int rc = poll(fds, 2, timeout_ms);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        return rc > 0 && !fds[1].revents && fds[0].revents;
+    }
+}
+
+bool UnixWebSocketClient::open(std::string &error)
+{
+    std::string path, resource;
+    if (!parseUrl(m_url, path, resource))
+    {
+        error = "invalid url " + m_url;
+        return false;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        error = strerror(errno);
+        return false;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        error = path + ": " + strerror(errno);
+        close(fd);
+        return false;
+    }
+    const struct timeval timeout = {UNIX_WS_SEND_TIMEOUT_MS / 1000, (UNIX_WS_SEND_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::shared_ptr<BatchSocket> socket = std::make_shared<BatchSocket>();
+    socket->fd = fd;
+    std::atomic_store(&m_socket, socket);
+    return true;
+}
+
+bool UnixWebSocketClient::handshake(std::string &error)
+{
+    std::string path, resource;
+    parseUrl(m_url, path, resource);
+
+    unsigned char nonce[16];
+    std::random_device random;
+    for (size_t i = 0; i < sizeof(nonce); i++)
+        nonce[i] = (unsigned char)random();
+    const std::string key = base64_encode(nonce, sizeof(nonce));
+
+    std::string request = "GET " + resource + " HTTP/1.1\r\n"
+                                              "Host: localhost\r\n"
+                                              "Upgrade: websocket\r\n"
+                                              "Connection: Upgrade\r\n"
+                                              "Sec-WebSocket-Key: " +
+                          key + "\r\n"
+                                "Sec-WebSocket-Version: 13\r\n";
+    {
+        std::lock_guard<std::mutex> lock(m_deflate_mutex);
+        m_deflate.reset(new MessageDeflate(m_deflate_config));
+        const std::string offer = m_deflate->offer();
+        if (!offer.empty())
+            request += "Sec-WebSocket-Extensions: " + offer + "\r\n";
+    }
+    for (const auto &header : m_headers)
+        request += header.first + ": " + header.second + "\r\n";
+    request += "\r\n";
+
+    size_t offset = 0;
+    while (offset < request.size())
+    {
+        const ssize_t sent = send(m_socket->fd, request.data() + offset, request.size() - offset, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+        {
+            error = std::string("sending upgrade request: ") + strerror(errno);
+            return false;
+        }
+        offset += sent;
+    }
+
+    // bytes after the headers are already websocket frames and stay in m_in
+    const int64_t deadline = now_ms() + UNIX_WS_HANDSHAKE_MS;
+    size_t end;
+    for (;;)
+    {
+        const uint8_t *crlf = (const uint8_t *)"\r\n\r\n";
+        auto found = std::search(m_in.begin(), m_in.end(), crlf, crlf + 4);
+        if (found != m_in.end())
+        {
+            end = found - m_in.begin() + 4;
+            break;
+        }
+        const int64_t remaining = deadline - now_ms();
+        if (m_in.size() > UNIX_WS_MAX_RESPONSE || remaining <= 0 || !waitReadable((int)remaining))
+        {
+            error = m_stopping ? "disconnected" : "no upgrade response";
+            return false;
+        }
+        const size_t old = m_in.size();
+        m_in.resize(old + UNIX_WS_READ_CHUNK);
+        const ssize_t got = recv(m_socket->fd, m_in.data() + old, UNIX_WS_READ_CHUNK, 0);
+        m_in.resize(old + std::max<ssize_t>(got, 0));
+        if (got == 0 || (got < 0 && errno != EINTR))
+        {
+            error = "connection closed during upgrade";
+            return false;
+        }
+    }
+
+    const std::string response(m_in.begin(), m_in.begin() + end);
+    m_in.erase(m_in.begin(), m_in.begin() + end);
+    const size_t space = response.find(' ');
+    const int status = space == std::string::npos ? 0 : atoi(response.c_str() + space + 1);
+    if (status != 101)
+    {
+        error = "upgrade failed with status " + std::to_string(status);
+        return false;
+    }
+    if (header_value(response, "Sec-WebSocket-Accept") != accept_key(key))
+    {
+        error = "invalid Sec-WebSocket-Accept";
+        return false;
+    }
+    const std::string extensions = header_value(response, "Sec-WebSocket-Extensions");
+    std::lock_guard<std::mutex> lock(m_deflate_mutex);
+    if (!m_deflate->accept(extensions))
+    {
+        error = "unsupported Sec-WebSocket-Extensions: " + extensions;
+        return false;
+    }
+    return true;
+}
+
+bool UnixWebSocketClient::dispatch()
+{
+    size_t pos = 0;
+    bool alive = true;
+    while (alive)
+    {
+        const size_t available = m_in.size() - pos;
+        if (available < 2)
+            break;
+        uint8_t *frame = m_in.data() + pos;
+        const bool fin = frame[0] & 0x80;
+        const uint8_t rsv = frame[0] & 0x70;
+        const uint8_t opcode = frame[0] & 0x0f;
+        const bool masked = frame[1] & 0x80;
+        uint64_t len = frame[1] & 0x7f;
+        size_t hlen = 2;
+        if (len == 126)
+        {
+            if (available < 4)
+                break;
+            len = ((uint64_t)frame[2] << 8) | frame[3];
+            hlen = 4;
+        }
+        else if (len == 127)
+        {
+            if (available < 10)
+                break;
+            len = 0;
+            for (int i = 0; i < 8; i++)
+                len = (len << 8) | frame[2 + i];
+            hlen = 10;
+        }
+        if (masked)
+            hlen += 4;
+        if (len > UNIX_WS_MAX_MESSAGE || m_message.size() + len > UNIX_WS_MAX_MESSAGE)
+        {
+            m_close_code = 1009;
+            m_close_reason = "message too big";
+            sendClose(1009);
+            return false;
+        }
+        if (available < hlen + len)
+            break;
+
+        uint8_t *payload = frame + hlen;
+        if (masked)
+        {
+            const uint8_t *mask = payload - 4;
+            for (uint64_t i = 0; i < len; i++)
+                payload[i] ^= mask[i & 3];
+        }
+        pos += hlen + len;
+
+        // only the first frame of a data message may say it is compressed,
+        // and only once the extension is negotiated. m_deflate is replaced
+        // on this thread and its inflate side is not used by senders.
+        if (rsv && (rsv != RSV1 || (opcode != OP_TEXT && opcode != OP_BINARY) || !m_deflate || !m_deflate->active()))
+        {
+            m_close_code = 1002;
+            m_close_reason = "unexpected reserved bits";
+            sendClose(1002);
+            alive = false;
+            continue;
+        }
+
+        switch (opcode)
+        {
+        case OP_TEXT:
+        case OP_BINARY:
+            m_message.assign((const char *)payload, len);
+            m_message_compressed = rsv == RSV1;
+            break;
+        case OP_CONTINUATION:
+            m_message.append((const char *)payload, len);
+            break;
+        case OP_PING:
+            sendFrame(OP_PONG, payload, len);
+            continue;
+        case OP_PONG:
+            continue;
+        case OP_CLOSE:
+            m_close_code = len >= 2 ? (payload[0] << 8) | payload[1] : 1005;
+            m_close_reason.assign(len > 2 ? (const char *)payload + 2 : "", len > 2 ? len - 2 : 0);
+            if (!m_close_sent)
+                sendClose(m_close_code == 1005 ? 1000 : m_close_code);
+            alive = false;
+            continue;
+        default:
+            m_close_code = 1002;
+            m_close_reason = "unknown opcode";
+            sendClose(1002);
+            alive = false;
+            continue;
+        }
+        if (fin)
+        {
+            if (m_message_compressed)
+            {
+                if (!m_deflate->decompress(m_message.data(), m_message.size(), UNIX_WS_MAX_MESSAGE, m_inflated))
+                {
+                    m_close_code = 1007;
+                    m_close_reason = "invalid compressed message";
+                    sendClose(1007);
+                    alive = false;
+                    continue;
+                }
+                m_message.swap(m_inflated);
+                m_message_compressed = false;
+            }
+            if (m_on_message)
+                m_on_message(m_message);
+            m_message.clear();
+        }
+    }
+    m_in.erase(m_in.begin(), m_in.begin() + pos);
+    return alive;
+}
+
+void UnixWebSocketClient::run()
+{
+    std::string error;
+    m_in.clear();
+    m_message.clear();
+    m_message_compressed = false;
+    if (!open(error) || !handshake(error))
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_socket->mutex);
+            if (m_socket->fd >= 0)
+                close(m_socket->fd);
+            m_socket->fd = -1;
+        }
+        if (!m_stopping && m_on_error)
+            m_on_error(-1, error);
+        return;
+    }
+
+    m_close_code = 1006;
+    m_close_reason.clear();
+    m_socket->last_send_ms = now_ms();
+    m_connected = true;
+    if (m_on_open)
+        m_on_open();
+
+    bool alive = dispatch(); // frames that came with the upgrade response
+    int64_t closing_since = -1;
+    while (alive)
+    {
+        const int64_t now = now_ms();
+        int timeout = -1;
+        if (m_stopping)
+        {
+            // our close frame is out, give the server a moment to answer
+            if (closing_since < 0)
+                closing_since = now;
+            timeout = (int)std::max<int64_t>(0, closing_since + UNIX_WS_CLOSE_MS - now);
+            if (timeout == 0)
+                break;
+        }
+        else if (m_ping_interval > 0)
+        {
+            timeout = (int)std::max<int64_t>(0, m_socket->last_send_ms + m_ping_interval * 1000 - now);
+            if (timeout == 0)
+            {
+                // a ping that cannot go out shut the socket down, close now
+                // instead of retrying it without ever reaching poll
+                if (!sendFrame(OP_PING, nullptr, 0))
+                    break;
+                continue;
+            }
+        }
+
+        struct pollfd fds[2] = {{m_socket->fd, POLLIN, 0}, {m_wake[0], POLLIN, 0}};
+        const int rc = poll(fds, 2, timeout);
+        if (rc < 0 && errno != EINTR)
+            break;
+        if (rc <= 0)
+            continue;
+        if (fds[1].revents)
+        {
+            char drain[16];
+            while (read(m_wake[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+        if (fds[0].revents)
+        {
+            const size_t old = m_in.size();
+            m_in.resize(old + UNIX_WS_READ_CHUNK);
+            const ssize_t got = recv(m_socket->fd, m_in.data() + old, UNIX_WS_READ_CHUNK, 0);
+            m_in.resize(old + std::max<ssize_t>(got, 0));
+            if (got == 0 || (got < 0 && errno != EINTR && errno != EAGAIN))
+                break;
+            alive = dispatch();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_socket->mutex);
+        m_connected = false;
+        close(m_socket->fd);
+        m_socket->fd = -1;
+    }
+    m_in.clear();
+    m_message.clear();
+    if (m_stopping && m_close_code == 1006)
+        m_close_code = 1000; // closed by us, the server just did not answer
+    if (m_on_close)
+        m_on_close(m_close_code, m_close_reason);
+}
@@ -0,0 +1,116 @@
+#ifndef UNIX_WS_CLIENT_H
+#define UNIX_WS_CLIENT_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "send_batch.h"
+#include "ws_transport.h"
+
+#define UNIX_WS_HANDSHAKE_MS 5000          /* connect and upgrade response */
+#define UNIX_WS_CLOSE_MS 1000              /* wait for the server's close frame */
+#define UNIX_WS_SEND_TIMEOUT_MS 1000       /* a peer not reading this long is dropped */
+#define UNIX_WS_MAX_MESSAGE (16 * 1024 * 1024) /* larger inbound messages close with 1009, inflating beyond it with 1007 */
+#define UNIX_WS_BATCH_FRAMES 64            /* frames per sendmsg, two iovecs each */
+
+/*
+ * Websocket client over an AF_UNIX stream socket for servers on the same
+ * host, without the loopback TCP stack or TLS. Urls look like
+ * ws+unix:///run/asr.sock or ws+unix:///run/asr.sock:/stream to request
+ * a path other than /.
+ *
+ * Frames carry a zero masking key. The key only guards intermediaries
+ * that cannot exist on a local socket, and with it the payload goes out
+ * straight from the caller's buffer in one sendmsg, header included; a
+ * batch of frames goes out in one sendmsg as well. On a thread with a
+ * SendBatch open (a media worker's pass) binary frames up to
+ * SEND_BATCH_MAX_FRAME are copied into the batch instead and written
+ * with those of the other connections at the end of the pass.
+ *
+ * permessage-deflate is offered for the message types setCompression()
+ * selects. Compressed messages go out from the deflate buffer, one at a
+ * time; binary frames left uncompressed keep the zero-copy path and the
+ * batching. Compressed messages from the server are inflated whatever
+ * was selected. TLS options are ignored.
+ */
+class UnixWebSocketClient : public WsTransport
+{
+public:
+    UnixWebSocketClient();
+    ~UnixWebSocketClient() override;
+
+    void setUrl(const std::string &url) override;
+    void setTLSOptions(const WebSocketTLSOptions &) override {}
+    void setPingInterval(int seconds) override;
+    void setCompression(const DeflateConfig &config) override;
+    void setHeaders(const Headers &headers) override;
+
+    void setMessageCallback(std::function<void(const std::string &)> callback) override;
+    void setOpenCallback(std::function<void()> callback) override;
+    void setErrorCallback(std::function<void(int, const std::string &)> callback) override;
+    void setCloseCallback(std::function<void(int, const std::string &)> callback) override;
+
+    void connect() override;
+    void disconnect() override;
+    bool isConnected() override;
+    bool sendBinary(const void *data, size_t len) override;
+    bool sendMessage(const char *text, size_t len) override;
+    size_t sendBinaryBatch(const Frame *frames, size_t count) override;
+
+    /* socket path and request path of a ws+unix:// url, false if malformed */
+    static bool parseUrl(const std::string &url, std::string &path, std::string &resource);
+
+private:
+    void run();
+    bool open(std::string &error);
+    bool handshake(std::string &error);
+    bool waitReadable(int timeout_ms);
+    bool sendFrame(uint8_t opcode, const void *data, size_t len);
+    /* a text or binary message, compressed if negotiated for its type */
+    bool sendData(uint8_t opcode, const void *data, size_t len);
+    /* frames of one opcode in one sendmsg, count at most UNIX_WS_BATCH_FRAMES; returns how many went out */
+    size_t sendFrames(uint8_t opcode, const Frame *frames, size_t count);
+    void sendClose(uint16_t code);
+    /* parses complete frames in m_in; false once the connection is done */
+    bool dispatch();
+
+    std::string m_url;
+    Headers m_headers;
+    int m_ping_interval;
+    std::function<void(const std::string &)> m_on_message;
+    std::function<void()> m_on_open;
+    std::function<void(int, const std::string &)> m_on_error;
+    std::function<void(int, const std::string &)> m_on_close;
+
+    /*
+     * Of the current connection, fd -1 once it is closed, so frames a batch
+     * still holds for it never reach the next one. Replaced by the client
+     * thread in open(), read elsewhere with std::atomic_load. Its
+     * last_send_ms keeps pings to an idle connection.
+     */
+    std::shared_ptr<BatchSocket> m_socket;
+    int m_wake[2]; /* disconnect() wakes the client thread through this pipe */
+    std::thread m_thread;
+    std::atomic<bool> m_connected;
+    std::atomic<bool> m_stopping;
+    std::atomic<bool> m_close_sent;
+
+    DeflateConfig m_deflate_config;
+    std::mutex m_deflate_mutex; /* held from compressing a message until it is sent */
+    std::unique_ptr<MessageDeflate> m_deflate; /* of the current connection, replaced in handshake() */
+    std::string m_deflated;
+
+    /* client thread only */
+    std::vector<uint8_t> m_in;
+    std::string m_message; /* fragments of the message being received */
+    bool m_message_compressed;
+    std::string m_inflated;
+    int m_close_code;
+    std::string m_close_reason;
+};
+
+#endif // UNIX_WS_CLIENT_H
@@ -7,94 +7,225 @@
 #include <switch_buffer.h>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include "base64.h"
+#include "audio_resampler.h"
+#include "audio_vad.h"
+#include "playout_buffer.h"
+#include "event_dispatcher.h"
+#include "teardown_pool.h"
+#include "stream_profile.h"
+#include "slab_allocator.h"
+#include "message_arena.h"
+#include "capture_ring.h"
+#include "reconnect_backoff.h"
+#include "endpoint_group.h"
+#include "admission.h"
+#include "dns_cache.h"
+#include "ws_transport.h"
+#include "unix_ws_client.h"
+#include "shm_audio.h"
+#include "send_queue.h"
+#include "audio_quality.h"
+#include "fanout.h"
+#include "media_worker.h"
 
 #define FRAME_SIZE_8000 320 /* 1000x0.02 (20ms)= 160 x(16bit= 2 bytes) 320 frame size*/
+#define PLAYBACK_DECODE_CHARS 4096                           /* base64 chars decoded per step, multiple of 4 */
+#define PLAYBACK_DECODE_BYTES (PLAYBACK_DECODE_CHARS / 4 * 3) /* 3072 bytes, whole frames for mono and stereo */
 
-class VideoStreamer
+// Decode and resample blocks for returned audio, kept together in one slab block.
+struct PlaybackScratch : public SlabAllocated<PlaybackScratch, 8>
 {
-public:
-    VideoStreamer(const char *uuid, const char *wsUri, responseHandler_t callback, int deflate, int heart_beat,
-                  bool suppressLog, const char *extra_headers, bool no_reconnect,
-                  const char *tls_cafile, const char *tls_keyfile, const char *tls_certfile,
-                  bool tls_disable_hostname_validation) : m_sessionId(uuid), m_notify(callback),
-                                                          m_suppress_log(suppressLog), m_extra_headers(extra_headers), m_playFile(0)
+    spx_int16_t decoded[PLAYBACK_DECODE_BYTES / sizeof(spx_int16_t)];
+    spx_int16_t resampled[PLAYBACK_DECODE_BYTES / sizeof(spx_int16_t)];
+};
+
+namespace
+{
+    // Module wide resolver cache, null when dns-cache is off. Streamers read
+    // it on every (re)connect, so it is swapped under dns_mutex.
+    std::mutex dns_mutex;
+    std::shared_ptr<DnsCache> dns_cache;
+    bool dns_rewrite = false;
+
+    std::shared_ptr<DnsCache> current_dns()
     {
+        std::lock_guard<std::mutex> lock(dns_mutex);
+        return dns_cache;
+    }
 
-        WebSocketHeaders hdrs;
-        WebSocketTLSOptions tls;
+    // The url a connect is made to. libwsc resolves the host itself, so
+    // only with dns-rewrite-urls does a plain ws:// url get a cached IPv4
+    // address instead; wss:// keeps the name for SNI and the certificate
+    // check. Never waits: a miss connects by name and warms the cache.
+    std::string connect_url(const std::string &url)
+    {
+        std::shared_ptr<DnsCache> cache = current_dns();
+        if (!cache)
+            return url;
+        const std::string host = DnsCache::hostOf(url);
+        if (host.empty() || DnsCache::isNumeric(host))
+            return url;
+        std::string address;
+        const bool plain = url.compare(0, 5, "ws://") == 0;
+        if (cache->lookup(host, &address, true) != DnsCache::POSITIVE || !dns_rewrite || !plain || address.empty())
+            return url;
+        return DnsCache::withHost(url, address);
+    }
 
-        if (m_extra_headers)
+    // Moves playback audio from the STREAM_SHM_AUDIO ring to write_sbuffer,
+    // as much as fits; the rest waits in the ring. write_mutex must be held.
+    void pump_shm_playback(private_t *tech_pvt)
+    {
+        auto *shm = static_cast<ShmAudioSegment *>(tech_pvt->pShm);
+        auto *playout = static_cast<PlayoutBuffer *>(tech_pvt->pPlayout);
+        // streamAudio waiting in the playout backlog was written first
+        if (playout && playout->backlogBytes() > 0)
+            return;
+        switch_size_t free_space = switch_buffer_freespace(tech_pvt->write_sbuffer);
+        const uint8_t *data;
+        size_t len;
+        while (free_space > 0 && (len = shm->playback().peek(&data, free_space)) > 0)
         {
-            cJSON *headers_json = cJSON_Parse(m_extra_headers);
-            if (headers_json)
-            {
-                cJSON *iterator = headers_json->child;
-                while (iterator)
-                {
-                    if (iterator->type == cJSON_String && iterator->valuestring != nullptr)
-                    {
-                        hdrs.set(iterator->string, iterator->valuestring);
-                    }
-                    iterator = iterator->next;
-                }
-                cJSON_Delete(headers_json);
-            }
+            switch_buffer_write(tech_pvt->write_sbuffer, data, len);
+            shm->playback().consume(len);
+            if (playout)
+                playout->noteWritten(len);
+            free_space -= len;
+        }
+    }
+}
+
+class VideoStreamer;
+
+// Lets a reconnect queued on the teardown pool or a start queued for
+// admission outlive its streamer: the job only touches the streamer while
+// it is set, and disconnect() or the destructor clears it under the same
+// lock.
+struct StreamerGuard
+{
+    std::mutex mutex;
+    VideoStreamer *streamer;
+};
+
+class VideoStreamer : public SlabAllocated<VideoStreamer, 16>
+{
+public:
+    // endpoints are tried in order; more than one only comes from an endpoint group.
+    // rate and channels are those of the outbound L16 audio. A tap is a
+    // fan-out destination: it only receives audio and never ends the stream.
+    VideoStreamer(const char *uuid, const std::vector<std::string> &endpoints, std::shared_ptr<EndpointGroup> group,
+                  responseHandler_t callback, const StreamProfile &profile, int rate, int channels, bool tap = false)
+        : m_sessionId(uuid), m_tap(tap), m_notify(callback), client(WsTransport::create(endpoints[0])), m_suppress_log(profile.suppress_log),
+          m_playFile(0), m_events(profile.events), m_reconnect(profile.reconnect.enabled),
+          m_backoff(profile.reconnect), m_endpoints(endpoints), m_group(std::move(group)),
+          m_guard(std::make_shared<StreamerGuard>())
+    {
+        m_guard->streamer = this;
+
+        // sent with the metadata on every connect so the server can tie a
+        // reconnected websocket to the recognition session it already has
+        if (m_reconnect)
+        {
+            char token[SWITCH_UUID_FORMATTED_LENGTH + 1];
+            m_resume_token = switch_uuid_str(token, sizeof(token));
         }
 
-        client.setUrl(wsUri);
+        WebSocketTLSOptions tls;
+
+        client->setUrl(connect_url(m_endpoints[0]));
 
         // Setup eventual TLS options.
         // tls_cafile may hold the special values
         // NONE, which disables validation and SYSTEM which uses
         // the system CAs bundle
-        if (tls_cafile)
+        if (!profile.tls_cafile.empty())
         {
-            tls.caFile = tls_cafile;
+            tls.caFile = profile.tls_cafile;
         }
 
-        if (tls_keyfile)
+        if (!profile.tls_keyfile.empty())
         {
-            tls.keyFile = tls_keyfile;
+            tls.keyFile = profile.tls_keyfile;
         }
 
-        if (tls_certfile)
+        if (!profile.tls_certfile.empty())
         {
-            tls.certFile = tls_certfile;
+            tls.certFile = profile.tls_certfile;
         }
 
-        tls.disableHostnameValidation = tls_disable_hostname_validation;
-        client.setTLSOptions(tls);
+        tls.disableHostnameValidation = profile.tls_disable_hostname_validation;
+        client->setTLSOptions(tls);
 
         // Optional heart beat, sent every xx seconds when there is not any traffic
         // to make sure that load balancers do not kill an idle connection.
-        if (heart_beat)
-            client.setPingInterval(heart_beat);
+        if (profile.heart_beat)
+            client->setPingInterval(profile.heart_beat);
 
-        // Per message deflate connection is enabled by default. You can tweak its parameters or disable it
-        if (deflate)
-            client.enableCompression(false);
+        // Per message deflate is on by default for text messages; audio is
+        // only deflated when asked for, raw PCM barely compresses
+        DeflateConfig compression = profile.compression;
+        if (profile.deflate)
+            compression.text = compression.binary = false;
+        client->setCompression(compression);
 
-        // Set extra headers if any
-        if (!hdrs.empty())
-            client.setHeaders(hdrs);
+        // Set extra headers if any, parsed when the profile was built
+        if (!profile.headers.empty())
+            client->setHeaders(profile.headers);
 
         // Setup a callback to be fired when a message or an event (open, close, error) is received
-        client.setMessageCallback([this](const std::string &message)
-                                  { eventCallback(MESSAGE, message.c_str()); });
+        client->setMessageCallback([this](const std::string &message)
+                                  { onMessage(message); });
 
-        client.setOpenCallback([this]()
+        client->setOpenCallback([this]()
                                {
+            const bool resumed = m_opened.exchange(true);
+            m_attempt_open = true;
+            {
+                std::lock_guard<std::mutex> lock(m_reconnect_mutex);
+                m_backoff.reset();
+                m_reconnecting = false;
+                if (m_group)
+                {
+                    const std::chrono::duration<double, std::milli> rtt = ReconnectBackoff::clock::now() - m_connect_start;
+                    m_group->report(m_endpoints[m_endpoint], true, rtt.count());
+                }
+            }
             cJSON *root;
             root = cJSON_CreateObject();
             cJSON_AddStringToObject(root, "status", "connected");
+            if (resumed)
+                cJSON_AddItemToObject(root, "resumed", cJSON_CreateTrue());
+            if (m_tap)
+                cJSON_AddStringToObject(root, "destination", m_endpoints[0].c_str());
             char *json_str = cJSON_PrintUnformatted(root);
-            eventCallback(CONNECT_SUCCESS, json_str);
+            // the metadata goes out ahead of the audio the old connection did not take
+            if (m_send)
+                m_send->reopen();
+            eventCallback(CONNECT_SUCCESS, json_str, resumed);
+            if (m_send)
+                m_send->resume();
             cJSON_Delete(root);
-            switch_safe_free(json_str); });
+            switch_safe_free(json_str);
+            // a lowered format is announced again after the metadata
+            if (m_quality)
+                m_announce_quality = true; });
 
-        client.setErrorCallback([this](int code, const std::string &msg)
+        client->setErrorCallback([this](int code, const std::string &msg)
                                 {
+            if (m_resetting)
+                return;
+            reportFailure();
+            // a failed first connect moves on to the next endpoint, a failed
+            // attempt after a drop is retried until the attempts run out
+            const bool reconnecting = (m_reconnecting || !m_opened) && scheduleReconnect();
+            if (m_send && !reconnecting)
+                m_send->clear();
             cJSON *root, *message;
             root = cJSON_CreateObject();
             cJSON_AddStringToObject(root, "status", "error");
@@ -102,16 +233,28 @@ public:
             cJSON_AddNumberToObject(message, "code", code);
             cJSON_AddStringToObject(message, "error", msg.c_str());
             cJSON_AddItemToObject(root, "message", message);
+            if (reconnecting)
+                cJSON_AddItemToObject(root, "reconnecting", cJSON_CreateTrue());
+            if (m_tap)
+                cJSON_AddStringToObject(root, "destination", m_endpoints[0].c_str());
 
             char *json_str = cJSON_PrintUnformatted(root);
 
-            eventCallback(CONNECT_ERROR, json_str);
+            eventCallback(CONNECT_ERROR, json_str, reconnecting);
 
             cJSON_Delete(root);
             switch_safe_free(json_str); });
 
-        client.setCloseCallback([this](int code, const std::string &reason)
+        client->setCloseCallback([this](int code, const std::string &reason)
                                 {
+            if (m_resetting)
+                return;
+            reportFailure();
+            const bool reconnecting = scheduleReconnect();
+            // audio the closed connection did not take is sent after the
+            // reconnect when the stream replays, and dropped otherwise
+            if (m_send && !(reconnecting && m_send->keepsUnsent()))
+                m_send->clear();
             cJSON *root, *message;
             root = cJSON_CreateObject();
             cJSON_AddStringToObject(root, "status", "disconnected");
@@ -119,15 +262,82 @@ public:
             cJSON_AddNumberToObject(message, "code", code);
             cJSON_AddStringToObject(message, "reason", reason.c_str());
             cJSON_AddItemToObject(root, "message", message);
+            if (reconnecting)
+                cJSON_AddItemToObject(root, "reconnecting", cJSON_CreateTrue());
+            if (m_tap)
+                cJSON_AddStringToObject(root, "destination", m_endpoints[0].c_str());
             char *json_str = cJSON_PrintUnformatted(root);
 
-            eventCallback(CONNECTION_DROPPED, json_str);
+            eventCallback(CONNECTION_DROPPED, json_str, reconnecting);
 
             cJSON_Delete(root);
             switch_safe_free(json_str); });
 
-        // Now that our callback is setup, we can start our background thread and receive messages
-        client.connect();
+        // STREAM_SEND_QUEUE: sends go through a thread of their own, the
+        // media thread only queues. Adaptive quality needs its delay, and a
+        // slow tap must not hold up the stream.
+        SendQueueConfig send = profile.send;
+        if (profile.quality.enabled && send.max_ms == 0 && send.max_bytes == 0)
+            send.max_ms = QUALITY_QUEUE_MS;
+        if (m_tap && send.max_ms == 0 && send.max_bytes == 0)
+            send.max_ms = FANOUT_QUEUE_MS;
+        // audio queued when the connection drops is kept like the capture ring's replay
+        send.keep_unsent = m_reconnect && profile.capture.replay_ms > 0;
+        if (send.max_ms > 0 || send.max_bytes > 0)
+            m_send.reset(new SendQueue(send, rate / 1000 * channels * sizeof(spx_int16_t), *client));
+        if (profile.quality.enabled)
+        {
+            m_quality.reset(new QualityController(profile.quality, rate));
+            m_encoder.reset(new QualityEncoder(rate, channels));
+            m_channels = channels;
+        }
+
+    }
+
+    // Starts the background thread and opens the websocket, from the
+    // first'th url of the route on; the urls before it had no room at
+    // admission and are tried last.
+    void connect(size_t first = 0)
+    {
+        if (first > 0)
+        {
+            std::rotate(m_endpoints.begin(), m_endpoints.begin() + first, m_endpoints.end());
+            client->setUrl(connect_url(m_endpoints[0]));
+        }
+        m_connect_start = ReconnectBackoff::clock::now();
+        client->connect();
+    }
+
+    // Runs on the admission thread when a queued start got a slot, or did
+    // not within admission-max-wait-ms, which fails the stream like a
+    // connect error.
+    static void admitted(const std::shared_ptr<StreamerGuard> &guard, std::unique_ptr<AdmissionController::Ticket> ticket,
+                         size_t chosen, uint32_t waited_ms)
+    {
+        std::lock_guard<std::mutex> lock(guard->mutex);
+        VideoStreamer *streamer = guard->streamer;
+        if (!streamer)
+            return; // stopped while queued, the ticket goes straight back
+        if (ticket)
+        {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "(%s) admitted to %s after %ums\n",
+                              streamer->m_sessionId.c_str(), streamer->m_endpoints[chosen].c_str(), waited_ms);
+            streamer->holdAdmission(std::move(ticket));
+            streamer->connect(chosen);
+            return;
+        }
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "(%s) admission to %s rejected after %ums\n",
+                          streamer->m_sessionId.c_str(), streamer->m_endpoints[0].c_str(), waited_ms);
+        cJSON *root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "status", "error");
+        cJSON *message = cJSON_CreateObject();
+        cJSON_AddNumberToObject(message, "code", 0);
+        cJSON_AddStringToObject(message, "error", "admission rejected");
+        cJSON_AddItemToObject(root, "message", message);
+        char *json_str = cJSON_PrintUnformatted(root);
+        streamer->eventCallback(CONNECT_ERROR, json_str);
+        cJSON_Delete(root);
+        switch_safe_free(json_str);
     }
 
     switch_media_bug_t *get_media_bug(switch_core_session_t *session)
@@ -152,22 +362,186 @@ public:
         }
     }
 
-    inline void send_initial_metadata(switch_core_session_t *session)
+    // With reconnect enabled, JSON object metadata carries resumeToken on
+    // every connect and resumed:true after a drop. With STREAM_SHM_AUDIO it
+    // carries the shm segment. Other metadata is sent as given, followed by
+    // a separate resume or shm message when there is something to add.
+    inline void send_initial_metadata(switch_core_session_t *session, bool resumed)
     {
         auto *bug = get_media_bug(session);
-        if (bug)
+        if (!bug)
+            return;
+        auto *tech_pvt = (private_t *)switch_core_media_bug_get_user_data(bug);
+        if (!tech_pvt)
+            return;
+
+        const char *metadata = tech_pvt->initialMetadata;
+        auto *shm = m_tap ? nullptr : static_cast<ShmAudioSegment *>(tech_pvt->pShm);
+        cJSON *json = nullptr;
+        if (!m_resume_token.empty() || shm)
         {
-            auto *tech_pvt = (private_t *)switch_core_media_bug_get_user_data(bug);
-            if (tech_pvt && strlen(tech_pvt->initialMetadata) > 0)
+            json = metadata ? cJSON_Parse(metadata) : nullptr;
+            if (json && json->type != cJSON_Object)
+            {
+                cJSON_Delete(json);
+                json = nullptr;
+            }
+            if (!json && (resumed || shm))
+            {
+                if (metadata)
+                    writeText(metadata);
+                metadata = nullptr;
+                json = cJSON_CreateObject();
+                cJSON_AddStringToObject(json, "type", resumed ? "resume" : "shm");
+            }
+        }
+
+        char *json_str = nullptr;
+        if (json)
+        {
+            if (!m_resume_token.empty())
+                cJSON_AddStringToObject(json, "resumeToken", m_resume_token.c_str());
+            if (resumed)
+                cJSON_AddItemToObject(json, "resumed", cJSON_CreateTrue());
+            if (shm)
             {
-                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
-                                  "sending initial metadata %s\n", tech_pvt->initialMetadata);
-                writeText(tech_pvt->initialMetadata);
+                cJSON *jshm = cJSON_CreateObject();
+                cJSON_AddStringToObject(jshm, "name", shm->name().c_str());
+                cJSON_AddNumberToObject(jshm, "size", (double)shm->size());
+                cJSON_AddStringToObject(jshm, "format", "L16");
+                cJSON_AddNumberToObject(jshm, "captureRate", tech_pvt->wsSampling);
+                cJSON_AddNumberToObject(jshm, "playbackRate", tech_pvt->sampling);
+                cJSON_AddNumberToObject(jshm, "channels", tech_pvt->channels);
+                cJSON_AddItemToObject(json, "shm", jshm);
             }
+            json_str = cJSON_PrintUnformatted(json);
+            cJSON_Delete(json);
+            metadata = json_str;
         }
+        if (metadata)
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                              "sending %s metadata %s\n", resumed ? "resumed" : "initial", metadata);
+            writeText(metadata);
+        }
+        switch_safe_free(json_str);
     }
 
-    void eventCallback(notifyEvent_t event, const char *message)
+    // A connect attempt that never opened counts against the endpoint in
+    // its group; a drop of an open connection does not by itself.
+    void reportFailure()
+    {
+        if (!m_group || m_attempt_open.exchange(true))
+            return;
+        std::lock_guard<std::mutex> lock(m_reconnect_mutex);
+        m_group->report(m_endpoints[m_endpoint], false, 0);
+    }
+
+    // Runs on the client thread when the connection closes or an attempt
+    // fails. Returns false when the stream is ending or the attempts are
+    // used up, true when a reconnect job will reopen it.
+    bool scheduleReconnect()
+    {
+        if (m_closing)
+            return false;
+        const bool opened = m_opened;
+
+        std::lock_guard<std::mutex> lock(m_reconnect_mutex);
+        if (opened ? !m_reconnect : m_endpoint + 1 >= m_endpoints.size())
+            return false;
+        if (m_reconnect_at != ReconnectBackoff::clock::time_point())
+            return true; // error and close of the same attempt
+        if (!opened)
+        {
+            // the first connect failed, go straight to the next endpoint
+            m_endpoint++;
+            m_reconnect_at = ReconnectBackoff::clock::now();
+            m_reconnecting = true;
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "(%s) connect failed, failing over to %s\n",
+                              m_sessionId.c_str(), m_endpoints[m_endpoint].c_str());
+            return true;
+        }
+        // the node that dropped gets one more try, then the others in turn
+        if (m_backoff.attempt() > 0 && m_endpoints.size() > 1)
+            m_endpoint = (m_endpoint + 1) % m_endpoints.size();
+        if (m_backoff.exhausted())
+        {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "(%s) giving up reconnect after %u attempts\n",
+                              m_sessionId.c_str(), m_backoff.attempt());
+            m_reconnecting = false;
+            return false;
+        }
+        const auto delay = m_backoff.next();
+        m_reconnect_at = ReconnectBackoff::clock::now() + delay;
+        m_reconnecting = true;
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "(%s) reconnect attempt %u in %lldms\n",
+                          m_sessionId.c_str(), m_backoff.attempt(), (long long)delay.count());
+        return true;
+    }
+
+    // Called from the write frame thread with tech_pvt->mutex held. True
+    // once, when the pending attempt is due; the caller then has
+    // reconnect() run off that thread.
+    bool reconnectDue()
+    {
+        if (!m_reconnecting || m_closing)
+            return false;
+        std::lock_guard<std::mutex> lock(m_reconnect_mutex);
+        if (m_reconnect_at == ReconnectBackoff::clock::time_point() || ReconnectBackoff::clock::now() < m_reconnect_at)
+            return false;
+        m_reconnect_at = ReconnectBackoff::clock::time_point();
+        return true;
+    }
+
+    std::shared_ptr<StreamerGuard> guard() const
+    {
+        return m_guard;
+    }
+
+    // Runs on a teardown worker: closes the dead connection, which joins
+    // its thread, and opens the next endpoint. libwsc connects on its own
+    // thread. A stream finished meanwhile is left alone.
+    static void reconnect(const std::shared_ptr<StreamerGuard> &guard)
+    {
+        std::lock_guard<std::mutex> lock(guard->mutex);
+        if (guard->streamer)
+            guard->streamer->reopen();
+    }
+
+    // True from a drop or failed first connect until the connection is open
+    // again or reconnecting gives up; outbound audio is kept meanwhile.
+    bool reconnecting() const
+    {
+        return m_reconnecting;
+    }
+
+    // Under the guard's lock, so disconnect() cannot close the client meanwhile.
+    void reopen()
+    {
+        std::string url;
+        {
+            std::lock_guard<std::mutex> lock(m_reconnect_mutex);
+            url = m_endpoints[m_endpoint];
+        }
+        m_resetting = true;
+        client->disconnect();
+        m_resetting = false;
+        if (m_send && !m_send->keepsUnsent())
+            m_send->clear();
+        client->setUrl(connect_url(url));
+        m_attempt_open = false;
+        m_connect_start = ReconnectBackoff::clock::now();
+        client->connect();
+    }
+
+    // The admission slot is given back when the streamer is deleted, after
+    // the teardown pool closed its websocket.
+    void holdAdmission(std::unique_ptr<AdmissionController::Ticket> ticket)
+    {
+        m_ticket = std::move(ticket);
+    }
+
+    void eventCallback(notifyEvent_t event, const char *message, bool reconnect = false)
     {
         switch_core_session_t *psession = switch_core_session_locate(m_sessionId.c_str());
         if (psession)
@@ -175,35 +549,287 @@ public:
             switch (event)
             {
             case CONNECT_SUCCESS:
-                send_initial_metadata(psession);
+                // reconnect: the connection was opened again
+                send_initial_metadata(psession, reconnect);
                 m_notify(psession, EVENT_CONNECT, message);
                 break;
             case CONNECTION_DROPPED:
-                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_INFO, "connection closed\n");
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_INFO, "connection closed%s\n", reconnect ? ", reconnecting" : "");
                 m_notify(psession, EVENT_DISCONNECT, message);
                 break;
             case CONNECT_ERROR:
-                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_INFO, "connection error\n");
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_INFO, "connection error%s\n", reconnect ? ", reconnecting" : "");
                 m_notify(psession, EVENT_ERROR, message);
 
-                media_bug_close(psession);
+                // reconnect: a failed attempt that will be retried; a tap
+                // that fails leaves the stream running
+                if (!reconnect && !m_tap)
+                    media_bug_close(psession);
 
                 break;
             case MESSAGE:
-                std::string msg(message);
-                if (processMessage(psession, msg) != SWITCH_TRUE)
-                {
-                    m_notify(psession, EVENT_JSON, msg.c_str());
-                }
-                if (!m_suppress_log)
-                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "response: %s\n", msg.c_str());
                 break;
             }
             switch_core_session_rwunlock(psession);
         }
     }
 
-    switch_bool_t processMessage(switch_core_session_t *session, std::string &message)
+    // Inbound text message. The message is used in place; temporaries of
+    // its processing come from m_arena and are released together at the end.
+    void onMessage(const std::string &message)
+    {
+        switch_core_session_t *psession = switch_core_session_locate(m_sessionId.c_str());
+        if (!psession)
+            return;
+
+        // a tap only receives audio, what it sends back is not acted on
+        if (m_tap)
+        {
+            if (!m_suppress_log)
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "response from %s: %s\n",
+                                  m_endpoints[0].c_str(), message.c_str());
+            switch_core_session_rwunlock(psession);
+            return;
+        }
+
+        std::string type;
+        const char *logged = message.c_str();
+        if (processMessage(psession, message, type, &logged) != SWITCH_TRUE)
+        {
+            dispatchResponse(psession, type, message);
+        }
+        if (!m_suppress_log)
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "response: %s\n", logged);
+        m_arena.reset();
+
+        switch_core_session_rwunlock(psession);
+    }
+
+    // Per-session totals of the message arena, logged when the stream ends.
+    void logArenaStats(switch_core_session_t *session)
+    {
+        if (m_arena.messages() == 0)
+            return;
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                          "(%s) messages: %llu, arena allocations: %llu, from heap: %llu, peak %zu bytes per message\n",
+                          m_sessionId.c_str(), (unsigned long long)m_arena.messages(),
+                          (unsigned long long)m_arena.allocations(), (unsigned long long)m_arena.heapAllocations(),
+                          m_arena.peak());
+    }
+
+    // Decodes base64 audio block by block into per-session scratch memory and
+    // resamples each block straight into write_sbuffer, so steady-state
+    // playback neither copies the whole payload nor allocates. Returns false
+    // when the message was cut short by a clear, a close or a lock failure.
+    bool enqueuePlayback(switch_core_session_t *session, private_t *tech_pvt, const char *b64, size_t b64_len)
+    {
+        // a clear since the previous message leaves stale history in the resampler
+        switch_mutex_lock(tech_pvt->write_mutex);
+        const uint32_t generation = tech_pvt->playback_generation;
+        switch_mutex_unlock(tech_pvt->write_mutex);
+        if (generation != m_playbackGeneration)
+        {
+            m_playbackGeneration = generation;
+            if (tech_pvt->write_resampler)
+                tech_pvt->write_resampler->reset();
+        }
+
+        const int channels = tech_pvt->channels;
+        const size_t frame_bytes = sizeof(spx_int16_t) * channels;
+        const bool resample = tech_pvt->sampling != tech_pvt->wsSampling;
+
+        if (!m_scratch)
+            m_scratch.reset(new PlaybackScratch);
+        const spx_uint32_t block_frames = PLAYBACK_DECODE_BYTES / frame_bytes;
+
+        size_t pos = 0;
+        while (pos < b64_len)
+        {
+            const size_t chunk = std::min<size_t>(b64_len - pos, PLAYBACK_DECODE_CHARS);
+            const size_t decoded = base64_decode_into(b64 + pos, chunk,
+                                                      reinterpret_cast<unsigned char *>(m_scratch->decoded));
+            pos += chunk;
+
+            const spx_uint32_t frames = decoded / frame_bytes;
+            if (!resample)
+            {
+                if (frames > 0 && !writeBlock(session, tech_pvt, generation, m_scratch->decoded, frames * frame_bytes))
+                    return false;
+                continue;
+            }
+
+            // the output block is the size of the input block, upsampling takes several passes
+            spx_uint32_t consumed = 0;
+            while (consumed < frames)
+            {
+                spx_uint32_t in_len = frames - consumed;
+                spx_uint32_t out_len = block_frames;
+                tech_pvt->write_resampler->process(m_scratch->decoded + consumed * channels, &in_len,
+                                                   m_scratch->resampled, &out_len);
+                consumed += in_len;
+                if (out_len > 0 && !writeBlock(session, tech_pvt, generation, m_scratch->resampled, out_len * frame_bytes))
+                    return false;
+                if (in_len == 0 && out_len == 0)
+                    break;
+            }
+        }
+        return true;
+    }
+
+    bool writeBlock(switch_core_session_t *session, private_t *tech_pvt, uint32_t generation, const spx_int16_t *data, size_t len)
+    {
+        switch_status_t status = writePlayback(tech_pvt, generation, reinterpret_cast<const uint8_t *>(data), len);
+        if (status == SWITCH_STATUS_BREAK)
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                              "%s playback cleared, dropping rest of message\n", tech_pvt->sessionId);
+            return false;
+        }
+        if (status != SWITCH_STATUS_SUCCESS)
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                              "%s write mutex lock failed dropping %zu bytes\n",
+                              tech_pvt->sessionId, len);
+            return false;
+        }
+        return true;
+    }
+
+    // Copies len bytes into write_sbuffer, the rest into the playout backlog
+    // behind it, waiting for the write thread to drain them only when both
+    // are full. This runs on the websocket client thread, which reads no
+    // further message while it waits, so a clearAudio sent by the server is
+    // only held up by a server more than twice STREAM_PLAYOUT_MAX ahead.
+    // Every write that has to wait counts as one playout overrun. Returns
+    // SWITCH_STATUS_BREAK when playback was cleared or the stream is
+    // closing, so the caller drops the message.
+    switch_status_t writePlayback(private_t *tech_pvt, uint32_t generation, const uint8_t *ptr, size_t len)
+    {
+        if (switch_mutex_lock(tech_pvt->write_mutex) != SWITCH_STATUS_SUCCESS)
+            return SWITCH_STATUS_FALSE;
+
+        auto *playout = static_cast<PlayoutBuffer *>(tech_pvt->pPlayout);
+        bool overrun = false;
+        size_t remaining = len;
+        while (remaining > 0)
+        {
+            if (tech_pvt->playback_generation != generation || tech_pvt->close_requested)
+            {
+                switch_mutex_unlock(tech_pvt->write_mutex);
+                return SWITCH_STATUS_BREAK;
+            }
+            // audio already in the backlog goes first
+            size_t chunk = 0;
+            if (playout->backlogBytes() == 0)
+            {
+                chunk = std::min<size_t>(remaining, switch_buffer_freespace(tech_pvt->write_sbuffer));
+                switch_buffer_write(tech_pvt->write_sbuffer, ptr, chunk);
+                playout->noteWritten(chunk);
+            }
+            if (chunk < remaining)
+                chunk += playout->defer(ptr + chunk, remaining - chunk);
+            if (chunk == 0)
+            {
+                if (!overrun)
+                {
+                    playout->noteOverrun();
+                    overrun = true;
+                }
+                switch_mutex_unlock(tech_pvt->write_mutex);
+                switch_yield(10000);
+                switch_mutex_lock(tech_pvt->write_mutex);
+                continue;
+            }
+            ptr += chunk;
+            remaining -= chunk;
+        }
+        switch_mutex_unlock(tech_pvt->write_mutex);
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    // Drops all queued playback and aborts any message still being decoded
+    // into it, then reports how much audio was discarded.
+    void clearPlayback(switch_core_session_t *session, private_t *tech_pvt)
+    {
+        switch_size_t discarded = 0;
+        switch_mutex_lock(tech_pvt->write_mutex);
+        if (tech_pvt->write_sbuffer)
+        {
+            discarded = switch_buffer_inuse(tech_pvt->write_sbuffer);
+            switch_buffer_zero(tech_pvt->write_sbuffer);
+        }
+        if (tech_pvt->pPlayout)
+            discarded += static_cast<PlayoutBuffer *>(tech_pvt->pPlayout)->backlogBytes();
+        if (tech_pvt->pShm)
+            static_cast<ShmAudioSegment *>(tech_pvt->pShm)->playback().discard();
+        std::vector<std::string> cleared;
+        if (tech_pvt->pPlayout)
+            static_cast<PlayoutBuffer *>(tech_pvt->pPlayout)->reset(&cleared);
+        tech_pvt->playback_generation++;
+        switch_mutex_unlock(tech_pvt->write_mutex);
+
+        for (const auto &mark : cleared)
+            sendMarkAck(mark, true);
+
+        const size_t bytes_per_ms = tech_pvt->sampling / 1000 * tech_pvt->channels * sizeof(spx_int16_t);
+        cJSON *root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "status", "cleared");
+        cJSON_AddNumberToObject(root, "bytes", (double)discarded);
+        cJSON_AddNumberToObject(root, "ms", bytes_per_ms ? (double)(discarded / bytes_per_ms) : 0);
+        char *json_str = cJSON_PrintUnformatted(root);
+        m_notify(session, EVENT_CLEAR, json_str);
+        cJSON_Delete(root);
+        switch_safe_free(json_str);
+
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) cleared %zu bytes of playback\n",
+                          m_sessionId.c_str(), (size_t)discarded);
+    }
+
+    // Tells the server that the chunk tagged with mark has been played out,
+    // or with cleared set that it was discarded before reaching the caller.
+    void sendMarkAck(const std::string &mark, bool cleared)
+    {
+        cJSON *root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "type", "mark");
+        cJSON_AddStringToObject(root, "mark", mark.c_str());
+        if (cleared)
+            cJSON_AddItemToObject(root, "cleared", cJSON_CreateTrue());
+        char *json_str = cJSON_PrintUnformatted(root);
+        writeText(json_str);
+        cJSON_Delete(root);
+        switch_safe_free(json_str);
+    }
+
+    // Queues the response for the API and turns it into a json event unless
+    // it is filtered out or coalesced with a newer message of the same type.
+    void dispatchResponse(switch_core_session_t *session, const std::string &type, const std::string &message)
+    {
+        if (m_events.queueEnabled())
+            m_events.enqueue(message);
+        std::string flush;
+        EventDispatcher::Action action = m_events.dispatch(type, message, flush);
+        if (!flush.empty())
+            m_notify(session, EVENT_JSON, flush.c_str());
+        if (action == EventDispatcher::FIRE)
+            m_notify(session, EVENT_JSON, message.c_str());
+    }
+
+    // Fires a coalesced message once its window has ended without a newer one.
+    void flushDueEvents(switch_core_session_t *session)
+    {
+        std::string message;
+        if (m_events.pending() && m_events.takeDue(message))
+            m_notify(session, EVENT_JSON, message.c_str());
+    }
+
+    std::string drainResponses(size_t max)
+    {
+        return m_events.drain(max, nullptr);
+    }
+
+    // Returns SWITCH_TRUE when the message was consumed by the module. logged
+    // is pointed at the text to log instead of the message, if it differs.
+    switch_bool_t processMessage(switch_core_session_t *session, const std::string &message, std::string &type, const char **logged)
     {
         cJSON *json = cJSON_Parse(message.c_str());
         switch_bool_t status = SWITCH_FALSE;
@@ -212,7 +838,19 @@ public:
             return status;
         }
         const char *jsType = cJSON_GetObjectCstr(json, "type");
-        if (jsType && strcmp(jsType, "streamAudio") == 0)
+        if (jsType)
+            type = jsType;
+        if (jsType && strcmp(jsType, "clearAudio") == 0)
+        {
+            auto *bug = get_media_bug(session);
+            auto *tech_pvt = bug ? (private_t *)switch_core_media_bug_get_user_data(bug) : nullptr;
+            if (tech_pvt && !tech_pvt->close_requested)
+            {
+                clearPlayback(session, tech_pvt);
+                status = SWITCH_TRUE;
+            }
+        }
+        else if (jsType && strcmp(jsType, "streamAudio") == 0)
         {
             cJSON *jsonData = cJSON_GetObjectItem(json, "data");
             if (jsonData)
@@ -226,84 +864,49 @@ public:
                 {
                     cJSON *jsonSampleRate = cJSON_GetObjectItem(jsonData, "sampleRate");
                     sampleRate = jsonSampleRate && jsonSampleRate->valueint ? jsonSampleRate->valueint : 0;
-                    std::string rawAudio;
+                    if (!jsonAudio || jsonAudio->valuestring == nullptr)
+                    {
+                        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
+                                          "(%s) processMessage - no audioData in streamAudio\n", m_sessionId.c_str());
+                        cJSON_Delete(jsonAudio);
+                        cJSON_Delete(json);
+                        return SWITCH_FALSE;
+                    }
                     try
                     {
-                        rawAudio = base64_decode(jsonAudio->valuestring);
                         auto *bug = get_media_bug(session);
                         if (bug)
                         {
                             auto *tech_pvt = (private_t *)switch_core_media_bug_get_user_data(bug);
+                            const char *mark = cJSON_GetObjectCstr(jsonData, "mark");
                             if (!tech_pvt || tech_pvt->close_requested)
                             {
+                                // the server is not left waiting for a mark that will not play
+                                if (mark)
+                                    sendMarkAck(mark, true);
                                 cJSON_Delete(jsonAudio);
                                 cJSON_Delete(json);
                                 return SWITCH_FALSE;
                             }
 
-                            const int inRate = tech_pvt->wsSampling;
-                            const int outRate = tech_pvt->sampling;
-                            const int channels = tech_pvt->channels;
-
-                            spx_uint32_t in_frames = rawAudio.size() / (sizeof(spx_int16_t) * channels);
-                            spx_uint32_t max_out = (spx_uint32_t)((double)in_frames * outRate / inRate) + 1;
-
-                            std::vector<spx_int16_t> in_buf(in_frames * channels);
-                            std::vector<spx_int16_t> out_buf(max_out * channels);
-                            memcpy(in_buf.data(), rawAudio.data(), rawAudio.size());
-
-                            spx_uint32_t in_len = in_frames;
-                            spx_uint32_t out_len = max_out;
-
-                            if (tech_pvt->sampling == tech_pvt->wsSampling)
-                            {
-                                out_buf = in_buf;
-                                out_len = in_len;
-                            }
-                            else
+                            // the mark goes after what was written to write_sbuffer; the
+                            // resampler's filter delay of the chunk is still held back
+                            // in write_resampler then, so it fires that much early
+                            if (!enqueuePlayback(session, tech_pvt, jsonAudio->valuestring, strlen(jsonAudio->valuestring)))
                             {
-                                if (channels == 1)
-                                {
-                                    speex_resampler_process_int(tech_pvt->write_resampler, 0,
-                                                                in_buf.data(), &in_len,
-                                                                out_buf.data(), &out_len);
-                                }
-                                else
-                                {
-                                    speex_resampler_process_interleaved_int(tech_pvt->write_resampler,
-                                                                            in_buf.data(), &in_len,
-                                                                            out_buf.data(), &out_len);
-                                }
+                                // cut short by a clear or a close
+                                if (mark)
+                                    sendMarkAck(mark, true);
                             }
-
-                            const size_t bytes_out = out_len * channels * sizeof(spx_int16_t);
-                            if (switch_mutex_lock(tech_pvt->write_mutex) == SWITCH_STATUS_SUCCESS)
+                            else if (mark && tech_pvt->pPlayout)
                             {
-                                size_t remaining = bytes_out;
-                                const uint8_t *ptr = reinterpret_cast<const uint8_t *>(out_buf.data());
-                                while (remaining > 0)
-                                {
-                                    switch_size_t free_space = switch_buffer_freespace(tech_pvt->write_sbuffer);
-                                    if (free_space == 0)
-                                    {
-                                        switch_mutex_unlock(tech_pvt->write_mutex);
-                                        switch_yield(10000);
-                                        switch_mutex_lock(tech_pvt->write_mutex);
-                                        continue;
-                                    }
-                                    size_t chunk = std::min<size_t>(remaining, free_space);
-                                    switch_buffer_write(tech_pvt->write_sbuffer, ptr, chunk);
-                                    ptr += chunk;
-                                    remaining -= chunk;
-                                }
+                                switch_mutex_lock(tech_pvt->write_mutex);
+                                // a mark follows the shm audio written before it
+                                if (tech_pvt->pShm)
+                                    pump_shm_playback(tech_pvt);
+                                static_cast<PlayoutBuffer *>(tech_pvt->pPlayout)->addMark(mark);
                                 switch_mutex_unlock(tech_pvt->write_mutex);
                             }
-                            else
-                            {
-                                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
-                                                  "%s write mutex lock failed dropping all %zu bytes\n",
-                                                  tech_pvt->sessionId, bytes_out);
-                            }
                         }
                     }
                     catch (const std::exception &e)
@@ -337,10 +940,12 @@ public:
                 if (jsonAudio && jsonAudio->valuestring != nullptr && !fileType.empty())
                 {
                     char filePath[256];
-                    std::string rawAudio;
+                    const size_t b64_len = strlen(jsonAudio->valuestring);
+                    unsigned char *rawAudio = static_cast<unsigned char *>(m_arena.allocate(b64_len / 4 * 3 + 3));
+                    size_t rawLen;
                     try
                     {
-                        rawAudio = base64_decode(jsonAudio->valuestring);
+                        rawLen = base64_decode_into(jsonAudio->valuestring, b64_len, rawAudio);
                     }
                     catch (const std::exception &e)
                     {
@@ -353,7 +958,7 @@ public:
                     switch_snprintf(filePath, 256, "%s%s%s_%d.tmp%s", SWITCH_GLOBAL_dirs.temp_dir,
                                     SWITCH_PATH_SEPARATOR, m_sessionId.c_str(), m_playFile++, fileType.c_str());
                     std::ofstream fstream(filePath, std::ofstream::binary);
-                    fstream << rawAudio;
+                    fstream.write(reinterpret_cast<const char *>(rawAudio), rawLen);
                     fstream.close();
                     m_Files.insert(filePath);
                     jsonFile = cJSON_CreateString(filePath);
@@ -364,7 +969,7 @@ public:
                 {
                     char *jsonString = cJSON_PrintUnformatted(jsonData);
                     m_notify(session, EVENT_PLAY, jsonString);
-                    message.assign(jsonString);
+                    *logged = m_arena.strdup(jsonString, strlen(jsonString));
                     free(jsonString);
                     status = SWITCH_TRUE;
                 }
@@ -380,31 +985,160 @@ public:
         return status;
     }
 
-    ~VideoStreamer() = default;
+    ~VideoStreamer()
+    {
+        std::lock_guard<std::mutex> lock(m_guard->mutex);
+        m_guard->streamer = nullptr;
+    }
 
     void disconnect()
     {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "disconnecting...\n");
-        client.disconnect();
+        m_closing = true;
+        {
+            // waits out a reconnect in progress, none starts after this
+            std::lock_guard<std::mutex> lock(m_guard->mutex);
+            m_guard->streamer = nullptr;
+        }
+        // what is still queued is given SEND_QUEUE_FLUSH_MS to go out before the close
+        if (m_send)
+            m_send->stop();
+        client->disconnect();
     }
 
     bool isConnected()
     {
-        return client.isConnected();
+        return client->isConnected();
+    }
+
+    const std::string &destination() const
+    {
+        return m_endpoints[0];
+    }
+
+    // With a send queue a packet counts as sent once queued; the queue's
+    // drop policy decides whether it goes out, and a stream that replays
+    // after a reconnect keeps what a dropped connection did not take.
+    bool writeBinary(uint8_t *buffer, size_t len)
+    {
+        if (!this->isConnected())
+            return false;
+        if (m_send)
+        {
+            pushAudio(buffer, len);
+            return true;
+        }
+        return client->sendBinary(buffer, len);
+    }
+
+    /* binary messages in order, handed to the transport as one batch; returns how many went out */
+    size_t writeBinaryBatch(const WsTransport::Frame *frames, size_t count)
+    {
+        if (!this->isConnected())
+            return 0;
+        if (m_send)
+        {
+            for (size_t i = 0; i < count; i++)
+                pushAudio(static_cast<const uint8_t *>(frames[i].data), frames[i].len);
+            return count;
+        }
+        return client->sendBinaryBatch(frames, count);
     }
 
-    void writeBinary(uint8_t *buffer, size_t len)
+    // A fan-out packet; it is queued as it is, shared with the other taps
+    // of its rate, unless adaptive quality re-encodes it.
+    void writeShared(const SharedFrame &frame)
     {
         if (!this->isConnected())
             return;
-        client.sendBinary(buffer, len);
+        pushAudio(reinterpret_cast<const uint8_t *>(frame->data()), frame->size(), &frame);
     }
 
     void writeText(const char *text)
     {
         if (!this->isConnected())
             return;
-        client.sendMessage(text, strlen(text));
+        if (m_send)
+        {
+            m_send->pushText(text, strlen(text));
+            return;
+        }
+        client->sendMessage(text, strlen(text));
+    }
+
+    // Queues one packet. With adaptive quality the format is picked per
+    // packet, and a change is announced in band right before the first
+    // packet in the new format:
+    // {"type":"audioFormat","encoding":"PCMU","sampleRate":8000,"channels":1,"reason":"congestion"}
+    void pushAudio(const uint8_t *data, size_t len, const SharedFrame *frame = nullptr)
+    {
+        if (m_quality)
+        {
+            const int changed = m_quality->update(m_send->delayMs(), QualityController::clock::now());
+            const bool reconnected = m_announce_quality.exchange(false);
+            if (changed >= 0)
+            {
+                m_encoder->reset();
+                announceQuality(changed < m_last_quality ? "recovered" : "congestion");
+            }
+            else if (reconnected && m_quality->quality() != QUALITY_FULL)
+            {
+                announceQuality("reconnected");
+            }
+            const uint8_t *encoded;
+            len = m_encoder->encode(m_quality->quality(), data, len, &encoded);
+            if (len == 0)
+                return;
+            if (encoded != data)
+                frame = nullptr;
+            data = encoded;
+        }
+        if (frame)
+            m_send->pushShared(*frame);
+        else
+            m_send->pushBinary(data, len);
+    }
+
+    void announceQuality(const char *reason)
+    {
+        const AudioQuality quality = m_quality->quality();
+        m_last_quality = quality;
+        cJSON *root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "type", "audioFormat");
+        cJSON_AddStringToObject(root, "encoding", QualityEncoder::encoding(quality));
+        cJSON_AddNumberToObject(root, "sampleRate", m_encoder->rate(quality));
+        cJSON_AddNumberToObject(root, "channels", m_channels);
+        cJSON_AddStringToObject(root, "reason", reason);
+        char *json_str = cJSON_PrintUnformatted(root);
+        m_send->pushText(json_str, strlen(json_str), true);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "(%s) audio format %s\n", m_sessionId.c_str(), json_str);
+        cJSON_Delete(root);
+        switch_safe_free(json_str);
+    }
+
+    uint32_t qualitySwitches() const
+    {
+        return m_quality ? m_quality->switches() : 0;
+    }
+
+    // True when the send queue became congested or clear since the last
+    // call, with its counters in stats.
+    bool pollCongestion(SendQueue::Stats &stats)
+    {
+        bool congested;
+        if (!m_send || !m_send->pollCongestion(congested))
+            return false;
+        stats = m_send->stats();
+        stats.congested = congested;
+        return true;
+    }
+
+    bool sendQueueStats(SendQueue::Stats &stats)
+    {
+        if (!m_send)
+            return false;
+        stats = m_send->stats();
+        return true;
     }
 
     void deleteFiles()
@@ -420,16 +1154,175 @@ public:
 
 private:
     std::string m_sessionId;
+    const bool m_tap; /* fan-out destination */
     responseHandler_t m_notify;
-    WebSocketClient client;
+    std::unique_ptr<WsTransport> client; /* by the first endpoint; groups do not mix ws+unix:// with network urls */
+    std::unique_ptr<SendQueue> m_send;   /* STREAM_SEND_QUEUE, sends through client */
+    std::unique_ptr<QualityController> m_quality; /* STREAM_ADAPTIVE_QUALITY, media thread only */
+    std::unique_ptr<QualityEncoder> m_encoder;
+    int m_channels = 0;
+    int m_last_quality = QUALITY_FULL;              /* last announced */
+    std::atomic<bool> m_announce_quality{false}; /* set on connect */
     bool m_suppress_log;
-    const char *m_extra_headers;
     int m_playFile;
     std::unordered_set<std::string> m_Files;
+    std::unique_ptr<PlaybackScratch> m_scratch; /* taken on the first streamAudio message */
+    MessageArena m_arena;
+    uint32_t m_playbackGeneration = 0;
+    EventDispatcher m_events;
+
+    const bool m_reconnect;
+    std::string m_resume_token;
+    std::atomic<bool> m_opened{false};      /* open at least once, drops are retried from then on */
+    std::atomic<bool> m_closing{false};     /* disconnect() called, no more attempts */
+    std::atomic<bool> m_resetting{false};   /* reopen() is closing the dead connection */
+    std::atomic<bool> m_reconnecting{false};
+    std::mutex m_reconnect_mutex;            /* m_backoff and m_reconnect_at */
+    ReconnectBackoff m_backoff;
+    ReconnectBackoff::clock::time_point m_reconnect_at; /* next attempt, epoch when none is pending */
+
+    std::vector<std::string> m_endpoints;       /* route of the group, or just the start url; reordered before connecting */
+    size_t m_endpoint = 0;                      /* under m_reconnect_mutex */
+    std::shared_ptr<EndpointGroup> m_group;     /* health reports, may be null */
+    ReconnectBackoff::clock::time_point m_connect_start;
+    std::atomic<bool> m_attempt_open{false}; /* the current attempt opened or was already reported */
+    std::unique_ptr<AdmissionController::Ticket> m_ticket;
+    std::shared_ptr<StreamerGuard> m_guard;
+};
+
+// The fan-out destinations of a stream (tech_pvt->pFanout): one tap per
+// destination, each with the group of its rate in rates.
+struct StreamFanout
+{
+    StreamFanout(int sampling, int primary_rate, int channels, int rtp_packets)
+        : rates(sampling, primary_rate, channels, rtp_packets)
+    {
+    }
+
+    FanoutRates rates;
+    std::vector<std::pair<VideoStreamer *, size_t>> taps;
+};
+
+// A stream's place in the media worker pool (tech_pvt->pMedia). The pool is
+// held so a stream that outlives a module shutdown can still be removed.
+struct MediaOffload
+{
+    std::shared_ptr<MediaWorkerPool> pool;
+    MediaWorkerPool::Stream *stream;
 };
 
 namespace
 {
+    TeardownPool *teardown_pool = nullptr;
+    std::shared_ptr<MediaWorkerPool> media_workers; /* media-workers, null runs the frame pipeline on the media thread */
+
+    // Profiles from video_stream.conf. reloadxml swaps in a new map; streams
+    // that are already running were built from the old one and keep going.
+    std::mutex profiles_mutex;
+    std::shared_ptr<const StreamProfileMap> profiles;
+    std::shared_ptr<const EndpointGroupMap> groups; /* same lifetime rules as profiles */
+    EndpointProber *prober = nullptr;
+    std::shared_ptr<AdmissionController> admission;
+
+    // A due reconnect runs on the teardown pool: closing the dead
+    // connection joins its thread, which the write frame thread must not
+    // wait for with tech_pvt->mutex held. Each tap gets a job of its own.
+    void start_reconnect(const char *sessionId, VideoStreamer *pVideoStreamer)
+    {
+        if (!pVideoStreamer->reconnectDue())
+            return;
+        std::shared_ptr<StreamerGuard> guard = pVideoStreamer->guard();
+        if (teardown_pool)
+        {
+            teardown_pool->submit(sessionId, [guard]
+                                  { VideoStreamer::reconnect(guard); });
+            return;
+        }
+        VideoStreamer::reconnect(guard);
+    }
+
+    cJSON *admission_json()
+    {
+        const AdmissionConfig config = admission->config();
+        const AdmissionController::Stats stats = admission->stats();
+        cJSON *root = cJSON_CreateObject();
+        cJSON *limits = cJSON_CreateObject();
+        cJSON_AddNumberToObject(limits, "admission-rate", config.rate);
+        cJSON_AddNumberToObject(limits, "admission-burst", config.burst);
+        cJSON_AddNumberToObject(limits, "endpoint-max-streams", config.endpoint_max_streams);
+        cJSON_AddNumberToObject(limits, "node-max-streams", config.node_max_streams);
+        cJSON_AddStringToObject(limits, "admission-policy", config.queue ? "queue" : "reject");
+        cJSON_AddNumberToObject(limits, "admission-max-wait-ms", config.max_wait_ms);
+        cJSON_AddItemToObject(root, "limits", limits);
+        cJSON_AddNumberToObject(root, "active", stats.active);
+        cJSON_AddNumberToObject(root, "waiting", stats.waiting);
+        cJSON_AddNumberToObject(root, "admitted", (double)stats.admitted);
+        cJSON_AddNumberToObject(root, "queued", (double)stats.queued);
+        cJSON_AddNumberToObject(root, "rejected", (double)stats.rejected);
+        cJSON_AddNumberToObject(root, "max_wait_ms", stats.max_wait_ms);
+        cJSON *endpoints = cJSON_CreateObject();
+        for (const auto &endpoint : stats.endpoints)
+        {
+            cJSON *jendpoint = cJSON_CreateObject();
+            cJSON_AddNumberToObject(jendpoint, "active", endpoint.active);
+            cJSON_AddNumberToObject(jendpoint, "waiting", endpoint.waiting);
+            cJSON_AddNumberToObject(jendpoint, "admitted", (double)endpoint.admitted);
+            cJSON_AddNumberToObject(jendpoint, "rejected", (double)endpoint.rejected);
+            cJSON_AddItemToObject(endpoints, endpoint.endpoint.c_str(), jendpoint);
+        }
+        cJSON_AddItemToObject(root, "endpoints", endpoints);
+        return root;
+    }
+
+    std::shared_ptr<const StreamProfile> find_profile(const std::string &name)
+    {
+        std::shared_ptr<const StreamProfileMap> current;
+        {
+            std::lock_guard<std::mutex> lock(profiles_mutex);
+            current = profiles;
+        }
+        if (!current)
+            return nullptr;
+        auto it = current->find(name);
+        return it != current->end() ? it->second : nullptr;
+    }
+
+    std::shared_ptr<const EndpointGroupMap> current_groups()
+    {
+        std::lock_guard<std::mutex> lock(profiles_mutex);
+        return groups;
+    }
+
+    std::shared_ptr<EndpointGroup> find_group(const std::string &name)
+    {
+        std::shared_ptr<const EndpointGroupMap> current = current_groups();
+        if (!current)
+            return nullptr;
+        auto it = current->find(name);
+        return it != current->end() ? it->second : nullptr;
+    }
+
+    // resolves the hosts of all configured urls ahead of the first call
+    void prefetch_hosts()
+    {
+        std::shared_ptr<DnsCache> cache = current_dns();
+        if (!cache)
+            return;
+        std::lock_guard<std::mutex> lock(profiles_mutex);
+        if (profiles)
+        {
+            for (const auto &entry : *profiles)
+                cache->prefetch(DnsCache::hostOf(entry.second->ws_uri));
+        }
+        if (groups)
+        {
+            for (const auto &entry : *groups)
+            {
+                for (const auto &url : entry.second->urls())
+                    cache->prefetch(DnsCache::hostOf(url));
+            }
+        }
+    }
 
     void *SWITCH_THREAD_FUNC write_frame_thread(switch_thread_t *thread, void *obj)
     {
@@ -452,7 +1345,7 @@ namespace
             return NULL;
         }
 
-        switch_status_t status = SWITCH_STATUS_FALSE;
+        auto *playout = static_cast<PlayoutBuffer *>(tech_pvt->pPlayout);
         switch_timer_t timer = {0};
         switch_frame_t write_frame = {0};
         switch_codec_t write_codec = {0};
@@ -495,19 +1388,51 @@ namespace
             return NULL;
         }
 
+        std::vector<std::string> reached;
         while (!tech_pvt->close_requested && switch_core_session_running(session))
         {
             if (switch_mutex_trylock(tech_pvt->write_mutex) == SWITCH_STATUS_SUCCESS)
             {
-                switch_size_t available = switch_buffer_inuse(tech_pvt->write_sbuffer);
-                if (available >= bytes)
+                if (tech_pvt->pShm)
+                    pump_shm_playback(tech_pvt);
+                if (playout->pull(tech_pvt->write_sbuffer, (int16_t *)write_frame.data, samples))
                 {
-                    write_frame.datalen = (uint32_t)switch_buffer_read(tech_pvt->write_sbuffer, write_frame.data, bytes);
-                    write_frame.samples = write_frame.datalen / 2 / channels;
+                    write_frame.datalen = bytes;
+                    write_frame.samples = samples;
                     switch_core_session_write_frame(session, &write_frame, SWITCH_IO_FLAG_NONE, 0);
                 }
+                if (playout->hasMarks())
+                    playout->takeReachedMarks(reached);
                 switch_mutex_unlock(tech_pvt->write_mutex);
             }
+            if (!reached.empty())
+            {
+                switch_mutex_lock(tech_pvt->mutex);
+                auto *pVideoStreamer = static_cast<VideoStreamer *>(tech_pvt->pVideoStreamer);
+                if (pVideoStreamer)
+                {
+                    for (const auto &mark : reached)
+                        pVideoStreamer->sendMarkAck(mark, false);
+                }
+                switch_mutex_unlock(tech_pvt->mutex);
+                reached.clear();
+            }
+            if ((tech_pvt->coalesce_events || tech_pvt->reconnect) && switch_mutex_trylock(tech_pvt->mutex) == SWITCH_STATUS_SUCCESS)
+            {
+                auto *pVideoStreamer = static_cast<VideoStreamer *>(tech_pvt->pVideoStreamer);
+                if (pVideoStreamer)
+                {
+                    if (tech_pvt->coalesce_events)
+                        pVideoStreamer->flushDueEvents(session);
+                    start_reconnect(tech_pvt->sessionId, pVideoStreamer);
+                    if (auto *fanout = static_cast<StreamFanout *>(tech_pvt->pFanout))
+                    {
+                        for (auto &tap : fanout->taps)
+                            start_reconnect(tech_pvt->sessionId, tap.first);
+                    }
+                }
+                switch_mutex_unlock(tech_pvt->mutex);
+            }
             switch_core_timer_next(&timer);
         }
 
@@ -516,49 +1441,414 @@ namespace
         return NULL;
     }
 
+    void fire_speech_event(private_t *tech_pvt, switch_core_session_t *session, const char *eventName, const char *status, double level)
+    {
+        cJSON *root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "status", status);
+        cJSON_AddNumberToObject(root, "level", level);
+        char *json_str = cJSON_PrintUnformatted(root);
+        tech_pvt->responseHandler(session, eventName, json_str);
+        cJSON_Delete(root);
+        switch_safe_free(json_str);
+    }
+
+    // destination is the url of a fan-out tap, nullptr for the stream's own websocket
+    void fire_congestion_event(private_t *tech_pvt, switch_core_session_t *session, const SendQueue::Stats &stats,
+                               const char *destination = nullptr)
+    {
+        cJSON *root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "status", stats.congested ? "congested" : "clear");
+        if (destination)
+            cJSON_AddStringToObject(root, "destination", destination);
+        cJSON_AddNumberToObject(root, "delayMs", stats.delay_ms);
+        cJSON_AddNumberToObject(root, "queuedBytes", (double)stats.depth_bytes);
+        cJSON_AddNumberToObject(root, "limitBytes", (double)stats.limit_bytes);
+        cJSON_AddNumberToObject(root, "sentPackets", (double)stats.sent_packets);
+        cJSON_AddNumberToObject(root, "droppedPackets", (double)stats.dropped_packets);
+        cJSON_AddNumberToObject(root, "droppedBytes", (double)stats.dropped_bytes);
+        cJSON_AddNumberToObject(root, "congestions", (double)stats.congestions);
+        char *json_str = cJSON_PrintUnformatted(root);
+        tech_pvt->responseHandler(session, EVENT_CONGESTION, json_str);
+        cJSON_Delete(root);
+        switch_safe_free(json_str);
+    }
+
+    // Sends one packet, or writes it to the shm ring with STREAM_SHM_AUDIO,
+    // or keeps it in the capture ring while the websocket
+    // has not opened yet or is being reopened, during a pause with
+    // STREAM_PAUSE_PREROLL, and while earlier captured audio is still queued
+    // ahead of it.
+    inline void deliver(private_t *tech_pvt, VideoStreamer *pVideoStreamer, const uint8_t *data, size_t len)
+    {
+        // shm audio does not depend on the websocket; a full ring drops it
+        if (tech_pvt->pShm)
+        {
+            static_cast<ShmAudioSegment *>(tech_pvt->pShm)->capture().write(data, len);
+            return;
+        }
+        auto *ring = static_cast<CaptureRing *>(tech_pvt->pCapture);
+        if (ring)
+        {
+            const bool connected = pVideoStreamer->isConnected();
+            if (connected)
+                ring->markConnected();
+            if (tech_pvt->audio_paused)
+            {
+                ring->push(data, len, ring->pauseLimit());
+                return;
+            }
+            if (!connected)
+            {
+                // after a drop audio is only kept while a reconnect is pending
+                size_t limit = ring->connectLimit();
+                if (ring->connectedOnce())
+                    limit = pVideoStreamer->reconnecting() ? ring->replayLimit() : 0;
+                ring->push(data, len, limit);
+                return;
+            }
+            if (!ring->empty())
+            {
+                ring->push(data, len, ring->capacity());
+                return;
+            }
+        }
+        // a send that fails while the connection goes down is replayed too
+        if (!pVideoStreamer->writeBinary(const_cast<uint8_t *>(data), len) && ring)
+            ring->push(data, len, ring->replayLimit());
+    }
+
+    // Sends up to CAPTURE_DRAIN_PACKETS packets of captured audio as one
+    // batch, a single sendmsg on a ws+unix:// stream.
+    void drain_capture(private_t *tech_pvt, VideoStreamer *pVideoStreamer, CaptureRing *ring)
+    {
+        const size_t packet = (size_t)tech_pvt->wsSampling / 50 * tech_pvt->channels * sizeof(spx_int16_t) * tech_pvt->rtp_packets;
+        WsTransport::Frame frames[CAPTURE_DRAIN_PACKETS];
+        size_t count = 0;
+        size_t queued = 0;
+        while (count < CAPTURE_DRAIN_PACKETS)
+        {
+            const uint8_t *data;
+            const size_t len = ring->peekAt(queued, &data, packet);
+            if (len == 0)
+                break;
+            frames[count++] = {data, len};
+            queued += len;
+        }
+        const size_t sent = pVideoStreamer->writeBinaryBatch(frames, count);
+        size_t consumed = 0;
+        for (size_t i = 0; i < sent; i++)
+            consumed += frames[i].len;
+        ring->consume(consumed);
+    }
+
+    // Hands one complete packet to the websocket. With STREAM_VAD enabled
+    // silent packets are held back for pre-roll and replaced by a periodic
+    // keepalive marker.
+    template <bool Gated>
+    inline void send_packet(private_t *tech_pvt, switch_core_session_t *session, VideoStreamer *pVideoStreamer,
+                            const uint8_t *data, size_t len)
+    {
+        // paused audio is only kept for STREAM_PAUSE_PREROLL, the gate and
+        // its speech events do not see it
+        if (!Gated || tech_pvt->audio_paused)
+        {
+            deliver(tech_pvt, pVideoStreamer, data, len);
+            return;
+        }
+
+        auto *gate = static_cast<VoiceGate *>(tech_pvt->pVoiceGate);
+        switch (gate->update(data, len))
+        {
+        case VoiceGate::SPEECH_START:
+            fire_speech_event(tech_pvt, session, EVENT_SPEECH_START, "speech_start", gate->level());
+            if (gate->prerollSize() > 0)
+            {
+                deliver(tech_pvt, pVideoStreamer, gate->preroll(), gate->prerollSize());
+                gate->clearPreroll();
+            }
+            break;
+        case VoiceGate::SPEECH_STOP:
+            fire_speech_event(tech_pvt, session, EVENT_SPEECH_STOP, "speech_stop", gate->level());
+            break;
+        case VoiceGate::NONE:
+            break;
+        }
+
+        if (gate->active())
+        {
+            deliver(tech_pvt, pVideoStreamer, data, len);
+        }
+        else
+        {
+            gate->remember(data, len);
+            if (gate->keepaliveDue())
+                pVideoStreamer->writeText(VAD_KEEPALIVE_MSG);
+        }
+    }
+
+    // Sends len bytes of L16 audio, or with STREAM_BUFFER_SIZE above 20ms
+    // accumulates them in read_sbuffer and sends once a full packet is ready.
+    template <bool Buffered, bool Gated>
+    inline void send_audio(private_t *tech_pvt, switch_core_session_t *session, VideoStreamer *pVideoStreamer,
+                           const uint8_t *data, size_t len)
+    {
+        if (!Buffered)
+        {
+            send_packet<Gated>(tech_pvt, session, pVideoStreamer, data, len);
+            return;
+        }
+        if (switch_buffer_freespace(tech_pvt->read_sbuffer) >= len)
+        {
+            switch_buffer_write(tech_pvt->read_sbuffer, data, len);
+        }
+        if (switch_buffer_freespace(tech_pvt->read_sbuffer) == 0)
+        {
+            const void *ptr = nullptr;
+            switch_size_t inuse = switch_buffer_peek_zerocopy(tech_pvt->read_sbuffer, &ptr);
+            if (inuse > 0)
+            {
+                send_packet<Gated>(tech_pvt, session, pVideoStreamer, (const uint8_t *)ptr, inuse);
+            }
+            switch_buffer_zero(tech_pvt->read_sbuffer);
+        }
+    }
+
+    // Hands the frame's packets to the fan-out taps. They get every packet,
+    // whatever the voice gate decided; a tap that is not connected loses it.
+    void feed_fanout(private_t *tech_pvt, const spx_int16_t *raw, size_t raw_frames, const spx_int16_t *primary,
+                     size_t primary_frames)
+    {
+        if (tech_pvt->audio_paused)
+            return;
+        auto *fanout = static_cast<StreamFanout *>(tech_pvt->pFanout);
+        fanout->rates.feed(raw, raw_frames, primary, primary_frames);
+        auto &ready = fanout->rates.ready();
+        for (const auto &packet : ready)
+        {
+            for (auto &tap : fanout->taps)
+            {
+                if (tap.second == packet.first)
+                    tap.first->writeShared(packet.second);
+            }
+        }
+        ready.clear();
+    }
+
+    // Per-frame pipeline, instantiated for every (channels, resampling,
+    // packetization, voice gating) combination and selected once in
+    // stream_data_init. Called with tech_pvt->mutex held, from stream_frame
+    // or from a media worker.
+    template <int Channels, bool Resample, bool Buffered, bool Gated>
+    void frame_handler(private_t *tech_pvt, switch_core_session_t *session, const uint8_t *data, uint32_t len)
+    {
+        auto *pVideoStreamer = static_cast<VideoStreamer *>(tech_pvt->pVideoStreamer);
+        const spx_uint32_t samples = len / (Channels * sizeof(spx_int16_t));
+
+        if (!Resample)
+        {
+            send_audio<Buffered, Gated>(tech_pvt, session, pVideoStreamer, data, len);
+            if (tech_pvt->pFanout)
+                feed_fanout(tech_pvt, (const spx_int16_t *)data, samples, (const spx_int16_t *)data, samples);
+            return;
+        }
+
+        spx_int16_t *out = tech_pvt->resampled;
+        spx_uint32_t in_len = samples;
+        spx_uint32_t out_len = SWITCH_RECOMMENDED_BUFFER_SIZE / Channels;
+        tech_pvt->read_resampler->process((const spx_int16_t *)data, &in_len, out, &out_len);
+        if (out_len > 0)
+        {
+            send_audio<Buffered, Gated>(tech_pvt, session, pVideoStreamer, (const uint8_t *)out,
+                                        out_len * Channels * sizeof(spx_int16_t));
+        }
+        if (tech_pvt->pFanout)
+            feed_fanout(tech_pvt, (const spx_int16_t *)data, samples, out, out_len);
+    }
+
+    template <int Channels, bool Resample>
+    frameHandler_t select_frame_handler(bool buffered, bool gated)
+    {
+        static const frameHandler_t handlers[2][2] = {
+            {frame_handler<Channels, Resample, false, false>, frame_handler<Channels, Resample, false, true>},
+            {frame_handler<Channels, Resample, true, false>, frame_handler<Channels, Resample, true, true>}};
+        return handlers[buffered ? 1 : 0][gated ? 1 : 0];
+    }
+
+    frameHandler_t select_frame_handler(int channels, bool resample, bool buffered, bool gated)
+    {
+        if (channels == 2)
+            return resample ? select_frame_handler<2, true>(buffered, gated) : select_frame_handler<2, false>(buffered, gated);
+        return resample ? select_frame_handler<1, true>(buffered, gated) : select_frame_handler<1, false>(buffered, gated);
+    }
+
+    // What follows the frames of a stream_frame call: captured audio that
+    // can go out now and the congestion of the send queues.
+    void poll_stream(private_t *tech_pvt, switch_core_session_t *session, VideoStreamer *pVideoStreamer)
+    {
+        auto *ring = static_cast<CaptureRing *>(tech_pvt->pCapture);
+        if (ring && !ring->empty() && !tech_pvt->audio_paused && pVideoStreamer->isConnected())
+            drain_capture(tech_pvt, pVideoStreamer, ring);
+        SendQueue::Stats stats;
+        if (pVideoStreamer->pollCongestion(stats))
+            fire_congestion_event(tech_pvt, session, stats);
+        if (auto *fanout = static_cast<StreamFanout *>(tech_pvt->pFanout))
+        {
+            for (auto &tap : fanout->taps)
+            {
+                if (tap.first->pollCongestion(stats))
+                    fire_congestion_event(tech_pvt, session, stats, tap.first->destination().c_str());
+            }
+        }
+    }
+
+    // True when the frames read now have somewhere to go.
+    inline bool stream_accepts(private_t *tech_pvt, VideoStreamer *pVideoStreamer)
+    {
+        return pVideoStreamer && (tech_pvt->pCapture || tech_pvt->pShm || tech_pvt->pFanout || pVideoStreamer->isConnected());
+    }
+
+    // Runs on a media worker: the frames stream_frame queued, then the same
+    // follow-up as on the media thread. Frames that have nowhere to go are
+    // dropped, as stream_frame would have left them unread. False while
+    // another thread holds the stream, to be retried.
+    bool run_queued(private_t *tech_pvt, switch_core_session_t *session, MediaQueue &queue)
+    {
+        if (switch_mutex_trylock(tech_pvt->mutex) != SWITCH_STATUS_SUCCESS)
+            return false;
+        auto *pVideoStreamer = static_cast<VideoStreamer *>(tech_pvt->pVideoStreamer);
+        const bool accepts = stream_accepts(tech_pvt, pVideoStreamer);
+        uint8_t *data = tech_pvt->queued_frame;
+        size_t len;
+        while ((len = queue.pop(data, SWITCH_RECOMMENDED_BUFFER_SIZE)) > 0)
+        {
+            if (accepts)
+                tech_pvt->frameHandler(tech_pvt, session, data, (uint32_t)len);
+        }
+        if (accepts)
+            poll_stream(tech_pvt, session, pVideoStreamer);
+        switch_mutex_unlock(tech_pvt->mutex);
+        return true;
+    }
+
     switch_status_t stream_data_init(private_t *tech_pvt, switch_core_session_t *session, char *wsUri,
                                      uint32_t sampling, int wsSampling, int channels, char *metadata, responseHandler_t responseHandler,
-                                     int deflate, int heart_beat, bool suppressLog, int rtp_packets, const char *extra_headers,
-                                     bool no_reconnect, const char *tls_cafile, const char *tls_keyfile,
-                                     const char *tls_certfile, bool tls_disable_hostname_validation)
+                                     const StreamProfile &profile, std::shared_ptr<EndpointGroup> group,
+                                     const std::vector<FanoutTarget> &fanout)
     {
-        int err; // speex
+        const int rtp_packets = profile.rtp_packets;
+        const VoiceGateConfig &vad = profile.vad;
+        int err; // speex fallback
 
         switch_memory_pool_t *pool = switch_core_session_get_pool(session);
 
         memset(tech_pvt, 0, sizeof(private_t));
 
-        strncpy(tech_pvt->sessionId, switch_core_session_get_uuid(session), MAX_SESSION_ID);
-        strncpy(tech_pvt->ws_uri, wsUri, MAX_WS_URI);
+        tech_pvt->sessionId = switch_core_session_strdup(session, switch_core_session_get_uuid(session));
+
+        // a group orders its endpoints for this call, the start url is not used
+        std::vector<std::string> endpoints;
+        if (group)
+        {
+            endpoints = group->route(tech_pvt->sessionId);
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) group %s routes to %s\n",
+                              tech_pvt->sessionId, group->name().c_str(), endpoints[0].c_str());
+        }
+        else
+        {
+            endpoints.push_back(wsUri);
+        }
+
+        // names known not to exist go last, and fail the start at once when
+        // nothing else is left; misses are resolved in the background
+        if (std::shared_ptr<DnsCache> cache = current_dns())
+        {
+            auto resolvable = std::stable_partition(endpoints.begin(), endpoints.end(), [&cache](const std::string &url)
+                                                    { return cache->lookup(DnsCache::hostOf(url)) != DnsCache::NEGATIVE; });
+            if (resolvable == endpoints.begin())
+            {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "(%s) host of %s does not resolve\n",
+                                  tech_pvt->sessionId, endpoints[0].c_str());
+                return SWITCH_STATUS_FALSE;
+            }
+        }
+
+        tech_pvt->ws_uri = switch_core_session_strdup(session, endpoints[0].c_str());
         tech_pvt->sampling = sampling;
         tech_pvt->wsSampling = wsSampling;
         tech_pvt->responseHandler = responseHandler;
         tech_pvt->rtp_packets = rtp_packets;
         tech_pvt->channels = channels;
         tech_pvt->audio_paused = 0;
+        tech_pvt->coalesce_events = profile.events.coalesce_ms > 0 && !profile.events.coalesce.empty() ? 1 : 0;
 
-        if (metadata)
-            strncpy(tech_pvt->initialMetadata, metadata, MAX_METADATA_LEN);
+        if (!zstr(metadata))
+            tech_pvt->initialMetadata = switch_core_session_strdup(session, metadata);
 
         // size_t buflen = (FRAME_SIZE_8000 * wsSampling / 8000 * channels * 1000 / RTP_PERIOD * BUFFERED_SEC);
         const size_t buflen = (FRAME_SIZE_8000 * wsSampling / 8000 * channels * rtp_packets);
 
-        auto *as = new VideoStreamer(tech_pvt->sessionId, wsUri, responseHandler, deflate, heart_beat,
-                                     suppressLog, extra_headers, no_reconnect,
-                                     tls_cafile, tls_keyfile, tls_certfile, tls_disable_hostname_validation);
-
+        auto *as = new VideoStreamer(tech_pvt->sessionId, endpoints, std::move(group), responseHandler, profile,
+                                     wsSampling, channels);
         tech_pvt->pVideoStreamer = static_cast<void *>(as);
 
+        // A start over the limits is queued instead of waited for on this
+        // (API or dialplan) thread. Its websocket connects from the admission
+        // thread once there is room; one still queued after
+        // admission-max-wait-ms ends with an error event.
+        if (admission)
+        {
+            size_t chosen = 0;
+            bool queued = false;
+            std::shared_ptr<StreamerGuard> guard = as->guard();
+            std::unique_ptr<AdmissionController::Ticket> ticket = admission->admit(
+                endpoints, chosen, [guard](std::unique_ptr<AdmissionController::Ticket> admitted, size_t index, uint32_t waited_ms)
+                { VideoStreamer::admitted(guard, std::move(admitted), index, waited_ms); },
+                queued);
+            if (ticket)
+            {
+                if (chosen > 0)
+                {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) admitted to %s\n",
+                                      tech_pvt->sessionId, endpoints[chosen].c_str());
+                }
+                as->holdAdmission(std::move(ticket));
+                as->connect(chosen);
+            }
+            else if (queued)
+            {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) queued for admission to %s\n",
+                                  tech_pvt->sessionId, endpoints[0].c_str());
+            }
+            else
+            {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "(%s) admission to %s rejected\n",
+                                  tech_pvt->sessionId, endpoints[0].c_str());
+                return SWITCH_STATUS_FALSE;
+            }
+        }
+        else
+        {
+            as->connect();
+        }
+
         switch_mutex_init(&tech_pvt->mutex, SWITCH_MUTEX_NESTED, pool);
         switch_mutex_init(&tech_pvt->write_mutex, SWITCH_MUTEX_NESTED, pool);
 
+        // frames are read and resampled into these, not onto the stack of the media thread
+        tech_pvt->read_frame = (uint8_t *)switch_core_session_alloc(session, SWITCH_RECOMMENDED_BUFFER_SIZE);
+
         if (switch_buffer_create(pool, &tech_pvt->read_sbuffer, buflen) != SWITCH_STATUS_SUCCESS)
         {
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
                               "%s: Error creating switch buffer.\n", tech_pvt->sessionId);
             return SWITCH_STATUS_FALSE;
         }
-        if (switch_buffer_create(pool, &tech_pvt->write_sbuffer, buflen) != SWITCH_STATUS_SUCCESS)
+        auto *playout = new PlayoutBuffer(profile.playout, sampling, channels);
+        tech_pvt->pPlayout = static_cast<void *>(playout);
+
+        // grows in 100ms steps up to the playout capacity instead of reserving it all per call
+        const size_t playout_step = sampling / 10 * channels * sizeof(spx_int16_t);
+        if (switch_buffer_create_dynamic(&tech_pvt->write_sbuffer, playout_step, playout_step, playout->capacityBytes()) != SWITCH_STATUS_SUCCESS)
         {
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR,
                               "%s: Error creating switch buffer.\n", tech_pvt->sessionId);
@@ -568,24 +1858,100 @@ namespace
         if (wsSampling != sampling)
         {
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) resampling from %u to %u\n", tech_pvt->sessionId, sampling, wsSampling);
-            tech_pvt->read_resampler = speex_resampler_init(channels, sampling, wsSampling, SWITCH_RESAMPLE_QUALITY, &err);
-            if (0 != err)
+            tech_pvt->read_resampler = stream_resampler_create(channels, sampling, wsSampling, SWITCH_RESAMPLE_QUALITY, &err);
+            if (!tech_pvt->read_resampler)
             {
                 switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Error initializing resampler: %s.\n", speex_resampler_strerror(err));
                 return SWITCH_STATUS_FALSE;
             }
-            tech_pvt->write_resampler = speex_resampler_init(channels, wsSampling, sampling, SWITCH_RESAMPLE_QUALITY, &err);
-            if (0 != err)
+            tech_pvt->resampled = (int16_t *)switch_core_session_alloc(session, SWITCH_RECOMMENDED_BUFFER_SIZE * sizeof(int16_t));
+            tech_pvt->write_resampler = stream_resampler_create(channels, wsSampling, sampling, SWITCH_RESAMPLE_QUALITY, &err);
+            if (!tech_pvt->write_resampler)
             {
                 switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Error initializing resampler: %s.\n", speex_resampler_strerror(err));
                 return SWITCH_STATUS_FALSE;
             }
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) using %s resampler\n",
+                              tech_pvt->sessionId, tech_pvt->read_resampler->name());
         }
         else
         {
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) no resampling needed for this call\n", tech_pvt->sessionId);
         }
 
+        // taps are not admitted and not checked against the dns cache, a
+        // destination that cannot be reached only loses its own audio
+        if (!fanout.empty())
+        {
+            auto *streamFanout = new StreamFanout(sampling, wsSampling, channels, rtp_packets);
+            tech_pvt->pFanout = static_cast<void *>(streamFanout);
+            for (const auto &target : fanout)
+            {
+                const int rate = target.rate > 0 ? target.rate : wsSampling;
+                const int group = streamFanout->rates.group(rate);
+                if (group < 0)
+                {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "(%s) fan-out to %s: cannot resample to %d\n",
+                                      tech_pvt->sessionId, target.url.c_str(), rate);
+                    return SWITCH_STATUS_FALSE;
+                }
+                auto *tap = new VideoStreamer(tech_pvt->sessionId, {target.url}, nullptr, responseHandler, profile, rate, channels, true);
+                streamFanout->taps.emplace_back(tap, (size_t)group);
+                tap->connect();
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) fan-out to %s at %d\n",
+                                  tech_pvt->sessionId, target.url.c_str(), rate);
+            }
+        }
+
+        if (vad.enabled)
+        {
+            const size_t bytes_per_ms = wsSampling / 1000 * channels * sizeof(spx_int16_t);
+            tech_pvt->pVoiceGate = static_cast<void *>(new VoiceGate(vad, bytes_per_ms));
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                              "(%s) voice gate enabled: threshold %ddBFS hangover %dms preroll %dms keepalive %dms\n",
+                              tech_pvt->sessionId, vad.threshold_dbfs, vad.hangover_ms, vad.preroll_ms, vad.keepalive_ms);
+        }
+
+        if (profile.shm.enabled)
+        {
+            std::string error;
+            auto *shm = ShmAudioSegment::create(tech_pvt->sessionId, profile.shm, wsSampling, sampling, channels, error);
+            if (!shm)
+            {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "(%s) shm audio: %s\n",
+                                  tech_pvt->sessionId, error.c_str());
+                return SWITCH_STATUS_FALSE;
+            }
+            tech_pvt->pShm = static_cast<void *>(shm);
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) shm audio in %s, %zu bytes\n",
+                              tech_pvt->sessionId, shm->name().c_str(), shm->size());
+        }
+
+        // the shm ring buffers audio regardless of the websocket
+        CaptureConfig capture = profile.capture;
+        if (!profile.reconnect.enabled)
+            capture.replay_ms = 0;
+        if (!tech_pvt->pShm && (capture.connect_ms > 0 || capture.pause_ms > 0 || capture.replay_ms > 0))
+        {
+            const size_t frame_bytes = channels * sizeof(spx_int16_t);
+            tech_pvt->pCapture = static_cast<void *>(new CaptureRing(capture, wsSampling / 1000 * frame_bytes, frame_bytes));
+        }
+        tech_pvt->reconnect = profile.reconnect.enabled || endpoints.size() > 1;
+
+        tech_pvt->frameHandler = select_frame_handler(channels, tech_pvt->read_resampler != nullptr, rtp_packets > 1,
+                                                      tech_pvt->pVoiceGate != nullptr);
+
+        // last, so a failed init has no stream registered; a start that
+        // fails later goes through stream_session_destroy
+        if (std::shared_ptr<MediaWorkerPool> pool = media_workers)
+        {
+            tech_pvt->queued_frame = (uint8_t *)switch_core_session_alloc(session, SWITCH_RECOMMENDED_BUFFER_SIZE);
+            auto *media = new MediaOffload{pool, nullptr};
+            media->stream = pool->add(sampling, channels, [tech_pvt, session, media]
+                                      { return run_queued(tech_pvt, session, media->stream->queue()); });
+            tech_pvt->pMedia = static_cast<void *>(media);
+        }
+
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) stream_data_init\n", tech_pvt->sessionId);
 
         return SWITCH_STATUS_SUCCESS;
@@ -594,11 +1960,24 @@ namespace
     void destroy_tech_pvt(private_t *tech_pvt)
     {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s destroy_tech_pvt\n", tech_pvt->sessionId);
+        // first, a worker may still be running the stream
+        if (tech_pvt->pMedia)
+        {
+            auto *media = static_cast<MediaOffload *>(tech_pvt->pMedia);
+            media->pool->remove(media->stream);
+            delete media;
+            tech_pvt->pMedia = nullptr;
+        }
         if (tech_pvt->read_resampler)
         {
-            speex_resampler_destroy(tech_pvt->read_resampler);
+            stream_resampler_destroy(tech_pvt->read_resampler);
             tech_pvt->read_resampler = nullptr;
         }
+        if (tech_pvt->write_resampler)
+        {
+            stream_resampler_destroy(tech_pvt->write_resampler);
+            tech_pvt->write_resampler = nullptr;
+        }
         if (tech_pvt->mutex)
         {
             switch_mutex_destroy(tech_pvt->mutex);
@@ -619,23 +1998,73 @@ namespace
             switch_buffer_destroy(&tech_pvt->write_sbuffer);
             tech_pvt->write_sbuffer = nullptr;
         }
+        if (tech_pvt->pPlayout)
+        {
+            delete static_cast<PlayoutBuffer *>(tech_pvt->pPlayout);
+            tech_pvt->pPlayout = nullptr;
+        }
+        if (tech_pvt->pCapture)
+        {
+            delete static_cast<CaptureRing *>(tech_pvt->pCapture);
+            tech_pvt->pCapture = nullptr;
+        }
+        if (tech_pvt->pShm)
+        {
+            delete static_cast<ShmAudioSegment *>(tech_pvt->pShm);
+            tech_pvt->pShm = nullptr;
+        }
+        if (tech_pvt->pVoiceGate)
+        {
+            delete static_cast<VoiceGate *>(tech_pvt->pVoiceGate);
+            tech_pvt->pVoiceGate = nullptr;
+        }
         if (tech_pvt->pVideoStreamer)
         {
             auto *as = (VideoStreamer *)tech_pvt->pVideoStreamer;
             delete as;
             tech_pvt->pVideoStreamer = nullptr;
         }
+        if (tech_pvt->pFanout)
+        {
+            auto *fanout = static_cast<StreamFanout *>(tech_pvt->pFanout);
+            for (auto &tap : fanout->taps)
+                delete tap.first;
+            delete fanout;
+            tech_pvt->pFanout = nullptr;
+        }
     }
 
+    // Hands the streamer to the teardown pool, which closes the websocket
+    // and deletes it off the calling thread.
     void finish(private_t *tech_pvt)
     {
         std::shared_ptr<VideoStreamer> aStreamer;
         aStreamer.reset((VideoStreamer *)tech_pvt->pVideoStreamer);
         tech_pvt->pVideoStreamer = nullptr;
 
-        std::thread t([aStreamer]
-                      { aStreamer->disconnect(); });
-        t.detach();
+        if (teardown_pool)
+        {
+            teardown_pool->submit(tech_pvt->sessionId, [aStreamer]
+                                  { aStreamer->disconnect(); });
+            return;
+        }
+        aStreamer->disconnect();
+    }
+
+    // The same for the fan-out taps; their audio is no longer fed.
+    void finish_fanout(private_t *tech_pvt)
+    {
+        auto *fanout = static_cast<StreamFanout *>(tech_pvt->pFanout);
+        for (auto &tap : fanout->taps)
+        {
+            std::shared_ptr<VideoStreamer> aTap(tap.first);
+            if (teardown_pool)
+                teardown_pool->submit(tech_pvt->sessionId, [aTap]
+                                      { aTap->disconnect(); });
+            else
+                aTap->disconnect();
+        }
+        fanout->taps.clear();
     }
 
 }
@@ -649,6 +2078,16 @@ extern "C"
         const char *hostEnd = nullptr;
         const char *portStart = nullptr;
 
+        // ws+unix:///path/to.sock[:/request/path], checked by the unix client
+        if (WsTransport::isUnix(url))
+        {
+            std::string path, resource;
+            if (!UnixWebSocketClient::parseUrl(url, path, resource))
+                return 0;
+            std::strncpy(wsUri, url, MAX_WS_URI);
+            return 1;
+        }
+
         // Check scheme
         if (strncmp(url, "ws://", 5) == 0)
         {
@@ -781,86 +2220,114 @@ extern "C"
         if (!tech_pvt)
             return SWITCH_STATUS_FALSE;
 
-        switch_core_media_bug_flush(bug);
+        // with STREAM_PAUSE_PREROLL the bug keeps being read into the capture ring
+        auto *ring = static_cast<CaptureRing *>(tech_pvt->pCapture);
+        if (!(ring && ring->pauseLimit()))
+            switch_core_media_bug_flush(bug);
         tech_pvt->audio_paused = pause;
         return SWITCH_STATUS_SUCCESS;
     }
 
+    switch_status_t stream_session_clear(switch_core_session_t *session)
+    {
+        switch_channel_t *channel = switch_core_session_get_channel(session);
+        auto *bug = (switch_media_bug_t *)switch_channel_get_private(channel, MY_BUG_NAME);
+        if (!bug)
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "stream_session_clear failed because no bug\n");
+            return SWITCH_STATUS_FALSE;
+        }
+        auto *tech_pvt = (private_t *)switch_core_media_bug_get_user_data(bug);
+
+        if (!tech_pvt || tech_pvt->close_requested)
+            return SWITCH_STATUS_FALSE;
+
+        switch_mutex_lock(tech_pvt->mutex);
+        auto *pVideoStreamer = static_cast<VideoStreamer *>(tech_pvt->pVideoStreamer);
+        if (pVideoStreamer)
+            pVideoStreamer->clearPlayback(session, tech_pvt);
+        switch_mutex_unlock(tech_pvt->mutex);
+
+        return pVideoStreamer ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE;
+    }
+
+    char *stream_session_responses(switch_core_session_t *session, int max)
+    {
+        switch_channel_t *channel = switch_core_session_get_channel(session);
+        auto *bug = (switch_media_bug_t *)switch_channel_get_private(channel, MY_BUG_NAME);
+        if (!bug)
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "stream_session_responses failed because no bug\n");
+            return nullptr;
+        }
+        auto *tech_pvt = (private_t *)switch_core_media_bug_get_user_data(bug);
+
+        if (!tech_pvt || tech_pvt->close_requested)
+            return nullptr;
+
+        char *responses = nullptr;
+        switch_mutex_lock(tech_pvt->mutex);
+        auto *pVideoStreamer = static_cast<VideoStreamer *>(tech_pvt->pVideoStreamer);
+        if (pVideoStreamer)
+            responses = strdup(pVideoStreamer->drainResponses(max > 0 ? (size_t)max : 0).c_str());
+        switch_mutex_unlock(tech_pvt->mutex);
+
+        return responses;
+    }
+
     switch_status_t stream_session_init(switch_core_session_t *session,
                                         responseHandler_t responseHandler,
+                                        responseHandler_t lightResponseHandler,
                                         uint32_t samples_per_second,
                                         char *wsUri,
                                         int wsSampling,
                                         int channels,
                                         char *metadata,
+                                        const char *profile_name,
+                                        const char *fanout,
                                         void **ppUserData)
     {
-        int deflate, heart_beat;
-        bool suppressLog = false;
-        const char *buffer_size;
-        const char *extra_headers;
-        int rtp_packets = 1; // 20ms burst
-        bool no_reconnect = false;
-        const char *tls_cafile = NULL;
-        ;
-        const char *tls_keyfile = NULL;
-        ;
-        const char *tls_certfile = NULL;
-        ;
-        bool tls_disable_hostname_validation = false;
-
         switch_channel_t *channel = switch_core_session_get_channel(session);
 
-        if (switch_channel_var_true(channel, "STREAM_MESSAGE_DEFLATE"))
-        {
-            deflate = 1;
-        }
-
-        if (switch_channel_var_true(channel, "STREAM_SUPPRESS_LOG"))
-        {
-            suppressLog = true;
-        }
+        // a named profile replaces the STREAM_* channel variables entirely
+        if (!profile_name)
+            profile_name = switch_channel_get_variable(channel, "STREAM_PROFILE");
 
-        if (switch_channel_var_true(channel, "STREAM_NO_RECONNECT"))
+        std::shared_ptr<const StreamProfile> profile;
+        std::shared_ptr<EndpointGroup> group;
+        if (profile_name && (profile = find_profile(profile_name)))
         {
-            no_reconnect = true;
+            if (!profile->group.empty() && !(group = find_group(profile->group)))
+            {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "stream profile %s: unknown group %s\n",
+                                  profile_name, profile->group.c_str());
+                return SWITCH_STATUS_FALSE;
+            }
         }
-
-        tls_cafile = switch_channel_get_variable(channel, "STREAM_TLS_CA_FILE");
-        tls_keyfile = switch_channel_get_variable(channel, "STREAM_TLS_KEY_FILE");
-        tls_certfile = switch_channel_get_variable(channel, "STREAM_TLS_CERT_FILE");
-
-        if (switch_channel_var_true(channel, "STREAM_TLS_DISABLE_HOSTNAME_VALIDATION"))
+        else if (profile_name && !(group = find_group(profile_name)))
         {
-            tls_disable_hostname_validation = true;
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "unknown stream profile %s\n", profile_name);
+            return SWITCH_STATUS_FALSE;
         }
-
-        const char *heartBeat = switch_channel_get_variable(channel, "STREAM_HEART_BEAT");
-        if (heartBeat)
+        else
         {
-            char *endptr;
-            long value = strtol(heartBeat, &endptr, 10);
-            if (*endptr == '\0' && value <= INT_MAX && value >= INT_MIN)
-            {
-                heart_beat = (int)value;
-            }
+            // no profile, or a bare endpoint group with the channel variables
+            auto channel_profile = std::make_shared<StreamProfile>();
+            stream_profile_from_channel(session, *channel_profile);
+            profile = channel_profile;
         }
 
-        if ((buffer_size = switch_channel_get_variable(channel, "STREAM_BUFFER_SIZE")))
+        // destinations of the profile, then those given on the start command
+        std::vector<FanoutTarget> targets = profile->fanout;
+        if (!zstr(fanout) && !stream_profile_parse_fanout(fanout, targets))
         {
-            int bSize = atoi(buffer_size);
-            if (bSize % 20 != 0)
-            {
-                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING, "%s: Buffer size of %s is not a multiple of 20ms. Using default 20ms.\n",
-                                  switch_channel_get_name(channel), buffer_size);
-            }
-            else if (bSize >= 20)
-            {
-                rtp_packets = bSize / 20;
-            }
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "invalid fan-out destinations %s\n", fanout);
+            return SWITCH_STATUS_FALSE;
         }
 
-        extra_headers = switch_channel_get_variable(channel, "STREAM_EXTRA_HEADERS");
+        // STREAM_EVENT_LIGHT is settled once here rather than looked up per event
+        if (profile->event_light)
+            responseHandler = lightResponseHandler;
 
         // allocate per-session tech_pvt
         auto *tech_pvt = (private_t *)switch_core_session_alloc(session, sizeof(private_t));
@@ -870,8 +2337,8 @@ extern "C"
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "error allocating memory!\n");
             return SWITCH_STATUS_FALSE;
         }
-        if (SWITCH_STATUS_SUCCESS != stream_data_init(tech_pvt, session, wsUri, samples_per_second, wsSampling, channels, metadata, responseHandler, deflate, heart_beat,
-                                                      suppressLog, rtp_packets, extra_headers, no_reconnect, tls_cafile, tls_keyfile, tls_certfile, tls_disable_hostname_validation))
+        if (SWITCH_STATUS_SUCCESS != stream_data_init(tech_pvt, session, wsUri, samples_per_second, wsSampling, channels, metadata, responseHandler,
+                                                      *profile, std::move(group), targets))
         {
             destroy_tech_pvt(tech_pvt);
             return SWITCH_STATUS_FALSE;
@@ -882,6 +2349,21 @@ extern "C"
         return SWITCH_STATUS_SUCCESS;
     }
 
+    // Undoes stream_session_init for a start that failed before the media
+    // bug was added: the websockets are closed, the admission slot and the
+    // media worker stream are given back.
+    void stream_session_destroy(void *pUserData)
+    {
+        auto *tech_pvt = (private_t *)pUserData;
+        switch_mutex_lock(tech_pvt->mutex);
+        if (tech_pvt->pVideoStreamer)
+            finish(tech_pvt);
+        if (tech_pvt->pFanout)
+            finish_fanout(tech_pvt);
+        switch_mutex_unlock(tech_pvt->mutex);
+        destroy_tech_pvt(tech_pvt);
+    }
+
     switch_status_t stream_session_write_thread_init(switch_core_session_t *session, void *pUserData)
     {
         private_t *tech_pvt = (private_t *)pUserData;
@@ -896,139 +2378,58 @@ extern "C"
     switch_bool_t stream_frame(switch_media_bug_t *bug)
     {
         auto *tech_pvt = (private_t *)switch_core_media_bug_get_user_data(bug);
-        if (!tech_pvt || tech_pvt->audio_paused)
+        if (!tech_pvt)
+            return SWITCH_TRUE;
+        auto *ring = static_cast<CaptureRing *>(tech_pvt->pCapture);
+        if (tech_pvt->audio_paused && !(ring && ring->pauseLimit()))
             return SWITCH_TRUE;
-        /*
-        auto flush_read_sbuffer = [&]() {
-            switch_size_t inuse = switch_buffer_inuse(tech_pvt->read_sbuffer);
-            if (inuse > 0) {
-                std::vector<uint8_t> tmp(inuse);
-                switch_buffer_read(tech_pvt->read_sbuffer, tmp.data(), inuse);
-                switch_buffer_zero(tech_pvt->read_sbuffer);
-                pVideoStreamer->writeBinary(tmp.data(), inuse);
-            }
-        };
-        */
-        if (switch_mutex_trylock(tech_pvt->mutex) == SWITCH_STATUS_SUCCESS)
-        {
-
-            if (!tech_pvt->pVideoStreamer)
-            {
-                switch_mutex_unlock(tech_pvt->mutex);
-                return SWITCH_TRUE;
-            }
-
-            auto *pVideoStreamer = static_cast<VideoStreamer *>(tech_pvt->pVideoStreamer);
 
-            if (!pVideoStreamer->isConnected())
-            {
-                switch_mutex_unlock(tech_pvt->mutex);
-                return SWITCH_TRUE;
-            }
+        const auto start = std::chrono::steady_clock::now();
+        uint32_t frames = 0;
+        uint8_t *data = tech_pvt->read_frame;
+        switch_frame_t frame = {};
+        frame.data = data;
+        frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
 
-            if (nullptr == tech_pvt->read_resampler)
+        if (auto *media = static_cast<MediaOffload *>(tech_pvt->pMedia))
+        {
+            // media-workers: the frames are only queued, without locking
+            while (switch_core_media_bug_read(bug, &frame, SWITCH_TRUE) == SWITCH_STATUS_SUCCESS)
             {
-
-                uint8_t data_buf[SWITCH_RECOMMENDED_BUFFER_SIZE];
-                switch_frame_t frame = {0};
-                frame.data = data_buf;
-                frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
-                size_t available = switch_buffer_freespace(tech_pvt->read_sbuffer);
-
-                while (switch_core_media_bug_read(bug, &frame, SWITCH_TRUE) == SWITCH_STATUS_SUCCESS)
-                {
-                    if (frame.datalen)
-                    {
-                        if (1 == tech_pvt->rtp_packets)
-                        {
-                            pVideoStreamer->writeBinary((uint8_t *)frame.data, frame.datalen);
-                            continue;
-                        }
-                        if (available >= frame.datalen)
-                        {
-                            switch_buffer_write(tech_pvt->read_sbuffer, static_cast<uint8_t *>(frame.data), frame.datalen);
-                        }
-                        if (0 == switch_buffer_freespace(tech_pvt->read_sbuffer))
-                        {
-                            switch_size_t inuse = switch_buffer_inuse(tech_pvt->read_sbuffer);
-                            if (inuse > 0)
-                            {
-                                std::vector<uint8_t> tmp(inuse);
-                                switch_buffer_read(tech_pvt->read_sbuffer, tmp.data(), inuse);
-                                switch_buffer_zero(tech_pvt->read_sbuffer);
-                                pVideoStreamer->writeBinary(tmp.data(), inuse);
-                            }
-                        }
-                    }
-                }
+                if (!frame.datalen)
+                    continue;
+                media->stream->queue().push(frame.data, frame.datalen);
+                frames++;
             }
-            else
+            if (frames > 0)
+                media->pool->wake(media->stream);
+        }
+        else if (switch_mutex_trylock(tech_pvt->mutex) == SWITCH_STATUS_SUCCESS)
+        {
+            auto *pVideoStreamer = static_cast<VideoStreamer *>(tech_pvt->pVideoStreamer);
+            if (stream_accepts(tech_pvt, pVideoStreamer))
             {
-
-                uint8_t data[SWITCH_RECOMMENDED_BUFFER_SIZE];
-                switch_frame_t frame = {};
-                frame.data = data;
-                frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
-                const size_t available = switch_buffer_freespace(tech_pvt->read_sbuffer);
-
+                switch_core_session_t *session = switch_core_media_bug_get_session(bug);
                 while (switch_core_media_bug_read(bug, &frame, SWITCH_TRUE) == SWITCH_STATUS_SUCCESS)
                 {
-                    if (frame.datalen)
-                    {
-                        spx_uint32_t in_len = frame.samples;
-                        spx_uint32_t out_len = (available / (tech_pvt->channels * sizeof(spx_int16_t)));
-                        spx_int16_t out[available / sizeof(spx_int16_t)];
-
-                        if (tech_pvt->channels == 1)
-                        {
-                            speex_resampler_process_int(tech_pvt->read_resampler,
-                                                        0,
-                                                        (const spx_int16_t *)frame.data,
-                                                        &in_len,
-                                                        &out[0],
-                                                        &out_len);
-                        }
-                        else
-                        {
-                            speex_resampler_process_interleaved_int(tech_pvt->read_resampler,
-                                                                    (const spx_int16_t *)frame.data,
-                                                                    &in_len,
-                                                                    &out[0],
-                                                                    &out_len);
-                        }
-
-                        if (out_len > 0)
-                        {
-                            const size_t bytes_written = out_len * tech_pvt->channels * sizeof(spx_int16_t);
-                            if (tech_pvt->rtp_packets == 1)
-                            { // 20ms packet
-                                pVideoStreamer->writeBinary((uint8_t *)out, bytes_written);
-                                continue;
-                            }
-                            if (bytes_written <= available)
-                            {
-                                switch_buffer_write(tech_pvt->read_sbuffer, (const uint8_t *)out, bytes_written);
-                            }
-                        }
-
-                        if (switch_buffer_freespace(tech_pvt->read_sbuffer) == 0)
-                        {
-                            switch_size_t inuse = switch_buffer_inuse(tech_pvt->read_sbuffer);
-                            if (inuse > 0)
-                            {
-                                std::vector<uint8_t> tmp(inuse);
-                                switch_buffer_read(tech_pvt->read_sbuffer, tmp.data(), inuse);
-                                switch_buffer_zero(tech_pvt->read_sbuffer);
-                                pVideoStreamer->writeBinary(tmp.data(), inuse);
-                            }
-                        }
-                    }
+                    if (!frame.datalen)
+                        continue;
+                    tech_pvt->frameHandler(tech_pvt, session, data, frame.datalen);
+                    frames++;
                 }
+                poll_stream(tech_pvt, session, pVideoStreamer);
             }
-
             switch_mutex_unlock(tech_pvt->mutex);
         }
 
+        if (frames > 0)
+        {
+            const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            tech_pvt->media_ns += ns;
+            tech_pvt->media_frames += frames;
+            if (ns > tech_pvt->media_max_ns)
+                tech_pvt->media_max_ns = ns;
+        }
         return SWITCH_TRUE;
     }
 
@@ -1039,8 +2440,7 @@ extern "C"
         if (bug)
         {
             auto *tech_pvt = (private_t *)switch_core_media_bug_get_user_data(bug);
-            char sessionId[MAX_SESSION_ID];
-            strcpy(sessionId, tech_pvt->sessionId);
+            const char *sessionId = tech_pvt->sessionId; // session pool, outlives tech_pvt
 
             switch_mutex_lock(tech_pvt->mutex);
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) stream_session_cleanup\n", sessionId);
@@ -1060,10 +2460,38 @@ extern "C"
             if (audioStreamer)
             {
                 audioStreamer->deleteFiles();
+                audioStreamer->logArenaStats(session);
+                auto *ring = static_cast<CaptureRing *>(tech_pvt->pCapture);
+                if (ring && ring->dropped() > 0)
+                {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) capture ring dropped %llu bytes\n",
+                                      sessionId, (unsigned long long)ring->dropped());
+                }
+                auto *shm = static_cast<ShmAudioSegment *>(tech_pvt->pShm);
+                if (shm && shm->capture().dropped() > 0)
+                {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) shm capture ring dropped %llu bytes\n",
+                                      sessionId, (unsigned long long)shm->capture().dropped());
+                }
+                SendQueue::Stats stats;
+                if (audioStreamer->sendQueueStats(stats) && (stats.dropped_packets > 0 || stats.failed_packets > 0))
+                {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                                      "(%s) send queue dropped %llu packets (%llu bytes), %llu failed, congested %llu times\n",
+                                      sessionId, (unsigned long long)stats.dropped_packets, (unsigned long long)stats.dropped_bytes,
+                                      (unsigned long long)stats.failed_packets, (unsigned long long)stats.congestions);
+                }
+                if (audioStreamer->qualitySwitches() > 0)
+                {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%s) audio format changed %u times\n",
+                                      sessionId, audioStreamer->qualitySwitches());
+                }
                 if (text)
                     audioStreamer->writeText(text);
                 finish(tech_pvt);
             }
+            if (tech_pvt->pFanout)
+                finish_fanout(tech_pvt);
 
             switch_mutex_unlock(tech_pvt->mutex);
 
@@ -1077,6 +2505,28 @@ extern "C"
                 }
             }
 
+            if (tech_pvt->pPlayout)
+            {
+                auto *playout = static_cast<PlayoutBuffer *>(tech_pvt->pPlayout);
+                switch_channel_set_variable_printf(channel, "STREAM_PLAYOUT_UNDERRUNS", "%u", playout->underruns());
+                switch_channel_set_variable_printf(channel, "STREAM_PLAYOUT_OVERRUNS", "%u", playout->overruns());
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                                  "(%s) playout: %u underruns, %u overruns, final target %ums\n",
+                                  sessionId, playout->underruns(), playout->overruns(), playout->targetMs());
+            }
+
+            // media thread time of the stream, to compare with and without media-workers
+            if (tech_pvt->media_frames > 0)
+            {
+                const uint64_t avg_ns = tech_pvt->media_ns / tech_pvt->media_frames;
+                switch_channel_set_variable_printf(channel, "STREAM_MEDIA_FRAME_US", "%.1f", avg_ns / 1000.0);
+                switch_channel_set_variable_printf(channel, "STREAM_MEDIA_MAX_US", "%.1f", tech_pvt->media_max_ns / 1000.0);
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
+                                  "(%s) media thread: %u frames, %.1fus per frame, longest call %.1fus%s\n",
+                                  sessionId, tech_pvt->media_frames, avg_ns / 1000.0, tech_pvt->media_max_ns / 1000.0,
+                                  tech_pvt->pMedia ? " (media workers)" : "");
+            }
+
             destroy_tech_pvt(tech_pvt);
 
             switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "(%s) stream_session_cleanup: connection closed\n", sessionId);
@@ -1086,4 +2536,198 @@ extern "C"
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "stream_session_cleanup: no bug - websocket connection already closed\n");
         return SWITCH_STATUS_FALSE;
     }
+
+    switch_status_t stream_module_init()
+    {
+        StreamModuleConfig config;
+        stream_profiles_load(config);
+        {
+            std::lock_guard<std::mutex> lock(profiles_mutex);
+            profiles = std::make_shared<const StreamProfileMap>(std::move(config.profiles));
+            groups = std::make_shared<const EndpointGroupMap>(std::move(config.groups));
+        }
+        teardown_pool = new TeardownPool(config.teardown);
+        if (config.media.workers > 0)
+        {
+            media_workers = std::make_shared<MediaWorkerPool>(config.media);
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "mod_video_stream: %d media workers%s\n", config.media.workers,
+                              config.media.cpus.empty() ? "" : ", pinned");
+        }
+        prober = new EndpointProber(config.probe, current_groups);
+        admission = std::make_shared<AdmissionController>(config.admission);
+        if (config.dns.enabled)
+        {
+            std::lock_guard<std::mutex> lock(dns_mutex);
+            dns_cache = std::make_shared<DnsCache>(config.dns, DnsCache::makeResolver(config.dns));
+            dns_rewrite = config.dns.rewrite;
+        }
+        prefetch_hosts();
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    // Settings apply at module load only; profiles and groups are replaced
+    // as a whole, groups keep the health of endpoints they still list.
+    switch_status_t stream_module_reload()
+    {
+        StreamModuleConfig config;
+        if (!stream_profiles_load(config))
+            return SWITCH_STATUS_FALSE;
+        const size_t count = config.profiles.size();
+        const size_t group_count = config.groups.size();
+        {
+            std::lock_guard<std::mutex> lock(profiles_mutex);
+            if (groups)
+            {
+                for (auto &entry : config.groups)
+                {
+                    auto old = groups->find(entry.first);
+                    if (old != groups->end())
+                        entry.second->inherit(*old->second);
+                }
+            }
+            profiles = std::make_shared<const StreamProfileMap>(std::move(config.profiles));
+            groups = std::make_shared<const EndpointGroupMap>(std::move(config.groups));
+        }
+        prefetch_hosts();
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "mod_video_stream: %zu stream profiles, %zu endpoint groups loaded\n",
+                          count, group_count);
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    int stream_profile_lookup(const char *name, char *wsUri, int *wsSampling)
+    {
+        std::shared_ptr<const StreamProfile> profile = find_profile(name);
+        std::shared_ptr<EndpointGroup> group = find_group(profile ? profile->group : name);
+        if (!profile && !group)
+            return 0;
+        // with a group the url is only a placeholder, the route is made per call
+        strncpy(wsUri, group ? group->urls()[0].c_str() : profile->ws_uri.c_str(), MAX_WS_URI);
+        if (profile && profile->sampling)
+            *wsSampling = profile->sampling;
+        return 1;
+    }
+
+    void stream_module_shutdown()
+    {
+        delete prober;
+        prober = nullptr;
+        TeardownPool *pool = teardown_pool;
+        teardown_pool = nullptr;
+        delete pool;
+        if (media_workers)
+        {
+            // streams still running hold the pool, their frames stay queued
+            media_workers->shutdown();
+            media_workers.reset();
+        }
+        if (admission)
+            admission->shutdown(); // rejects the starts still queued
+        admission.reset();         // streams still running keep it alive through their tickets
+        std::shared_ptr<DnsCache> cache;
+        {
+            std::lock_guard<std::mutex> lock(dns_mutex);
+            cache.swap(dns_cache);
+        }
+        if (cache)
+            cache->shutdown(); // joins the resolver thread
+        std::lock_guard<std::mutex> lock(profiles_mutex);
+        profiles.reset();
+        groups.reset();
+    }
+
+    switch_status_t stream_admission_set(const char *name, const char *value)
+    {
+        if (!admission || !admission->set(name, value))
+            return SWITCH_STATUS_FALSE;
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "mod_video_stream: %s set to %s\n", name, value);
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    char *stream_admission_status()
+    {
+        if (!admission)
+            return nullptr;
+        cJSON *root = admission_json();
+        char *json_str = cJSON_PrintUnformatted(root);
+        cJSON_Delete(root);
+        return json_str;
+    }
+
+    char *stream_module_status()
+    {
+        if (!teardown_pool)
+            return nullptr;
+        const TeardownPool::Stats stats = teardown_pool->stats();
+        cJSON *root = cJSON_CreateObject();
+        cJSON *teardown = cJSON_CreateObject();
+        cJSON_AddNumberToObject(teardown, "queued", (double)stats.queued);
+        cJSON_AddNumberToObject(teardown, "active", (double)stats.active);
+        cJSON_AddNumberToObject(teardown, "overdue", (double)stats.overdue);
+        cJSON_AddNumberToObject(teardown, "spares", (double)stats.spares);
+        cJSON_AddNumberToObject(teardown, "completed", (double)stats.completed);
+        cJSON_AddNumberToObject(teardown, "late", (double)stats.late);
+        cJSON_AddItemToObject(root, "teardown", teardown);
+        if (std::shared_ptr<MediaWorkerPool> pool = media_workers)
+        {
+            const MediaWorkerPool::Stats media_stats = pool->stats();
+            cJSON *media = cJSON_CreateObject();
+            cJSON_AddNumberToObject(media, "workers", (double)media_stats.workers);
+            cJSON_AddNumberToObject(media, "streams", (double)media_stats.streams);
+            cJSON_AddNumberToObject(media, "runs", (double)media_stats.runs);
+            cJSON_AddNumberToObject(media, "retries", (double)media_stats.retries);
+            cJSON_AddNumberToObject(media, "dropped_frames", (double)media_stats.dropped_frames);
+            cJSON *sends = cJSON_CreateObject();
+            cJSON_AddItemToObject(sends, "io_uring", media_stats.batch_ring ? cJSON_CreateTrue() : cJSON_CreateFalse());
+            cJSON_AddNumberToObject(sends, "frames", (double)media_stats.sends.frames);
+            cJSON_AddNumberToObject(sends, "writes", (double)media_stats.sends.writes);
+            cJSON_AddNumberToObject(sends, "syscalls", (double)media_stats.sends.syscalls);
+            cJSON_AddNumberToObject(sends, "failures", (double)media_stats.sends.failures);
+            cJSON_AddItemToObject(media, "batched_sends", sends);
+            cJSON_AddItemToObject(root, "media", media);
+        }
+        if (admission)
+            cJSON_AddItemToObject(root, "admission", admission_json());
+        if (std::shared_ptr<DnsCache> cache = current_dns())
+        {
+            const DnsCache::Stats dns_stats = cache->stats();
+            cJSON *dns = cJSON_CreateObject();
+            cJSON_AddNumberToObject(dns, "entries", (double)dns_stats.entries);
+            cJSON_AddNumberToObject(dns, "hits", (double)dns_stats.hits);
+            cJSON_AddNumberToObject(dns, "negative_hits", (double)dns_stats.negative_hits);
+            cJSON_AddNumberToObject(dns, "misses", (double)dns_stats.misses);
+            cJSON_AddNumberToObject(dns, "resolves", (double)dns_stats.resolves);
+            cJSON_AddNumberToObject(dns, "refreshes", (double)dns_stats.refreshes);
+            cJSON_AddNumberToObject(dns, "failures", (double)dns_stats.failures);
+            cJSON_AddItemToObject(root, "dns", dns);
+        }
+
+        cJSON *jgroups = cJSON_CreateObject();
+        if (std::shared_ptr<const EndpointGroupMap> current = current_groups())
+        {
+            for (const auto &entry : *current)
+            {
+                cJSON *jgroup = cJSON_CreateObject();
+                cJSON_AddStringToObject(jgroup, "policy", EndpointGroup::policyName(entry.second->policy()));
+                cJSON *jendpoints = cJSON_CreateArray();
+                for (const auto &endpoint : entry.second->status())
+                {
+                    cJSON *jendpoint = cJSON_CreateObject();
+                    cJSON_AddStringToObject(jendpoint, "url", endpoint.url.c_str());
+                    cJSON_AddItemToObject(jendpoint, "healthy", endpoint.healthy ? cJSON_CreateTrue() : cJSON_CreateFalse());
+                    if (endpoint.rtt_ms >= 0)
+                        cJSON_AddNumberToObject(jendpoint, "rtt_ms", (double)(int)(endpoint.rtt_ms * 10 + 0.5) / 10);
+                    cJSON_AddNumberToObject(jendpoint, "failures", endpoint.failures);
+                    cJSON_AddNumberToObject(jendpoint, "connects", (double)endpoint.connects);
+                    cJSON_AddNumberToObject(jendpoint, "errors", (double)endpoint.errors);
+                    cJSON_AddItemToArray(jendpoints, jendpoint);
+                }
+                cJSON_AddItemToObject(jgroup, "endpoints", jendpoints);
+                cJSON_AddItemToObject(jgroups, entry.first.c_str(), jgroup);
+            }
+        }
+        cJSON_AddItemToObject(root, "groups", jgroups);
+        char *json_str = cJSON_PrintUnformatted(root);
+        cJSON_Delete(root);
+        return json_str;
+    }
 }
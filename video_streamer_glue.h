@@ -2,13 +2,27 @@
 #define VIDEO_STREAMER_GLUE_H
 #include "mod_video_stream.h"
 
+SWITCH_BEGIN_EXTERN_C
+
 int validate_ws_uri(const char *url, char *wsUri);
 switch_status_t is_valid_utf8(const char *str);
 switch_status_t stream_session_send_text(switch_core_session_t *session, char *text);
 switch_status_t stream_session_pauseresume(switch_core_session_t *session, int pause);
-switch_status_t stream_session_init(switch_core_session_t *session, responseHandler_t responseHandler, uint32_t samples_per_second, char *wsUri, int wsSampling, int channels, char *metadata, void **ppUserData);
+switch_status_t stream_session_clear(switch_core_session_t *session);
+char *stream_session_responses(switch_core_session_t *session, int max);
+switch_status_t stream_session_init(switch_core_session_t *session, responseHandler_t responseHandler, responseHandler_t lightResponseHandler, uint32_t samples_per_second, char *wsUri, int wsSampling, int channels, char *metadata, const char *profile_name, const char *fanout, void **ppUserData);
+void stream_session_destroy(void *pUserData);
 switch_status_t stream_session_write_thread_init(switch_core_session_t *session, void *pUserData);
 switch_bool_t stream_frame(switch_media_bug_t *bug);
 switch_status_t stream_session_cleanup(switch_core_session_t *session, char *text, int channelIsClosing);
+switch_status_t stream_module_init(void);
+switch_status_t stream_module_reload(void);
+int stream_profile_lookup(const char *name, char *wsUri, int *wsSampling);
+void stream_module_shutdown(void);
+char *stream_module_status(void);
+switch_status_t stream_admission_set(const char *name, const char *value);
+char *stream_admission_status(void);
+
+SWITCH_END_EXTERN_C
 
 #endif // VIDEO_STREAMER_GLUE_H
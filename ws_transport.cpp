@@ -0,0 +1,89 @@
+#include "ws_transport.h"
+#include "unix_ws_client.h"
+
+namespace
+{
+    // libwsc as it is, for ws:// and wss://
+    class LibwscTransport : public WsTransport
+    {
+    public:
+        void setUrl(const std::string &url) override
+        {
+            m_client.setUrl(url);
+        }
+        void setTLSOptions(const WebSocketTLSOptions &tls) override
+        {
+            m_client.setTLSOptions(tls);
+        }
+        void setPingInterval(int seconds) override
+        {
+            m_client.setPingInterval(seconds);
+        }
+        // libwsc negotiates deflate with its own level and window and
+        // applies it to every message of the connection. Audio makes up
+        // nearly all of what a stream sends, so its setting decides.
+        void setCompression(const DeflateConfig &config) override
+        {
+            m_client.enableCompression(config.binary);
+        }
+        void setHeaders(const Headers &headers) override
+        {
+            WebSocketHeaders hdrs;
+            for (const auto &header : headers)
+                hdrs.set(header.first, header.second);
+            if (!hdrs.empty())
+                m_client.setHeaders(hdrs);
+        }
+        void setMessageCallback(std::function<void(const std::string &)> callback) override
+        {
+            m_client.setMessageCallback(std::move(callback));
+        }
+        void setOpenCallback(std::function<void()> callback) override
+        {
+            m_client.setOpenCallback(std::move(callback));
+        }
+        void setErrorCallback(std::function<void(int, const std::string &)> callback) override
+        {
+            m_client.setErrorCallback(std::move(callback));
+        }
+        void setCloseCallback(std::function<void(int, const std::string &)> callback) override
+        {
+            m_client.setCloseCallback(std::move(callback));
+        }
+        void connect() override
+        {
+            m_client.connect();
+        }
+        void disconnect() override
+        {
+            m_client.disconnect();
+        }
+        bool isConnected() override
+        {
+            return m_client.isConnected();
+        }
+        bool sendBinary(const void *data, size_t len) override
+        {
+            return m_client.sendBinary(data, len);
+        }
+        bool sendMessage(const char *text, size_t len) override
+        {
+            return m_client.sendMessage(text, len);
+        }
+
+    private:
+        WebSocketClient m_client;
+    };
+}
+
+bool WsTransport::isUnix(const std::string &url)
+{
+    return url.compare(0, 10, "ws+unix://") == 0;
+}
+
+std::unique_ptr<WsTransport> WsTransport::create(const std::string &url)
+{
+    if (isUnix(url))
+        return std::unique_ptr<WsTransport>(new UnixWebSocketClient());
+    return std::unique_ptr<WsTransport>(new LibwscTransport());
+}
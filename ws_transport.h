@@ -0,0 +1,71 @@
+#ifndef WS_TRANSPORT_H
+#define WS_TRANSPORT_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "WebSocketClient.h"
+#include "message_deflate.h"
+
+/*
+ * The websocket client calls a stream makes, so the connection layer can
+ * be picked per url: libwsc for ws:// and wss://, UnixWebSocketClient for
+ * ws+unix://. Semantics follow libwsc: connect() returns at once and the
+ * outcome arrives through the callbacks on the client's own thread;
+ * disconnect() blocks until that thread is gone.
+ */
+class WsTransport
+{
+public:
+    typedef std::vector<std::pair<std::string, std::string>> Headers;
+
+    struct Frame
+    {
+        const void *data;
+        size_t len;
+    };
+
+    virtual ~WsTransport() = default;
+
+    virtual void setUrl(const std::string &url) = 0;
+    virtual void setTLSOptions(const WebSocketTLSOptions &tls) = 0;
+    virtual void setPingInterval(int seconds) = 0;
+    /* permessage-deflate, by message type; applies from the next connect */
+    virtual void setCompression(const DeflateConfig &config) = 0;
+    virtual void setHeaders(const Headers &headers) = 0;
+
+    virtual void setMessageCallback(std::function<void(const std::string &)> callback) = 0;
+    virtual void setOpenCallback(std::function<void()> callback) = 0;
+    virtual void setErrorCallback(std::function<void(int, const std::string &)> callback) = 0;
+    virtual void setCloseCallback(std::function<void(int, const std::string &)> callback) = 0;
+
+    virtual void connect() = 0;
+    virtual void disconnect() = 0;
+    virtual bool isConnected() = 0;
+    virtual bool sendBinary(const void *data, size_t len) = 0;
+    virtual bool sendMessage(const char *text, size_t len) = 0;
+
+    /*
+     * Sends each frame as its own binary message, in order, and returns how
+     * many went out. Transports that own their socket gather the batch into
+     * one system call; libwsc sends them one by one.
+     */
+    virtual size_t sendBinaryBatch(const Frame *frames, size_t count)
+    {
+        size_t sent = 0;
+        while (sent < count && sendBinary(frames[sent].data, frames[sent].len))
+            sent++;
+        return sent;
+    }
+
+    /* ws+unix:// urls */
+    static bool isUnix(const std::string &url);
+
+    /* the transport for the scheme of url; the url itself is set separately */
+    static std::unique_ptr<WsTransport> create(const std::string &url);
+};
+
+#endif // WS_TRANSPORT_H